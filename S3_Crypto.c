@@ -19,6 +19,7 @@
 #include <pthread.h>
 
 #include "S3_Crypto.h"
+#include "S3_HLS_Memory.h"
 #include "S3_HLS_Return_Code.h"
 
 int32_t S3_SHA256_Init(S3_SHA256_CTX* ctx) {
@@ -45,24 +46,66 @@ int32_t S3_SHA256_Final(S3_SHA256_CTX *ctx, S3_SHA256_HASH result) {
     return SHA256_Final(result, ctx);
 }
 
-int32_t S3_HMAC_SHA256(const void* key, unsigned int key_length, const void* data, unsigned int data_length, S3_SHA256_HASH result){
+S3_HMAC_SHA256_CTX* S3_HMAC_SHA256_New() {
+    return HMAC_CTX_new();
+}
+
+void S3_HMAC_SHA256_Free(S3_HMAC_SHA256_CTX* ctx) {
+    HMAC_CTX_free(ctx);
+}
+
+int32_t S3_HMAC_SHA256_With_Ctx(S3_HMAC_SHA256_CTX* ctx, const void* key, unsigned int key_length, const void* data, unsigned int data_length, S3_SHA256_HASH result) {
     const EVP_MD * engine = EVP_sha256();
     unsigned int ret_length = 0;
 
-    HMAC_CTX* ctx = NULL; 
-    ctx = HMAC_CTX_new();	
     if(NULL == ctx) {
         return S3_CRYPTO_FAILED;
     }
-        
-    HMAC_Init_ex(ctx, key, key_length, engine, NULL);  
+
+    // new key resets the context, digest is kept from previous call
+    if(1 != HMAC_Init_ex(ctx, key, key_length, engine, NULL)) {
+        return S3_CRYPTO_FAILED;
+    }
+
     HMAC_Update(ctx, (unsigned char*)data, data_length); 
   
     HMAC_Final(ctx, result, &ret_length);  
+
+    if(SHA256_DIGEST_LENGTH != ret_length) {
+        return S3_CRYPTO_FAILED;
+    }
+
+    return S3_CRYPTO_OK;
+}
+
+int32_t S3_HMAC_SHA256(const void* key, unsigned int key_length, const void* data, unsigned int data_length, S3_SHA256_HASH result){
+    HMAC_CTX* ctx = NULL; 
+    ctx = HMAC_CTX_new();	
+    if(NULL == ctx) {
+        return S3_CRYPTO_FAILED;
+    }
+        
+    int32_t ret = S3_HMAC_SHA256_With_Ctx(ctx, key, key_length, data, data_length, result);
   
     HMAC_CTX_free(ctx);
 
-    if(SHA256_DIGEST_LENGTH != ret_length) {
+    return ret;
+}
+
+static void* S3_Crypto_Malloc(size_t size, const char* file, int line) {
+    return S3_HLS_Malloc(size);
+}
+
+static void* S3_Crypto_Realloc(void* ptr, size_t size, const char* file, int line) {
+    return S3_HLS_Realloc(ptr, size);
+}
+
+static void S3_Crypto_Free(void* ptr, const char* file, int line) {
+    S3_HLS_Free(ptr);
+}
+
+int32_t S3_Crypto_Use_SDK_Allocator() {
+    if(1 != CRYPTO_set_mem_functions(S3_Crypto_Malloc, S3_Crypto_Realloc, S3_Crypto_Free)) {
         return S3_CRYPTO_FAILED;
     }
 
@@ -48,6 +48,21 @@ int32_t S3_SHA256_Final(S3_SHA256_CTX *ctx, S3_SHA256_HASH result);
 
 int32_t S3_HMAC_SHA256(const void* key, unsigned int key_length, const void* data, unsigned int data_length, S3_SHA256_HASH result);
 
+/*
+ * HMAC context that can be reused between calls, avoids allocating a context for every hash
+ */
+S3_HMAC_SHA256_CTX* S3_HMAC_SHA256_New();
+
+void S3_HMAC_SHA256_Free(S3_HMAC_SHA256_CTX* ctx);
+
+int32_t S3_HMAC_SHA256_With_Ctx(S3_HMAC_SHA256_CTX* ctx, const void* key, unsigned int key_length, const void* data, unsigned int data_length, S3_SHA256_HASH result);
+
+/*
+ * Route OpenSSL allocations to SDK allocator
+ * Only works before OpenSSL allocates any memory
+ */
+int32_t S3_Crypto_Use_SDK_Allocator();
+
 #ifdef __cplusplus
 #if __cplusplus
 }
@@ -1,9 +1,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 
 
 #include "S3_HLS_Buffer_Mgr.h"
+#include "S3_HLS_Memory.h"
 #include "S3_HLS_Return_Code.h" 
 
 #define S3_HLS_BUFFER_FLUSH_CLEAR_DEBUG
@@ -22,44 +27,326 @@
 #define BUFFER_DEBUG(x, ...)
 #endif
 
+#define S3_HLS_BUFFER_MIN_REF_CAPACITY      64
+
+// define to always use plain malloc ring buffer
+//#define S3_HLS_BUFFER_NO_MIRROR
+
+#if !defined(S3_HLS_BUFFER_NO_MIRROR) && defined(SYS_memfd_create)
+#define S3_HLS_BUFFER_MIRROR_SUPPORTED
+#endif
+
 /*
- * Buffer manager is a central managememnt of video and audio buffer that is cached for sending to S3
- * Initialize will allocate memory buffer for given size
+ * Map the same memory twice back to back, so data across ring buffer boundary is continuous in virtual memory
+ * buffer_size should be multiple of page size
+ * Return NULL if not supported by the system
+ */
+static uint8_t* S3_HLS_Map_Mirror_Buffer(uint32_t buffer_size) {
+#ifdef S3_HLS_BUFFER_MIRROR_SUPPORTED
+    int fd = syscall(SYS_memfd_create, "s3_hls_buffer", 0);
+    if(0 > fd) {
+        BUFFER_DEBUG("Failed to create memfd!\n");
+        return NULL;
+    }
+
+    if(0 != ftruncate(fd, buffer_size)) {
+        BUFFER_DEBUG("Failed to set memfd size!\n");
+        close(fd);
+        return NULL;
+    }
+
+    // reserve continuous address space first, then map the file twice into it
+    uint8_t* base = (uint8_t*)mmap(NULL, (size_t)buffer_size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(MAP_FAILED == base) {
+        BUFFER_DEBUG("Failed to reserve address space!\n");
+        close(fd);
+        return NULL;
+    }
+
+    if(MAP_FAILED == mmap(base, buffer_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0)
+        || MAP_FAILED == mmap(base + buffer_size, buffer_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0)) {
+        BUFFER_DEBUG("Failed to map mirror buffer!\n");
+        munmap(base, (size_t)buffer_size * 2);
+        close(fd);
+        return NULL;
+    }
+
+    close(fd); // mappings keep the memory
+    return base;
+#else
+    return NULL;
+#endif
+}
+
+/*
+ * Reserve address space for max_size and back only first buffer_size bytes with memory
+ * Both sizes should be multiple of page size
+ */
+static uint8_t* S3_HLS_Map_Elastic_Buffer(uint32_t buffer_size, uint32_t max_size) {
+    uint8_t* base = (uint8_t*)mmap(NULL, max_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(MAP_FAILED == base) {
+        BUFFER_DEBUG("Failed to reserve address space for elastic buffer!\n");
+        return NULL;
+    }
+
+    if(0 != mprotect(base, buffer_size, PROT_READ | PROT_WRITE)) {
+        BUFFER_DEBUG("Failed to commit elastic buffer!\n");
+        munmap(base, max_size);
+        return NULL;
+    }
+
+    return base;
+}
+
+/*
+ * Positions of reference ring run in [0, 2 * size), so full and empty ring can be told apart
+ */
+static inline uint32_t S3_HLS_Ring_Index(uint32_t pos, uint32_t size) {
+    return pos >= size ? pos - size : pos;
+}
+
+static inline uint32_t S3_HLS_Ring_Advance(uint32_t pos, uint32_t length, uint32_t size) {
+    pos += length;
+    return pos >= 2 * size ? pos - 2 * size : pos;
+}
+
+static inline uint32_t S3_HLS_Ring_Distance(uint32_t from, uint32_t to, uint32_t size) {
+    return to >= from ? to - from : to + 2 * size - from;
+}
+
+/*
+ * Offset in buffer where written data ends, write_index is 0 both when buffer is empty and when data ends at buffer end
+ */
+static inline uint32_t S3_HLS_Buffer_Write_End(S3_HLS_BUFFER_CTX* ctx, uint32_t used_length) {
+    return 0 == ctx->write_index && 0 < used_length ? ctx->total_length : ctx->write_index;
+}
+
+/*
+ * Called by writer when data does not fit before buffer end or buffer is full
+ * Buffer can only grow when data does not wrap around buffer end, new memory is added right after the data
+ */
+static void S3_HLS_Grow_Buffer(S3_HLS_BUFFER_CTX* ctx, uint32_t used_length, uint32_t length) {
+    uint32_t size = ctx->total_length;
+    if(size >= ctx->max_length)
+        return;
+
+    uint32_t end = S3_HLS_Buffer_Write_End(ctx, used_length);
+    if(end < used_length) // data wraps around buffer end
+        return;
+
+    // only grow when upload falls behind or buffer is below its floor, otherwise just wrap around
+    uint32_t backlog = S3_HLS_Get_Flushed_Parts(ctx);
+    if(used_length + length <= S3_HLS_BUFFER_GROW_WATERMARK(size) && backlog < S3_HLS_BUFFER_GROW_BACKLOG && size >= ctx->min_length)
+        return;
+
+    uint32_t new_size = size;
+    do {
+        new_size = ctx->max_length - new_size > ctx->chunk_length ? new_size + ctx->chunk_length : ctx->max_length;
+    } while((new_size < end + length || new_size < ctx->min_length) && new_size < ctx->max_length);
+
+    if(0 != mprotect(ctx->buffer_start + size, new_size - size, PROT_READ | PROT_WRITE)) {
+        BUFFER_DEBUG("Failed to grow buffer to %u!\n", new_size);
+        return;
+    }
+
+    BUFFER_FLUSH_DEBUG("Grow buffer %u -> %u, used %u, backlog %u\n", size, new_size, used_length, backlog);
+    ctx->write_index = end;
+    ctx->last_flush = ctx->buffer_start + end - ctx->pending_length;
+    __atomic_store_n(&ctx->total_length, new_size, __ATOMIC_RELEASE);
+
+    if(new_size > ctx->peak_length)
+        __atomic_store_n(&ctx->peak_length, new_size, __ATOMIC_RELAXED);
+
+    __atomic_add_fetch(&ctx->grow_count, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Called by writer after flush, give back one chunk when backlog is drained and data is below the chunk
+ */
+static void S3_HLS_Shrink_Buffer(S3_HLS_BUFFER_CTX* ctx) {
+    uint32_t size = ctx->total_length;
+    if(!ctx->elastic || size <= ctx->min_length)
+        return;
+
+    uint32_t used_length = ctx->write_pos - __atomic_load_n(&ctx->release_pos, __ATOMIC_ACQUIRE);
+    uint32_t backlog = S3_HLS_Get_Flushed_Parts(ctx);
+    if(used_length > S3_HLS_BUFFER_SHRINK_WATERMARK(size) || 1 < backlog)
+        return;
+
+    uint32_t new_size = size - ctx->min_length > ctx->chunk_length ? size - ctx->chunk_length : ctx->min_length;
+    uint32_t end = S3_HLS_Buffer_Write_End(ctx, used_length);
+    if(end < used_length || end > new_size) // data wraps around or lies in memory to give back
+        return;
+
+    // parts not cleared yet are all below new end, so nothing in the released range is read any more
+    madvise(ctx->buffer_start + new_size, size - new_size, MADV_DONTNEED);
+    if(0 != mprotect(ctx->buffer_start + new_size, size - new_size, PROT_NONE)) {
+        BUFFER_DEBUG("Failed to protect released buffer!\n");
+    }
+
+    BUFFER_FLUSH_DEBUG("Shrink buffer %u -> %u, used %u\n", size, new_size, used_length);
+    ctx->write_index = end == new_size ? 0 : end;
+    ctx->last_flush = ctx->buffer_start + ctx->write_index;
+    __atomic_store_n(&ctx->total_length, new_size, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&ctx->shrink_count, 1, __ATOMIC_RELAXED);
+}
+
+static void S3_HLS_Free_Buffer_Memory(S3_HLS_BUFFER_CTX* ctx) {
+    if(ctx->elastic) {
+        munmap(ctx->buffer_start, ctx->max_length);
+    } else if(ctx->mirrored) {
+        munmap(ctx->buffer_start, (size_t)ctx->total_length * 2);
+    } else {
+        S3_HLS_Free(ctx->buffer_start);
+    }
+}
+
+/*
+ * Allocate buffer of given size, max_size of 0 means buffer size is fixed
  */
-S3_HLS_BUFFER_CTX* S3_HLS_Initialize_Buffer(uint32_t buffer_size, BUFFER_CALL_BACK function_pointer) {
+static S3_HLS_BUFFER_CTX* S3_HLS_Create_Buffer(uint32_t buffer_size, uint32_t max_size, uint32_t chunk_size, BUFFER_CALL_BACK function_pointer, void* user_data) {
     BUFFER_DEBUG("Initializing Buffer!\n");
     S3_HLS_BUFFER_CTX* ret = NULL;
-    ret = (S3_HLS_BUFFER_CTX*)malloc(sizeof(S3_HLS_BUFFER_CTX));
+    ret = (S3_HLS_BUFFER_CTX*)S3_HLS_Malloc(sizeof(S3_HLS_BUFFER_CTX));
     if(NULL == ret) {
         BUFFER_DEBUG("Failed to allocate buffer context!\n");
         return ret;
     }
     
-    ret->buffer_start = (uint8_t*)malloc(buffer_size);
+    // mirror and elastic mapping work on whole pages
+    uint32_t page_size = (uint32_t)sysconf(_SC_PAGESIZE);
+    uint32_t mirror_size = (buffer_size + page_size - 1) / page_size * page_size;
+
+    ret->buffer_start = NULL;
+    ret->mirrored = 0;
+    ret->elastic = 0;
+
+    // user allocator or arena owns all memory, so do not map the ring separately
+    if(S3_HLS_Memory_Is_Default() && 0 < max_size) {
+        max_size = (max_size + page_size - 1) / page_size * page_size;
+        chunk_size = (chunk_size + page_size - 1) / page_size * page_size;
+
+        ret->buffer_start = S3_HLS_Map_Elastic_Buffer(mirror_size, max_size);
+        if(NULL != ret->buffer_start) {
+            ret->elastic = 1;
+            buffer_size = mirror_size;
+        }
+    }
+
+    if(NULL == ret->buffer_start && S3_HLS_Memory_Is_Default()) {
+        ret->buffer_start = S3_HLS_Map_Mirror_Buffer(mirror_size);
+        if(NULL != ret->buffer_start) {
+            ret->mirrored = 1;
+            buffer_size = mirror_size;
+        }
+    }
+
+    if(NULL == ret->buffer_start) {
+        BUFFER_DEBUG("Mirror buffer not available, fallback to allocator!\n");
+        ret->mirrored = 0;
+        ret->buffer_start = (uint8_t*)S3_HLS_Malloc(buffer_size);
+    }
+
     if(NULL == ret->buffer_start) {
         BUFFER_DEBUG("Failed to allocate buffer!\n");
-        free(ret);
+        S3_HLS_Free(ret);
         return NULL;
     }
     
+    ret->total_length = buffer_size;
+    ret->base_length = buffer_size;
+    ret->min_length = buffer_size;
+    ret->max_length = ret->elastic ? max_size : buffer_size;
+    ret->chunk_length = ret->elastic ? chunk_size : 0;
+    ret->peak_length = buffer_size;
+    ret->grow_count = 0;
+    ret->shrink_count = 0;
+
     if(0 != pthread_mutex_init(&ret->buffer_lock, NULL)) {
         BUFFER_DEBUG("Failed to initialize buffer lock!\n");
-        free(ret->buffer_start);
-        free(ret);
+        S3_HLS_Free_Buffer_Memory(ret);
+        S3_HLS_Free(ret);
         return NULL;
     }
-    
-    ret->total_length = buffer_size;
 
-    ret->used_start = ret->buffer_start;
-    ret->used_length = 0;
+    pthread_condattr_t cattr;
+    if(0 != pthread_condattr_init(&cattr)) {
+        BUFFER_DEBUG("Failed to initialize space condition attribute!\n");
+        goto l_destroy_buffer_lock;
+    }
+
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+
+    if(0 != pthread_cond_init(&ret->space_cond, &cattr)) {
+        BUFFER_DEBUG("Failed to initialize space condition!\n");
+        pthread_condattr_destroy(&cattr);
+        goto l_destroy_buffer_lock;
+    }
+
+    pthread_condattr_destroy(&cattr);
+
+    if(0 != pthread_mutex_init(&ret->space_lock, NULL)) {
+        BUFFER_DEBUG("Failed to initialize space lock!\n");
+        pthread_cond_destroy(&ret->space_cond);
+        goto l_destroy_buffer_lock;
+    }
+
+    ret->space_waiters = 0;
+    ret->evict_request = 0;
+    ret->evicted_segments = 0;
+
+    ret->write_pos = 0;
+    ret->write_index = 0;
+    ret->flushed_parts = 0;
+    ret->release_pos = 0;
+    ret->cleared_parts = 0;
+    ret->release_end = NULL;
     
     ret->last_flush = ret->buffer_start;
+    ret->pending_length = 0;
+
+    ret->refs = NULL;
+    ret->ref_capacity = 0;
+    ret->ref_write_pos = 0;
+    ret->ref_release_pos = 0;
+    ret->ref_total = 0;
+    ret->last_flush_ref = 0;
+    ret->pending_ref_length = 0;
+    ret->pending_index_count = 0;
+    ret->pending_is_init = 0;
+    ret->partial_length = 0;
+    ret->partial_refs = 0;
+    ret->partial_ref_length = 0;
     
     BUFFER_DEBUG("Callback function address %ld", function_pointer);
     ret->call_back = function_pointer;
+    ret->call_back_user_data = user_data;
 
     return ret;
+
+l_destroy_buffer_lock:
+    pthread_mutex_destroy(&ret->buffer_lock);
+    S3_HLS_Free_Buffer_Memory(ret);
+    S3_HLS_Free(ret);
+    return NULL;
+}
+
+/*
+ * Buffer manager is a central managememnt of video and audio buffer that is cached for sending to S3
+ * Initialize will allocate memory buffer for given size
+ */
+S3_HLS_BUFFER_CTX* S3_HLS_Initialize_Buffer(uint32_t buffer_size, BUFFER_CALL_BACK function_pointer, void* user_data) {
+    return S3_HLS_Create_Buffer(buffer_size, 0, 0, function_pointer, user_data);
+}
+
+/*
+ * Buffer grows in chunks up to max_size under upload backlog
+ */
+S3_HLS_BUFFER_CTX* S3_HLS_Initialize_Elastic_Buffer(uint32_t buffer_size, uint32_t max_size, uint32_t chunk_size, BUFFER_CALL_BACK function_pointer, void* user_data) {
+    if(max_size <= buffer_size || 0 == chunk_size) // nothing to grow
+        return S3_HLS_Create_Buffer(buffer_size, 0, 0, function_pointer, user_data);
+
+    return S3_HLS_Create_Buffer(buffer_size, max_size, chunk_size, function_pointer, user_data);
 }
 
 /*
@@ -68,61 +355,140 @@ S3_HLS_BUFFER_CTX* S3_HLS_Initialize_Buffer(uint32_t buffer_size, BUFFER_CALL_BA
  */
 void S3_HLS_Finalize_Buffer(S3_HLS_BUFFER_CTX* ctx) {
     pthread_mutex_destroy(&ctx->buffer_lock);
+    pthread_mutex_destroy(&ctx->space_lock);
+    pthread_cond_destroy(&ctx->space_cond);
+
+    // give back caller buffers that are still referenced
+    while(ctx->ref_release_pos != ctx->ref_write_pos) {
+        S3_HLS_BUFFER_REF* ref = &ctx->refs[S3_HLS_Ring_Index(ctx->ref_release_pos, ctx->ref_capacity)];
+        if(NULL != ref->release)
+            ref->release(ref->user_data);
 
-    free(ctx->buffer_start);
-    free(ctx);
+        ctx->ref_release_pos = S3_HLS_Ring_Advance(ctx->ref_release_pos, 1, ctx->ref_capacity);
+    }
+
+    if(NULL != ctx->refs)
+        S3_HLS_Free(ctx->refs);
+
+    S3_HLS_Free_Buffer_Memory(ctx);
+    S3_HLS_Free(ctx);
+}
+
+/*
+ * Describe pending data from offset (ring bytes) and ref_offset (references) after last flush up to write position
+ */
+static void S3_HLS_Pending_Part(S3_HLS_BUFFER_CTX* ctx, uint32_t offset, uint32_t ref_offset, uint32_t ref_length_offset, S3_HLS_BUFFER_PART_CTX* part_ctx) {
+    uint8_t* start = ctx->last_flush + offset;
+    if(!ctx->mirrored && start >= ctx->buffer_start + ctx->total_length)
+        start -= ctx->total_length;
+
+    uint32_t length = ctx->pending_length - offset;
+    uint32_t first_length = ctx->buffer_start + ctx->total_length - start;
+
+    if(ctx->mirrored || length <= first_length) { // continuous, or acrossed boundary of mirrored buffer
+        part_ctx->first_part_start = start;
+        part_ctx->first_part_length = length;
+
+        part_ctx->second_part_start = NULL;
+        part_ctx->second_part_length = 0;
+    } else { // acrossed ring buffer boundary
+        part_ctx->first_part_start = start;
+        part_ctx->first_part_length = first_length;
+
+        part_ctx->second_part_start = ctx->buffer_start;
+        part_ctx->second_part_length = length - first_length;
+    }
+
+    uint32_t unflushed_refs = ctx->ref_total - ctx->last_flush_ref - ref_offset;
+    part_ctx->ref_start = 0 == unflushed_refs ? 0 : S3_HLS_Ring_Index(S3_HLS_Ring_Advance(ctx->ref_write_pos, 2 * ctx->ref_capacity - unflushed_refs, ctx->ref_capacity), ctx->ref_capacity);
+    part_ctx->ref_count = unflushed_refs;
+    part_ctx->ref_length = ctx->pending_ref_length - ref_length_offset;
+    part_ctx->ref_base = offset;
+
+    part_ctx->timestamp = ctx->last_flush_timestamp;
+    part_ctx->index_count = 0;
+    part_ctx->is_init = ctx->pending_is_init;
+    part_ctx->is_partial = 0;
+    part_ctx->part_timestamp = 0;
+}
+
+int32_t S3_HLS_Flush_Partial(S3_HLS_BUFFER_CTX* ctx, uint64_t part_timestamp) {
+    if(NULL == ctx)
+        return S3_HLS_INVALID_PARAMETER;
+
+    if(0 == S3_HLS_Get_Partial_Pending_Length(ctx))
+        return S3_HLS_OK;
+
+    if(NULL != ctx->call_back) {
+        BUFFER_FLUSH_DEBUG("Flush partial segment at %u!\n", ctx->partial_length);
+        S3_HLS_BUFFER_PART_CTX part_ctx;
+        S3_HLS_Pending_Part(ctx, ctx->partial_length, ctx->partial_refs, ctx->partial_ref_length, &part_ctx);
+
+        part_ctx.is_partial = 1;
+        part_ctx.part_timestamp = part_timestamp;
+
+        ctx->call_back(&part_ctx, ctx->call_back_user_data);
+    }
+
+    ctx->partial_length = ctx->pending_length;
+    ctx->partial_refs = ctx->ref_total - ctx->last_flush_ref;
+    ctx->partial_ref_length = ctx->pending_ref_length;
+
+    return S3_HLS_OK;
+}
+
+uint32_t S3_HLS_Get_Partial_Pending_Length(S3_HLS_BUFFER_CTX* ctx) {
+    return ctx->pending_length + ctx->pending_ref_length - ctx->partial_length - ctx->partial_ref_length;
 }
 
 /*
  * Flush buffer will switch the partition of buffer that pending send out and 
  * buffer that is currently put data into
+ * Called by writer side only
  */
 int32_t S3_HLS_Flush_Buffer(S3_HLS_BUFFER_CTX* ctx) {
     BUFFER_FLUSH_DEBUG("Flushing buffer!\n");
     if(NULL == ctx)
         return S3_HLS_INVALID_PARAMETER;
 
-    uint8_t* cur_pos = ctx->used_start + ctx->used_length;
     if(NULL == ctx->last_flush) {
         BUFFER_FLUSH_DEBUG("Invalid last flush time!\n");
         return S3_HLS_INVALID_PARAMETER; // valid ctx will contain last_flush
     }
         
-    if(0 == ctx->used_length) {
+    if(0 == S3_HLS_Get_Used_Length(ctx)) {
         BUFFER_FLUSH_DEBUG("Buffer is empty!\n");
         time(&ctx->last_flush_timestamp);
         return S3_HLS_OK;
     }
     
-    if(ctx->last_flush != cur_pos) { // avoid duplicate flush especially when buffer is full
+    if(0 < ctx->pending_length) { // avoid duplicate flush especially when buffer is full
         if(NULL != ctx->call_back) {
             BUFFER_FLUSH_DEBUG("Calling callback function!\n");
             S3_HLS_BUFFER_PART_CTX part_ctx;
-            if(cur_pos >= ctx->buffer_start + ctx->total_length) 
-                cur_pos -= ctx->total_length;
-                
-            if(ctx->last_flush < cur_pos) {
-                part_ctx.first_part_start = ctx->last_flush;
-                part_ctx.first_part_length = cur_pos - ctx->last_flush;
-                
-                part_ctx.second_part_start = NULL;
-                part_ctx.second_part_length = 0;
-            } else { // acrossed ring buffer boundary
-                part_ctx.first_part_start = ctx->last_flush;
-                part_ctx.first_part_length = ctx->buffer_start + ctx->total_length - ctx->last_flush;
-                
-                part_ctx.second_part_start = ctx->buffer_start;
-                part_ctx.second_part_length = cur_pos - ctx->buffer_start;
-            }
-            
-            part_ctx.timestamp = ctx->last_flush_timestamp;
+            S3_HLS_Pending_Part(ctx, 0, 0, 0, &part_ctx);
+
+            part_ctx.index_count = ctx->pending_index_count;
+            memcpy(part_ctx.index, ctx->pending_index, ctx->pending_index_count * sizeof(S3_HLS_BUFFER_INDEX_ENTRY));
             
-            ctx->call_back(&part_ctx);
+            ctx->flushed_parts++;
+            ctx->call_back(&part_ctx, ctx->call_back_user_data);
             printf("Flush Buffer %p, %p, %d, %p, %d\n", ctx->last_flush, part_ctx.first_part_start, part_ctx.first_part_length, part_ctx.second_part_start, part_ctx.second_part_length);
         }
     
-        ctx->last_flush = cur_pos;
+        ctx->last_flush = ctx->buffer_start + ctx->write_index;
         time(&ctx->last_flush_timestamp);
+
+        ctx->pending_length = 0;
+        ctx->last_flush_ref = ctx->ref_total;
+        ctx->pending_ref_length = 0;
+        ctx->pending_index_count = 0;
+        ctx->pending_is_init = 0;
+        ctx->partial_length = 0;
+        ctx->partial_refs = 0;
+        ctx->partial_ref_length = 0;
+
+        S3_HLS_Shrink_Buffer(ctx);
     }
 
     return S3_HLS_OK;
@@ -131,6 +497,7 @@ int32_t S3_HLS_Flush_Buffer(S3_HLS_BUFFER_CTX* ctx) {
 /*
  * Clear buffer will release buffer that provided by flush buffer
  * After clear the buffer, it can be reused by other input
+ * Called by uploader side only, no need to lock buffer
  */
 int32_t S3_HLS_Clear_Buffer(S3_HLS_BUFFER_CTX* buffer_ctx, S3_HLS_BUFFER_PART_CTX* part_ctx) {
     BUFFER_FLUSH_DEBUG("Clear Buffer!\n");
@@ -140,77 +507,424 @@ int32_t S3_HLS_Clear_Buffer(S3_HLS_BUFFER_CTX* buffer_ctx, S3_HLS_BUFFER_PART_CT
     if(NULL == part_ctx->second_part_start && 0 < part_ctx->second_part_length)
         return S3_HLS_INVALID_PARAMETER;
 
+    // bytes of partial segment belong to a part cleared later
+    if(part_ctx->is_partial)
+        return S3_HLS_OK;
+
     // Only support clear buffer in sequence, not support clear buffer in middle of used buffer
     printf("Clear Buffer %p, %u, %p, %u\n", part_ctx->first_part_start, part_ctx->first_part_length, part_ctx->second_part_start, part_ctx->second_part_length);
-    if(buffer_ctx->used_start != part_ctx->first_part_start) {
-        printf("Clear buffer not match start! %p, %p\n", buffer_ctx->used_start, part_ctx->first_part_start);
+    // next part starts where last one ends, or at buffer start after wrapping around
+    uint8_t* expected_start = buffer_ctx->release_end;
+    if(buffer_ctx->mirrored && NULL != expected_start && expected_start >= buffer_ctx->buffer_start + buffer_ctx->total_length)
+        expected_start -= buffer_ctx->total_length;
+
+    if(NULL != expected_start && expected_start != part_ctx->first_part_start && buffer_ctx->buffer_start != part_ctx->first_part_start) {
+        printf("Clear buffer not match start! %p, %p\n", expected_start, part_ctx->first_part_start);
     }
-    
-    uint8_t* next_start = (NULL == part_ctx->second_part_start) ? (part_ctx->first_part_start + part_ctx->first_part_length) : (part_ctx->second_part_start + part_ctx->second_part_length);
-    if(next_start > buffer_ctx->used_start) {
-        buffer_ctx->used_length -= (next_start - buffer_ctx->used_start);
-    } else if(next_start < buffer_ctx->used_start) {
-        buffer_ctx->used_length -= buffer_ctx->total_length - (buffer_ctx->used_start - next_start);
+
+    // give back referenced caller buffers before the space can be reused
+    if(0 < part_ctx->ref_count) {
+        uint32_t ref_release_pos = buffer_ctx->ref_release_pos;
+        if(S3_HLS_Ring_Index(ref_release_pos, buffer_ctx->ref_capacity) != part_ctx->ref_start) {
+            printf("Clear reference not match start! %u, %u\n", S3_HLS_Ring_Index(ref_release_pos, buffer_ctx->ref_capacity), part_ctx->ref_start);
+        }
+
+        for(uint32_t i = 0; i < part_ctx->ref_count; i++) {
+            S3_HLS_BUFFER_REF* ref = &buffer_ctx->refs[S3_HLS_Ring_Index(ref_release_pos, buffer_ctx->ref_capacity)];
+            if(NULL != ref->release)
+                ref->release(ref->user_data);
+
+            ref_release_pos = S3_HLS_Ring_Advance(ref_release_pos, 1, buffer_ctx->ref_capacity);
+        }
+
+        __atomic_store_n(&buffer_ctx->ref_release_pos, ref_release_pos, __ATOMIC_RELEASE);
+    }
+
+    if(0 < part_ctx->second_part_length) {
+        buffer_ctx->release_end = part_ctx->second_part_start + part_ctx->second_part_length;
     } else {
-        printf("Fix Buffer Bug!\n");
+        buffer_ctx->release_end = part_ctx->first_part_start + part_ctx->first_part_length;
     }
-    
-    buffer_ctx->used_start = next_start;
-/*        
-    uint32_t release_length = (part_ctx->first_part_length + part_ctx->second_part_length);
-    
-    buffer_ctx->used_length -= release_length;
-    buffer_ctx->used_start += release_length;
-*/    
-    printf("Buffer Info: %p, %u, %p, %u\n", buffer_ctx->used_start, buffer_ctx->used_length, buffer_ctx->buffer_start, buffer_ctx->total_length);
-    if(buffer_ctx->used_start >= buffer_ctx->buffer_start + buffer_ctx->total_length) {
-        buffer_ctx->used_start -= buffer_ctx->total_length;
+
+    __atomic_add_fetch(&buffer_ctx->cleared_parts, 1, __ATOMIC_RELEASE);
+
+    // free running position, independent of buffer size which writer may change
+    uint32_t release_pos = buffer_ctx->release_pos + part_ctx->first_part_length + part_ctx->second_part_length;
+    __atomic_store_n(&buffer_ctx->release_pos, release_pos, __ATOMIC_SEQ_CST);
+
+    // wake up writer blocked by overflow policy, only pay for the lock when someone is waiting
+    if(0 < __atomic_load_n(&buffer_ctx->space_waiters, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&buffer_ctx->space_lock);
+        pthread_cond_broadcast(&buffer_ctx->space_cond);
+        pthread_mutex_unlock(&buffer_ctx->space_lock);
     }
-    printf("New Buffer Start: %p\n", buffer_ctx->used_start);
+
+    printf("New Buffer Start: %p\n", buffer_ctx->release_end);
 
     return S3_HLS_OK;
 }
 
 /*
- * Put data into buffer
+ * Reserve room at write position
  */
-int32_t S3_HLS_Put_To_Buffer(S3_HLS_BUFFER_CTX* ctx, uint8_t* data, uint32_t length) {
-    BUFFER_DEBUG("Putting Buffer!\n");
-    if(NULL == ctx) {
+int32_t S3_HLS_Reserve_Buffer(S3_HLS_BUFFER_CTX* ctx, uint32_t length, S3_HLS_BUFFER_SPAN* span) {
+    if(NULL == ctx || NULL == span) {
         BUFFER_DEBUG("Invalid Buffer Context!\n");
         return S3_HLS_INVALID_PARAMETER;
     }
-    
+
+    // lock is handled outside reserve if necessary
+    uint32_t used_length = ctx->write_pos - __atomic_load_n(&ctx->release_pos, __ATOMIC_ACQUIRE);
+    if(ctx->elastic && (ctx->total_length < used_length + length || ctx->total_length < ctx->write_index + length))
+        S3_HLS_Grow_Buffer(ctx, used_length, length);
+
+    if(ctx->total_length < used_length + length) {
+        BUFFER_DEBUG("Buffer is full, currently used %d, new data %d\n", used_length, length);
+        return S3_HLS_BUFFER_OVERFLOW;
+    }
+
+    uint8_t* current = ctx->buffer_start + ctx->write_index;
+    uint32_t to_end = ctx->total_length - ctx->write_index;
+
+    span->first_part_start = current;
+    if(ctx->mirrored || to_end >= length) { // mirror mapping continues after buffer end
+        span->first_part_length = length;
+        span->second_part_start = NULL;
+        span->second_part_length = 0;
+    } else { // acrossed ring buffer boundary
+        span->first_part_length = to_end;
+        span->second_part_start = ctx->buffer_start;
+        span->second_part_length = length - to_end;
+    }
+
+    return length;
+}
+
+/*
+ * Publish reserved room to uploader side
+ */
+int32_t S3_HLS_Commit_Buffer(S3_HLS_BUFFER_CTX* ctx, uint32_t length) {
+    if(NULL == ctx)
+        return S3_HLS_INVALID_PARAMETER;
+
+    ctx->write_index += length;
+    if(ctx->write_index >= ctx->total_length)
+        ctx->write_index -= ctx->total_length;
+
+    __atomic_store_n(&ctx->write_pos, ctx->write_pos + length, __ATOMIC_RELEASE);
+    ctx->pending_length += length;
+
+    return length;
+}
+
+/*
+ * Put data into buffer
+ */
+int32_t S3_HLS_Put_To_Buffer(S3_HLS_BUFFER_CTX* ctx, uint8_t* data, uint32_t length) {
+    BUFFER_DEBUG("Putting Buffer!\n");
     if(NULL == data && 0 < length) {
         BUFFER_DEBUG("Input data address is NULL, but length is not 0\n");
         return S3_HLS_INVALID_PARAMETER;
     }
-    
+
+    if(0 == length)
+        return 0;
+
+    S3_HLS_BUFFER_SPAN span;
+    int32_t ret = S3_HLS_Reserve_Buffer(ctx, length, &span);
+    if(0 > ret)
+        return ret;
+
+    BUFFER_DEBUG("Copy Buffer!\n");
+    memcpy(span.first_part_start, data, span.first_part_length);
+    if(0 < span.second_part_length)
+        memcpy(span.second_part_start, data + span.first_part_length, span.second_part_length);
+
+    return S3_HLS_Commit_Buffer(ctx, length);
+}
+
+/*
+ * Put reference of data into buffer
+ */
+int32_t S3_HLS_Put_Ref_To_Buffer(S3_HLS_BUFFER_CTX* ctx, uint8_t* data, uint32_t length) {
+    BUFFER_DEBUG("Putting Reference!\n");
+    if(NULL == ctx || NULL == data) {
+        BUFFER_DEBUG("Invalid Reference!\n");
+        return S3_HLS_INVALID_PARAMETER;
+    }
+
+    if(0 == length)
+        return 0;
+
     // lock is handled outside put if necessary
-    if(ctx->total_length < ctx->used_length + length) {
-        BUFFER_DEBUG("Buffer is full, currently used %d, new data %d\n", ctx->used_length, length);
-        return S3_HLS_BUFFER_OVERFLOW;
+    if(NULL == ctx->refs) {
+        uint32_t capacity = ctx->max_length / S3_HLS_TS_PACKET_SIZE;
+        if(S3_HLS_BUFFER_MIN_REF_CAPACITY > capacity)
+            capacity = S3_HLS_BUFFER_MIN_REF_CAPACITY;
+
+        ctx->refs = (S3_HLS_BUFFER_REF*)S3_HLS_Malloc(capacity * sizeof(S3_HLS_BUFFER_REF));
+        if(NULL == ctx->refs) {
+            BUFFER_DEBUG("Failed to allocate references!\n");
+            return S3_HLS_OUT_OF_MEMORY;
+        }
+
+        ctx->ref_capacity = capacity;
     }
 
-    BUFFER_DEBUG("Copy Buffer!\n");
-    uint8_t* buffer_end = ctx->buffer_start + ctx->total_length;
-    uint8_t* current = ctx->used_start + ctx->used_length;
-    if(current >= buffer_end)
-        current -= ctx->total_length;
-        
-    if(buffer_end - current < length) {
-        // acrossed ring buffer boundary
-        memcpy(current, data, buffer_end - current);
-        memcpy(ctx->buffer_start, data + (buffer_end - current), length - (buffer_end - current));
-    } else {
-        memcpy(current, data, length);
+    uint32_t ref_write_pos = ctx->ref_write_pos;
+    uint32_t ref_used = S3_HLS_Ring_Distance(__atomic_load_n(&ctx->ref_release_pos, __ATOMIC_ACQUIRE), ref_write_pos, ctx->ref_capacity);
+    if(ref_used == ctx->ref_capacity) {
+        BUFFER_DEBUG("References are full, currently used %d\n", ref_used);
+        return S3_HLS_BUFFER_OVERFLOW;
     }
-    
-    ctx->used_length += length;
+
+    S3_HLS_BUFFER_REF* ref = &ctx->refs[S3_HLS_Ring_Index(ref_write_pos, ctx->ref_capacity)];
+    ref->data = data;
+    ref->length = length;
+    ref->offset = ctx->pending_length;
+    ref->release = NULL;
+    ref->user_data = NULL;
+
+    __atomic_store_n(&ctx->ref_write_pos, S3_HLS_Ring_Advance(ref_write_pos, 1, ctx->ref_capacity), __ATOMIC_RELEASE);
+    ctx->ref_total++;
+    ctx->pending_ref_length += length;
 
     return length;
 }
 
+/*
+ * Attach release call back to last reference added after mark
+ */
+void S3_HLS_Release_Ref_In_Buffer(S3_HLS_BUFFER_CTX* ctx, uint32_t mark, BUFFER_RELEASE_CALL_BACK release, void* user_data) {
+    if(NULL == release)
+        return;
+
+    if(NULL == ctx || mark == ctx->ref_total) { // nothing referenced, caller buffer can be given back now
+        release(user_data);
+        return;
+    }
+
+    // last reference added, references after mark are not flushed so uploader does not read them yet
+    S3_HLS_BUFFER_REF* ref = &ctx->refs[S3_HLS_Ring_Index(S3_HLS_Ring_Advance(ctx->ref_write_pos, 2 * ctx->ref_capacity - 1, ctx->ref_capacity), ctx->ref_capacity)];
+    ref->release = release;
+    ref->user_data = user_data;
+}
+
+uint32_t S3_HLS_Get_Part_Length(S3_HLS_BUFFER_PART_CTX* part_ctx) {
+    return part_ctx->first_part_length + part_ctx->second_part_length + part_ctx->ref_length;
+}
+
+void S3_HLS_Initialize_Reader(S3_HLS_BUFFER_READER* reader, S3_HLS_BUFFER_CTX* buffer_ctx, S3_HLS_BUFFER_PART_CTX* part_ctx) {
+    reader->buffer_ctx = buffer_ctx;
+    reader->part_ctx = part_ctx;
+
+    reader->pos = 0;
+    reader->ring_pos = 0;
+    reader->ref_index = 0;
+    reader->ref_pos = 0;
+}
+
+/*
+ * Get span at current position of reader
+ * Return reference if reader is at the offset of next reference, otherwise return ring bytes up to next reference
+ */
+static uint32_t S3_HLS_Reader_Span(S3_HLS_BUFFER_READER* reader, uint8_t** span, uint8_t* in_ref) {
+    S3_HLS_BUFFER_PART_CTX* part_ctx = reader->part_ctx;
+    uint32_t ring_end = part_ctx->first_part_length + part_ctx->second_part_length;
+
+    S3_HLS_BUFFER_REF* ref = NULL;
+    if(reader->ref_index < part_ctx->ref_count) {
+        S3_HLS_BUFFER_CTX* buffer_ctx = reader->buffer_ctx;
+        ref = &buffer_ctx->refs[(part_ctx->ref_start + reader->ref_index) % buffer_ctx->ref_capacity];
+
+        if(ref->offset - part_ctx->ref_base <= reader->ring_pos) {
+            *in_ref = 1;
+            *span = ref->data + reader->ref_pos;
+            return ref->length - reader->ref_pos;
+        }
+
+        ring_end = ref->offset - part_ctx->ref_base;
+    }
+
+    *in_ref = 0;
+    if(reader->ring_pos >= ring_end) {
+        *span = NULL;
+        return 0;
+    }
+
+    if(reader->ring_pos < part_ctx->first_part_length) {
+        *span = part_ctx->first_part_start + reader->ring_pos;
+        return (ring_end < part_ctx->first_part_length ? ring_end : part_ctx->first_part_length) - reader->ring_pos;
+    }
+
+    *span = part_ctx->second_part_start + (reader->ring_pos - part_ctx->first_part_length);
+    return ring_end - reader->ring_pos;
+}
+
+/*
+ * Read part as a stream, seeking forward from current position is cheap, seeking backward restarts from beginning
+ */
+uint32_t S3_HLS_Read_Part(void* ctx, uint32_t pos, uint8_t** span) {
+    S3_HLS_BUFFER_READER* reader = (S3_HLS_BUFFER_READER*)ctx;
+    if(NULL == reader || NULL == span)
+        return 0;
+
+    if(pos < reader->pos) // retry upload from beginning
+        S3_HLS_Initialize_Reader(reader, reader->buffer_ctx, reader->part_ctx);
+
+    uint8_t in_ref;
+    while(1) {
+        uint32_t length = S3_HLS_Reader_Span(reader, span, &in_ref);
+        if(0 == length || reader->pos == pos)
+            return length;
+
+        uint32_t step = pos - reader->pos < length ? pos - reader->pos : length;
+        if(in_ref) {
+            S3_HLS_BUFFER_REF* ref = &reader->buffer_ctx->refs[(reader->part_ctx->ref_start + reader->ref_index) % reader->buffer_ctx->ref_capacity];
+            reader->ref_pos += step;
+            if(reader->ref_pos == ref->length) {
+                reader->ref_index++;
+                reader->ref_pos = 0;
+            }
+        } else {
+            reader->ring_pos += step;
+        }
+
+        reader->pos += step;
+    }
+}
+
+void S3_HLS_Mark_Buffer(S3_HLS_BUFFER_CTX* ctx, S3_HLS_BUFFER_MARK* mark) {
+    mark->write_pos = ctx->write_pos;
+    mark->write_end = S3_HLS_Buffer_Write_End(ctx, S3_HLS_Get_Used_Length(ctx));
+    mark->pending_length = ctx->pending_length;
+    mark->ref_write_pos = ctx->ref_write_pos;
+    mark->ref_total = ctx->ref_total;
+    mark->pending_ref_length = ctx->pending_ref_length;
+    mark->release_pos = __atomic_load_n(&ctx->release_pos, __ATOMIC_ACQUIRE);
+}
+
+void S3_HLS_Rollback_Buffer(S3_HLS_BUFFER_CTX* ctx, S3_HLS_BUFFER_MARK* mark) {
+    // data after mark is not flushed yet, so uploader never looks at it
+    __atomic_store_n(&ctx->write_pos, mark->write_pos, __ATOMIC_RELEASE);
+    ctx->pending_length = mark->pending_length;
+
+    // buffer may have grown after mark, then writing continues right after data instead of wrapping around
+    ctx->write_index = mark->write_end >= ctx->total_length ? mark->write_end - ctx->total_length : mark->write_end;
+
+    __atomic_store_n(&ctx->ref_write_pos, mark->ref_write_pos, __ATOMIC_RELEASE);
+    ctx->ref_total = mark->ref_total;
+    ctx->pending_ref_length = mark->pending_ref_length;
+}
+
+int32_t S3_HLS_Wait_For_Buffer_Space(S3_HLS_BUFFER_CTX* ctx, uint32_t release_pos, const struct timespec* deadline) {
+    if(NULL == ctx || NULL == deadline)
+        return S3_HLS_INVALID_PARAMETER;
+
+    int32_t ret = S3_HLS_OK;
+
+    pthread_mutex_lock(&ctx->space_lock);
+    __atomic_add_fetch(&ctx->space_waiters, 1, __ATOMIC_SEQ_CST);
+
+    while(release_pos == __atomic_load_n(&ctx->release_pos, __ATOMIC_SEQ_CST)) {
+        if(ETIMEDOUT == pthread_cond_timedwait(&ctx->space_cond, &ctx->space_lock, deadline)) {
+            if(release_pos == __atomic_load_n(&ctx->release_pos, __ATOMIC_SEQ_CST))
+                ret = S3_HLS_TIMEOUT;
+
+            break;
+        }
+    }
+
+    __atomic_sub_fetch(&ctx->space_waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&ctx->space_lock);
+
+    return ret;
+}
+
+uint32_t S3_HLS_Get_Flushed_Length(S3_HLS_BUFFER_CTX* ctx) {
+    return S3_HLS_Get_Used_Length(ctx) - ctx->pending_length;
+}
+
+uint32_t S3_HLS_Get_Flushed_Parts(S3_HLS_BUFFER_CTX* ctx) {
+    return ctx->flushed_parts - __atomic_load_n(&ctx->cleared_parts, __ATOMIC_ACQUIRE);
+}
+
+uint32_t S3_HLS_Get_Pending_Length(S3_HLS_BUFFER_CTX* ctx) {
+    return ctx->pending_length + ctx->pending_ref_length;
+}
+
+int32_t S3_HLS_Add_Index_Entry(S3_HLS_BUFFER_CTX* ctx, uint32_t offset, uint32_t length, uint64_t pts) {
+    if(S3_HLS_BUFFER_MAX_INDEX_ENTRIES <= ctx->pending_index_count)
+        return S3_HLS_BUFFER_OVERFLOW;
+
+    S3_HLS_BUFFER_INDEX_ENTRY* entry = &ctx->pending_index[ctx->pending_index_count++];
+    entry->offset = offset;
+    entry->length = length;
+    entry->pts = pts;
+
+    return S3_HLS_OK;
+}
+
+void S3_HLS_Set_Init_Part(S3_HLS_BUFFER_CTX* ctx) {
+    ctx->pending_is_init = 1;
+}
+
+void S3_HLS_Set_Evict_Request(S3_HLS_BUFFER_CTX* ctx, uint8_t evict) {
+    __atomic_store_n(&ctx->evict_request, evict, __ATOMIC_RELEASE);
+}
+
+uint8_t S3_HLS_Take_Evict_Request(S3_HLS_BUFFER_CTX* ctx) {
+    if(0 == __atomic_load_n(&ctx->evict_request, __ATOMIC_ACQUIRE))
+        return 0;
+
+    __atomic_store_n(&ctx->evict_request, 0, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&ctx->evicted_segments, 1, __ATOMIC_RELAXED);
+
+    return 1;
+}
+
+uint32_t S3_HLS_Get_Used_Length(S3_HLS_BUFFER_CTX* ctx) {
+    uint32_t release_pos = __atomic_load_n(&ctx->release_pos, __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&ctx->write_pos, __ATOMIC_ACQUIRE) - release_pos;
+}
+
+int32_t S3_HLS_Set_Buffer_Floor(S3_HLS_BUFFER_CTX* ctx, uint32_t size) {
+    if(NULL == ctx)
+        return S3_HLS_INVALID_PARAMETER;
+
+    if(!ctx->elastic)
+        return S3_HLS_INVALID_STATUS;
+
+    // shrink gives memory back down to floor in one step, so floor is whole pages like chunks
+    uint32_t page_size = (uint32_t)sysconf(_SC_PAGESIZE);
+    if(size < ctx->base_length)
+        size = ctx->base_length;
+
+    // max length is whole pages, so rounding up does not pass it
+    size = size >= ctx->max_length ? ctx->max_length : (size + page_size - 1) / page_size * page_size;
+    if(size != ctx->min_length)
+        BUFFER_FLUSH_DEBUG("Buffer floor %u -> %u\n", ctx->min_length, size);
+
+    __atomic_store_n(&ctx->min_length, size, __ATOMIC_RELAXED);
+
+    return S3_HLS_OK;
+}
+
+int32_t S3_HLS_Get_Buffer_Info(S3_HLS_BUFFER_CTX* ctx, S3_HLS_BUFFER_INFO* info) {
+    if(NULL == ctx || NULL == info)
+        return S3_HLS_INVALID_PARAMETER;
+
+    info->current_size = __atomic_load_n(&ctx->total_length, __ATOMIC_ACQUIRE);
+    info->min_size = __atomic_load_n(&ctx->min_length, __ATOMIC_RELAXED);
+    info->max_size = ctx->max_length;
+    info->peak_size = __atomic_load_n(&ctx->peak_length, __ATOMIC_RELAXED);
+    info->used_size = S3_HLS_Get_Used_Length(ctx);
+    info->grow_events = __atomic_load_n(&ctx->grow_count, __ATOMIC_RELAXED);
+    info->shrink_events = __atomic_load_n(&ctx->shrink_count, __ATOMIC_RELAXED);
+
+    return S3_HLS_OK;
+}
+
 int32_t S3_HLS_Lock_Buffer(S3_HLS_BUFFER_CTX* ctx) {
     if(NULL == ctx) {
         return S3_HLS_INVALID_PARAMETER;
@@ -219,6 +933,14 @@ int32_t S3_HLS_Lock_Buffer(S3_HLS_BUFFER_CTX* ctx) {
     return pthread_mutex_lock(&ctx->buffer_lock);
 }
 
+int32_t S3_HLS_Try_Lock_Buffer(S3_HLS_BUFFER_CTX* ctx) {
+    if(NULL == ctx) {
+        return S3_HLS_INVALID_PARAMETER;
+    }
+
+    return pthread_mutex_trylock(&ctx->buffer_lock);
+}
+
 int32_t S3_HLS_Unlock_Buffer(S3_HLS_BUFFER_CTX* ctx) {
     if(NULL == ctx) {
         return S3_HLS_INVALID_PARAMETER;
@@ -23,12 +23,33 @@
 #include "time.h"
 #include <pthread.h>
 
+#include "S3_HLS_SDK.h"
+
 #ifdef __cplusplus
 #if __cplusplus
 extern "C" {
 #endif
 #endif /* End of #ifdef __cplusplus */
 
+#define S3_HLS_CACHE_LINE_SIZE          64
+#define S3_HLS_CACHE_ALIGNED            __attribute__((aligned(S3_HLS_CACHE_LINE_SIZE)))
+
+// elastic buffer grows when this much is in use or this many parts wait for upload, and shrinks below a quarter when idle
+#define S3_HLS_BUFFER_GROW_WATERMARK(size)      ((size) / 4 * 3)
+#define S3_HLS_BUFFER_SHRINK_WATERMARK(size)    ((size) / 4)
+#define S3_HLS_BUFFER_GROW_BACKLOG              3
+
+#define S3_HLS_BUFFER_MAX_INDEX_ENTRIES         32      // random access points recorded per part, later ones are not recorded
+
+/*
+ * Byte range of a random access point (key frame with tables in front of it) within a part
+ */
+typedef struct s3_hls_buffer_index_entry_s {
+    uint32_t offset;
+    uint32_t length;
+    uint64_t pts;               // 90kHz
+} S3_HLS_BUFFER_INDEX_ENTRY;
+
 typedef struct s3_hls_buffer_part_handle_s {
     uint8_t* first_part_start;
     uint32_t first_part_length;
@@ -36,31 +57,165 @@ typedef struct s3_hls_buffer_part_handle_s {
     uint8_t* second_part_start;
     uint32_t second_part_length;
     
+    // payload kept by reference, interleaved with the ring bytes above when reading the part
+    uint32_t ref_start;
+    uint32_t ref_count;
+    uint32_t ref_length;
+
     time_t timestamp;
+
+    uint32_t index_count;
+    S3_HLS_BUFFER_INDEX_ENTRY index[S3_HLS_BUFFER_MAX_INDEX_ENTRIES];
+
+    uint8_t is_init;            // fMP4 init segment instead of media segment
+
+    // partial segment handed out ahead of the segment it belongs to, its bytes are cleared with that segment
+    uint8_t is_partial;
+    uint64_t part_timestamp;    // caller defined, e.g. ms timestamp of first frame
+    uint32_t ref_base;          // offset of partial segment in its segment, reference offsets count from segment start
 } S3_HLS_BUFFER_PART_CTX;
 
-typedef void (*BUFFER_CALL_BACK)(S3_HLS_BUFFER_PART_CTX* ctx);
+/*
+ * Called under buffer lock with each flushed part, user_data is the one passed at initialize
+ */
+typedef void (*BUFFER_CALL_BACK)(S3_HLS_BUFFER_PART_CTX* ctx, void* user_data);
+
+/*
+ * Called once the referenced caller buffer is no longer used by the SDK
+ */
+typedef void (*BUFFER_RELEASE_CALL_BACK)(void* user_data);
 
+/*
+ * Caller owned data inserted into the ring at given offset of the pending part
+ * Only the last reference of a frame pack carries the release call back
+ */
+typedef struct s3_hls_buffer_ref_s {
+    uint8_t* data;
+    uint32_t length;
+    uint32_t offset;
+
+    BUFFER_RELEASE_CALL_BACK release;
+    void* user_data;
+} S3_HLS_BUFFER_REF;
+
+/*
+ * Buffer is a single writer / single uploader ring
+ * Writers (serialized by buffer_lock) only move write positions, uploader only moves release positions
+ * Positions are published with release / acquire atomics so uploader never takes buffer_lock
+ * Ring bytes are counted with free running positions, so uploader does not depend on buffer size and writer can resize the buffer
+ */
 typedef struct s3_hls_buffer_s {
     uint8_t* buffer_start;
     uint32_t total_length;
-    
-    uint8_t* used_start;
-    uint32_t used_length;
-    
+    uint8_t mirrored;           // buffer is mapped twice, total_length bytes after any position are continuous
+
+    // elastic buffer reserves max_length of address space, only total_length of it is backed by memory
+    uint8_t elastic;
+    uint32_t base_length;       // size given to initialize
+    uint32_t min_length;        // grows to it before wrapping around and never shrinks below it, at least base_length
+    uint32_t max_length;
+    uint32_t chunk_length;
+    uint32_t peak_length;
+    uint32_t grow_count;
+    uint32_t shrink_count;
+
+    // writer side
+    uint32_t write_pos S3_HLS_CACHE_ALIGNED;  // bytes ever written, wraps around at 2^32
+    uint32_t write_index;                       // offset in buffer of next write
+    uint32_t ref_write_pos;                     // in [0, 2 * ref_capacity)
+    uint32_t flushed_parts;
+
     uint8_t* last_flush;
     time_t last_flush_timestamp;
+    uint32_t pending_length;    // ring bytes written since last flush
+
+    // reference ring, allocated on first use
+    S3_HLS_BUFFER_REF* refs;
+    uint32_t ref_capacity;
+    uint32_t ref_total;         // number of references ever added, used as mark by writers
+    uint32_t last_flush_ref;    // number of references already handed out by flush
+    uint32_t pending_ref_length;
+
+    // random access points of pending part, handed out by flush
+    uint32_t pending_index_count;
+    S3_HLS_BUFFER_INDEX_ENTRY pending_index[S3_HLS_BUFFER_MAX_INDEX_ENTRIES];
+    uint8_t pending_is_init;
+
+    // head of pending part already handed out as partial segments
+    uint32_t partial_length;
+    uint32_t partial_refs;
+    uint32_t partial_ref_length;
 
     pthread_mutex_t buffer_lock;
 
     BUFFER_CALL_BACK call_back;
+    void* call_back_user_data;
+
+    // uploader side
+    uint32_t release_pos S3_HLS_CACHE_ALIGNED;  // bytes ever released
+    uint32_t ref_release_pos;
+    uint32_t cleared_parts;
+    uint8_t* release_end;       // end of last cleared part, only used to check clear order
+
+    // overflow handling, writer may wait for uploader to free space or ask it to drop oldest part
+    uint32_t space_waiters;
+    uint32_t evict_request;
+    uint32_t evicted_segments;
+    pthread_mutex_t space_lock;
+    pthread_cond_t space_cond;
 } S3_HLS_BUFFER_CTX;
 
+/*
+ * Writer state saved before writing a frame, so a frame that does not fit can be taken back as a whole
+ */
+typedef struct s3_hls_buffer_mark_s {
+    uint32_t write_pos;
+    uint32_t write_end;         // offset in buffer where written data ends, may equal buffer size
+    uint32_t pending_length;
+    uint32_t ref_write_pos;
+    uint32_t ref_total;
+    uint32_t pending_ref_length;
+
+    uint32_t release_pos;       // uploader position seen when mark is taken
+} S3_HLS_BUFFER_MARK;
+
+// room reserved at write position, second part is only used when room wraps around end of a buffer that is not mirrored
+typedef struct s3_hls_buffer_span_s {
+    uint8_t* first_part_start;
+    uint32_t first_part_length;
+
+    uint8_t* second_part_start;
+    uint32_t second_part_length;
+} S3_HLS_BUFFER_SPAN;
+
+/*
+ * Cursor used to read a flushed part as one continuous stream of ring bytes and referenced data
+ */
+typedef struct s3_hls_buffer_reader_s {
+    S3_HLS_BUFFER_CTX* buffer_ctx;
+    S3_HLS_BUFFER_PART_CTX* part_ctx;
+
+    uint32_t pos;
+    uint32_t ring_pos;
+    uint32_t ref_index;
+    uint32_t ref_pos;
+} S3_HLS_BUFFER_READER;
+
 /*
  * Buffer manager is a central managememnt of video and audio buffer that is cached for sending to S3
  * Initialize will allocate memory buffer for given size
+ * When supported by the system, the buffer is mapped twice back to back (size rounded up to page size)
+ * so flushed parts never have a second part. Otherwise a plain malloc buffer is used.
  */
-S3_HLS_BUFFER_CTX* S3_HLS_Initialize_Buffer(uint32_t buffer_size, BUFFER_CALL_BACK function_pointer);
+S3_HLS_BUFFER_CTX* S3_HLS_Initialize_Buffer(uint32_t buffer_size, BUFFER_CALL_BACK function_pointer, void* user_data);
+
+/*
+ * Same as S3_HLS_Initialize_Buffer, but buffer starts with buffer_size and grows in chunk_size steps up to max_size
+ * when upload falls behind, then gives memory back to the system when backlog is drained
+ * Address space of max_size is reserved up front so data never moves, elastic buffer is not mirror mapped
+ * Falls back to fixed buffer of buffer_size if address space cannot be reserved or user allocator is used
+ */
+S3_HLS_BUFFER_CTX* S3_HLS_Initialize_Elastic_Buffer(uint32_t buffer_size, uint32_t max_size, uint32_t chunk_size, BUFFER_CALL_BACK function_pointer, void* user_data);
 
 /*
  * Free up memory allocated for buffer
@@ -79,6 +234,7 @@ int32_t S3_HLS_Flush_Buffer(S3_HLS_BUFFER_CTX* ctx);
 /*
  * Clear buffer will release buffer that provided by flush buffer
  * After clear the buffer, it can be reused by other input
+ * Parts must be cleared in the order they are flushed, buffer lock is not needed
  */
 int32_t S3_HLS_Clear_Buffer(S3_HLS_BUFFER_CTX* buffer_ctx, S3_HLS_BUFFER_PART_CTX* ctx);
 
@@ -89,8 +245,141 @@ int32_t S3_HLS_Clear_Buffer(S3_HLS_BUFFER_CTX* buffer_ctx, S3_HLS_BUFFER_PART_CT
  */
 int32_t S3_HLS_Put_To_Buffer(S3_HLS_BUFFER_CTX* ctx, uint8_t* data, uint32_t length);
 
+/*
+ * Reserve length bytes at write position so writer can fill them in place
+ * Nothing is written until S3_HLS_Commit_Buffer is called, so an unused reservation needs no rollback
+ * Return length if success
+ * Return negative error code if failed
+ */
+int32_t S3_HLS_Reserve_Buffer(S3_HLS_BUFFER_CTX* ctx, uint32_t length, S3_HLS_BUFFER_SPAN* span);
+
+/*
+ * Publish length bytes filled after S3_HLS_Reserve_Buffer, length must not exceed reserved length
+ */
+int32_t S3_HLS_Commit_Buffer(S3_HLS_BUFFER_CTX* ctx, uint32_t length);
+
+/*
+ * Put a reference of caller owned data into buffer, data is not copied
+ * The data must stay valid until release call back attached by S3_HLS_Release_Ref_In_Buffer is called
+ * Return number of bytes referenced if success
+ * Return negative error code if failed
+ */
+int32_t S3_HLS_Put_Ref_To_Buffer(S3_HLS_BUFFER_CTX* ctx, uint8_t* data, uint32_t length);
+
+/*
+ * Attach release call back to the references added after given mark (value of ref_total before writing)
+ * The call back is called when the part contains the last reference is cleared
+ * If no reference is added after mark, the call back is called immediately
+ */
+void S3_HLS_Release_Ref_In_Buffer(S3_HLS_BUFFER_CTX* ctx, uint32_t mark, BUFFER_RELEASE_CALL_BACK release, void* user_data);
+
+/*
+ * Total length of a flushed part including referenced data
+ */
+uint32_t S3_HLS_Get_Part_Length(S3_HLS_BUFFER_PART_CTX* part_ctx);
+
+/*
+ * Prepare reader for a flushed part
+ */
+void S3_HLS_Initialize_Reader(S3_HLS_BUFFER_READER* reader, S3_HLS_BUFFER_CTX* buffer_ctx, S3_HLS_BUFFER_PART_CTX* part_ctx);
+
+/*
+ * Get the contiguous span starting at pos of the part, pos usually increases between calls
+ * Return length of the span and set span to its address, return 0 when reaching end of part
+ */
+uint32_t S3_HLS_Read_Part(void* reader, uint32_t pos, uint8_t** span);
+
+/*
+ * Save writer state, must not flush between mark and rollback
+ */
+void S3_HLS_Mark_Buffer(S3_HLS_BUFFER_CTX* ctx, S3_HLS_BUFFER_MARK* mark);
+
+/*
+ * Drop everything written after mark, including references
+ */
+void S3_HLS_Rollback_Buffer(S3_HLS_BUFFER_CTX* ctx, S3_HLS_BUFFER_MARK* mark);
+
+/*
+ * Block writer until uploader clears a part after release_pos was seen, or until deadline (CLOCK_MONOTONIC)
+ * Return S3_HLS_TIMEOUT if nothing is cleared before deadline
+ */
+int32_t S3_HLS_Wait_For_Buffer_Space(S3_HLS_BUFFER_CTX* ctx, uint32_t release_pos, const struct timespec* deadline);
+
+/*
+ * Number of bytes flushed but not cleared yet, called by writer side
+ */
+uint32_t S3_HLS_Get_Flushed_Length(S3_HLS_BUFFER_CTX* ctx);
+
+/*
+ * Number of segments flushed but not cleared yet, called by writer side
+ */
+uint32_t S3_HLS_Get_Flushed_Parts(S3_HLS_BUFFER_CTX* ctx);
+
+/*
+ * Length of pending part including referenced data, i.e. offset in the part of the next byte written
+ */
+uint32_t S3_HLS_Get_Pending_Length(S3_HLS_BUFFER_CTX* ctx);
+
+/*
+ * Record byte range of a random access point in pending part, it is handed out with the part by next flush
+ * Return S3_HLS_BUFFER_OVERFLOW if the part already has S3_HLS_BUFFER_MAX_INDEX_ENTRIES entries
+ */
+int32_t S3_HLS_Add_Index_Entry(S3_HLS_BUFFER_CTX* ctx, uint32_t offset, uint32_t length, uint64_t pts);
+
+/*
+ * Hand out data written since last partial flush as a partial segment, pending part is not closed
+ * Partial segment stays readable until the part it belongs to is cleared, clearing it releases nothing
+ * Parts are still cleared in flush order, so a part is never released while one of its partial segments is read
+ */
+int32_t S3_HLS_Flush_Partial(S3_HLS_BUFFER_CTX* ctx, uint64_t part_timestamp);
+
+/*
+ * Length of pending part not handed out as partial segment yet, including referenced data
+ */
+uint32_t S3_HLS_Get_Partial_Pending_Length(S3_HLS_BUFFER_CTX* ctx);
+
+/*
+ * Mark pending part as init segment, handed out with the part by next flush
+ */
+void S3_HLS_Set_Init_Part(S3_HLS_BUFFER_CTX* ctx);
+
+/*
+ * Ask uploader to drop the next part it takes instead of uploading it, or cancel the request
+ */
+void S3_HLS_Set_Evict_Request(S3_HLS_BUFFER_CTX* ctx, uint8_t evict);
+
+/*
+ * Called by uploader for each part, return 1 if the part should be cleared without uploading
+ */
+uint8_t S3_HLS_Take_Evict_Request(S3_HLS_BUFFER_CTX* ctx);
+
+/*
+ * Number of bytes in buffer that are not cleared yet, can be called from any thread
+ */
+uint32_t S3_HLS_Get_Used_Length(S3_HLS_BUFFER_CTX* ctx);
+
+/*
+ * Set size elastic buffer grows to instead of wrapping around and never shrinks below, clamped between size given to initialize and max size
+ * Buffer grows to it at the next write that would wrap around, called by writer with buffer locked
+ * Returns S3_HLS_INVALID_STATUS for fixed buffer
+ */
+int32_t S3_HLS_Set_Buffer_Floor(S3_HLS_BUFFER_CTX* ctx, uint32_t size);
+
+/*
+ * Size, usage and resize events of buffer, can be called from any thread
+ */
+int32_t S3_HLS_Get_Buffer_Info(S3_HLS_BUFFER_CTX* ctx, S3_HLS_BUFFER_INFO* info);
+
+/*
+ * Lock is only needed to serialize writers (e.g. video and audio put from different threads)
+ */
 int32_t S3_HLS_Lock_Buffer(S3_HLS_BUFFER_CTX* ctx);
 
+/*
+ * Returns 0 if lock is taken, used by threads other than writers that must not wait behind a blocked writer
+ */
+int32_t S3_HLS_Try_Lock_Buffer(S3_HLS_BUFFER_CTX* ctx);
+
 int32_t S3_HLS_Unlock_Buffer(S3_HLS_BUFFER_CTX* ctx);
 
 #ifdef __cplusplus
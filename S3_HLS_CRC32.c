@@ -0,0 +1,68 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT-0
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pthread.h>
+
+#include "S3_HLS_CRC32.h"
+
+#define S3_HLS_CRC32_POLYNOMIAL         0x04C11DB7
+#define S3_HLS_CRC32_SLICES             8
+
+/*
+ * Slicing-by-8 tables, table[k][i] is CRC of byte i followed by k zero bytes
+ * Eight input bytes are folded with eight independent lookups instead of eight dependent ones
+ */
+static uint32_t crc_table[S3_HLS_CRC32_SLICES][256];
+
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void S3_HLS_CRC32_Build_Table() {
+    for(uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i << 24;
+        for(uint32_t bit = 0; bit < 8; bit++)
+            crc = (crc & 0x80000000) ? (crc << 1) ^ S3_HLS_CRC32_POLYNOMIAL : crc << 1;
+
+        crc_table[0][i] = crc;
+    }
+
+    for(uint32_t k = 1; k < S3_HLS_CRC32_SLICES; k++) {
+        for(uint32_t i = 0; i < 256; i++)
+            crc_table[k][i] = (crc_table[k - 1][i] << 8) ^ crc_table[0][crc_table[k - 1][i] >> 24];
+    }
+}
+
+uint32_t S3_HLS_CRC32(const uint8_t* data, uint32_t length) {
+    pthread_once(&crc_table_once, S3_HLS_CRC32_Build_Table);
+
+    uint32_t crc = 0xFFFFFFFF;
+
+    while(S3_HLS_CRC32_SLICES <= length) {
+        crc ^= ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+
+        crc = crc_table[7][crc >> 24] ^ crc_table[6][(crc >> 16) & 0xFF] ^ crc_table[5][(crc >> 8) & 0xFF] ^ crc_table[4][crc & 0xFF]
+            ^ crc_table[3][data[4]] ^ crc_table[2][data[5]] ^ crc_table[1][data[6]] ^ crc_table[0][data[7]];
+
+        data += S3_HLS_CRC32_SLICES;
+        length -= S3_HLS_CRC32_SLICES;
+    }
+
+    while(0 < length--)
+        crc = (crc << 8) ^ crc_table[0][(crc >> 24) ^ *data++];
+
+    return crc;
+}
@@ -0,0 +1,624 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT-0
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "stdio.h"
+#include "string.h"
+
+#include "S3_HLS_FMP4.h"
+#include "S3_HLS_Return_Code.h"
+#include "S3_HLS_H264_Nalu_Types.h"
+
+/*
+ * Fragmented MP4 (CMAF) boxes, ISO/IEC 14496-12 and 14496-15
+ *
+ * Init segment
+ *  ftyp
+ *  moov
+ *      mvhd
+ *      trak (video, then audio)
+ *          tkhd
+ *          mdia
+ *              mdhd
+ *              hdlr
+ *              minf
+ *                  vmhd / smhd
+ *                  dinf / dref / url
+ *                  stbl / stsd (avc1 + avcC, hvc1 + hvcC or mp4a + esds), empty stts, stsc, stsz and stco
+ *      mvex
+ *          trex for each track
+ *
+ * Media segment is a sequence of fragments of one track each
+ *  moof
+ *      mfhd                    sequence number
+ *      traf
+ *          tfhd                track id, default-base-is-moof, default duration and flags
+ *          tfdt                decode time of first sample
+ *          trun                sample sizes, flags of first sample and composition offset
+ *  mdat
+ *
+ * Parameter sets stay in band in front of key frames as in TS, sample entry carries the first ones seen
+ */
+
+// #define S3_HLS_FMP4_DEBUG
+
+#ifdef S3_HLS_FMP4_DEBUG
+#define FMP4_DEBUG(x, ...) printf(x, ##__VA_ARGS__)
+#else
+#define FMP4_DEBUG(x, ...)
+#endif
+
+#define S3_HLS_FMP4_MAX_INIT_SIZE           2048
+#define S3_HLS_FMP4_MAX_HEADER_SIZE         (128 + S3_HLS_FMP4_MAX_SAMPLES * 4)
+#define S3_HLS_FMP4_BOX_HEADER_SIZE         8
+#define S3_HLS_FMP4_NALU_LENGTH_SIZE        4       // replaces 3 or 4 bytes start code
+
+#define S3_HLS_FMP4_MOVIE_TIMESCALE         1000
+
+#define S3_HLS_FMP4_SYNC_SAMPLE_FLAGS       0x02000000  // depends on no other sample
+#define S3_HLS_FMP4_NON_SYNC_SAMPLE_FLAGS   0x01010000  // depends on others, not a sync sample
+
+#define S3_HLS_FMP4_TFHD_FLAGS              0x020028    // default-base-is-moof, default duration and flags
+#define S3_HLS_FMP4_TRUN_DATA_OFFSET        0x000001
+#define S3_HLS_FMP4_TRUN_FIRST_FLAGS        0x000004
+#define S3_HLS_FMP4_TRUN_SAMPLE_SIZE        0x000200
+#define S3_HLS_FMP4_TRUN_COMPOSITION        0x000800
+
+#define S3_HLS_FMP4_H265_PROFILE_SIZE       12      // general profile, compatibility, constraint flags and level
+
+typedef struct s3_hls_fmp4_writer_s {
+    uint8_t* data;
+    uint32_t size;
+    uint32_t pos;
+    uint8_t overflow;
+} S3_HLS_FMP4_WRITER;
+
+static const uint32_t m_fmp4_matrix[9] = { 0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000 };
+
+static void S3_HLS_FMP4_Put_Bytes(S3_HLS_FMP4_WRITER* writer, const uint8_t* data, uint32_t length) {
+    if(writer->overflow || writer->size - writer->pos < length) {
+        writer->overflow = 1;
+        return;
+    }
+
+    memcpy(writer->data + writer->pos, data, length);
+    writer->pos += length;
+}
+
+static void S3_HLS_FMP4_Put_Zero(S3_HLS_FMP4_WRITER* writer, uint32_t length) {
+    if(writer->overflow || writer->size - writer->pos < length) {
+        writer->overflow = 1;
+        return;
+    }
+
+    memset(writer->data + writer->pos, 0, length);
+    writer->pos += length;
+}
+
+static void S3_HLS_FMP4_Put_8(S3_HLS_FMP4_WRITER* writer, uint8_t value) {
+    S3_HLS_FMP4_Put_Bytes(writer, &value, 1);
+}
+
+static void S3_HLS_FMP4_Put_16(S3_HLS_FMP4_WRITER* writer, uint16_t value) {
+    uint8_t data[2] = { value >> 8, value & 0xFF };
+    S3_HLS_FMP4_Put_Bytes(writer, data, sizeof(data));
+}
+
+static void S3_HLS_FMP4_Put_32(S3_HLS_FMP4_WRITER* writer, uint32_t value) {
+    uint8_t data[4] = { value >> 24, (value >> 16) & 0xFF, (value >> 8) & 0xFF, value & 0xFF };
+    S3_HLS_FMP4_Put_Bytes(writer, data, sizeof(data));
+}
+
+static void S3_HLS_FMP4_Put_64(S3_HLS_FMP4_WRITER* writer, uint64_t value) {
+    S3_HLS_FMP4_Put_32(writer, value >> 32);
+    S3_HLS_FMP4_Put_32(writer, value & 0xFFFFFFFF);
+}
+
+/*
+ * Start a box, size is filled by S3_HLS_FMP4_End_Box, returns position of the box
+ */
+static uint32_t S3_HLS_FMP4_Start_Box(S3_HLS_FMP4_WRITER* writer, const char* type) {
+    uint32_t pos = writer->pos;
+    S3_HLS_FMP4_Put_32(writer, 0);
+    S3_HLS_FMP4_Put_Bytes(writer, (const uint8_t*)type, 4);
+    return pos;
+}
+
+static uint32_t S3_HLS_FMP4_Start_Full_Box(S3_HLS_FMP4_WRITER* writer, const char* type, uint8_t version, uint32_t flags) {
+    uint32_t pos = S3_HLS_FMP4_Start_Box(writer, type);
+    S3_HLS_FMP4_Put_32(writer, ((uint32_t)version << 24) | (flags & 0xFFFFFF));
+    return pos;
+}
+
+static void S3_HLS_FMP4_End_Box(S3_HLS_FMP4_WRITER* writer, uint32_t pos) {
+    if(writer->overflow)
+        return;
+
+    uint32_t size = writer->pos - pos;
+    writer->data[pos] = size >> 24;
+    writer->data[pos + 1] = (size >> 16) & 0xFF;
+    writer->data[pos + 2] = (size >> 8) & 0xFF;
+    writer->data[pos + 3] = size & 0xFF;
+}
+
+static void S3_HLS_FMP4_Put_Matrix(S3_HLS_FMP4_WRITER* writer) {
+    for(uint32_t cnt = 0; cnt < sizeof(m_fmp4_matrix) / sizeof(m_fmp4_matrix[0]); cnt++)
+        S3_HLS_FMP4_Put_32(writer, m_fmp4_matrix[cnt]);
+}
+
+/*
+ * Copy RBSP of NALU without emulation prevention bytes, stops after length bytes
+ * Returns number of bytes copied
+ */
+static uint32_t S3_HLS_FMP4_Unescape(uint8_t* dest, uint32_t length, const uint8_t* nalu, uint32_t nalu_length) {
+    uint32_t copied = 0;
+    uint32_t zeros = 0;
+
+    for(uint32_t pos = 0; pos < nalu_length && copied < length; pos++) {
+        if(2 <= zeros && 0x03 == nalu[pos]) {
+            zeros = 0;
+            continue;
+        }
+
+        zeros = 0 == nalu[pos] ? zeros + 1 : 0;
+        dest[copied++] = nalu[pos];
+    }
+
+    return copied;
+}
+
+static void S3_HLS_FMP4_Put_AVCC(S3_HLS_FMP4_WRITER* writer, S3_HLS_FMP4_INIT* init) {
+    uint32_t box = S3_HLS_FMP4_Start_Box(writer, "avcC");
+    S3_HLS_FMP4_Put_8(writer, 1);               // configurationVersion
+    S3_HLS_FMP4_Put_Bytes(writer, init->sps + 1, 3); // profile, compatibility, level
+    S3_HLS_FMP4_Put_8(writer, 0xFC | (S3_HLS_FMP4_NALU_LENGTH_SIZE - 1));
+    S3_HLS_FMP4_Put_8(writer, 0xE0 | 1);        // one SPS
+    S3_HLS_FMP4_Put_16(writer, init->sps_length);
+    S3_HLS_FMP4_Put_Bytes(writer, init->sps, init->sps_length);
+    S3_HLS_FMP4_Put_8(writer, 1);               // one PPS
+    S3_HLS_FMP4_Put_16(writer, init->pps_length);
+    S3_HLS_FMP4_Put_Bytes(writer, init->pps, init->pps_length);
+    S3_HLS_FMP4_End_Box(writer, box);
+}
+
+static void S3_HLS_FMP4_Put_HVCC_Array(S3_HLS_FMP4_WRITER* writer, uint8_t type, uint8_t* nalu, uint32_t length) {
+    S3_HLS_FMP4_Put_8(writer, 0x80 | type);     // array_completeness, parameter sets are also in band
+    S3_HLS_FMP4_Put_16(writer, 1);
+    S3_HLS_FMP4_Put_16(writer, length);
+    S3_HLS_FMP4_Put_Bytes(writer, nalu, length);
+}
+
+/*
+ * Profile, tier and level are copied from SPS, chroma format and bit depth are taken from parsed SPS
+ */
+static void S3_HLS_FMP4_Put_HVCC(S3_HLS_FMP4_WRITER* writer, S3_HLS_FMP4_INIT* init) {
+    // 2 bytes NALU header, 1 byte VPS id, max sub layers and nesting flag, then profile_tier_level
+    uint8_t rbsp[3 + S3_HLS_FMP4_H265_PROFILE_SIZE] = { 0 };
+    S3_HLS_FMP4_Unescape(rbsp, sizeof(rbsp), init->sps, init->sps_length);
+
+    uint8_t sub_layers = ((rbsp[2] >> 1) & 0x07) + 1;
+    uint8_t nesting = rbsp[2] & 0x01;
+    S3_HLS_VIDEO_INFO* info = init->video_info;
+
+    uint32_t box = S3_HLS_FMP4_Start_Box(writer, "hvcC");
+    S3_HLS_FMP4_Put_8(writer, 1);               // configurationVersion
+    S3_HLS_FMP4_Put_Bytes(writer, rbsp + 3, S3_HLS_FMP4_H265_PROFILE_SIZE);
+    S3_HLS_FMP4_Put_16(writer, 0xF000);         // min_spatial_segmentation_idc
+    S3_HLS_FMP4_Put_8(writer, 0xFC);            // parallelismType unknown
+    S3_HLS_FMP4_Put_8(writer, 0xFC | info->chroma_format);  // chroma_format_idc
+    S3_HLS_FMP4_Put_8(writer, 0xF8 | (info->bit_depth - 8));    // bit_depth_luma_minus8
+    S3_HLS_FMP4_Put_8(writer, 0xF8 | (info->bit_depth_chroma - 8)); // bit_depth_chroma_minus8
+    S3_HLS_FMP4_Put_16(writer, 0);              // avgFrameRate
+    S3_HLS_FMP4_Put_8(writer, (sub_layers << 3) | (nesting << 2) | (S3_HLS_FMP4_NALU_LENGTH_SIZE - 1));
+    S3_HLS_FMP4_Put_8(writer, 3);               // VPS, SPS and PPS arrays
+    S3_HLS_FMP4_Put_HVCC_Array(writer, 32, init->vps, init->vps_length);
+    S3_HLS_FMP4_Put_HVCC_Array(writer, 33, init->sps, init->sps_length);
+    S3_HLS_FMP4_Put_HVCC_Array(writer, 34, init->pps, init->pps_length);
+    S3_HLS_FMP4_End_Box(writer, box);
+}
+
+/*
+ * Descriptor of esds, sizes are small enough for one byte
+ */
+static void S3_HLS_FMP4_Put_Descriptor(S3_HLS_FMP4_WRITER* writer, uint8_t tag, uint8_t length) {
+    S3_HLS_FMP4_Put_8(writer, tag);
+    S3_HLS_FMP4_Put_8(writer, length);
+}
+
+static void S3_HLS_FMP4_Put_ESDS(S3_HLS_FMP4_WRITER* writer, S3_HLS_FMP4_INIT* init) {
+    uint32_t box = S3_HLS_FMP4_Start_Full_Box(writer, "esds", 0, 0);
+
+    S3_HLS_FMP4_Put_Descriptor(writer, 0x03, 3 + 2 + 13 + 2 + sizeof(init->audio_config) + 3); // ES_Descriptor
+    S3_HLS_FMP4_Put_16(writer, 0);              // ES_ID
+    S3_HLS_FMP4_Put_8(writer, 0);               // flags
+
+    S3_HLS_FMP4_Put_Descriptor(writer, 0x04, 13 + 2 + sizeof(init->audio_config)); // DecoderConfigDescriptor
+    S3_HLS_FMP4_Put_8(writer, 0x40);            // MPEG-4 audio
+    S3_HLS_FMP4_Put_8(writer, (0x05 << 2) | 1); // audio stream
+    S3_HLS_FMP4_Put_Zero(writer, 3 + 4 + 4);    // buffer size, max and average bitrate unknown
+
+    S3_HLS_FMP4_Put_Descriptor(writer, 0x05, sizeof(init->audio_config)); // DecoderSpecificInfo
+    S3_HLS_FMP4_Put_Bytes(writer, init->audio_config, sizeof(init->audio_config));
+
+    S3_HLS_FMP4_Put_Descriptor(writer, 0x06, 1); // SLConfigDescriptor
+    S3_HLS_FMP4_Put_8(writer, 0x02);
+
+    S3_HLS_FMP4_End_Box(writer, box);
+}
+
+static void S3_HLS_FMP4_Put_Video_Entry(S3_HLS_FMP4_WRITER* writer, S3_HLS_FMP4_INIT* init) {
+    uint8_t h265 = S3_HLS_VIDEO_CODEC_H265 == init->video_codec;
+
+    uint32_t box = S3_HLS_FMP4_Start_Box(writer, h265 ? "hvc1" : "avc1");
+    S3_HLS_FMP4_Put_Zero(writer, 6);
+    S3_HLS_FMP4_Put_16(writer, 1);              // data_reference_index
+    S3_HLS_FMP4_Put_Zero(writer, 16);
+    S3_HLS_FMP4_Put_16(writer, init->video_info->width);    // picture size after cropping
+    S3_HLS_FMP4_Put_16(writer, init->video_info->height);
+    S3_HLS_FMP4_Put_32(writer, 0x00480000);     // 72 dpi
+    S3_HLS_FMP4_Put_32(writer, 0x00480000);
+    S3_HLS_FMP4_Put_32(writer, 0);
+    S3_HLS_FMP4_Put_16(writer, 1);              // frame_count
+    S3_HLS_FMP4_Put_Zero(writer, 32);           // compressorname
+    S3_HLS_FMP4_Put_16(writer, 0x0018);         // depth
+    S3_HLS_FMP4_Put_16(writer, 0xFFFF);
+
+    if(h265)
+        S3_HLS_FMP4_Put_HVCC(writer, init);
+    else
+        S3_HLS_FMP4_Put_AVCC(writer, init);
+
+    S3_HLS_FMP4_End_Box(writer, box);
+}
+
+static void S3_HLS_FMP4_Put_Audio_Entry(S3_HLS_FMP4_WRITER* writer, S3_HLS_FMP4_INIT* init) {
+    uint32_t box = S3_HLS_FMP4_Start_Box(writer, "mp4a");
+    S3_HLS_FMP4_Put_Zero(writer, 6);
+    S3_HLS_FMP4_Put_16(writer, 1);              // data_reference_index
+    S3_HLS_FMP4_Put_Zero(writer, 8);
+    S3_HLS_FMP4_Put_16(writer, init->audio_channels);
+    S3_HLS_FMP4_Put_16(writer, 16);             // samplesize
+    S3_HLS_FMP4_Put_32(writer, 0);
+    S3_HLS_FMP4_Put_32(writer, (init->audio_sample_rate & 0xFFFF) << 16);
+    S3_HLS_FMP4_Put_ESDS(writer, init);
+    S3_HLS_FMP4_End_Box(writer, box);
+}
+
+static void S3_HLS_FMP4_Put_Track(S3_HLS_FMP4_WRITER* writer, S3_HLS_FMP4_INIT* init, uint32_t track_id) {
+    uint8_t is_video = S3_HLS_FMP4_VIDEO_TRACK_ID == track_id;
+    uint32_t box;
+
+    uint32_t trak = S3_HLS_FMP4_Start_Box(writer, "trak");
+
+    box = S3_HLS_FMP4_Start_Full_Box(writer, "tkhd", 0, 0x03); // enabled, in movie
+    S3_HLS_FMP4_Put_Zero(writer, 8);            // creation and modification time
+    S3_HLS_FMP4_Put_32(writer, track_id);
+    S3_HLS_FMP4_Put_Zero(writer, 4 + 4 + 8);    // reserved, duration, reserved
+    S3_HLS_FMP4_Put_16(writer, 0);              // layer
+    S3_HLS_FMP4_Put_16(writer, 0);              // alternate_group
+    S3_HLS_FMP4_Put_16(writer, is_video ? 0 : 0x0100); // volume
+    S3_HLS_FMP4_Put_16(writer, 0);
+    S3_HLS_FMP4_Put_Matrix(writer);
+    S3_HLS_FMP4_Put_32(writer, is_video ? init->video_info->width << 16 : 0); // width and height in 16.16 fixed point
+    S3_HLS_FMP4_Put_32(writer, is_video ? init->video_info->height << 16 : 0);
+    S3_HLS_FMP4_End_Box(writer, box);
+
+    uint32_t mdia = S3_HLS_FMP4_Start_Box(writer, "mdia");
+
+    box = S3_HLS_FMP4_Start_Full_Box(writer, "mdhd", 0, 0);
+    S3_HLS_FMP4_Put_Zero(writer, 8);
+    S3_HLS_FMP4_Put_32(writer, is_video ? S3_HLS_FMP4_VIDEO_TIMESCALE : init->audio_sample_rate);
+    S3_HLS_FMP4_Put_32(writer, 0);              // duration
+    S3_HLS_FMP4_Put_16(writer, 0x55C4);         // language "und"
+    S3_HLS_FMP4_Put_16(writer, 0);
+    S3_HLS_FMP4_End_Box(writer, box);
+
+    box = S3_HLS_FMP4_Start_Full_Box(writer, "hdlr", 0, 0);
+    S3_HLS_FMP4_Put_32(writer, 0);
+    S3_HLS_FMP4_Put_Bytes(writer, (const uint8_t*)(is_video ? "vide" : "soun"), 4);
+    S3_HLS_FMP4_Put_Zero(writer, 12);
+    S3_HLS_FMP4_Put_Bytes(writer, (const uint8_t*)(is_video ? "VideoHandler" : "SoundHandler"), 13); // with terminating zero
+    S3_HLS_FMP4_End_Box(writer, box);
+
+    uint32_t minf = S3_HLS_FMP4_Start_Box(writer, "minf");
+
+    if(is_video) {
+        box = S3_HLS_FMP4_Start_Full_Box(writer, "vmhd", 0, 1);
+        S3_HLS_FMP4_Put_Zero(writer, 8);
+    } else {
+        box = S3_HLS_FMP4_Start_Full_Box(writer, "smhd", 0, 0);
+        S3_HLS_FMP4_Put_Zero(writer, 4);
+    }
+    S3_HLS_FMP4_End_Box(writer, box);
+
+    uint32_t dinf = S3_HLS_FMP4_Start_Box(writer, "dinf");
+    uint32_t dref = S3_HLS_FMP4_Start_Full_Box(writer, "dref", 0, 0);
+    S3_HLS_FMP4_Put_32(writer, 1);
+    box = S3_HLS_FMP4_Start_Full_Box(writer, "url ", 0, 1); // media in same file
+    S3_HLS_FMP4_End_Box(writer, box);
+    S3_HLS_FMP4_End_Box(writer, dref);
+    S3_HLS_FMP4_End_Box(writer, dinf);
+
+    uint32_t stbl = S3_HLS_FMP4_Start_Box(writer, "stbl");
+
+    uint32_t stsd = S3_HLS_FMP4_Start_Full_Box(writer, "stsd", 0, 0);
+    S3_HLS_FMP4_Put_32(writer, 1);
+    if(is_video)
+        S3_HLS_FMP4_Put_Video_Entry(writer, init);
+    else
+        S3_HLS_FMP4_Put_Audio_Entry(writer, init);
+    S3_HLS_FMP4_End_Box(writer, stsd);
+
+    // samples are described by fragments
+    box = S3_HLS_FMP4_Start_Full_Box(writer, "stts", 0, 0);
+    S3_HLS_FMP4_Put_32(writer, 0);
+    S3_HLS_FMP4_End_Box(writer, box);
+
+    box = S3_HLS_FMP4_Start_Full_Box(writer, "stsc", 0, 0);
+    S3_HLS_FMP4_Put_32(writer, 0);
+    S3_HLS_FMP4_End_Box(writer, box);
+
+    box = S3_HLS_FMP4_Start_Full_Box(writer, "stsz", 0, 0);
+    S3_HLS_FMP4_Put_32(writer, 0);
+    S3_HLS_FMP4_Put_32(writer, 0);
+    S3_HLS_FMP4_End_Box(writer, box);
+
+    box = S3_HLS_FMP4_Start_Full_Box(writer, "stco", 0, 0);
+    S3_HLS_FMP4_Put_32(writer, 0);
+    S3_HLS_FMP4_End_Box(writer, box);
+
+    S3_HLS_FMP4_End_Box(writer, stbl);
+    S3_HLS_FMP4_End_Box(writer, minf);
+    S3_HLS_FMP4_End_Box(writer, mdia);
+    S3_HLS_FMP4_End_Box(writer, trak);
+}
+
+static void S3_HLS_FMP4_Put_Trex(S3_HLS_FMP4_WRITER* writer, uint32_t track_id) {
+    uint32_t box = S3_HLS_FMP4_Start_Full_Box(writer, "trex", 0, 0);
+    S3_HLS_FMP4_Put_32(writer, track_id);
+    S3_HLS_FMP4_Put_32(writer, 1);              // default_sample_description_index
+    S3_HLS_FMP4_Put_Zero(writer, 12);           // duration, size and flags are set by each fragment
+    S3_HLS_FMP4_End_Box(writer, box);
+}
+
+int32_t S3_HLS_FMP4_Write_Init(S3_HLS_BUFFER_CTX* ctx, S3_HLS_FMP4_INIT* init) {
+    if(NULL == ctx || NULL == init || NULL == init->sps || 4 > init->sps_length || NULL == init->pps || 0 == init->pps_length || NULL == init->video_info)
+        return S3_HLS_INVALID_PARAMETER;
+
+    if(S3_HLS_VIDEO_CODEC_H265 == init->video_codec && (NULL == init->vps || 0 == init->vps_length))
+        return S3_HLS_INVALID_PARAMETER;
+
+    if(init->has_audio && 0 == init->audio_sample_rate)
+        return S3_HLS_INVALID_PARAMETER;
+
+    uint8_t data[S3_HLS_FMP4_MAX_INIT_SIZE];
+    S3_HLS_FMP4_WRITER writer = { data, sizeof(data), 0, 0 };
+    uint32_t box;
+
+    box = S3_HLS_FMP4_Start_Box(&writer, "ftyp");
+    S3_HLS_FMP4_Put_Bytes(&writer, (const uint8_t*)"iso6", 4); // major brand
+    S3_HLS_FMP4_Put_32(&writer, 0);
+    S3_HLS_FMP4_Put_Bytes(&writer, (const uint8_t*)"iso6cmfcmp41", 12); // compatible brands
+    S3_HLS_FMP4_End_Box(&writer, box);
+
+    uint32_t moov = S3_HLS_FMP4_Start_Box(&writer, "moov");
+
+    box = S3_HLS_FMP4_Start_Full_Box(&writer, "mvhd", 0, 0);
+    S3_HLS_FMP4_Put_Zero(&writer, 8);           // creation and modification time
+    S3_HLS_FMP4_Put_32(&writer, S3_HLS_FMP4_MOVIE_TIMESCALE);
+    S3_HLS_FMP4_Put_32(&writer, 0);             // duration
+    S3_HLS_FMP4_Put_32(&writer, 0x00010000);    // rate 1.0
+    S3_HLS_FMP4_Put_16(&writer, 0x0100);        // volume 1.0
+    S3_HLS_FMP4_Put_Zero(&writer, 10);
+    S3_HLS_FMP4_Put_Matrix(&writer);
+    S3_HLS_FMP4_Put_Zero(&writer, 24);          // pre_defined
+    S3_HLS_FMP4_Put_32(&writer, (init->has_audio ? S3_HLS_FMP4_AUDIO_TRACK_ID : S3_HLS_FMP4_VIDEO_TRACK_ID) + 1);
+    S3_HLS_FMP4_End_Box(&writer, box);
+
+    S3_HLS_FMP4_Put_Track(&writer, init, S3_HLS_FMP4_VIDEO_TRACK_ID);
+    if(init->has_audio)
+        S3_HLS_FMP4_Put_Track(&writer, init, S3_HLS_FMP4_AUDIO_TRACK_ID);
+
+    uint32_t mvex = S3_HLS_FMP4_Start_Box(&writer, "mvex");
+    S3_HLS_FMP4_Put_Trex(&writer, S3_HLS_FMP4_VIDEO_TRACK_ID);
+    if(init->has_audio)
+        S3_HLS_FMP4_Put_Trex(&writer, S3_HLS_FMP4_AUDIO_TRACK_ID);
+    S3_HLS_FMP4_End_Box(&writer, mvex);
+
+    S3_HLS_FMP4_End_Box(&writer, moov);
+
+    if(writer.overflow) {
+        FMP4_DEBUG("[FMP4] Init segment too large!\n");
+        return S3_HLS_INVALID_PARAMETER;
+    }
+
+    FMP4_DEBUG("[FMP4] Init segment %d bytes\n", writer.pos);
+    return S3_HLS_Put_To_Buffer(ctx, data, writer.pos);
+}
+
+/*
+ * Build moof and mdat header, sample data follows
+ */
+static uint32_t S3_HLS_FMP4_Build_Header(uint8_t* data, S3_HLS_FMP4_FRAGMENT* fragment, uint32_t payload_length) {
+    S3_HLS_FMP4_WRITER writer = { data, S3_HLS_FMP4_MAX_HEADER_SIZE, 0, 0 };
+    uint8_t is_video = S3_HLS_FMP4_VIDEO_TRACK_ID == fragment->track_id;
+    uint32_t box;
+
+    uint32_t trun_flags = S3_HLS_FMP4_TRUN_DATA_OFFSET | S3_HLS_FMP4_TRUN_SAMPLE_SIZE;
+    if(is_video && fragment->random_access)
+        trun_flags |= S3_HLS_FMP4_TRUN_FIRST_FLAGS;
+    if(is_video && 0 != fragment->composition_offset)
+        trun_flags |= S3_HLS_FMP4_TRUN_COMPOSITION;
+
+    uint32_t moof = S3_HLS_FMP4_Start_Box(&writer, "moof");
+
+    box = S3_HLS_FMP4_Start_Full_Box(&writer, "mfhd", 0, 0);
+    S3_HLS_FMP4_Put_32(&writer, fragment->sequence);
+    S3_HLS_FMP4_End_Box(&writer, box);
+
+    uint32_t traf = S3_HLS_FMP4_Start_Box(&writer, "traf");
+
+    box = S3_HLS_FMP4_Start_Full_Box(&writer, "tfhd", 0, S3_HLS_FMP4_TFHD_FLAGS);
+    S3_HLS_FMP4_Put_32(&writer, fragment->track_id);
+    S3_HLS_FMP4_Put_32(&writer, fragment->sample_duration);
+    S3_HLS_FMP4_Put_32(&writer, is_video ? S3_HLS_FMP4_NON_SYNC_SAMPLE_FLAGS : S3_HLS_FMP4_SYNC_SAMPLE_FLAGS);
+    S3_HLS_FMP4_End_Box(&writer, box);
+
+    box = S3_HLS_FMP4_Start_Full_Box(&writer, "tfdt", 1, 0);
+    S3_HLS_FMP4_Put_64(&writer, fragment->base_decode_time);
+    S3_HLS_FMP4_End_Box(&writer, box);
+
+    box = S3_HLS_FMP4_Start_Full_Box(&writer, "trun", 0, trun_flags);
+    S3_HLS_FMP4_Put_32(&writer, fragment->sample_count);
+    uint32_t data_offset_pos = writer.pos;
+    S3_HLS_FMP4_Put_32(&writer, 0);             // filled once moof size is known
+    if(trun_flags & S3_HLS_FMP4_TRUN_FIRST_FLAGS)
+        S3_HLS_FMP4_Put_32(&writer, S3_HLS_FMP4_SYNC_SAMPLE_FLAGS);
+
+    for(uint32_t cnt = 0; cnt < fragment->sample_count; cnt++) {
+        S3_HLS_FMP4_Put_32(&writer, fragment->sample_sizes[cnt]);
+        if(trun_flags & S3_HLS_FMP4_TRUN_COMPOSITION)
+            S3_HLS_FMP4_Put_32(&writer, fragment->composition_offset);
+    }
+    S3_HLS_FMP4_End_Box(&writer, box);
+
+    S3_HLS_FMP4_End_Box(&writer, traf);
+    S3_HLS_FMP4_End_Box(&writer, moof);
+
+    // data starts after mdat header, offset is relative to moof
+    uint32_t data_offset = writer.pos + S3_HLS_FMP4_BOX_HEADER_SIZE;
+    uint32_t pos = writer.pos;
+    writer.pos = data_offset_pos;
+    S3_HLS_FMP4_Put_32(&writer, data_offset);
+    writer.pos = pos;
+
+    S3_HLS_FMP4_Put_32(&writer, S3_HLS_FMP4_BOX_HEADER_SIZE + payload_length);
+    S3_HLS_FMP4_Put_Bytes(&writer, (const uint8_t*)"mdat", 4);
+
+    return writer.pos;
+}
+
+/*
+ * Copy length bytes to reserved span at offset, span may wrap around buffer end
+ */
+static void S3_HLS_FMP4_Copy_To_Span(S3_HLS_BUFFER_SPAN* span, uint32_t* offset, const uint8_t* data, uint32_t length) {
+    if(*offset < span->first_part_length) {
+        uint32_t first_length = span->first_part_length - *offset;
+        if(first_length > length)
+            first_length = length;
+
+        memcpy(span->first_part_start + *offset, data, first_length);
+        *offset += first_length;
+        data += first_length;
+        length -= first_length;
+    }
+
+    if(0 < length) {
+        memcpy(span->second_part_start + *offset - span->first_part_length, data, length);
+        *offset += length;
+    }
+}
+
+/*
+ * Put bytes of item starting at skip, either copied to span or referenced
+ */
+static int32_t S3_HLS_FMP4_Put_Item(S3_HLS_BUFFER_CTX* ctx, S3_HLS_BUFFER_SPAN* span, uint32_t* offset, S3_HLS_FRAME_ITEM* item, uint32_t skip) {
+    uint8_t* parts[2] = { item->first_part_start, item->second_part_start };
+    uint32_t lengths[2] = { item->first_part_length, item->second_part_length };
+
+    for(uint32_t part = 0; part < 2; part++) {
+        if(skip >= lengths[part]) {
+            skip -= lengths[part];
+            continue;
+        }
+
+        if(NULL != span) {
+            S3_HLS_FMP4_Copy_To_Span(span, offset, parts[part] + skip, lengths[part] - skip);
+        } else {
+            int32_t ret = S3_HLS_Put_Ref_To_Buffer(ctx, parts[part] + skip, lengths[part] - skip);
+            if(0 > ret)
+                return ret;
+        }
+
+        skip = 0;
+    }
+
+    return S3_HLS_OK;
+}
+
+int32_t S3_HLS_FMP4_Write_Fragment(S3_HLS_BUFFER_CTX* ctx, S3_HLS_FMP4_FRAGMENT* fragment, uint8_t by_reference, uint32_t* header_length) {
+    if(NULL == ctx || NULL == fragment || 0 == fragment->sample_count || S3_HLS_FMP4_MAX_SAMPLES < fragment->sample_count)
+        return S3_HLS_INVALID_PARAMETER;
+
+    uint8_t is_video = S3_HLS_FMP4_VIDEO_TRACK_ID == fragment->track_id;
+
+    uint32_t payload_length = 0;
+    for(uint32_t cnt = 0; cnt < fragment->sample_count; cnt++)
+        payload_length += fragment->sample_sizes[cnt];
+
+    uint8_t header[S3_HLS_FMP4_MAX_HEADER_SIZE];
+    uint32_t length = S3_HLS_FMP4_Build_Header(header, fragment, payload_length);
+
+    S3_HLS_BUFFER_SPAN span;
+    S3_HLS_BUFFER_SPAN* copy_span = NULL;
+    uint32_t offset = 0;
+    int32_t ret;
+
+    if(by_reference) {
+        ret = S3_HLS_Put_To_Buffer(ctx, header, length);
+    } else { // reserve whole fragment once and fill it in place
+        ret = S3_HLS_Reserve_Buffer(ctx, length + payload_length, &span);
+        if(0 <= ret) {
+            copy_span = &span;
+            S3_HLS_FMP4_Copy_To_Span(copy_span, &offset, header, length);
+        }
+    }
+
+    if(0 > ret)
+        return ret;
+
+    for(uint32_t cnt = 0; cnt < fragment->item_count; cnt++) {
+        S3_HLS_FRAME_ITEM* item = &fragment->items[cnt];
+        uint32_t skip = 0;
+
+        if(is_video) { // start code to NALU length
+            skip = S3_HLS_Nalu_Start_Code_Length(item, fragment->length_prefixed);
+            uint32_t nalu_length = item->first_part_length + item->second_part_length - skip;
+            uint8_t prefix[S3_HLS_FMP4_NALU_LENGTH_SIZE] = { nalu_length >> 24, (nalu_length >> 16) & 0xFF, (nalu_length >> 8) & 0xFF, nalu_length & 0xFF };
+
+            if(NULL != copy_span) {
+                S3_HLS_FMP4_Copy_To_Span(copy_span, &offset, prefix, sizeof(prefix));
+            } else {
+                ret = S3_HLS_Put_To_Buffer(ctx, prefix, sizeof(prefix));
+                if(0 > ret)
+                    return ret;
+            }
+        }
+
+        ret = S3_HLS_FMP4_Put_Item(ctx, copy_span, &offset, item, skip);
+        if(0 > ret)
+            return ret;
+    }
+
+    if(NULL != copy_span)
+        S3_HLS_Commit_Buffer(ctx, length + payload_length);
+
+    if(NULL != header_length)
+        *header_length = length;
+
+    return length + payload_length;
+}
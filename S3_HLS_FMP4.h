@@ -0,0 +1,101 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT-0
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __S3_HLS_FMP4_H__
+#define __S3_HLS_FMP4_H__
+
+#include "stdint.h"
+
+#include "S3_HLS_SDK.h"
+#include "S3_HLS_Buffer_Mgr.h"
+
+#ifdef __cplusplus
+#if __cplusplus
+extern "C" {
+#endif
+#endif /* End of #ifdef __cplusplus */
+
+#define S3_HLS_FMP4_VIDEO_TRACK_ID          1
+#define S3_HLS_FMP4_AUDIO_TRACK_ID          2
+
+#define S3_HLS_FMP4_VIDEO_TIMESCALE         90000
+#define S3_HLS_FMP4_AAC_FRAME_SAMPLES       1024    // duration of an AAC frame in audio timescale
+
+#define S3_HLS_FMP4_MAX_SAMPLES             64      // samples in one fragment
+
+/*
+ * Everything the init segment describes, parameter sets are NALUs without start code
+ */
+typedef struct s3_hls_fmp4_init_s {
+    S3_HLS_VIDEO_CODEC video_codec;
+    uint8_t* vps;                   // H265 only
+    uint32_t vps_length;
+    uint8_t* sps;
+    uint32_t sps_length;
+    uint8_t* pps;
+    uint32_t pps_length;
+    S3_HLS_VIDEO_INFO* video_info;  // parsed from sps, gives picture size, chroma format and bit depth
+
+    uint8_t has_audio;
+    uint8_t audio_config[2];        // AAC AudioSpecificConfig
+    uint32_t audio_sample_rate;     // also timescale of audio track
+    uint32_t audio_channels;
+} S3_HLS_FMP4_INIT;
+
+/*
+ * One moof / mdat pair of a single track
+ * Video fragment has one sample made of all frame items, start code (3 or 4 bytes) of each item is replaced by 4 bytes length
+ * Audio fragment has one sample per entry of sample_sizes, items are copied as they are
+ */
+typedef struct s3_hls_fmp4_fragment_s {
+    uint32_t track_id;
+    uint32_t sequence;                  // mfhd sequence number, counted by muxer
+    uint64_t base_decode_time;          // in track timescale
+    uint32_t sample_duration;           // every sample of fragment
+    uint32_t composition_offset;        // PTS - DTS of video sample
+    uint8_t random_access;              // video sample is a sync sample
+
+    uint32_t sample_count;
+    uint32_t sample_sizes[S3_HLS_FMP4_MAX_SAMPLES];
+
+    S3_HLS_FRAME_ITEM* items;
+    uint32_t item_count;
+    uint8_t length_prefixed;            // video items start with NALU length instead of start code
+} S3_HLS_FMP4_FRAGMENT;
+
+/*
+ * Write ftyp and moov describing video track and optional AAC track
+ * Returns number of bytes written
+ */
+int32_t S3_HLS_FMP4_Write_Init(S3_HLS_BUFFER_CTX* ctx, S3_HLS_FMP4_INIT* init);
+
+/*
+ * Write moof and mdat of fragment
+ * When not by reference, items are copied, otherwise only boxes and NALU lengths are copied and items are referenced
+ * Partially written fragment should be rolled back by caller
+ * Returns number of bytes written, header_length is set to bytes of boxes
+ */
+int32_t S3_HLS_FMP4_Write_Fragment(S3_HLS_BUFFER_CTX* ctx, S3_HLS_FMP4_FRAGMENT* fragment, uint8_t by_reference, uint32_t* header_length);
+
+#ifdef __cplusplus
+#if __cplusplus
+}
+#endif
+#endif /* End of #ifdef __cplusplus */
+
+#endif
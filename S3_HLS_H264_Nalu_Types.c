@@ -22,40 +22,84 @@
 
 #define S3_HLS_NALU_BYTE_POS                5
 #define S3_HLS_H264_NALU_BITS               0x1F
+#define S3_HLS_H264_NALU_REF_IDC_BITS       0x60
 
 const uint8_t h264_start_code[4] = { 0x00, 0x00, 0x00, 0x01 };
 
-S3_HLS_H264E_NALU_TYPE_E S3_HLS_H264_Nalu_Type(S3_HLS_FRAME_ITEM* item) {
+/*
+ * Byte at pos of item that is split into two parts, pos must be within item
+ */
+static uint8_t S3_HLS_Nalu_Byte(S3_HLS_FRAME_ITEM* item, uint32_t pos) {
+    return pos < item->first_part_length ? item->first_part_start[pos] : item->second_part_start[pos - item->first_part_length];
+}
+
+/*
+ * Length prefix must cover the rest of the item, one NALU per item as with start codes
+ */
+static int32_t S3_HLS_Nalu_Header_Length_Prefixed(S3_HLS_FRAME_ITEM* item) {
+    if(S3_HLS_NALU_BYTE_POS > item->first_part_length + item->second_part_length)
+        return -1;
+
+    uint32_t nalu_length = 0;
+    for(uint32_t i = 0; i < sizeof(h264_start_code); i++)
+        nalu_length = (nalu_length << 8) | S3_HLS_Nalu_Byte(item, i);
+
+    if(nalu_length != item->first_part_length + item->second_part_length - sizeof(h264_start_code))
+        return -1;
+
+    return S3_HLS_Nalu_Byte(item, S3_HLS_NALU_BYTE_POS - 1);
+}
+
+uint32_t S3_HLS_Nalu_Start_Code_Length(S3_HLS_FRAME_ITEM* item, uint8_t length_prefixed) {
+    if(length_prefixed)
+        return sizeof(h264_start_code);
+
+    if(NULL == item->second_part_start && 0 != item->second_part_length)
+        return 0;
+
+    uint32_t length = item->first_part_length + item->second_part_length;
+    uint32_t zeros = 0;
+
+    // 00 00 01 or 00 00 00 01
+    while(zeros < sizeof(h264_start_code) - 1 && zeros < length && 0 == S3_HLS_Nalu_Byte(item, zeros))
+        zeros++;
+
+    if(2 > zeros || zeros >= length || 0x01 != S3_HLS_Nalu_Byte(item, zeros))
+        return 0;
+
+    return zeros + 1;
+}
+
+int32_t S3_HLS_Nalu_Header(S3_HLS_FRAME_ITEM* item, uint8_t length_prefixed) {
     if(NULL == item->second_part_start && 0 != item->second_part_length) {
-        return S3_HLS_H264E_NALU_UNSPECIFIED;
+        return -1;
     }
 
-    if(S3_HLS_NALU_BYTE_POS > item->first_part_length + item->second_part_length) {
-        return S3_HLS_H264E_NALU_UNSPECIFIED;
-    }
-    
-    int i = 0;
-    while(i < item->first_part_length && i < S3_HLS_NALU_BYTE_POS - 1) {
-        if(h264_start_code[i] != item->first_part_start[i]) {
-            return S3_HLS_H264E_NALU_UNSPECIFIED;
-        }
-        
-        i++;
-    }
-    
-    while(i < S3_HLS_NALU_BYTE_POS - 1) {
-        // only enter this piece of code when first part length is not enought for finding the nalu byte
-        if(h264_start_code[i] != item->second_part_start[i - item->first_part_length]){
-            return S3_HLS_H264E_NALU_UNSPECIFIED;
-        }
-        
-        i++;
+    if(length_prefixed)
+        return S3_HLS_Nalu_Header_Length_Prefixed(item);
+
+    uint32_t start_code_length = S3_HLS_Nalu_Start_Code_Length(item, 0);
+    if(0 == start_code_length || start_code_length >= item->first_part_length + item->second_part_length) {
+        return -1;
     }
-    
-    if(i > item->first_part_length) {
-        return item->second_part_start[i - item->first_part_length] & S3_HLS_H264_NALU_BITS;
-    } else {
-        return item->first_part_start[i] & S3_HLS_H264_NALU_BITS;
+
+    return S3_HLS_Nalu_Byte(item, start_code_length);
+}
+
+S3_HLS_H264E_NALU_TYPE_E S3_HLS_H264_Nalu_Type(S3_HLS_FRAME_ITEM* item, uint8_t length_prefixed) {
+    int32_t header = S3_HLS_Nalu_Header(item, length_prefixed);
+    if(0 > header) {
+        return S3_HLS_H264E_NALU_UNSPECIFIED;
     }
+
+    return header & S3_HLS_H264_NALU_BITS;
 }
 
+int32_t S3_HLS_H264_Nalu_Ref_Idc(S3_HLS_FRAME_ITEM* item, uint8_t length_prefixed) {
+    int32_t header = S3_HLS_Nalu_Header(item, length_prefixed);
+    if(0 > header) {
+        return -1;
+    }
+
+    return (header & S3_HLS_H264_NALU_REF_IDC_BITS) >> 5;
+}
@@ -44,7 +44,26 @@ typedef enum {
     S3_HLS_H264E_NALU_FILLER = 12
 } S3_HLS_H264E_NALU_TYPE_E;
 
-S3_HLS_H264E_NALU_TYPE_E S3_HLS_H264_Nalu_Type(S3_HLS_FRAME_ITEM* item);
+/*
+ * Find NALU header byte after 3 or 4 bytes start code, first byte of the 2 bytes header for H.265
+ * Return -1 if item does not start with start code, or with its own length when items are length prefixed
+ * Length prefixed items start with 4 bytes big endian NALU length (AVCC / HVCC) instead of start code
+ */
+int32_t S3_HLS_Nalu_Header(S3_HLS_FRAME_ITEM* item, uint8_t length_prefixed);
+
+/*
+ * Length of start code (3 or 4 bytes) or length prefix (4 bytes) in front of NALU header
+ * Return 0 if item does not start with start code
+ */
+uint32_t S3_HLS_Nalu_Start_Code_Length(S3_HLS_FRAME_ITEM* item, uint8_t length_prefixed);
+
+S3_HLS_H264E_NALU_TYPE_E S3_HLS_H264_Nalu_Type(S3_HLS_FRAME_ITEM* item, uint8_t length_prefixed);
+
+/*
+ * Return nal_ref_idc of the NALU, 0 means no other frame references it
+ * Return -1 if item does not start with start code
+ */
+int32_t S3_HLS_H264_Nalu_Ref_Idc(S3_HLS_FRAME_ITEM* item, uint8_t length_prefixed);
 
 #ifdef __cplusplus
 #if __cplusplus
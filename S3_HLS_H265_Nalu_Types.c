@@ -0,0 +1,50 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT-0
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "stdlib.h"
+
+#include "S3_HLS_H264_Nalu_Types.h"
+#include "S3_HLS_H265_Nalu_Types.h"
+
+#define S3_HLS_H265_NALU_BITS               0x7E    // forbidden_zero_bit, 6 bits nal_unit_type, first bit of nuh_layer_id
+#define S3_HLS_H265_NALU_SHIFT              1
+#define S3_HLS_H265_MAX_SUB_LAYER_NON_REF   14      // even types up to this are sub-layer non-reference pictures
+
+S3_HLS_H265E_NALU_TYPE_E S3_HLS_H265_Nalu_Type(S3_HLS_FRAME_ITEM* item, uint8_t length_prefixed) {
+    int32_t header = S3_HLS_Nalu_Header(item, length_prefixed);
+    if(0 > header) {
+        return S3_HLS_H265E_NALU_UNSPECIFIED;
+    }
+
+    return (header & S3_HLS_H265_NALU_BITS) >> S3_HLS_H265_NALU_SHIFT;
+}
+
+uint8_t S3_HLS_H265_Is_Random_Access(S3_HLS_H265E_NALU_TYPE_E type) {
+    return S3_HLS_H265E_NALU_BLA_W_LP <= type && S3_HLS_H265E_NALU_CRA >= type;
+}
+
+int32_t S3_HLS_H265_Nalu_Is_Reference(S3_HLS_FRAME_ITEM* item, uint8_t length_prefixed) {
+    int32_t header = S3_HLS_Nalu_Header(item, length_prefixed);
+    if(0 > header) {
+        return -1;
+    }
+
+    uint32_t type = (header & S3_HLS_H265_NALU_BITS) >> S3_HLS_H265_NALU_SHIFT;
+
+    return !(S3_HLS_H265_MAX_SUB_LAYER_NON_REF >= type && 0 == (type & 0x01));
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT-0
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __S3_HLS_H265_NALU_TYPES_H__
+#define __S3_HLS_H265_NALU_TYPES_H__
+
+#include "stdint.h"
+#include "S3_HLS_SDK.h"
+
+#ifdef __cplusplus
+#if __cplusplus
+extern "C" {
+#endif
+#endif /* End of #ifdef __cplusplus */
+
+typedef enum {
+    S3_HLS_H265E_NALU_TRAIL_N = 0,
+    S3_HLS_H265E_NALU_TRAIL_R = 1,
+    S3_HLS_H265E_NALU_TSA_N = 2,
+    S3_HLS_H265E_NALU_TSA_R = 3,
+    S3_HLS_H265E_NALU_STSA_N = 4,
+    S3_HLS_H265E_NALU_STSA_R = 5,
+    S3_HLS_H265E_NALU_RADL_N = 6,
+    S3_HLS_H265E_NALU_RADL_R = 7,
+    S3_HLS_H265E_NALU_RASL_N = 8,
+    S3_HLS_H265E_NALU_RASL_R = 9,
+    S3_HLS_H265E_NALU_BLA_W_LP = 16,
+    S3_HLS_H265E_NALU_BLA_W_RADL = 17,
+    S3_HLS_H265E_NALU_BLA_N_LP = 18,
+    S3_HLS_H265E_NALU_IDR_W_RADL = 19,
+    S3_HLS_H265E_NALU_IDR_N_LP = 20,
+    S3_HLS_H265E_NALU_CRA = 21,
+    S3_HLS_H265E_NALU_VPS = 32,
+    S3_HLS_H265E_NALU_SPS = 33,
+    S3_HLS_H265E_NALU_PPS = 34,
+    S3_HLS_H265E_NALU_AUD = 35, // Access Unit Delimeter
+    S3_HLS_H265E_NALU_END_SEQ = 36,
+    S3_HLS_H265E_NALU_END_STREAM = 37,
+    S3_HLS_H265E_NALU_FILLER = 38,
+    S3_HLS_H265E_NALU_PREFIX_SEI = 39,
+    S3_HLS_H265E_NALU_SUFFIX_SEI = 40,
+    S3_HLS_H265E_NALU_UNSPECIFIED = 48
+} S3_HLS_H265E_NALU_TYPE_E;
+
+/*
+ * Return 6 bits nal_unit_type of the NALU
+ * Return S3_HLS_H265E_NALU_UNSPECIFIED if item does not start with start code
+ */
+S3_HLS_H265E_NALU_TYPE_E S3_HLS_H265_Nalu_Type(S3_HLS_FRAME_ITEM* item, uint8_t length_prefixed);
+
+/*
+ * Return 1 for IRAP pictures (BLA, IDR and CRA), decoding can start from them
+ */
+uint8_t S3_HLS_H265_Is_Random_Access(S3_HLS_H265E_NALU_TYPE_E type);
+
+/*
+ * Return 0 for sub-layer non-reference pictures (TRAIL_N, TSA_N, ...), no other frame references them
+ * Return 1 for other NALUs, -1 if item does not start with start code
+ */
+int32_t S3_HLS_H265_Nalu_Is_Reference(S3_HLS_FRAME_ITEM* item, uint8_t length_prefixed);
+
+#ifdef __cplusplus
+#if __cplusplus
+}
+#endif
+#endif /* End of #ifdef __cplusplus */
+
+#endif
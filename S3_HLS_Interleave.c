@@ -0,0 +1,340 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT-0
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+
+#include "S3_HLS_Interleave.h"
+#include "S3_HLS_Pes.h"
+#include "S3_HLS_Memory.h"
+#include "S3_HLS_Return_Code.h"
+
+//#define S3_HLS_INTERLEAVE_DEBUG
+
+#ifdef S3_HLS_INTERLEAVE_DEBUG
+#define INTERLEAVE_DEBUG(x, ...) printf(x, ##__VA_ARGS__)
+#else
+#define INTERLEAVE_DEBUG(x, ...)
+#endif
+
+#define S3_HLS_INTERLEAVE_STREAMS_PER_PROGRAM   2       // video, audio
+
+/*
+ * Producers only move slot_write / stage_write under put_lock of their stream, merge stage only moves slot_read / stage_release
+ * under merge_lock. Both publish with release and load the other side with acquire, so producers of different streams
+ * never share a lock and a producer never waits for the merge stage.
+ * Whoever puts a frame runs the merge stage if merge_lock is free, frames put meanwhile are picked up by that run
+ * through merge_requests.
+ */
+
+static int64_t S3_HLS_Interleave_Now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+S3_HLS_INTERLEAVE_CTX* S3_HLS_Interleave_Initialize(S3_HLS_PES_CTX* pes_ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t program_count, uint32_t window_ms, uint32_t video_stage_size, uint32_t audio_stage_size) {
+    if(NULL == pes_ctx || NULL == buffer_ctx || 0 == program_count || S3_HLS_MAX_PROGRAMS < program_count || S3_HLS_INTERLEAVE_MAX_WINDOW < window_ms)
+        return NULL;
+
+    S3_HLS_INTERLEAVE_CTX* ctx = (S3_HLS_INTERLEAVE_CTX*)S3_HLS_Calloc(1, sizeof(S3_HLS_INTERLEAVE_CTX));
+    if(NULL == ctx) {
+        INTERLEAVE_DEBUG("Failed to allocate interleave context!\n");
+        return NULL;
+    }
+
+    ctx->pes_ctx = pes_ctx;
+    ctx->buffer_ctx = buffer_ctx;
+    ctx->window_ms = window_ms;
+    ctx->stream_count = program_count * S3_HLS_INTERLEAVE_STREAMS_PER_PROGRAM;
+
+    ctx->streams = (S3_HLS_INTERLEAVE_STREAM*)S3_HLS_Calloc(ctx->stream_count, sizeof(S3_HLS_INTERLEAVE_STREAM));
+    if(NULL == ctx->streams) {
+        INTERLEAVE_DEBUG("Failed to allocate staging queues!\n");
+        goto l_free_ctx;
+    }
+
+    uint32_t stream_index;
+    for(stream_index = 0; stream_index < ctx->stream_count; stream_index++) {
+        S3_HLS_INTERLEAVE_STREAM* stream = &ctx->streams[stream_index];
+        stream->stage_size = stream_index % S3_HLS_INTERLEAVE_STREAMS_PER_PROGRAM ? audio_stage_size : video_stage_size;
+        if(0 < stream->stage_size) {
+            stream->stage = (uint8_t*)S3_HLS_Malloc(stream->stage_size);
+            if(NULL == stream->stage) {
+                INTERLEAVE_DEBUG("Failed to allocate stage of %u bytes!\n", stream->stage_size);
+                goto l_free_streams;
+            }
+        }
+
+        if(0 != pthread_mutex_init(&stream->put_lock, NULL)) {
+            S3_HLS_Free(stream->stage);
+            goto l_free_streams;
+        }
+    }
+
+    if(0 != pthread_mutex_init(&ctx->merge_lock, NULL))
+        goto l_free_streams;
+
+    return ctx;
+
+l_free_streams:
+    while(stream_index > 0) {
+        stream_index--;
+        pthread_mutex_destroy(&ctx->streams[stream_index].put_lock);
+        S3_HLS_Free(ctx->streams[stream_index].stage);
+    }
+
+    S3_HLS_Free(ctx->streams);
+
+l_free_ctx:
+    S3_HLS_Free(ctx);
+
+    return NULL;
+}
+
+void S3_HLS_Interleave_Finalize(S3_HLS_INTERLEAVE_CTX* ctx) {
+    if(NULL == ctx)
+        return;
+
+    for(uint32_t stream_index = 0; stream_index < ctx->stream_count; stream_index++) {
+        pthread_mutex_destroy(&ctx->streams[stream_index].put_lock);
+        S3_HLS_Free(ctx->streams[stream_index].stage);
+    }
+
+    pthread_mutex_destroy(&ctx->merge_lock);
+    S3_HLS_Free(ctx->streams);
+    S3_HLS_Free(ctx);
+}
+
+/*
+ * Copy item to stage at stage_index, item in stage has a second part when it crosses stage end
+ */
+static void S3_HLS_Interleave_Copy_Item(S3_HLS_INTERLEAVE_STREAM* stream, S3_HLS_FRAME_ITEM* dest, S3_HLS_FRAME_ITEM* src) {
+    uint32_t length = src->first_part_length + src->second_part_length;
+    uint32_t to_end = stream->stage_size - stream->stage_index;
+
+    *dest = *src;
+    dest->first_part_start = stream->stage + stream->stage_index;
+    dest->first_part_length = length < to_end ? length : to_end;
+    dest->second_part_start = length > to_end ? stream->stage : NULL;
+    dest->second_part_length = length > to_end ? length - to_end : 0;
+
+    uint8_t* parts[2] = { src->first_part_start, src->second_part_start };
+    uint32_t part_lengths[2] = { src->first_part_length, src->second_part_length };
+    for(uint32_t part = 0; part < 2; part++) {
+        uint8_t* data = parts[part];
+        uint32_t remain = part_lengths[part];
+        while(0 < remain) {
+            uint32_t room = stream->stage_size - stream->stage_index;
+            uint32_t copy = remain < room ? remain : room;
+            memcpy(stream->stage + stream->stage_index, data, copy);
+            data += copy;
+            remain -= copy;
+            stream->stage_index = copy == room ? 0 : stream->stage_index + copy;
+        }
+    }
+}
+
+static void S3_HLS_Interleave_Write_Slot(S3_HLS_INTERLEAVE_CTX* ctx, uint32_t stream_index, S3_HLS_INTERLEAVE_SLOT* slot) {
+    uint32_t program = stream_index / S3_HLS_INTERLEAVE_STREAMS_PER_PROGRAM;
+    uint8_t is_audio = stream_index % S3_HLS_INTERLEAVE_STREAMS_PER_PROGRAM;
+    int32_t ret;
+
+    if(is_audio) {
+        ret = slot->by_reference ? S3_HLS_Pes_Write_Audio_Frame_Ref(ctx->pes_ctx, ctx->buffer_ctx, program, &slot->pack, slot->release, slot->user_data) : S3_HLS_Pes_Write_Audio_Frame(ctx->pes_ctx, ctx->buffer_ctx, program, &slot->pack);
+    } else {
+        ret = slot->by_reference ? S3_HLS_Pes_Write_Video_Frame_Ref(ctx->pes_ctx, ctx->buffer_ctx, program, &slot->pack, slot->release, slot->user_data) : S3_HLS_Pes_Write_Video_Frame(ctx->pes_ctx, ctx->buffer_ctx, program, &slot->pack);
+    }
+
+    if(0 > ret) {
+        INTERLEAVE_DEBUG("Failed to write staged frame of stream %u, %d!\n", stream_index, ret);
+    }
+}
+
+/*
+ * Write staged frames in DTS order, called with merge_lock held
+ * Frame with lowest DTS is written once every stream that may still put an earlier frame has a frame staged,
+ * or when waiting for them would exceed window in DTS or in time, or its stream is running out of room
+ * Video streams are waited for from the start, audio streams once they put a frame
+ */
+static void S3_HLS_Interleave_Merge_Locked(S3_HLS_INTERLEAVE_CTX* ctx, uint8_t flush) {
+    int64_t now = S3_HLS_Interleave_Now();
+    uint64_t window = (uint64_t)ctx->window_ms * 1000; // timestamps are in microseconds
+
+    while(1) {
+        S3_HLS_INTERLEAVE_SLOT* next = NULL;
+        uint32_t next_stream = 0;
+        uint8_t waiting = 0;
+        uint8_t crowded = 0;
+        uint64_t newest_dts = 0;
+
+        for(uint32_t stream_index = 0; stream_index < ctx->stream_count; stream_index++) {
+            S3_HLS_INTERLEAVE_STREAM* stream = &ctx->streams[stream_index];
+            uint32_t slot_write = __atomic_load_n(&stream->slot_write, __ATOMIC_ACQUIRE);
+            uint8_t is_audio = stream_index % S3_HLS_INTERLEAVE_STREAMS_PER_PROGRAM;
+            if(is_audio && !__atomic_load_n(&stream->active, __ATOMIC_ACQUIRE))
+                continue;
+
+            if(__atomic_load_n(&stream->active, __ATOMIC_ACQUIRE)) {
+                uint64_t last_dts = __atomic_load_n(&stream->last_dts, __ATOMIC_ACQUIRE);
+                if(last_dts > newest_dts)
+                    newest_dts = last_dts;
+            }
+
+            if(slot_write == stream->slot_read) {
+                waiting = 1;
+                continue;
+            }
+
+            uint32_t stage_used = __atomic_load_n(&stream->stage_write, __ATOMIC_ACQUIRE) - stream->stage_release;
+            if(S3_HLS_INTERLEAVE_SLOTS <= slot_write - stream->slot_read + 1 || stage_used > stream->stage_size / 2)
+                crowded = 1;
+
+            S3_HLS_INTERLEAVE_SLOT* slot = &stream->slots[stream->slot_read % S3_HLS_INTERLEAVE_SLOTS];
+            if(NULL == next || slot->dts < next->dts) {
+                next = slot;
+                next_stream = stream_index;
+            }
+        }
+
+        if(NULL == next)
+            break;
+
+        if(!flush && waiting && !crowded && next->dts + window > newest_dts && now - next->put_time < ctx->window_ms)
+            break;
+
+        S3_HLS_INTERLEAVE_STREAM* stream = &ctx->streams[next_stream];
+        S3_HLS_Interleave_Write_Slot(ctx, next_stream, next);
+
+        __atomic_store_n(&stream->stage_release, stream->stage_release + next->stage_length, __ATOMIC_RELEASE);
+        __atomic_store_n(&stream->slot_read, stream->slot_read + 1, __ATOMIC_RELEASE);
+    }
+}
+
+/*
+ * Run merge stage unless another thread runs it, in which case that thread sees merge_requests changed and runs it again
+ */
+static void S3_HLS_Interleave_Try_Merge(S3_HLS_INTERLEAVE_CTX* ctx) {
+    while(0 == pthread_mutex_trylock(&ctx->merge_lock)) {
+        uint32_t requests = __atomic_load_n(&ctx->merge_requests, __ATOMIC_SEQ_CST);
+        S3_HLS_Interleave_Merge_Locked(ctx, 0);
+        pthread_mutex_unlock(&ctx->merge_lock);
+
+        if(requests == __atomic_load_n(&ctx->merge_requests, __ATOMIC_SEQ_CST))
+            break;
+    }
+}
+
+int32_t S3_HLS_Interleave_Put(S3_HLS_INTERLEAVE_CTX* ctx, uint32_t program, uint8_t is_audio, S3_HLS_FRAME_PACK* pack, uint8_t by_reference, BUFFER_RELEASE_CALL_BACK release, void* user_data) {
+    int32_t ret = S3_HLS_OK;
+
+    if(NULL == ctx || NULL == pack || 0 == pack->item_count || S3_HLS_SIMPLE_PUT_MAX_FRAME_PER_PACK < pack->item_count || ctx->stream_count <= program * S3_HLS_INTERLEAVE_STREAMS_PER_PROGRAM) {
+        S3_HLS_Release_Ref_In_Buffer(NULL, 0, release, user_data);
+        return S3_HLS_INVALID_PARAMETER;
+    }
+
+    uint32_t length = 0;
+    for(uint32_t cnt = 0; cnt < pack->item_count; cnt++) {
+        S3_HLS_FRAME_ITEM* item = &pack->items[cnt];
+        if(NULL == item->first_part_start || (NULL == item->second_part_start && 0 != item->second_part_length)) {
+            S3_HLS_Release_Ref_In_Buffer(NULL, 0, release, user_data);
+            return S3_HLS_INVALID_PARAMETER;
+        }
+
+        length += item->first_part_length + item->second_part_length;
+    }
+
+    uint32_t stream_index = program * S3_HLS_INTERLEAVE_STREAMS_PER_PROGRAM + (is_audio ? 1 : 0);
+    S3_HLS_INTERLEAVE_STREAM* stream = &ctx->streams[stream_index];
+
+    if(0 != pthread_mutex_lock(&stream->put_lock)) {
+        S3_HLS_Release_Ref_In_Buffer(NULL, 0, release, user_data);
+        return S3_HLS_LOCK_FAILED;
+    }
+
+    uint32_t slot_read = __atomic_load_n(&stream->slot_read, __ATOMIC_ACQUIRE);
+    uint32_t stage_used = stream->stage_write - __atomic_load_n(&stream->stage_release, __ATOMIC_ACQUIRE);
+    if(S3_HLS_INTERLEAVE_SLOTS <= stream->slot_write - slot_read || (!by_reference && length > stream->stage_size - stage_used)) {
+        INTERLEAVE_DEBUG("Stream %u staging queue is full!\n", stream_index);
+        pthread_mutex_unlock(&stream->put_lock);
+        S3_HLS_Release_Ref_In_Buffer(NULL, 0, release, user_data);
+        ret = S3_HLS_BUFFER_OVERFLOW;
+        goto l_merge;
+    }
+
+    S3_HLS_INTERLEAVE_SLOT* slot = &stream->slots[stream->slot_write % S3_HLS_INTERLEAVE_SLOTS];
+    slot->dts = is_audio ? pack->items[0].timestamp : S3_HLS_Pes_Decode_Timestamp(ctx->pes_ctx, &pack->items[0]);
+    slot->put_time = S3_HLS_Interleave_Now();
+    slot->by_reference = by_reference;
+    slot->release = release;
+    slot->user_data = user_data;
+
+    if(by_reference) {
+        slot->pack = *pack;
+        slot->stage_length = 0;
+    } else {
+        slot->pack.item_count = pack->item_count;
+        for(uint32_t cnt = 0; cnt < pack->item_count; cnt++)
+            S3_HLS_Interleave_Copy_Item(stream, &slot->pack.items[cnt], &pack->items[cnt]);
+
+        slot->stage_length = length;
+        __atomic_store_n(&stream->stage_write, stream->stage_write + length, __ATOMIC_RELEASE);
+    }
+
+    __atomic_store_n(&stream->last_dts, slot->dts, __ATOMIC_RELEASE);
+    __atomic_store_n(&stream->active, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&stream->slot_write, stream->slot_write + 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&stream->put_lock);
+
+l_merge:
+    __atomic_add_fetch(&ctx->merge_requests, 1, __ATOMIC_SEQ_CST);
+    S3_HLS_Interleave_Try_Merge(ctx);
+
+    return ret;
+}
+
+int32_t S3_HLS_Interleave_Merge(S3_HLS_INTERLEAVE_CTX* ctx) {
+    if(NULL == ctx)
+        return S3_HLS_INVALID_PARAMETER;
+
+    // a producer running merge stage writes what is due itself
+    if(0 != pthread_mutex_trylock(&ctx->merge_lock))
+        return S3_HLS_LOCK_FAILED;
+
+    S3_HLS_Interleave_Merge_Locked(ctx, 0);
+
+    pthread_mutex_unlock(&ctx->merge_lock);
+
+    return S3_HLS_OK;
+}
+
+int32_t S3_HLS_Interleave_Flush(S3_HLS_INTERLEAVE_CTX* ctx) {
+    if(NULL == ctx)
+        return S3_HLS_INVALID_PARAMETER;
+
+    if(0 != pthread_mutex_lock(&ctx->merge_lock))
+        return S3_HLS_LOCK_FAILED;
+
+    S3_HLS_Interleave_Merge_Locked(ctx, 1);
+
+    pthread_mutex_unlock(&ctx->merge_lock);
+
+    return S3_HLS_OK;
+}
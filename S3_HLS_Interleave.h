@@ -0,0 +1,122 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT-0
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __S3_HLS_INTERLEAVE_H__
+#define __S3_HLS_INTERLEAVE_H__
+
+#include "stdint.h"
+#include "pthread.h"
+
+#include "S3_HLS_SDK.h"
+#include "S3_HLS_Buffer_Mgr.h"
+#include "S3_HLS_Pes.h"
+
+#ifdef __cplusplus
+#if __cplusplus
+extern "C" {
+#endif
+#endif /* End of #ifdef __cplusplus */
+
+#define S3_HLS_INTERLEAVE_SLOTS             64      // frames staged per elementary stream
+#define S3_HLS_INTERLEAVE_MAX_WINDOW        2000    // ms
+
+/*
+ * One staged frame, items point into stage of stream or to caller data when put by reference
+ */
+typedef struct s3_hls_interleave_slot_s {
+    S3_HLS_FRAME_PACK pack;
+    uint64_t dts;
+    int64_t put_time;                   // monotonic ms
+    uint32_t stage_length;              // bytes of stage taken by frame, 0 when put by reference
+    uint8_t by_reference;
+    BUFFER_RELEASE_CALL_BACK release;
+    void* user_data;
+} S3_HLS_INTERLEAVE_SLOT;
+
+/*
+ * Staging queue of one elementary stream, one producer (serialized by put_lock) and the merge stage as consumer
+ * Copied frame data goes to stage, a byte ring given back in the order frames are written
+ */
+typedef struct s3_hls_interleave_stream_s {
+    S3_HLS_INTERLEAVE_SLOT slots[S3_HLS_INTERLEAVE_SLOTS];
+
+    uint8_t* stage;
+    uint32_t stage_size;
+
+    // producer side
+    pthread_mutex_t put_lock S3_HLS_CACHE_ALIGNED;
+    uint32_t slot_write;                // slots ever put
+    uint32_t stage_write;               // stage bytes ever taken
+    uint32_t stage_index;               // offset in stage of next copy
+    uint64_t last_dts;                  // of latest frame put, read by merge stage
+    uint8_t active;                     // frames were put, merge stage waits for this stream
+
+    // merge stage side
+    uint32_t slot_read S3_HLS_CACHE_ALIGNED;
+    uint32_t stage_release;
+} S3_HLS_INTERLEAVE_STREAM;
+
+typedef struct s3_hls_interleave_ctx_s {
+    S3_HLS_PES_CTX* pes_ctx;
+    S3_HLS_BUFFER_CTX* buffer_ctx;
+    uint32_t window_ms;
+
+    uint32_t stream_count;              // video and audio of each program
+    S3_HLS_INTERLEAVE_STREAM* streams;
+
+    pthread_mutex_t merge_lock;
+    uint32_t merge_requests;            // counted by producers so merge stage does not miss frames put while it runs
+} S3_HLS_INTERLEAVE_CTX;
+
+/*
+ * Allocate staging queues for video and audio of program_count programs, stages of given sizes are allocated up front
+ * Frames are written to buffer_ctx through muxer pes_ctx in DTS order, frames of a stream wait at most window_ms for other streams
+ */
+S3_HLS_INTERLEAVE_CTX* S3_HLS_Interleave_Initialize(S3_HLS_PES_CTX* pes_ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t program_count, uint32_t window_ms, uint32_t video_stage_size, uint32_t audio_stage_size);
+
+/*
+ * Free staging queues, frames still staged should be written by S3_HLS_Interleave_Flush before
+ */
+void S3_HLS_Interleave_Finalize(S3_HLS_INTERLEAVE_CTX* ctx);
+
+/*
+ * Stage a frame and write frames that are due, never waits for the merge stage run by another thread
+ * Frame data is copied to stage unless by_reference, release is called once frame is written or dropped
+ * Returns S3_HLS_BUFFER_OVERFLOW if the stream has no free slot or stage room
+ * Errors of writing staged frames are not returned, they are counted in drop counters
+ */
+int32_t S3_HLS_Interleave_Put(S3_HLS_INTERLEAVE_CTX* ctx, uint32_t program, uint8_t is_audio, S3_HLS_FRAME_PACK* pack, uint8_t by_reference, BUFFER_RELEASE_CALL_BACK release, void* user_data);
+
+/*
+ * Write staged frames that are due as a put would, frames that waited window_ms are due even if no producer puts again
+ * Called by watchdog, returns S3_HLS_LOCK_FAILED without waiting when another thread runs merge stage
+ */
+int32_t S3_HLS_Interleave_Merge(S3_HLS_INTERLEAVE_CTX* ctx);
+
+/*
+ * Write every staged frame in DTS order, waits for merge stage run by another thread
+ */
+int32_t S3_HLS_Interleave_Flush(S3_HLS_INTERLEAVE_CTX* ctx);
+
+#ifdef __cplusplus
+#if __cplusplus
+}
+#endif
+#endif /* End of #ifdef __cplusplus */
+
+#endif
@@ -0,0 +1,363 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT-0
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "S3_HLS_Memory.h"
+#include "S3_HLS_Return_Code.h"
+
+//#define S3_HLS_MEMORY_DEBUG
+
+#ifdef S3_HLS_MEMORY_DEBUG
+#define MEMORY_DEBUG(x, ...) printf(x, ##__VA_ARGS__)
+#else
+#define MEMORY_DEBUG(x, ...)
+#endif
+
+#define S3_HLS_HUGE_PAGE_SIZE           (2 * 1024 * 1024)
+
+/*
+ * Arena is split into blocks, each block is a 16 bytes header followed by payload
+ * Headers sit right before a cache line boundary so every payload is aligned
+ * Block sizes are multiple of alignment, free blocks are linked and merged with free neighbours
+ */
+typedef struct s3_hls_arena_block_s {
+    uint32_t size;          // block size including header
+    uint32_t prev_size;     // size of block before this one, 0 for first block
+    uint32_t used;
+    uint32_t reserved;
+} S3_HLS_ARENA_BLOCK;
+
+typedef struct s3_hls_arena_free_link_s {
+    S3_HLS_ARENA_BLOCK* next;
+    S3_HLS_ARENA_BLOCK* prev;
+} S3_HLS_ARENA_FREE_LINK;
+
+#define S3_HLS_ARENA_HEADER_SIZE        sizeof(S3_HLS_ARENA_BLOCK)
+#define S3_HLS_ARENA_PAYLOAD(block)     ((uint8_t*)(block) + S3_HLS_ARENA_HEADER_SIZE)
+#define S3_HLS_ARENA_BLOCK_OF(ptr)      ((S3_HLS_ARENA_BLOCK*)((uint8_t*)(ptr) - S3_HLS_ARENA_HEADER_SIZE))
+#define S3_HLS_ARENA_LINK(block)        ((S3_HLS_ARENA_FREE_LINK*)S3_HLS_ARENA_PAYLOAD(block))
+
+static S3_HLS_MALLOC_CALL_BACK s3_hls_malloc = NULL;
+static S3_HLS_REALLOC_CALL_BACK s3_hls_realloc = NULL;
+static S3_HLS_FREE_CALL_BACK s3_hls_free = NULL;
+
+static uint8_t* arena_start = NULL;
+static uint32_t arena_length = 0;
+static uint32_t arena_used = 0;
+static uint8_t arena_active = 0;
+static S3_HLS_ARENA_BLOCK* arena_free_list = NULL;
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint8_t S3_HLS_Arena_Contains(void* ptr) {
+    return NULL != arena_start && (uint8_t*)ptr >= arena_start && (uint8_t*)ptr < arena_start + arena_length;
+}
+
+static void S3_HLS_Arena_Link(S3_HLS_ARENA_BLOCK* block) {
+    S3_HLS_ARENA_LINK(block)->prev = NULL;
+    S3_HLS_ARENA_LINK(block)->next = arena_free_list;
+    if(NULL != arena_free_list)
+        S3_HLS_ARENA_LINK(arena_free_list)->prev = block;
+
+    arena_free_list = block;
+}
+
+static void S3_HLS_Arena_Unlink(S3_HLS_ARENA_BLOCK* block) {
+    S3_HLS_ARENA_FREE_LINK* link = S3_HLS_ARENA_LINK(block);
+    if(NULL != link->prev)
+        S3_HLS_ARENA_LINK(link->prev)->next = link->next;
+    else
+        arena_free_list = link->next;
+
+    if(NULL != link->next)
+        S3_HLS_ARENA_LINK(link->next)->prev = link->prev;
+}
+
+static void* S3_HLS_Arena_Malloc(size_t size) {
+    if(0 == size || size > arena_length)
+        return NULL;
+
+    uint32_t need = (size + S3_HLS_ARENA_HEADER_SIZE + S3_HLS_MEMORY_ALIGNMENT - 1) / S3_HLS_MEMORY_ALIGNMENT * S3_HLS_MEMORY_ALIGNMENT;
+
+    pthread_mutex_lock(&arena_lock);
+
+    // first fit
+    S3_HLS_ARENA_BLOCK* block = arena_free_list;
+    while(NULL != block && block->size < need)
+        block = S3_HLS_ARENA_LINK(block)->next;
+
+    if(NULL == block) {
+        MEMORY_DEBUG("Arena is out of memory! used %u, request %u\n", arena_used, need);
+        pthread_mutex_unlock(&arena_lock);
+        return NULL;
+    }
+
+    S3_HLS_Arena_Unlink(block);
+
+    if(block->size - need >= S3_HLS_MEMORY_ALIGNMENT) { // split, keep tail as free block
+        S3_HLS_ARENA_BLOCK* rest = (S3_HLS_ARENA_BLOCK*)((uint8_t*)block + need);
+        rest->size = block->size - need;
+        rest->prev_size = need;
+        rest->used = 0;
+
+        S3_HLS_ARENA_BLOCK* next = (S3_HLS_ARENA_BLOCK*)((uint8_t*)rest + rest->size);
+        next->prev_size = rest->size;
+
+        block->size = need;
+        S3_HLS_Arena_Link(rest);
+    }
+
+    block->used = 1;
+    arena_used += block->size;
+
+    pthread_mutex_unlock(&arena_lock);
+
+    return S3_HLS_ARENA_PAYLOAD(block);
+}
+
+static void S3_HLS_Arena_Free(void* ptr) {
+    pthread_mutex_lock(&arena_lock);
+
+    S3_HLS_ARENA_BLOCK* block = S3_HLS_ARENA_BLOCK_OF(ptr);
+    block->used = 0;
+    arena_used -= block->size;
+
+    // merge with next block, the end of arena is a used block of size 0
+    S3_HLS_ARENA_BLOCK* next = (S3_HLS_ARENA_BLOCK*)((uint8_t*)block + block->size);
+    if(!next->used) {
+        S3_HLS_Arena_Unlink(next);
+        block->size += next->size;
+    }
+
+    // merge with previous block
+    if(0 != block->prev_size) {
+        S3_HLS_ARENA_BLOCK* prev = (S3_HLS_ARENA_BLOCK*)((uint8_t*)block - block->prev_size);
+        if(!prev->used) {
+            S3_HLS_Arena_Unlink(prev);
+            prev->size += block->size;
+            block = prev;
+        }
+    }
+
+    next = (S3_HLS_ARENA_BLOCK*)((uint8_t*)block + block->size);
+    next->prev_size = block->size;
+
+    S3_HLS_Arena_Link(block);
+
+    pthread_mutex_unlock(&arena_lock);
+}
+
+static void* S3_HLS_Arena_Realloc(void* ptr, size_t size) {
+    if(NULL == ptr)
+        return S3_HLS_Arena_Malloc(size);
+
+    if(0 == size) {
+        S3_HLS_Arena_Free(ptr);
+        return NULL;
+    }
+
+    uint32_t capacity = S3_HLS_ARENA_BLOCK_OF(ptr)->size - S3_HLS_ARENA_HEADER_SIZE;
+    if(size <= capacity)
+        return ptr;
+
+    void* ret = S3_HLS_Arena_Malloc(size);
+    if(NULL == ret)
+        return NULL;
+
+    memcpy(ret, ptr, capacity);
+    S3_HLS_Arena_Free(ptr);
+
+    return ret;
+}
+
+int32_t S3_HLS_Memory_Set_Allocator(S3_HLS_MALLOC_CALL_BACK malloc_call_back, S3_HLS_REALLOC_CALL_BACK realloc_call_back, S3_HLS_FREE_CALL_BACK free_call_back) {
+    if(NULL == malloc_call_back && NULL == realloc_call_back && NULL == free_call_back) {
+        s3_hls_malloc = NULL;
+        s3_hls_realloc = NULL;
+        s3_hls_free = NULL;
+        return S3_HLS_OK;
+    }
+
+    if(NULL == malloc_call_back || NULL == realloc_call_back || NULL == free_call_back)
+        return S3_HLS_INVALID_PARAMETER;
+
+    s3_hls_malloc = malloc_call_back;
+    s3_hls_realloc = realloc_call_back;
+    s3_hls_free = free_call_back;
+
+    return S3_HLS_OK;
+}
+
+int32_t S3_HLS_Memory_Initialize_Arena(uint32_t arena_size, uint32_t flags) {
+    if(arena_size < 2 * S3_HLS_MEMORY_ALIGNMENT)
+        return S3_HLS_INVALID_PARAMETER;
+
+    if(NULL != arena_start) {
+        if(arena_size > arena_length) {
+            MEMORY_DEBUG("Arena already mapped with smaller size %u!\n", arena_length);
+            return S3_HLS_INVALID_STATUS;
+        }
+
+        arena_active = 1;
+        return S3_HLS_Memory_Set_Allocator(S3_HLS_Arena_Malloc, S3_HLS_Arena_Realloc, S3_HLS_Arena_Free);
+    }
+
+    uint8_t* start = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if(flags & S3_HLS_ARENA_HUGE_PAGE) {
+        uint32_t huge_size = (arena_size + S3_HLS_HUGE_PAGE_SIZE - 1) / S3_HLS_HUGE_PAGE_SIZE * S3_HLS_HUGE_PAGE_SIZE;
+        start = (uint8_t*)mmap(NULL, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(MAP_FAILED != start) {
+            arena_size = huge_size;
+        } else {
+            MEMORY_DEBUG("Huge page not available, fallback to normal pages!\n");
+        }
+    }
+#endif
+
+    if(MAP_FAILED == start) {
+        start = (uint8_t*)mmap(NULL, arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(MAP_FAILED == start) {
+            MEMORY_DEBUG("Failed to map arena!\n");
+            return S3_HLS_OUT_OF_MEMORY;
+        }
+    }
+
+    if(flags & S3_HLS_ARENA_LOCK) {
+        if(0 != mlock(start, arena_size)) {
+            MEMORY_DEBUG("Failed to lock arena in memory!\n");
+        }
+    }
+
+    // first header right before first cache line boundary, keep last cache line for end marker
+    uint32_t blocks_length = (arena_size / S3_HLS_MEMORY_ALIGNMENT - 2) * S3_HLS_MEMORY_ALIGNMENT;
+
+    S3_HLS_ARENA_BLOCK* first = (S3_HLS_ARENA_BLOCK*)(start + S3_HLS_MEMORY_ALIGNMENT - S3_HLS_ARENA_HEADER_SIZE);
+    first->size = blocks_length;
+    first->prev_size = 0;
+    first->used = 0;
+
+    S3_HLS_ARENA_BLOCK* end = (S3_HLS_ARENA_BLOCK*)((uint8_t*)first + blocks_length);
+    end->size = 0;
+    end->prev_size = blocks_length;
+    end->used = 1;
+
+    pthread_mutex_lock(&arena_lock);
+    arena_start = start;
+    arena_length = arena_size;
+    arena_used = 0;
+    arena_free_list = NULL;
+    S3_HLS_Arena_Link(first);
+    arena_active = 1;
+    pthread_mutex_unlock(&arena_lock);
+
+    return S3_HLS_Memory_Set_Allocator(S3_HLS_Arena_Malloc, S3_HLS_Arena_Realloc, S3_HLS_Arena_Free);
+}
+
+void S3_HLS_Memory_Finalize_Arena() {
+    if(NULL == arena_start)
+        return;
+
+    S3_HLS_Memory_Set_Allocator(NULL, NULL, NULL);
+    arena_active = 0;
+
+    pthread_mutex_lock(&arena_lock);
+    if(0 != arena_used) {
+        // libraries may keep global state allocated from arena until process exits
+        MEMORY_DEBUG("Arena still has %u bytes in use, keep it mapped!\n", arena_used);
+        pthread_mutex_unlock(&arena_lock);
+        return;
+    }
+
+    munmap(arena_start, arena_length);
+    arena_start = NULL;
+    arena_length = 0;
+    arena_free_list = NULL;
+    pthread_mutex_unlock(&arena_lock);
+}
+
+uint8_t S3_HLS_Memory_Is_Default() {
+    return NULL == s3_hls_malloc;
+}
+
+void* S3_HLS_Malloc(size_t size) {
+    if(NULL != s3_hls_malloc)
+        return s3_hls_malloc(size);
+
+    void* ret = NULL;
+    if(0 != posix_memalign(&ret, S3_HLS_MEMORY_ALIGNMENT, size))
+        return NULL;
+
+    return ret;
+}
+
+void* S3_HLS_Calloc(size_t count, size_t size) {
+    if(0 != size && count > (size_t)-1 / size)
+        return NULL;
+
+    void* ret = S3_HLS_Malloc(count * size);
+    if(NULL != ret)
+        memset(ret, 0, count * size);
+
+    return ret;
+}
+
+void* S3_HLS_Realloc(void* ptr, size_t size) {
+    // memory allocated before allocator is switched goes back to where it comes from
+    if(NULL != ptr && !arena_active && S3_HLS_Arena_Contains(ptr))
+        return S3_HLS_Arena_Realloc(ptr, size);
+
+    if(NULL != ptr && arena_active && !S3_HLS_Arena_Contains(ptr))
+        return realloc(ptr, size);
+
+    if(NULL != s3_hls_realloc)
+        return s3_hls_realloc(ptr, size);
+
+    return realloc(ptr, size);
+}
+
+char* S3_HLS_Strdup(const char* str) {
+    size_t length = strlen(str) + 1;
+    char* ret = (char*)S3_HLS_Malloc(length);
+    if(NULL != ret)
+        memcpy(ret, str, length);
+
+    return ret;
+}
+
+void S3_HLS_Free(void* ptr) {
+    if(NULL == ptr)
+        return;
+
+    // memory allocated before allocator is switched goes back to where it comes from
+    if(S3_HLS_Arena_Contains(ptr)) {
+        S3_HLS_Arena_Free(ptr);
+        return;
+    }
+
+    if(arena_active || NULL == s3_hls_free) {
+        free(ptr);
+        return;
+    }
+
+    s3_hls_free(ptr);
+}
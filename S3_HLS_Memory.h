@@ -0,0 +1,74 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT-0
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __S3_HLS_MEMORY_H__
+#define __S3_HLS_MEMORY_H__
+
+#include "stdint.h"
+#include "stddef.h"
+
+#include "S3_HLS_SDK.h"
+
+#ifdef __cplusplus
+#if __cplusplus
+extern "C" {
+#endif
+#endif /* End of #ifdef __cplusplus */
+
+#define S3_HLS_MEMORY_ALIGNMENT         64      // allocations from default allocator and arena start at cache line
+
+/*
+ * Route SDK allocations to user functions, pass NULL to go back to default allocator
+ * Must be called before any SDK object is created
+ */
+int32_t S3_HLS_Memory_Set_Allocator(S3_HLS_MALLOC_CALL_BACK malloc_call_back, S3_HLS_REALLOC_CALL_BACK realloc_call_back, S3_HLS_FREE_CALL_BACK free_call_back);
+
+/*
+ * Map one region at init time and serve all SDK allocations from it
+ * flags is combination of S3_HLS_ARENA_HUGE_PAGE and S3_HLS_ARENA_LOCK
+ * Calling again keeps the existing region if it is large enough
+ */
+int32_t S3_HLS_Memory_Initialize_Arena(uint32_t arena_size, uint32_t flags);
+
+/*
+ * Unmap region if nothing allocated from it is still in use, and go back to default allocator
+ */
+void S3_HLS_Memory_Finalize_Arena();
+
+/*
+ * Return 1 if neither user allocator nor arena is set
+ */
+uint8_t S3_HLS_Memory_Is_Default();
+
+void* S3_HLS_Malloc(size_t size);
+
+void* S3_HLS_Calloc(size_t count, size_t size);
+
+void* S3_HLS_Realloc(void* ptr, size_t size);
+
+char* S3_HLS_Strdup(const char* str);
+
+void S3_HLS_Free(void* ptr);
+
+#ifdef __cplusplus
+#if __cplusplus
+}
+#endif
+#endif /* End of #ifdef __cplusplus */
+
+#endif
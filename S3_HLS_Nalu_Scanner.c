@@ -0,0 +1,330 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT-0
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "stdlib.h"
+
+#include "S3_HLS_Nalu_Scanner.h"
+
+// define to always use the scalar scanner
+//#define S3_HLS_NALU_SCAN_SCALAR
+
+#if !defined(S3_HLS_NALU_SCAN_SCALAR) && defined(__AVX2__)
+#include <immintrin.h>
+#define S3_HLS_NALU_SCAN_AVX2
+#elif !defined(S3_HLS_NALU_SCAN_SCALAR) && defined(__SSE2__)
+#include <emmintrin.h>
+#define S3_HLS_NALU_SCAN_SSE2
+#elif !defined(S3_HLS_NALU_SCAN_SCALAR) && defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define S3_HLS_NALU_SCAN_NEON
+#endif
+
+#define S3_HLS_NALU_START_CODE_SIZE         3       // 00 00 01, leading zero of 4 bytes start code is checked separately
+#define S3_HLS_NALU_LENGTH_SIZE             4       // big endian NALU length in front of each length prefixed NALU
+#define S3_HLS_NALU_SCAN_BLOCK_SIZE         64      // bytes checked for 00 01 at once, only blocks that have it are compared lane by lane
+
+/*
+ * Scalar search from pos, a byte larger than 1 rules out the three start codes that would contain it
+ */
+static uint32_t S3_HLS_Nalu_Find_Scalar(const uint8_t* data, uint32_t pos, uint32_t length) {
+    while(pos + S3_HLS_NALU_START_CODE_SIZE <= length) {
+        if(0x01 < data[pos + 2]) {
+            pos += S3_HLS_NALU_START_CODE_SIZE;
+        } else if(0x01 == data[pos + 2] && 0x00 == data[pos + 1] && 0x00 == data[pos]) {
+            return pos;
+        } else {
+            pos++;
+        }
+    }
+
+    return length;
+}
+
+#if defined(S3_HLS_NALU_SCAN_AVX2)
+#define S3_HLS_NALU_VECTOR_SIZE             sizeof(__m256i)
+
+/*
+ * Mask of lanes where a start code begins, each lane compares the start code beginning at its byte
+ * Loads at +1 and +2 bring the following bytes into the lane
+ */
+static inline uint32_t S3_HLS_Nalu_Vector_Hits(const uint8_t* data) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+
+    __m256i byte0 = _mm256_loadu_si256((const __m256i*)data);
+    __m256i byte1 = _mm256_loadu_si256((const __m256i*)(data + 1));
+    __m256i byte2 = _mm256_loadu_si256((const __m256i*)(data + 2));
+
+    __m256i hit = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(byte0, zero), _mm256_cmpeq_epi8(byte1, zero)), _mm256_cmpeq_epi8(byte2, one));
+    return (uint32_t)_mm256_movemask_epi8(hit);
+}
+
+/*
+ * Non zero if 00 01 is at +1 of any lane in the block, only the first byte of the start code is left out
+ * Seldom true on slice data, so the branch on it is well predicted
+ */
+static inline uint32_t S3_HLS_Nalu_Block_Hits(const uint8_t* data) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+
+    __m256i block0 = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(data + 1)), zero),
+        _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(data + 2)), one));
+    __m256i block1 = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(data + sizeof(__m256i) + 1)), zero),
+        _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(data + sizeof(__m256i) + 2)), one));
+
+    return (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(block0, block1));
+}
+#elif defined(S3_HLS_NALU_SCAN_SSE2)
+#define S3_HLS_NALU_VECTOR_SIZE             sizeof(__m128i)
+
+static inline uint32_t S3_HLS_Nalu_Vector_Hits(const uint8_t* data) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+
+    __m128i byte0 = _mm_loadu_si128((const __m128i*)data);
+    __m128i byte1 = _mm_loadu_si128((const __m128i*)(data + 1));
+    __m128i byte2 = _mm_loadu_si128((const __m128i*)(data + 2));
+
+    __m128i hit = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(byte0, zero), _mm_cmpeq_epi8(byte1, zero)), _mm_cmpeq_epi8(byte2, one));
+    return (uint32_t)_mm_movemask_epi8(hit);
+}
+
+static inline __m128i S3_HLS_Nalu_Pair_Hits(const uint8_t* data) {
+    return _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + 1)), _mm_setzero_si128()),
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + 2)), _mm_set1_epi8(1)));
+}
+
+static inline uint32_t S3_HLS_Nalu_Block_Hits(const uint8_t* data) {
+    __m128i block0 = S3_HLS_Nalu_Pair_Hits(data);
+    __m128i block1 = S3_HLS_Nalu_Pair_Hits(data + sizeof(__m128i));
+    __m128i block2 = S3_HLS_Nalu_Pair_Hits(data + 2 * sizeof(__m128i));
+    __m128i block3 = S3_HLS_Nalu_Pair_Hits(data + 3 * sizeof(__m128i));
+
+    return (uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(block0, block1), _mm_or_si128(block2, block3)));
+}
+#elif defined(S3_HLS_NALU_SCAN_NEON)
+#define S3_HLS_NALU_VECTOR_SIZE             sizeof(uint8x16_t)
+
+/*
+ * No movemask on NEON, non zero if any lane hits and the lane is found with scalar code
+ */
+static inline uint32_t S3_HLS_Nalu_Vector_Hits(const uint8_t* data) {
+    const uint8x16_t one = vdupq_n_u8(1);
+
+    uint8x16_t byte0 = vld1q_u8(data);
+    uint8x16_t byte1 = vld1q_u8(data + 1);
+    uint8x16_t byte2 = vld1q_u8(data + 2);
+
+    uint8x16_t hit = vandq_u8(vandq_u8(vceqzq_u8(byte0), vceqzq_u8(byte1)), vceqq_u8(byte2, one));
+    return vmaxvq_u8(hit);
+}
+
+static inline uint8x16_t S3_HLS_Nalu_Pair_Hits(const uint8_t* data) {
+    return vandq_u8(vceqzq_u8(vld1q_u8(data + 1)), vceqq_u8(vld1q_u8(data + 2), vdupq_n_u8(1)));
+}
+
+static inline uint32_t S3_HLS_Nalu_Block_Hits(const uint8_t* data) {
+    uint8x16_t block0 = S3_HLS_Nalu_Pair_Hits(data);
+    uint8x16_t block1 = S3_HLS_Nalu_Pair_Hits(data + sizeof(uint8x16_t));
+    uint8x16_t block2 = S3_HLS_Nalu_Pair_Hits(data + 2 * sizeof(uint8x16_t));
+    uint8x16_t block3 = S3_HLS_Nalu_Pair_Hits(data + 3 * sizeof(uint8x16_t));
+
+    return vmaxvq_u8(vorrq_u8(vorrq_u8(block0, block1), vorrq_u8(block2, block3)));
+}
+#endif
+
+#if defined(S3_HLS_NALU_SCAN_NEON)
+static inline uint32_t S3_HLS_Nalu_Hit_Position(const uint8_t* data, uint32_t pos, uint32_t mask) {
+    return S3_HLS_Nalu_Find_Scalar(data, pos, pos + S3_HLS_NALU_VECTOR_SIZE + S3_HLS_NALU_START_CODE_SIZE - 1);
+}
+#elif defined(S3_HLS_NALU_VECTOR_SIZE)
+static inline uint32_t S3_HLS_Nalu_Hit_Position(const uint8_t* data, uint32_t pos, uint32_t mask) {
+    return pos + __builtin_ctz(mask);
+}
+#endif
+
+uint32_t S3_HLS_Nalu_Find_Start_Code(const uint8_t* data, uint32_t length) {
+    uint32_t pos = 0;
+
+#if defined(S3_HLS_NALU_VECTOR_SIZE)
+    // a block without 00 01 at +1 of any lane has no start code and is skipped with two compares per vector
+    while(pos + S3_HLS_NALU_SCAN_BLOCK_SIZE + S3_HLS_NALU_START_CODE_SIZE - 1 <= length) {
+        if(0 != S3_HLS_Nalu_Block_Hits(data + pos)) {
+            for(uint32_t vector = 0; vector < S3_HLS_NALU_SCAN_BLOCK_SIZE; vector += S3_HLS_NALU_VECTOR_SIZE) {
+                uint32_t mask = S3_HLS_Nalu_Vector_Hits(data + pos + vector);
+                if(0 != mask)
+                    return S3_HLS_Nalu_Hit_Position(data, pos + vector, mask);
+            }
+        }
+
+        pos += S3_HLS_NALU_SCAN_BLOCK_SIZE;
+    }
+
+    while(pos + S3_HLS_NALU_VECTOR_SIZE + S3_HLS_NALU_START_CODE_SIZE - 1 <= length) {
+        uint32_t mask = S3_HLS_Nalu_Vector_Hits(data + pos);
+        if(0 != mask)
+            return S3_HLS_Nalu_Hit_Position(data, pos, mask);
+
+        pos += S3_HLS_NALU_VECTOR_SIZE;
+    }
+#endif
+
+    return S3_HLS_Nalu_Find_Scalar(data, pos, length);
+}
+
+/*
+ * Byte at pos of item that is split into two parts, pos must be within item
+ */
+static uint8_t S3_HLS_Nalu_Item_Byte(S3_HLS_FRAME_ITEM* item, uint32_t pos) {
+    return pos < item->first_part_length ? item->first_part_start[pos] : item->second_part_start[pos - item->first_part_length];
+}
+
+/*
+ * Set nalu to bytes from start to end of item
+ */
+static void S3_HLS_Nalu_Set_Range(S3_HLS_FRAME_ITEM* item, uint32_t start, uint32_t end, S3_HLS_FRAME_ITEM* nalu) {
+    *nalu = *item;
+
+    if(end <= item->first_part_length) {
+        nalu->first_part_start = item->first_part_start + start;
+        nalu->first_part_length = end - start;
+        nalu->second_part_start = NULL;
+        nalu->second_part_length = 0;
+    } else if(start >= item->first_part_length) {
+        nalu->first_part_start = item->second_part_start + start - item->first_part_length;
+        nalu->first_part_length = end - start;
+        nalu->second_part_start = NULL;
+        nalu->second_part_length = 0;
+    } else {
+        nalu->first_part_start = item->first_part_start + start;
+        nalu->first_part_length = item->first_part_length - start;
+        nalu->second_part_length = end - item->first_part_length;
+    }
+}
+
+/*
+ * Start code found at pos ends NALU in front of it, leading zero byte makes it a 4 bytes start code
+ */
+static int32_t S3_HLS_Nalu_Add_Start(S3_HLS_FRAME_ITEM* item, uint32_t pos, uint32_t* nalu_start, int32_t count, S3_HLS_FRAME_ITEM* nalus, uint32_t max_count) {
+    if(0 < pos && 0x00 == S3_HLS_Nalu_Item_Byte(item, pos - 1))
+        pos--;
+
+    if(0 == count) // data before first start code is not a NALU
+        return 0 == pos ? 1 : -1;
+
+    if((uint32_t)count <= max_count)
+        S3_HLS_Nalu_Set_Range(item, *nalu_start, pos, &nalus[count - 1]);
+
+    *nalu_start = pos;
+    return count + 1;
+}
+
+int32_t S3_HLS_Nalu_Split(S3_HLS_FRAME_ITEM* item, S3_HLS_FRAME_ITEM* nalus, uint32_t max_count) {
+    if(NULL == item || NULL == item->first_part_start || (NULL == item->second_part_start && 0 != item->second_part_length))
+        return -1;
+
+    uint32_t length = item->first_part_length + item->second_part_length;
+    uint32_t nalu_start = 0;
+    uint32_t next = 0;      // start codes do not overlap, next one begins at or after this
+    int32_t count = 0;      // NALUs started so far
+
+    // start codes within first part
+    while(next < item->first_part_length) {
+        uint32_t pos = next + S3_HLS_Nalu_Find_Start_Code(item->first_part_start + next, item->first_part_length - next);
+        if(pos >= item->first_part_length)
+            break;
+
+        count = S3_HLS_Nalu_Add_Start(item, pos, &nalu_start, count, nalus, max_count);
+        if(0 > count)
+            return -1;
+
+        next = pos + S3_HLS_NALU_START_CODE_SIZE;
+    }
+
+    // start codes across the two parts
+    uint32_t pos = item->first_part_length > S3_HLS_NALU_START_CODE_SIZE - 1 ? item->first_part_length - (S3_HLS_NALU_START_CODE_SIZE - 1) : 0;
+    if(pos < next)
+        pos = next;
+
+    for(; pos < item->first_part_length && pos + S3_HLS_NALU_START_CODE_SIZE <= length; pos++) {
+        if(0x00 != S3_HLS_Nalu_Item_Byte(item, pos) || 0x00 != S3_HLS_Nalu_Item_Byte(item, pos + 1) || 0x01 != S3_HLS_Nalu_Item_Byte(item, pos + 2))
+            continue;
+
+        count = S3_HLS_Nalu_Add_Start(item, pos, &nalu_start, count, nalus, max_count);
+        if(0 > count)
+            return -1;
+
+        next = pos + S3_HLS_NALU_START_CODE_SIZE;
+        break; // next start code begins in second part
+    }
+
+    // start codes within second part
+    while(next < length) {
+        uint32_t skip = next > item->first_part_length ? next - item->first_part_length : 0;
+        uint32_t pos = item->first_part_length + skip + S3_HLS_Nalu_Find_Start_Code(item->second_part_start + skip, item->second_part_length - skip);
+        if(pos >= length)
+            break;
+
+        count = S3_HLS_Nalu_Add_Start(item, pos, &nalu_start, count, nalus, max_count);
+        if(0 > count)
+            return -1;
+
+        next = pos + S3_HLS_NALU_START_CODE_SIZE;
+    }
+
+    if(0 == count)
+        return -1;
+
+    if((uint32_t)count <= max_count)
+        S3_HLS_Nalu_Set_Range(item, nalu_start, length, &nalus[count - 1]);
+
+    return count;
+}
+
+int32_t S3_HLS_Nalu_Split_Length_Prefixed(S3_HLS_FRAME_ITEM* item, S3_HLS_FRAME_ITEM* nalus, uint32_t max_count) {
+    if(NULL == item || NULL == item->first_part_start || (NULL == item->second_part_start && 0 != item->second_part_length))
+        return -1;
+
+    uint32_t length = item->first_part_length + item->second_part_length;
+    uint32_t nalu_start = 0;
+    int32_t count = 0;      // NALUs found so far
+
+    // only the length bytes are read, they may be in either part or across both
+    while(nalu_start < length) {
+        if(length - nalu_start <= S3_HLS_NALU_LENGTH_SIZE) // no room for length and NALU header
+            return -1;
+
+        uint32_t nalu_length = 0;
+        for(uint32_t cnt = 0; cnt < S3_HLS_NALU_LENGTH_SIZE; cnt++)
+            nalu_length = (nalu_length << 8) | S3_HLS_Nalu_Item_Byte(item, nalu_start + cnt);
+
+        if(0 == nalu_length || nalu_length > length - nalu_start - S3_HLS_NALU_LENGTH_SIZE)
+            return -1;
+
+        count++;
+        if((uint32_t)count <= max_count)
+            S3_HLS_Nalu_Set_Range(item, nalu_start, nalu_start + S3_HLS_NALU_LENGTH_SIZE + nalu_length, &nalus[count - 1]);
+
+        nalu_start += S3_HLS_NALU_LENGTH_SIZE + nalu_length;
+    }
+
+    if(0 == count)
+        return -1;
+
+    return count;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT-0
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __S3_HLS_NALU_SCANNER_H__
+#define __S3_HLS_NALU_SCANNER_H__
+
+#include "stdint.h"
+
+#include "S3_HLS_SDK.h"
+
+#ifdef __cplusplus
+#if __cplusplus
+extern "C" {
+#endif
+#endif /* End of #ifdef __cplusplus */
+
+#define S3_HLS_NALU_MAX_PER_ACCESS_UNIT     32      // NALUs of one video frame that are classified and written as fMP4 samples
+
+/*
+ * Offset of first 3 bytes start code 00 00 01 in data, length if there is none
+ * Uses AVX2, SSE2 or NEON when the compiler targets them, scalar code otherwise
+ */
+uint32_t S3_HLS_Nalu_Find_Start_Code(const uint8_t* data, uint32_t length);
+
+/*
+ * Split item holding one or more NALUs with 3 or 4 bytes start codes, e.g. a whole access unit, into one item per NALU
+ * Start codes across the two parts of item are found, NALU items may have two parts as well
+ * Each NALU item starts at its start code and gets timestamps of item
+ * Returns number of NALUs in item, at most max_count of them are set
+ * Returns -1 if item does not start with start code
+ */
+int32_t S3_HLS_Nalu_Split(S3_HLS_FRAME_ITEM* item, S3_HLS_FRAME_ITEM* nalus, uint32_t max_count);
+
+/*
+ * Split item holding one or more NALUs behind 4 bytes big endian lengths (AVCC / HVCC), e.g. a whole MP4 sample, into one item per NALU
+ * Lengths across the two parts of item are read, NALU items may have two parts as well
+ * Each NALU item starts at its length and gets timestamps of item
+ * Returns number of NALUs in item, at most max_count of them are set
+ * Returns -1 if lengths do not end exactly at the end of item
+ */
+int32_t S3_HLS_Nalu_Split_Length_Prefixed(S3_HLS_FRAME_ITEM* item, S3_HLS_FRAME_ITEM* nalus, uint32_t max_count);
+
+#ifdef __cplusplus
+#if __cplusplus
+}
+#endif
+#endif /* End of #ifdef __cplusplus */
+
+#endif
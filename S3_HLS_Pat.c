@@ -35,17 +35,19 @@
  *      0x00        section_number +1 for every section
  *      0x00        last_section_number
  *  
- *      // loop start
+ *      // loop start, one entry for each program
  *      0x00        first 8 bits of program number in PMT
  *      0x01        last 8 bits of program number in PMT
  *      0xf0        0b111 reserved 0b10000 first 5 bits of program number in PMT
  *      0x00        last 8 bits of program number in PMT
  *
- *      // CRC
+ *      // CRC32 of section from table_id, 0x2ab104b2 for single program
  *      0x2a
  *      0xb1
  *      0x04
  *      0xb2
+ *
+ *  Section is built when program count changes, remaining bytes of the packet are 0xFF
  */
 
 #include <stdio.h>
@@ -53,6 +55,7 @@
 #include <string.h>
 
 #include "S3_HLS_Pat.h"
+#include "S3_HLS_CRC32.h"
 #include "S3_HLS_Return_Code.h"
 
 // #define S3_HLS_PAT_DEBUG
@@ -63,35 +66,85 @@
 #define PAT_DEBUG(x, ...)
 #endif
 
-#define S3_HLS_PAT_HEADER_LENGTH        188
+#define S3_HLS_PAT_SECTION_START        5       // TS header and pointer field
+#define S3_HLS_PAT_SECTION_HEADER       8       // table_id to last_section_number
+#define S3_HLS_PAT_CRC_LENGTH           4
+
+int32_t S3_HLS_PAT_Set_Programs(S3_HLS_PAT_CTX* ctx, uint32_t program_count) {
+    if(0 == program_count || S3_HLS_MAX_PROGRAMS < program_count)
+        return S3_HLS_INVALID_PARAMETER;
+
+    PAT_DEBUG("Building PAT for %d programs\n", program_count);
+    memset(ctx->packet, 0xFF, sizeof(ctx->packet));
+
+    ctx->packet[0] = 0x47;
+    ctx->packet[1] = 0x40;  // payload start, PID 0x0000
+    ctx->packet[2] = 0x00;
+    ctx->packet[3] = 0x10;  // payload only, counter is set when written
+    ctx->packet[4] = 0x00;  // pointer field
+
+    uint8_t* section = ctx->packet + S3_HLS_PAT_SECTION_START;
+    uint32_t section_length = S3_HLS_PAT_SECTION_HEADER - 3 + 4 * program_count + S3_HLS_PAT_CRC_LENGTH; // bytes after section length field
+
+    uint8_t* pos = section;
+    *pos++ = 0x00;
+    *pos++ = 0xb0 | ((section_length >> 8) & 0x0F);
+    *pos++ = section_length & 0xFF;
+    *pos++ = 0x00;
+    *pos++ = 0x01;
+    *pos++ = 0xc1;
+    *pos++ = 0x00;
+    *pos++ = 0x00;
 
-uint8_t const_pat[21] = {   0x47, 0x40, 0x00, 0x10, 0x00, 0x00, 0xb0, 0x0d, 
-                            0x00, 0x01, 0xc1, 0x00, 0x00, 0x00, 0x01, 0xf0, 
-                            0x00, 0x2a, 0xb1, 0x04, 0xb2};
-                                
-int8_t m_pat_counter = 0;
+    for(uint32_t program = 0; program < program_count; program++) {
+        uint32_t program_number = program + 1;
+        uint32_t pid = S3_HLS_Program_PMT_PID(program);
+
+        *pos++ = (program_number >> 8) & 0xFF;
+        *pos++ = program_number & 0xFF;
+        *pos++ = 0xe0 | ((pid >> 8) & 0x1F);
+        *pos++ = pid & 0xFF;
+    }
+
+    uint32_t crc = S3_HLS_CRC32(section, pos - section);
+    *pos++ = (crc >> 24) & 0xFF;
+    *pos++ = (crc >> 16) & 0xFF;
+    *pos++ = (crc >> 8) & 0xFF;
+    *pos++ = crc & 0xFF;
+
+    ctx->built = 1;
+
+    return S3_HLS_OK;
+}
 
-int32_t S3_HLS_H264_PAT_Write_To_Buffer(S3_HLS_BUFFER_CTX* buffer_ctx) {
+int32_t S3_HLS_H264_PAT_Write_To_Buffer(S3_HLS_PAT_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx) {
     PAT_DEBUG("Writing PAT\n");
     int32_t ret;
 
-    const_pat[S3_HLS_TS_COUNTER_INDEX] &= 0xF0;
-    const_pat[S3_HLS_TS_COUNTER_INDEX] |= (m_pat_counter & 0x0F);
-    
+    if(!ctx->built)
+        S3_HLS_PAT_Set_Programs(ctx, 1);
+
+    ctx->packet[S3_HLS_TS_COUNTER_INDEX] &= 0xF0;
+    ctx->packet[S3_HLS_TS_COUNTER_INDEX] |= (ctx->counter & 0x0F);
+
     PAT_DEBUG("Put PAT to buffer\n");
-    ret = S3_HLS_Put_To_Buffer(buffer_ctx, const_pat, sizeof(const_pat));
-    if(0 > ret)
-        return ret;
-        
-    ret = S3_HLS_Put_To_Buffer(buffer_ctx, const_fill_word, S3_HLS_PAT_HEADER_LENGTH - sizeof(const_pat));
+    ret = S3_HLS_Put_To_Buffer(buffer_ctx, ctx->packet, sizeof(ctx->packet));
     if(0 > ret)
         return ret;
 
-    m_pat_counter++;
-    
-    return S3_HLS_PAT_HEADER_LENGTH;
+    ctx->counter++;
+
+    return S3_HLS_TS_PACKET_SIZE;
 }
 
-void S3_HLS_PAT_Reset_Counter() {
-    m_pat_counter = 0;
-}
\ No newline at end of file
+void S3_HLS_PAT_Reset_Counter(S3_HLS_PAT_CTX* ctx) {
+    ctx->counter = 0;
+}
+
+int8_t S3_HLS_PAT_Get_Counter(S3_HLS_PAT_CTX* ctx) {
+    return ctx->counter;
+}
+
+void S3_HLS_PAT_Set_Counter(S3_HLS_PAT_CTX* ctx, int8_t counter) {
+    ctx->counter = counter;
+}
@@ -21,6 +21,7 @@
 
 #include "stdint.h"
 #include "S3_HLS_Buffer_Mgr.h"
+#include "S3_HLS_Return_Code.h"
 
 #ifdef __cplusplus
 #if __cplusplus
@@ -31,13 +32,29 @@ extern "C" {
 #define ERR_S3_HLS_H264_PAT_NULL_BUFFER                 -1
 #define ERR_S3_HLS_H264_PAT_INVALID_BUFFER_LENGTH       -2
 
+/*
+ * PAT packet and continuity counter of one muxer, zero filled context is ready to use
+ */
+typedef struct s3_hls_pat_s {
+    uint8_t packet[S3_HLS_TS_PACKET_SIZE];
+    uint8_t built;
+    int8_t counter;
+} S3_HLS_PAT_CTX;
+
+/*
+ * Build PAT listing program_count programs, program n has program number n + 1 and PMT PID 0x1000 + n
+ * Single program PAT is built on first write when not called
+ */
+int32_t S3_HLS_PAT_Set_Programs(S3_HLS_PAT_CTX* ctx, uint32_t program_count);
+
 /*
  * write PAT header to buffer
- * as pat is fixed for given stream will only verify size
  * returns number of bytes written to the buffer
  */
-int32_t S3_HLS_H264_PAT_Write_To_Buffer(S3_HLS_BUFFER_CTX* buffer_ctx);
-void S3_HLS_PAT_Reset_Counter();
+int32_t S3_HLS_H264_PAT_Write_To_Buffer(S3_HLS_PAT_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx);
+void S3_HLS_PAT_Reset_Counter(S3_HLS_PAT_CTX* ctx);
+int8_t S3_HLS_PAT_Get_Counter(S3_HLS_PAT_CTX* ctx);
+void S3_HLS_PAT_Set_Counter(S3_HLS_PAT_CTX* ctx, int8_t counter);
 
 #ifdef __cplusplus
 #if __cplusplus
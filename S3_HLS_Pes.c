@@ -48,14 +48,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <time.h>
 
 #include "S3_HLS_Pes.h"
 #include "S3_HLS_Return_Code.h"
 #include "S3_HLS_H264_Nalu_Types.h"
+#include "S3_HLS_H265_Nalu_Types.h"
+#include "S3_HLS_Nalu_Scanner.h"
+#include "S3_HLS_SPS.h"
+#include "S3_HLS_Memory.h"
 
 #include "S3_HLS_Pat.h"
 #include "S3_HLS_Pmt.h"
 #include "S3_HLS_TS.h"
+#include "S3_HLS_FMP4.h"
 
 //#define S3_HLS_PES_DEBUG
 
@@ -81,18 +87,29 @@
 #define S3_HLS_PES_VIDEO_CODE           0xe0
 #define S3_HLS_PES_AUDIO_CODE           0xc0
 
-static uint8_t video_pes_header[20] = { 0x00, 0x00, 0x01, /* 3 bytes start code of PES */
+// copied to PES header of each muxer by S3_HLS_Pes_Initialize
+static const uint8_t video_pes_header_template[S3_HLS_PES_VIDEO_HEADER_SIZE] = { 0x00, 0x00, 0x01, /* 3 bytes start code of PES */
                                         0xe0, /* Stream type (0xe0) */
                                         0x00, 0x00, /* Packet Length, 0x00, 0x00 for video, data length for audio*/
-                                        0x80, 0x80, /* PTS, DTS flags*/
-                                        0x05, /* PES Header Data Length 5 for 5 bytes of PTS */
+                                        0x80, 0x80, /* PTS, DTS flags, 0xC0 when DTS is written */
+                                        0x05, /* PES Header Data Length 5 for 5 bytes of PTS, 10 with DTS */
                                         0x00, 0x00, 0x00, 0x00, 0x00, /* PTS field */
-                                        // below only for video
+                                        // below only for video, DTS field goes in front of AUD when differs from PTS
                                         0x00, 0x00, 0x00, 0x01, /* H264 Start Code */
-                                        0x09, 0xF0 /* H264 Sequence End */
+                                        0x09, 0xF0, /* H264 Access Unit Delimiter */
+                                        0x00, 0x00, 0x00, 0x00, 0x00, 0x00 /* room for DTS field and longer H265 Access Unit Delimiter */
                                       };
 
-static uint8_t audio_pes_header[14] = { 0x00, 0x00, 0x01, /* 3 bytes start code of PES */
+#define S3_HLS_PES_VIDEO_TIMESTAMP_POS  9
+#define S3_HLS_PES_VIDEO_DTS_POS        14
+
+// start code and AUD put after PES header fields
+static const uint8_t video_aud_template[S3_HLS_PES_AUD_SIZE] = { 0x00, 0x00, 0x00, 0x01, 0x09, 0xF0, 0x00 };
+
+// H265 AUD: nal_unit_type 35 with nuh_temporal_id_plus1 1, pic_type 2 (I, P, B) and stop bit
+static const uint8_t h265_aud[3] = { 0x46, 0x01, 0x50 };
+
+static const uint8_t audio_pes_header_template[S3_HLS_PES_AUDIO_HEADER_SIZE] = { 0x00, 0x00, 0x01, /* 3 bytes start code of PES */
                                         0xc0, /* Stream type (0xc0) */
                                         0x00, 0x00, /* Packet Length, 0x00, 0x00 for video, data length for audio*/
                                         0x80, 0x80, /* PTS, DTS flags*/
@@ -100,74 +117,773 @@ static uint8_t audio_pes_header[14] = { 0x00, 0x00, 0x01, /* 3 bytes start code
                                         0x00, 0x00, 0x00, 0x00, 0x00 /* PTS field */
                                       };
 
-// every 2 video frame packs may need increase if < 20 FPS
-static uint8_t pcr_count = 0;
-static const uint8_t pcr_count_interval = 2;
+#define S3_HLS_PES_DEFAULT_PCR_INTERVAL     40      // ms
+#define S3_HLS_PES_MAX_PCR_INTERVAL         100     // ms, longest gap allowed by ISO/IEC 13818-1
+
+#define S3_HLS_PES_DEFAULT_AUDIO_AGGREGATION    100     // ms
+#define S3_HLS_PES_MAX_AUDIO_AGGREGATION        1000    // ms
+
+/*
+ * What muxer needs to know of a NALU, independent of codec
+ */
+typedef struct s3_hls_pes_nalu_info_s {
+    int32_t parameter_set;      // S3_HLS_PES_PARAMETER_SET_XXX
+    uint8_t random_access;      // H264 IDR, H265 IRAP (BLA, IDR, CRA)
+    uint8_t reference;          // unknown items are treated as reference
+} S3_HLS_PES_NALU_INFO;
+
+#define S3_HLS_PES_START_CODE_SIZE              4       // replaced by NALU length in fMP4
+#define S3_HLS_PES_ADTS_HEADER_SIZE             7       // 9 with CRC
+#define S3_HLS_PES_DEFAULT_FRAME_DURATION       33333   // us, duration of first fMP4 video sample
+
+#define S3_HLS_PES_LENGTH_PREFIXED(ctx)         (S3_HLS_NALU_FORMAT_LENGTH_PREFIXED == (ctx)->nalu_format)
+
+// cached parameter sets always have start code
+static uint8_t annexb_start_code[S3_HLS_PES_START_CODE_SIZE] = { 0x00, 0x00, 0x00, 0x01 };
+
+static const uint32_t adts_sample_rates[16] = { 96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350, 0, 0, 0 };
+
+#define S3_HLS_PES_DEFAULT_TARGET_DURATION      2000    // ms
+#define S3_HLS_PES_MIN_TARGET_DURATION          1000    // ms, object keys have second resolution
+
+// default segment duration and ring size are picked from bitrate expected for picture size and frame rate of SPS
+#define S3_HLS_PES_H264_MILLIBITS_PER_PIXEL     70      // bits per pixel of each frame * 1000, camera scenes with moderate motion
+#define S3_HLS_PES_H265_MILLIBITS_PER_PIXEL     40
+#define S3_HLS_PES_DEFAULT_FRAME_RATE           25      // SPS without timing info
+#define S3_HLS_PES_MIN_SEGMENT_BYTES            (512 * 1024)    // shorter segments at low bitrate cost more in PUT requests than they save in latency
+#define S3_HLS_PES_MAX_DEFAULT_DURATION         6000    // ms
+#define S3_HLS_PES_BUFFER_SEGMENTS              4       // ring holds this many segments at twice expected bitrate
+#define S3_HLS_PES_BUFFER_ALIGNMENT             (1024 * 1024)
+
+#define S3_HLS_PES_MIN_PART_DURATION            100     // ms
+#define S3_HLS_PES_MAX_PART_DURATION            1000    // ms
+
+// overflow handling
+#define S3_HLS_PES_NON_REF_WATERMARK(total)     ((total) / 8 * 7)   // drop non reference frames above this usage
+#define S3_HLS_PES_IDR_ONLY_WATERMARK(total)    ((total) / 2)       // keep IDR only until usage below this
+
+typedef struct s3_hls_pes_mark_s {
+    S3_HLS_BUFFER_MARK buffer_mark;
+    uint32_t program;
+
+    int8_t video_counter;
+    int8_t audio_counter;
+    int8_t pat_counter;
+    int8_t pmt_counters[S3_HLS_MAX_PROGRAMS];
+    uint32_t fmp4_sequence;
+
+    uint8_t psi_needed;
+    uint64_t last_psi_timestamp;
+    uint8_t pcr_written;
+    uint64_t last_pcr_timestamp;
+    uint64_t last_video_timestamp;
+    uint8_t segment_has_sps;
+
+    uint32_t segment_bytes;
+    uint32_t segment_overhead_bytes;
+    uint32_t segment_psi_bytes;
+} S3_HLS_PES_MARK;
+
+void S3_HLS_Pes_Initialize(S3_HLS_PES_CTX* ctx) {
+    memcpy(ctx->video_pes_header, video_pes_header_template, sizeof(video_pes_header_template));
+    ctx->video_pes_header_length = 20;
+    memcpy(ctx->video_aud, video_aud_template, sizeof(video_aud_template));
+    ctx->video_aud_length = 6;
+    memcpy(ctx->audio_pes_header, audio_pes_header_template, sizeof(audio_pes_header_template));
+
+    S3_HLS_PMT_Initialize(&ctx->pmt);
+    ctx->fmp4_sequence = 1;
+
+    ctx->pcr_interval = S3_HLS_PES_DEFAULT_PCR_INTERVAL;
+    ctx->psi_needed = 1;
+
+    ctx->video_codec = S3_HLS_VIDEO_CODEC_H264;
+    ctx->audio_aggregation = S3_HLS_PES_DEFAULT_AUDIO_AGGREGATION;
+    ctx->container = S3_HLS_CONTAINER_TS;
+    ctx->nalu_format = S3_HLS_NALU_FORMAT_ANNEXB;
+
+    ctx->program_count = 1;
+    ctx->segment_target = S3_HLS_PES_DEFAULT_TARGET_DURATION;
+    ctx->segment_target_from_sps = 1;
+
+    ctx->first_call = 1;
+    ctx->overflow_policy = S3_HLS_OVERFLOW_SKIP_GOP;
+}
+
+int32_t S3_HLS_Pes_Allocate_Programs(S3_HLS_PES_CTX* ctx) {
+    if(NULL != ctx->programs)
+        return S3_HLS_INVALID_STATUS;
 
-// every 3 video frame packs
-static uint8_t pat_pmt_count = 0;
-static const uint8_t pat_pmt_interval = 3;
+    ctx->programs = (S3_HLS_PES_PROGRAM*)S3_HLS_Calloc(ctx->program_count, sizeof(S3_HLS_PES_PROGRAM));
+    if(NULL == ctx->programs) {
+        PES_DEBUG("Allocate programs failed!\n");
+        return S3_HLS_OUT_OF_MEMORY;
+    }
 
-// may need to modify according to
-static S3_HLS_H264E_NALU_TYPE_E seperate_nalu_type = S3_HLS_H264E_NALU_SPS;
+    return S3_HLS_OK;
+}
 
-static uint8_t seperate_count = 0;
-static const uint8_t seperate_count_interval = 1; //@_@ xxlang : seperate ts by key frame
+void S3_HLS_Pes_Free_Programs(S3_HLS_PES_CTX* ctx) {
+    S3_HLS_Free(ctx->programs);
+    ctx->programs = NULL;
+}
 
-static uint8_t first_call = 1;
+static int64_t S3_HLS_Pes_Now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
-static uint8_t has_error = 0;
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
 
-int32_t S3_HLS_Pes_Write_Video_Pes(S3_HLS_BUFFER_CTX* buffer_ctx, uint64_t input_timestamp) {
+static void S3_HLS_Pes_Write_Timestamp(uint8_t* field, uint8_t prefix, uint64_t input_timestamp) {
     uint64_t timestamp = input_timestamp / 100 * 9 + 63000;
 
-    video_pes_header[9] = 0x21 | ((timestamp >> 29) & 0x0e);
-    video_pes_header[10] = (timestamp >> 22) & 0xff;
-    video_pes_header[11] = 0x01 | ((timestamp >> 14) & 0xfe);
-    video_pes_header[12] = (timestamp >> 7) & 0xff;
-    video_pes_header[13] = 0x01 | (timestamp & 0xfe);
+    field[0] = prefix | ((timestamp >> 29) & 0x0e);
+    field[1] = (timestamp >> 22) & 0xff;
+    field[2] = 0x01 | ((timestamp >> 14) & 0xfe);
+    field[3] = (timestamp >> 7) & 0xff;
+    field[4] = 0x01 | ((timestamp << 1) & 0xfe);
+}
+
+static void S3_HLS_Pes_Update_Video_Pes(S3_HLS_PES_CTX* ctx, uint64_t pts, uint64_t dts) {
+    uint32_t pos = S3_HLS_PES_VIDEO_DTS_POS;
+
+    if(pts == dts) {
+        ctx->video_pes_header[7] = 0x80;
+        ctx->video_pes_header[8] = 0x05;
+        S3_HLS_Pes_Write_Timestamp(ctx->video_pes_header + S3_HLS_PES_VIDEO_TIMESTAMP_POS, 0x21, pts);
+    } else {
+        ctx->video_pes_header[7] = 0xC0;
+        ctx->video_pes_header[8] = 0x0A;
+        S3_HLS_Pes_Write_Timestamp(ctx->video_pes_header + S3_HLS_PES_VIDEO_TIMESTAMP_POS, 0x31, pts);
+        S3_HLS_Pes_Write_Timestamp(ctx->video_pes_header + S3_HLS_PES_VIDEO_DTS_POS, 0x11, dts);
+        pos += 5;
+    }
+
+    memcpy(ctx->video_pes_header + pos, ctx->video_aud, ctx->video_aud_length);
+    ctx->video_pes_header_length = pos + ctx->video_aud_length;
+}
 
-    return S3_HLS_Put_To_Buffer(buffer_ctx, video_pes_header, sizeof(video_pes_header));
+/*
+ * Decode order timestamp of a frame, all muxing decisions follow it as presentation order may go back with B frames
+ */
+uint64_t S3_HLS_Pes_Decode_Timestamp(S3_HLS_PES_CTX* ctx, S3_HLS_FRAME_ITEM* item) {
+    return ctx->has_decode_timestamp ? item->decode_timestamp : item->timestamp;
 }
 
-int32_t S3_HLS_Pes_Write_Audio_Pes(S3_HLS_BUFFER_CTX* buffer_ctx, uint64_t input_timestamp, uint32_t packet_length) {
-    packet_length += sizeof(audio_pes_header) - 6;
+static void S3_HLS_Pes_Update_Audio_Pes(S3_HLS_PES_CTX* ctx, uint64_t input_timestamp, uint32_t packet_length) {
+    packet_length += sizeof(ctx->audio_pes_header) - 6;
 
-    audio_pes_header[4] = ((packet_length >> 8) & 0xFF);
-    audio_pes_header[5] = (packet_length & 0xFF);
+    ctx->audio_pes_header[4] = ((packet_length >> 8) & 0xFF);
+    ctx->audio_pes_header[5] = (packet_length & 0xFF);
 
     uint64_t timestamp = input_timestamp / 100 * 9 + 63000;
 
-    audio_pes_header[9] = 0x21 | ((timestamp >> 29) & 0x0e);
-    audio_pes_header[10] = (timestamp >> 22) & 0xff;
-    audio_pes_header[11] = 0x01 | ((timestamp >> 14) & 0xfe);
-    audio_pes_header[12] = (timestamp >> 7) & 0xff;
-    audio_pes_header[13] = 0x01 | (timestamp & 0xfe);
+    ctx->audio_pes_header[9] = 0x21 | ((timestamp >> 29) & 0x0e);
+    ctx->audio_pes_header[10] = (timestamp >> 22) & 0xff;
+    ctx->audio_pes_header[11] = 0x01 | ((timestamp >> 14) & 0xfe);
+    ctx->audio_pes_header[12] = (timestamp >> 7) & 0xff;
+    ctx->audio_pes_header[13] = 0x01 | ((timestamp << 1) & 0xfe);
+}
+
+/*
+ * Write frame pack as TS packets, copy payload if release call back is not set, otherwise keep reference
+ */
+static int32_t S3_HLS_Pes_Write_Frame(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, S3_HLS_TS_FRAME* frame, S3_HLS_FRAME_ITEM* items, uint32_t item_count, uint32_t content_length, BUFFER_RELEASE_CALL_BACK release) {
+    frame->items = items;
+    frame->item_count = item_count;
+    frame->content_length = content_length;
+
+    int32_t ret = S3_HLS_TS_Write_Frame(&ctx->ts, buffer_ctx, frame, NULL != release);
+    if(0 > ret)
+        return ret;
+
+    uint32_t length = S3_HLS_TS_Get_Packet_Count(frame) * S3_HLS_TS_PACKET_SIZE;
+    ctx->segment_bytes += length;
+    ctx->segment_overhead_bytes += length - content_length;
+
+    return ret;
+}
+
+/*
+ * Write frame items as one fMP4 fragment, copy payload if release call back is not set, otherwise keep reference
+ */
+static int32_t S3_HLS_Pes_Write_Fragment(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, S3_HLS_FMP4_FRAGMENT* fragment, BUFFER_RELEASE_CALL_BACK release) {
+    uint32_t header_length = 0;
+
+    fragment->sequence = ctx->fmp4_sequence;
+    fragment->length_prefixed = S3_HLS_PES_LENGTH_PREFIXED(ctx);
+
+    int32_t ret = S3_HLS_FMP4_Write_Fragment(buffer_ctx, fragment, NULL != release, &header_length);
+    if(0 > ret)
+        return ret;
+
+    ctx->fmp4_sequence++;
+
+    ctx->segment_bytes += ret;
+    ctx->segment_overhead_bytes += header_length;
+
+    return S3_HLS_OK;
+}
+
+/*
+ * Whether interval_ms passed since last timestamp, timestamp going back (encoder restarted) also counts
+ */
+static uint8_t S3_HLS_Pes_Interval_Passed(uint64_t timestamp, uint64_t last_timestamp, uint32_t interval_ms) {
+    return timestamp < last_timestamp || timestamp - last_timestamp >= (uint64_t)interval_ms * 1000;
+}
+
+static int32_t S3_HLS_Pes_Write_Staged_Audio(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t program, uint8_t can_wait);
+static uint8_t S3_HLS_Pes_Has_Staged_Audio(S3_HLS_PES_CTX* ctx);
+
+/*
+ * Flush segment being written, next segment starts with PAT / PMT and PCR so it can be decoded on its own
+ * Staged audio goes to the end of the segment being closed
+ */
+static int32_t S3_HLS_Pes_Close_Segment(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint8_t can_wait) {
+    for(uint32_t program = 0; program < ctx->program_count; program++)
+        S3_HLS_Pes_Write_Staged_Audio(ctx, buffer_ctx, program, can_wait);
+
+    // partial segments cover the whole segment
+    if(0 != ctx->part_target)
+        S3_HLS_Flush_Partial(buffer_ctx, ctx->part_start_timestamp / 1000);
+
+    int32_t ret = S3_HLS_Flush_Buffer(buffer_ctx);
+    if(0 > ret)
+        return ret;
+
+    if(0 < ctx->segment_bytes) {
+        ctx->mux_info.segments++;
+        ctx->mux_info.last_segment_bytes = ctx->segment_bytes;
+        ctx->mux_info.last_segment_overhead_bytes = ctx->segment_overhead_bytes;
+        ctx->mux_info.last_segment_psi_bytes = ctx->segment_psi_bytes;
+        ctx->mux_info.total_bytes += ctx->segment_bytes;
+        ctx->mux_info.total_overhead_bytes += ctx->segment_overhead_bytes;
+    }
+
+    ctx->segment_bytes = 0;
+    ctx->segment_overhead_bytes = 0;
+    ctx->segment_psi_bytes = 0;
+
+    ctx->psi_needed = 1;
+    for(uint32_t program = 0; program < ctx->program_count; program++) {
+        ctx->programs[program].pcr_written = 0;
+        ctx->programs[program].segment_has_sps = 0;
+    }
+
+    ctx->segment_started = 0;
+    ctx->segment_has_video = 0;
+
+    return ret;
+}
+
+/*
+ * Save muxer and buffer state before writing a frame
+ */
+static void S3_HLS_Pes_Mark(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t program, S3_HLS_PES_MARK* mark) {
+    S3_HLS_PES_PROGRAM* program_ctx = &ctx->programs[program];
+
+    S3_HLS_Mark_Buffer(buffer_ctx, &mark->buffer_mark);
+    mark->program = program;
+
+    mark->video_counter = S3_HLS_TS_Get_Counter(&ctx->ts, S3_HLS_Program_Video_PID(program));
+    mark->audio_counter = S3_HLS_TS_Get_Counter(&ctx->ts, S3_HLS_Program_Audio_PID(program));
+    mark->pat_counter = S3_HLS_PAT_Get_Counter(&ctx->pat);
+    for(uint32_t cnt = 0; cnt < ctx->program_count; cnt++)
+        mark->pmt_counters[cnt] = S3_HLS_PMT_Get_Counter(&ctx->pmt, cnt);
+    mark->fmp4_sequence = ctx->fmp4_sequence;
+
+    mark->psi_needed = ctx->psi_needed;
+    mark->last_psi_timestamp = ctx->last_psi_timestamp;
+    mark->pcr_written = program_ctx->pcr_written;
+    mark->last_pcr_timestamp = program_ctx->last_pcr_timestamp;
+    mark->last_video_timestamp = program_ctx->last_video_timestamp;
+    mark->segment_has_sps = program_ctx->segment_has_sps;
+
+    mark->segment_bytes = ctx->segment_bytes;
+    mark->segment_overhead_bytes = ctx->segment_overhead_bytes;
+    mark->segment_psi_bytes = ctx->segment_psi_bytes;
+}
 
-    return S3_HLS_Put_To_Buffer(buffer_ctx, audio_pes_header, sizeof(audio_pes_header));
+/*
+ * Take back a partially written frame, so buffer only contains whole frames
+ */
+static void S3_HLS_Pes_Rollback(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, S3_HLS_PES_MARK* mark) {
+    S3_HLS_PES_PROGRAM* program_ctx = &ctx->programs[mark->program];
+
+    S3_HLS_Rollback_Buffer(buffer_ctx, &mark->buffer_mark);
+
+    S3_HLS_TS_Set_Counter(&ctx->ts, S3_HLS_Program_Video_PID(mark->program), mark->video_counter);
+    S3_HLS_TS_Set_Counter(&ctx->ts, S3_HLS_Program_Audio_PID(mark->program), mark->audio_counter);
+    S3_HLS_PAT_Set_Counter(&ctx->pat, mark->pat_counter);
+    for(uint32_t cnt = 0; cnt < ctx->program_count; cnt++)
+        S3_HLS_PMT_Set_Counter(&ctx->pmt, cnt, mark->pmt_counters[cnt]);
+    ctx->fmp4_sequence = mark->fmp4_sequence;
+
+    ctx->psi_needed = mark->psi_needed;
+    ctx->last_psi_timestamp = mark->last_psi_timestamp;
+    program_ctx->pcr_written = mark->pcr_written;
+    program_ctx->last_pcr_timestamp = mark->last_pcr_timestamp;
+    program_ctx->last_video_timestamp = mark->last_video_timestamp;
+    program_ctx->segment_has_sps = mark->segment_has_sps;
+
+    ctx->segment_bytes = mark->segment_bytes;
+    ctx->segment_overhead_bytes = mark->segment_overhead_bytes;
+    ctx->segment_psi_bytes = mark->segment_psi_bytes;
 }
 
-int32_t S3_HLS_Pes_Write_Video_Frame(S3_HLS_BUFFER_CTX* buffer_ctx, S3_HLS_FRAME_PACK* pack) {
+/*
+ * Called after a frame is rolled back because buffer is full
+ * Wait for uploader to free some space when policy allows
+ * Return S3_HLS_OK if frame should be written again, otherwise the frame is dropped
+ */
+static int32_t S3_HLS_Pes_Wait_For_Space(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, S3_HLS_PES_MARK* mark, struct timespec* deadline, uint8_t* has_deadline) {
+    if(S3_HLS_OVERFLOW_BLOCK != ctx->overflow_policy && S3_HLS_OVERFLOW_EVICT_OLDEST != ctx->overflow_policy)
+        return S3_HLS_BUFFER_OVERFLOW;
+
+    if(0 == S3_HLS_Get_Flushed_Length(buffer_ctx)) {
+        PES_DEBUG("[Pes] Current segment uses whole buffer, nothing to wait for!\n");
+        return S3_HLS_BUFFER_OVERFLOW;
+    }
+
+    if(!*has_deadline) {
+        clock_gettime(CLOCK_MONOTONIC, deadline);
+        deadline->tv_sec += ctx->overflow_timeout_ms / 1000;
+        deadline->tv_nsec += (ctx->overflow_timeout_ms % 1000) * 1000000;
+        if(deadline->tv_nsec >= 1000000000) {
+            deadline->tv_sec++;
+            deadline->tv_nsec -= 1000000000;
+        }
+
+        *has_deadline = S3_HLS_TRUE;
+    }
+
+    if(S3_HLS_OVERFLOW_EVICT_OLDEST == ctx->overflow_policy)
+        S3_HLS_Set_Evict_Request(buffer_ctx, S3_HLS_TRUE);
+
+    int32_t ret = S3_HLS_Wait_For_Buffer_Space(buffer_ctx, mark->buffer_mark.release_pos, deadline);
+
+    // only evict as much as needed, ask again if frame still does not fit
+    if(S3_HLS_OVERFLOW_EVICT_OLDEST == ctx->overflow_policy)
+        S3_HLS_Set_Evict_Request(buffer_ctx, S3_HLS_FALSE);
+
+    if(S3_HLS_OK != ret) {
+        PES_DEBUG("[Pes] Wait for buffer space timeout!\n");
+        ctx->drop_counters.block_timeouts++;
+        return ret;
+    }
+
+    S3_HLS_Pes_Mark(ctx, buffer_ctx, mark->program, mark); // pick up new uploader position
+
+    return S3_HLS_OK;
+}
+
+static void S3_HLS_Pes_Nalu_Info(S3_HLS_PES_CTX* ctx, S3_HLS_FRAME_ITEM* item, S3_HLS_PES_NALU_INFO* info) {
+    info->parameter_set = S3_HLS_PES_PARAMETER_SET_NONE;
+
+    if(S3_HLS_VIDEO_CODEC_H265 == ctx->video_codec) {
+        S3_HLS_H265E_NALU_TYPE_E type = S3_HLS_H265_Nalu_Type(item, S3_HLS_PES_LENGTH_PREFIXED(ctx));
+        PES_DEBUG("[Pes - Video] Nalu: %d\n", type);
+
+        if(S3_HLS_H265E_NALU_VPS == type)
+            info->parameter_set = S3_HLS_PES_PARAMETER_SET_VPS;
+        else if(S3_HLS_H265E_NALU_SPS == type)
+            info->parameter_set = S3_HLS_PES_PARAMETER_SET_SPS;
+        else if(S3_HLS_H265E_NALU_PPS == type)
+            info->parameter_set = S3_HLS_PES_PARAMETER_SET_PPS;
+
+        info->random_access = S3_HLS_H265_Is_Random_Access(type);
+        info->reference = (0 != S3_HLS_H265_Nalu_Is_Reference(item, S3_HLS_PES_LENGTH_PREFIXED(ctx)));
+        return;
+    }
+
+    S3_HLS_H264E_NALU_TYPE_E type = S3_HLS_H264_Nalu_Type(item, S3_HLS_PES_LENGTH_PREFIXED(ctx));
+    PES_DEBUG("[Pes - Video] Nalu: %d\n", type);
+
+    if(S3_HLS_H264E_NALU_SPS == type)
+        info->parameter_set = S3_HLS_PES_PARAMETER_SET_SPS;
+    else if(S3_HLS_H264E_NALU_PPS == type)
+        info->parameter_set = S3_HLS_PES_PARAMETER_SET_PPS;
+
+    info->random_access = (S3_HLS_H264E_NALU_IDR == type);
+    info->reference = (0 != S3_HLS_H264_Nalu_Ref_Idc(item, S3_HLS_PES_LENGTH_PREFIXED(ctx)));
+}
+
+static void S3_HLS_Pes_Set_Item(S3_HLS_FRAME_ITEM* item, uint8_t* data, uint32_t length, uint64_t timestamp) {
+    item->first_part_start = data;
+    item->first_part_length = length;
+    item->second_part_start = NULL;
+    item->second_part_length = 0;
+    item->timestamp = timestamp;
+}
+
+/*
+ * Whether every parameter set the codec needs in front of a key frame is cached
+ */
+static uint8_t S3_HLS_Pes_Has_Parameter_Sets(S3_HLS_PES_CTX* ctx, S3_HLS_PES_PROGRAM* program_ctx) {
+    uint32_t first_set = S3_HLS_VIDEO_CODEC_H265 == ctx->video_codec ? S3_HLS_PES_PARAMETER_SET_VPS : S3_HLS_PES_PARAMETER_SET_SPS;
+
+    for(uint32_t set = first_set; set < S3_HLS_PES_PARAMETER_SET_COUNT; set++) {
+        if(0 == program_ctx->parameter_set_lengths[set])
+            return S3_HLS_FALSE;
+    }
+
+    return S3_HLS_TRUE;
+}
+
+/*
+ * Keep a copy of VPS / SPS / PPS item, parameter sets larger than cache are not kept
+ */
+static void S3_HLS_Pes_Cache_Parameter_Set(uint8_t* cache, uint32_t* cache_length, S3_HLS_FRAME_ITEM* item, uint8_t length_prefixed) {
+    // cached copy is put in front of frames of either format, it always has 4 bytes start code
+    uint32_t skip = S3_HLS_Nalu_Start_Code_Length(item, length_prefixed);
+    uint32_t length = item->first_part_length + item->second_part_length - skip + S3_HLS_PES_START_CODE_SIZE;
+    if(S3_HLS_PES_MAX_PARAMETER_SET < length) {
+        *cache_length = 0;
+        return;
+    }
+
+    memcpy(cache, annexb_start_code, sizeof(annexb_start_code));
+    cache += sizeof(annexb_start_code);
+
+    if(skip < item->first_part_length) {
+        memcpy(cache, item->first_part_start + skip, item->first_part_length - skip);
+        cache += item->first_part_length - skip;
+        skip = 0;
+    } else {
+        skip -= item->first_part_length;
+    }
+
+    if(0 < item->second_part_length)
+        memcpy(cache, item->second_part_start + skip, item->second_part_length - skip);
+
+    *cache_length = length;
+}
+
+/*
+ * Parse SPS just cached for program, for program 0 also pick segment duration and raise elastic buffer floor from it
+ */
+static void S3_HLS_Pes_Update_Video_Info(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t program, S3_HLS_PES_PROGRAM* program_ctx) {
+    uint32_t length = program_ctx->parameter_set_lengths[S3_HLS_PES_PARAMETER_SET_SPS];
+    if(S3_HLS_PES_START_CODE_SIZE >= length)
+        return;
+
+    S3_HLS_VIDEO_INFO* info = &program_ctx->video_info;
+    if(S3_HLS_OK != S3_HLS_SPS_Parse(ctx->video_codec, program_ctx->parameter_sets[S3_HLS_PES_PARAMETER_SET_SPS] + S3_HLS_PES_START_CODE_SIZE, length - S3_HLS_PES_START_CODE_SIZE, info)) {
+        PES_DEBUG("[Pes - Video] Failed to parse SPS of program %u!\n", program);
+        return;
+    }
+
+    program_ctx->has_video_info = S3_HLS_TRUE;
+
+    uint64_t frame_rate_milli = 0 < info->frame_rate_den ? (uint64_t)info->frame_rate_num * 1000 / info->frame_rate_den : 0;
+    if(0 == frame_rate_milli || 1000 * 1000 < frame_rate_milli) // timing info missing or not a frame rate
+        frame_rate_milli = S3_HLS_PES_DEFAULT_FRAME_RATE * 1000;
+
+    uint64_t millibits = S3_HLS_VIDEO_CODEC_H265 == ctx->video_codec ? S3_HLS_PES_H265_MILLIBITS_PER_PIXEL : S3_HLS_PES_H264_MILLIBITS_PER_PIXEL;
+    uint64_t bitrate = (uint64_t)info->width * info->height * frame_rate_milli / 1000 * millibits / 1000;
+    if(0 == bitrate)
+        bitrate = 1;
+
+    info->bitrate_estimate = bitrate > UINT32_MAX ? UINT32_MAX : (uint32_t)bitrate;
+
+    // whole seconds long enough for minimum segment size
+    uint64_t duration = ((uint64_t)S3_HLS_PES_MIN_SEGMENT_BYTES * 8 * 1000 / bitrate + 999) / 1000 * 1000;
+    if(S3_HLS_PES_DEFAULT_TARGET_DURATION > duration)
+        duration = S3_HLS_PES_DEFAULT_TARGET_DURATION;
+
+    if(S3_HLS_PES_MAX_DEFAULT_DURATION < duration)
+        duration = S3_HLS_PES_MAX_DEFAULT_DURATION;
+
+    info->segment_duration_ms = (uint32_t)duration;
+
+    uint64_t buffer_size = bitrate * 2 / 8 * duration / 1000 * S3_HLS_PES_BUFFER_SEGMENTS;
+    buffer_size = (buffer_size + S3_HLS_PES_BUFFER_ALIGNMENT - 1) / S3_HLS_PES_BUFFER_ALIGNMENT * S3_HLS_PES_BUFFER_ALIGNMENT;
+    info->buffer_size = buffer_size > UINT32_MAX / 2 ? UINT32_MAX / 2 : (uint32_t)buffer_size;
+
+    if(0 != program)
+        return;
+
+    if(ctx->segment_target_from_sps)
+        ctx->segment_target = info->segment_duration_ms;
+
+    // fixed buffer keeps its size, buffer_size is only reported
+    S3_HLS_Set_Buffer_Floor(buffer_ctx, info->buffer_size);
+}
+
+/*
+ * Hand out data written since last partial segment with staged audio, segment being written goes on
+ * Next partial segment starts with PAT / PMT and parameter sets like a segment
+ */
+static int32_t S3_HLS_Pes_Close_Part(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx) {
+    for(uint32_t program = 0; program < ctx->program_count; program++)
+        S3_HLS_Pes_Write_Staged_Audio(ctx, buffer_ctx, program, S3_HLS_TRUE);
+
+    int32_t ret = S3_HLS_Flush_Partial(buffer_ctx, ctx->part_start_timestamp / 1000);
+    if(0 > ret)
+        return ret;
+
+    ctx->psi_needed = 1;
+    for(uint32_t program = 0; program < ctx->program_count; program++)
+        ctx->programs[program].segment_has_sps = 0;
+
+    return S3_HLS_OK;
+}
+
+/*
+ * Duration segments are cut at, grows with closed segments waiting behind the one being uploaded
+ */
+static uint32_t S3_HLS_Pes_Target_Duration(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx) {
+    if(ctx->segment_max_target <= ctx->segment_target)
+        return ctx->segment_target;
+
+    uint64_t target = (uint64_t)ctx->segment_target * S3_HLS_Get_Flushed_Parts(buffer_ctx);
+    if(target < ctx->segment_target)
+        return ctx->segment_target;
+
+    return target > ctx->segment_max_target ? ctx->segment_max_target : (uint32_t)target;
+}
+
+/*
+ * Frame of program 0 is about to be written, cut segment in front of it when it is due
+ * Key frames cut once target duration passed, segments without video (audio only) are cut by time
+ */
+static int32_t S3_HLS_Pes_Split_Segment(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint64_t timestamp, uint64_t frame_duration, uint8_t is_video, uint8_t has_sps, uint8_t random_access) {
+    int32_t ret = S3_HLS_OK;
+    uint8_t need_cut = S3_HLS_FALSE;
+
+    if(0 == ctx->segment_target) {
+        need_cut = has_sps;
+    } else if(ctx->segment_started && (is_video ? (has_sps || random_access) : !ctx->segment_has_video)) {
+        uint32_t target = S3_HLS_Pes_Target_Duration(ctx, buffer_ctx);
+        ctx->mux_info.target_duration_ms = target;
+
+        // one frame early is fine, waiting for the next key frame would be a whole GOP late
+        need_cut = S3_HLS_Pes_Interval_Passed(timestamp + frame_duration, ctx->segment_start_timestamp, target);
+    }
+
+    if(need_cut && (0 < buffer_ctx->pending_length || S3_HLS_Pes_Has_Staged_Audio(ctx))) {
+        PES_DEBUG("[Pes] Need Seperate\n");
+        ret = S3_HLS_Pes_Close_Segment(ctx, buffer_ctx, S3_HLS_TRUE);
+        if(0 > ret) {
+            PES_DEBUG("[Pes] Flush Buffer Failed!\n");
+            return ret;
+        }
+    }
+
+    if(!ctx->segment_started) {
+        ctx->segment_started = 1;
+        ctx->segment_start_timestamp = timestamp;
+    }
+
+    // partial segment starts at a key frame, or at any frame of a segment without video, so it can be played on its own
+    if(0 != ctx->part_target && (is_video ? (has_sps || random_access) : !ctx->segment_has_video)) {
+        if(0 < S3_HLS_Get_Partial_Pending_Length(buffer_ctx) && S3_HLS_Pes_Interval_Passed(timestamp + frame_duration, ctx->part_start_timestamp, ctx->part_target)) {
+            ret = S3_HLS_Pes_Close_Part(ctx, buffer_ctx);
+            if(0 > ret)
+                return ret;
+        }
+
+        if(0 == S3_HLS_Get_Partial_Pending_Length(buffer_ctx))
+            ctx->part_start_timestamp = timestamp;
+    }
+
+    if(is_video)
+        ctx->segment_has_video = 1;
+
+    return ret;
+}
+
+/*
+ * Write video frame as one fMP4 fragment with one sample, pts and dts are input timestamps
+ */
+static int32_t S3_HLS_Pes_Write_Video_Fragment(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, S3_HLS_FRAME_ITEM* items, uint32_t item_count, uint64_t pts, uint64_t dts, uint64_t frame_duration, uint8_t random_access, BUFFER_RELEASE_CALL_BACK release) {
+    S3_HLS_FMP4_FRAGMENT fragment;
+
+    fragment.track_id = S3_HLS_FMP4_VIDEO_TRACK_ID;
+    fragment.base_decode_time = dts / 100 * 9;
+
+    // next frame is not known yet, assume it comes after the same interval as this one, tfdt of next fragment corrects it
+    fragment.sample_duration = (0 < frame_duration ? frame_duration : S3_HLS_PES_DEFAULT_FRAME_DURATION) / 100 * 9;
+    fragment.composition_offset = pts / 100 * 9 - dts / 100 * 9;
+    fragment.random_access = random_access;
+
+    // start code of each item is replaced by 4 bytes NALU length
+    fragment.sample_count = 1;
+    fragment.sample_sizes[0] = 0;
+    for(uint32_t cnt = 0; cnt < item_count; cnt++)
+        fragment.sample_sizes[0] += items[cnt].first_part_length + items[cnt].second_part_length - S3_HLS_Nalu_Start_Code_Length(&items[cnt], S3_HLS_PES_LENGTH_PREFIXED(ctx)) + S3_HLS_PES_START_CODE_SIZE;
+
+    fragment.items = items;
+    fragment.item_count = item_count;
+
+    return S3_HLS_Pes_Write_Fragment(ctx, buffer_ctx, &fragment, release);
+}
+
+/*
+ * Write fMP4 init segment from parameter sets of program 0 and flush it as a part of its own
+ */
+static int32_t S3_HLS_Pes_Write_Init(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx) {
+    S3_HLS_PES_PROGRAM* program_ctx = &ctx->programs[0];
+    S3_HLS_FMP4_INIT init;
+
+    // cached parameter sets start with 4 bytes start code
+    uint32_t* lengths = program_ctx->parameter_set_lengths;
+    init.video_codec = ctx->video_codec;
+    init.vps = program_ctx->parameter_sets[S3_HLS_PES_PARAMETER_SET_VPS] + S3_HLS_PES_START_CODE_SIZE;
+    init.vps_length = 0 < lengths[S3_HLS_PES_PARAMETER_SET_VPS] ? lengths[S3_HLS_PES_PARAMETER_SET_VPS] - S3_HLS_PES_START_CODE_SIZE : 0;
+    init.sps = program_ctx->parameter_sets[S3_HLS_PES_PARAMETER_SET_SPS] + S3_HLS_PES_START_CODE_SIZE;
+    init.sps_length = lengths[S3_HLS_PES_PARAMETER_SET_SPS] - S3_HLS_PES_START_CODE_SIZE;
+    init.pps = program_ctx->parameter_sets[S3_HLS_PES_PARAMETER_SET_PPS] + S3_HLS_PES_START_CODE_SIZE;
+    init.pps_length = lengths[S3_HLS_PES_PARAMETER_SET_PPS] - S3_HLS_PES_START_CODE_SIZE;
+    init.video_info = &program_ctx->video_info;
+
+    init.has_audio = ctx->fmp4_has_audio_config;
+    memcpy(init.audio_config, ctx->fmp4_audio_config, sizeof(init.audio_config));
+    init.audio_sample_rate = ctx->fmp4_audio_sample_rate;
+    init.audio_channels = ctx->fmp4_audio_channels;
+
+    int32_t ret = S3_HLS_FMP4_Write_Init(buffer_ctx, &init);
+    if(0 > ret) {
+        PES_DEBUG("[Pes - Video] Write Init Segment Failed!\n");
+        return ret;
+    }
+
+    S3_HLS_Set_Init_Part(buffer_ctx);
+
+    ret = S3_HLS_Flush_Buffer(buffer_ctx);
+    if(0 > ret)
+        return ret;
+
+    ctx->fmp4_init_written = 1;
+
+    return S3_HLS_OK;
+}
+
+/*
+ * Write TS packets of a video frame pack, content_length is length of all frame items
+ */
+static int32_t S3_HLS_Pes_Write_Video_Packets(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t program, S3_HLS_FRAME_ITEM* frame_items, uint32_t frame_item_count, uint32_t content_length, uint8_t random_access, uint8_t has_sps, BUFFER_RELEASE_CALL_BACK release) {
+    int32_t ret;
+    S3_HLS_PES_PROGRAM* program_ctx = &ctx->programs[program];
+    uint64_t timestamp = S3_HLS_Pes_Decode_Timestamp(ctx, &frame_items[0]);
+
+    S3_HLS_FRAME_ITEM* items = frame_items;
+    uint32_t item_count = frame_item_count;
+    S3_HLS_FRAME_ITEM parameter_set_items[S3_HLS_PES_PARAMETER_SET_COUNT + S3_HLS_NALU_MAX_PER_ACCESS_UNIT];
+
+    // segment starting at a key frame without parameter sets cannot be decoded on its own
+    uint32_t first_set = S3_HLS_VIDEO_CODEC_H265 == ctx->video_codec ? S3_HLS_PES_PARAMETER_SET_VPS : S3_HLS_PES_PARAMETER_SET_SPS;
+
+    // length prefixed sources usually carry parameter sets once, every key frame gets them
+    uint8_t needs_sps = S3_HLS_NALU_FORMAT_LENGTH_PREFIXED == ctx->nalu_format || !program_ctx->segment_has_sps;
+    if(random_access && !has_sps && needs_sps && S3_HLS_Pes_Has_Parameter_Sets(ctx, program_ctx)) {
+        PES_DEBUG("[Pes - Video] Put cached parameter sets before key frame\n");
+        uint32_t set_count = 0;
+        for(uint32_t set = first_set; set < S3_HLS_PES_PARAMETER_SET_COUNT; set++) {
+            S3_HLS_Pes_Set_Item(&parameter_set_items[set_count++], program_ctx->parameter_sets[set], program_ctx->parameter_set_lengths[set], timestamp);
+            content_length += program_ctx->parameter_set_lengths[set];
+        }
+
+        memcpy(parameter_set_items + set_count, frame_items, item_count * sizeof(S3_HLS_FRAME_ITEM));
+
+        items = parameter_set_items;
+        item_count += set_count;
+        release = NULL; // cache may change before segment is uploaded, copy this frame
+
+        has_sps = S3_HLS_TRUE;
+    }
+
+    if(has_sps)
+        program_ctx->segment_has_sps = 1;
+
+    uint64_t frame_duration = timestamp > program_ctx->last_video_timestamp ? timestamp - program_ctx->last_video_timestamp : 0;
+    program_ctx->last_video_timestamp = timestamp;
+
+    if(S3_HLS_CONTAINER_FMP4 == ctx->container)
+        return S3_HLS_Pes_Write_Video_Fragment(ctx, buffer_ctx, items, item_count, frame_items[0].timestamp, timestamp, frame_duration, random_access, release);
+
+    // decide whether write pat & pmt
+    if(ctx->psi_needed || (0 != ctx->psi_interval && S3_HLS_Pes_Interval_Passed(timestamp, ctx->last_psi_timestamp, ctx->psi_interval))) {
+        ret = S3_HLS_H264_PAT_Write_To_Buffer(&ctx->pat, buffer_ctx);
+        if(0 > ret) {
+            PES_DEBUG("[Pes - Video] Write PAT Failed!\n");
+            return ret;
+        }
+
+        for(uint32_t cnt = 0; cnt < ctx->program_count; cnt++) {
+            ret = S3_HLS_H264_PMT_Write_To_Buffer(&ctx->pmt, buffer_ctx, cnt);
+            if(0 > ret) {
+                PES_DEBUG("[Pes - Video] Write PMT Failed!\n");
+                return ret;
+            }
+        }
+
+        ctx->segment_bytes += (1 + ctx->program_count) * S3_HLS_TS_PACKET_SIZE;
+        ctx->segment_overhead_bytes += (1 + ctx->program_count) * S3_HLS_TS_PACKET_SIZE;
+        ctx->segment_psi_bytes += (1 + ctx->program_count) * S3_HLS_TS_PACKET_SIZE;
+
+        ctx->psi_needed = 0;
+        ctx->last_psi_timestamp = timestamp;
+    }
+
+    // put PCR on this frame if waiting for next one would make the gap longer than interval
+    uint8_t has_pcr = !program_ctx->pcr_written || S3_HLS_Pes_Interval_Passed(timestamp + frame_duration, program_ctx->last_pcr_timestamp, ctx->pcr_interval);
+    if(has_pcr) {
+        program_ctx->pcr_written = 1;
+        program_ctx->last_pcr_timestamp = timestamp;
+    }
+
+    S3_HLS_Pes_Update_Video_Pes(ctx, frame_items[0].timestamp, timestamp);
+
+    S3_HLS_TS_FRAME frame;
+    frame.pid = S3_HLS_Program_Video_PID(program);
+    frame.random_access = random_access;
+    frame.has_pcr = has_pcr;
+    frame.pcr_timestamp = timestamp; // PCR must not pass DTS
+    frame.pes_header = ctx->video_pes_header;
+    frame.pes_header_length = ctx->video_pes_header_length;
+    frame.item_prefix = S3_HLS_NALU_FORMAT_LENGTH_PREFIXED == ctx->nalu_format ? annexb_start_code : NULL;
+    frame.item_prefix_length = sizeof(annexb_start_code);
+
+    PES_DEBUG("[Pes - Video] Write TS Packets %d\n", content_length);
+    return S3_HLS_Pes_Write_Frame(ctx, buffer_ctx, &frame, items, item_count, content_length, release);
+}
+
+static int32_t S3_HLS_Pes_Write_Video(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t program, S3_HLS_FRAME_PACK* pack, BUFFER_RELEASE_CALL_BACK release, void* user_data) {
     int32_t ret = S3_HLS_OK;
 
     uint8_t random_access = S3_HLS_FALSE;
-    uint8_t has_pcr = S3_HLS_FALSE;
+    uint8_t has_sps = S3_HLS_FALSE;
+    uint8_t is_reference = S3_HLS_FALSE;
     uint32_t content_length = 0;
 
-    if(0 == pack->item_count) {
-        PES_DEBUG("[Pes - Video] Invalid Packet Count!\n");
+    // items may hold whole access units, frame is classified by each NALU in them
+    S3_HLS_FRAME_ITEM nalus[S3_HLS_NALU_MAX_PER_ACCESS_UNIT];
+    uint32_t nalu_count = 0;
+
+    if(0 == pack->item_count || NULL == ctx->programs || ctx->program_count <= program || (ctx->has_decode_timestamp && pack->items[0].decode_timestamp > pack->items[0].timestamp)) {
+        PES_DEBUG("[Pes - Video] Invalid Packet Count or Timestamp!\n");
+        S3_HLS_Release_Ref_In_Buffer(NULL, 0, release, user_data);
         return S3_HLS_INVALID_PARAMETER;
     }
 
+    S3_HLS_PES_PROGRAM* program_ctx = &ctx->programs[program];
+
     if (0 != S3_HLS_Lock_Buffer(buffer_ctx)) {// lock failed
         PES_DEBUG("[Pes - Video] Lock Buffer Failed!\n");
+        S3_HLS_Release_Ref_In_Buffer(NULL, 0, release, user_data);
         return S3_HLS_LOCK_FAILED;
     }
 
-    if(first_call) {
+    uint32_t ref_mark = buffer_ctx->ref_total;
+
+    ctx->last_frame_time = S3_HLS_Pes_Now();
+
+    if(ctx->first_call) {
         PES_DEBUG("[Pes - Video] First Call Flush Buffer!\n");
         S3_HLS_Flush_Buffer(buffer_ctx); // only update last timestamp
-        first_call = 0;
+        ctx->first_call = 0;
     }
 
     for(uint32_t cnt = 0; cnt < pack->item_count; cnt++) {
@@ -176,190 +892,433 @@ int32_t S3_HLS_Pes_Write_Video_Frame(S3_HLS_BUFFER_CTX* buffer_ctx, S3_HLS_FRAME
             goto l_exit;
         }
 
-        S3_HLS_H264E_NALU_TYPE_E frame_type = S3_HLS_H264_Nalu_Type(&pack->items[cnt]);
-        if(seperate_nalu_type == frame_type) {
-            PES_DEBUG("[Pes - Video] Nalu: %d\n", frame_type);
-            if(seperate_count_interval == seperate_count) {
-                PES_DEBUG("[Pes - Video] Need Seperate\n");
-                has_error = 0;
-                ret = S3_HLS_Flush_Buffer(buffer_ctx);
-                if(0 > ret) {
-                    PES_DEBUG("[Pes - Video] Flush Buffer Failed!\n");
-                    goto l_exit;
-                }
-
-                seperate_count = 0;
-                pat_pmt_count = 0;
-            }
+        int32_t count;
+        if(S3_HLS_NALU_FORMAT_LENGTH_PREFIXED == ctx->nalu_format)
+            count = S3_HLS_Nalu_Split_Length_Prefixed(&pack->items[cnt], nalus + nalu_count, S3_HLS_NALU_MAX_PER_ACCESS_UNIT - nalu_count);
+        else
+            count = S3_HLS_Nalu_Split(&pack->items[cnt], nalus + nalu_count, S3_HLS_NALU_MAX_PER_ACCESS_UNIT - nalu_count);
 
-            seperate_count++;
+        // start code or length is replaced when writing, it must be there to be replaced
+        // fMP4 and length prefixed TS write every NALU on its own, Annex-B TS writes items as they are and classifies as many NALUs as fit
+        if((S3_HLS_CONTAINER_FMP4 == ctx->container || S3_HLS_NALU_FORMAT_LENGTH_PREFIXED == ctx->nalu_format) && (0 > count || S3_HLS_NALU_MAX_PER_ACCESS_UNIT - nalu_count < (uint32_t)count)) {
+            ret = S3_HLS_INVALID_PARAMETER;
+            goto l_exit;
         }
 
-        if(S3_HLS_H264E_NALU_IDR == frame_type) {
-            random_access = S3_HLS_TRUE;
+        uint32_t filled = 0 > count ? 0 : (uint32_t)count;
+        if(filled > S3_HLS_NALU_MAX_PER_ACCESS_UNIT - nalu_count)
+            filled = S3_HLS_NALU_MAX_PER_ACCESS_UNIT - nalu_count;
+
+        for(uint32_t end = nalu_count + filled; nalu_count < end; nalu_count++) {
+            S3_HLS_PES_NALU_INFO info;
+            S3_HLS_Pes_Nalu_Info(ctx, &nalus[nalu_count], &info);
+
+            if(S3_HLS_PES_PARAMETER_SET_NONE != info.parameter_set)
+                S3_HLS_Pes_Cache_Parameter_Set(program_ctx->parameter_sets[info.parameter_set], &program_ctx->parameter_set_lengths[info.parameter_set], &nalus[nalu_count], S3_HLS_PES_LENGTH_PREFIXED(ctx));
+
+            if(S3_HLS_PES_PARAMETER_SET_SPS == info.parameter_set)
+                S3_HLS_Pes_Update_Video_Info(ctx, buffer_ctx, program, program_ctx);
+
+            if(S3_HLS_PES_PARAMETER_SET_SPS == info.parameter_set || S3_HLS_PES_PARAMETER_SET_VPS == info.parameter_set)
+                has_sps = S3_HLS_TRUE;
+
+            if(info.random_access)
+                random_access = S3_HLS_TRUE;
+
+            if(info.reference)
+                is_reference = S3_HLS_TRUE;
         }
 
         content_length += pack->items[cnt].first_part_length + pack->items[cnt].second_part_length;
     }
 
+    // key frame does not depend on frames skipped before it
+    if(has_sps || random_access)
+        program_ctx->has_error = 0;
+
+    // frames before init segment cannot be played, wait for a key frame with everything init segment needs, picture size comes from parsed SPS
+    if(S3_HLS_CONTAINER_FMP4 == ctx->container && !ctx->fmp4_init_written) {
+        if(!random_access || !S3_HLS_Pes_Has_Parameter_Sets(ctx, program_ctx) || !program_ctx->has_video_info || (1 == ctx->audio_format && !ctx->fmp4_has_audio_config)) {
+            ctx->drop_counters.skipped_frames++;
+            goto l_exit;
+        }
+
+        ret = S3_HLS_Pes_Write_Init(ctx, buffer_ctx);
+        if(0 > ret)
+            goto l_exit;
+    }
+
+    // other programs follow segments of program 0
+    uint64_t timestamp = S3_HLS_Pes_Decode_Timestamp(ctx, &pack->items[0]);
+    if(0 == program) {
+        uint64_t frame_duration = timestamp > program_ctx->last_video_timestamp ? timestamp - program_ctx->last_video_timestamp : 0;
+
+        ret = S3_HLS_Pes_Split_Segment(ctx, buffer_ctx, timestamp, frame_duration, S3_HLS_TRUE, has_sps, random_access);
+        if(0 > ret)
+            goto l_exit;
+    }
+
+    uint8_t segment_empty = (0 == buffer_ctx->pending_length);
+
     PES_DEBUG("[Pes - Video] Video Stream Length %d\n", content_length);
-    if(has_error) {
+    if(program_ctx->has_error) {
         PES_DEBUG("[pes - Video] Prev error detected, skip until next sperate frame!\n");
+        ctx->drop_counters.skipped_frames++;
         goto l_exit;
     }
-    content_length += sizeof(video_pes_header); // calculate total length
 
-    // decide whether write pat & pmt
-    if(0 == pat_pmt_count) {
-        ret = S3_HLS_H264_PAT_Write_To_Buffer(buffer_ctx);
-        if(0 > ret) {
-            has_error = 1;
-            PES_DEBUG("[Pes - Video] Write PAT Failed!\n");
+    if(ctx->idr_only) {
+        if(!random_access) {
+            ctx->drop_counters.non_idr_frames++;
             goto l_exit;
         }
 
-        ret = S3_HLS_H264_PMT_Write_To_Buffer(buffer_ctx);
-        if(0 > ret) {
-            has_error = 1;
-            PES_DEBUG("[Pes - Video] Write PAT Failed!\n");
-            goto l_exit;
+        if(S3_HLS_Get_Used_Length(buffer_ctx) < S3_HLS_PES_IDR_ONLY_WATERMARK(buffer_ctx->total_length)) {
+            PES_DEBUG("[Pes - Video] Buffer drained, back to all frames!\n");
+            ctx->idr_only = 0; // resume from this IDR
         }
     }
 
-    // update counter
-    pat_pmt_count++;
-    if(pat_pmt_interval == pat_pmt_count) {
-        pat_pmt_count = 0;
+    if(S3_HLS_OVERFLOW_DROP_NON_REF == ctx->overflow_policy && !is_reference && S3_HLS_Get_Used_Length(buffer_ctx) > S3_HLS_PES_NON_REF_WATERMARK(buffer_ctx->total_length)) {
+        // keep the remaining room for frames others depend on
+        ctx->drop_counters.non_ref_frames++;
+        goto l_exit;
     }
 
-    if(0 == pcr_count) {
-        has_pcr = S3_HLS_TRUE;
-        pcr_count++;
-        if(pcr_count_interval == pcr_count) {
-            pcr_count = 0;
-        }
-    }
+    // keep audio within aggregation interval of video
+    if(0 < program_ctx->audio_stage_frames && timestamp >= program_ctx->audio_stage_first_timestamp && timestamp - program_ctx->audio_stage_first_timestamp >= (uint64_t)ctx->audio_aggregation * 1000)
+        S3_HLS_Pes_Write_Staged_Audio(ctx, buffer_ctx, program, S3_HLS_TRUE);
 
-    S3_HLS_TS_Set_Pid(S3_HLS_Video_PID);
+    S3_HLS_PES_MARK mark;
+    S3_HLS_Pes_Mark(ctx, buffer_ctx, program, &mark);
 
-    S3_HLS_TS_Set_Payload_Start();
+    uint32_t frame_offset = S3_HLS_Get_Pending_Length(buffer_ctx); // PAT / PMT written with frame are in its range
 
-    if(random_access) {
-        S3_HLS_TS_Set_Random_Access();
-    }
+    struct timespec deadline;
+    uint8_t has_deadline = S3_HLS_FALSE;
 
-    if(has_pcr) {
-        S3_HLS_TS_Set_PCR(pack->items[0].timestamp);
-    }
+    // fMP4 needs a length in front of each NALU and TS a start code in place of each length, Annex-B TS keeps items as they are
+    uint8_t per_nalu = S3_HLS_CONTAINER_FMP4 == ctx->container || S3_HLS_NALU_FORMAT_LENGTH_PREFIXED == ctx->nalu_format;
+    S3_HLS_FRAME_ITEM* frame_items = per_nalu ? nalus : pack->items;
+    uint32_t frame_item_count = per_nalu ? nalu_count : pack->item_count;
 
-    S3_HLS_TS_Fill_Remaining_Length(content_length);
+    while(0 > (ret = S3_HLS_Pes_Write_Video_Packets(ctx, buffer_ctx, program, frame_items, frame_item_count, content_length, random_access, has_sps, release))) {
+        S3_HLS_Pes_Rollback(ctx, buffer_ctx, &mark);
 
-    PES_DEBUG("[Pes - Video] Write TS Header %d\n", content_length);
-    // write TS header
-    ret = S3_HLS_TS_Write_To_Buffer(buffer_ctx);
+        if(S3_HLS_BUFFER_OVERFLOW != ret) {
+            program_ctx->has_error = 1;
+            goto l_exit;
+        }
 
-    if(0 > ret) { // write error
-        has_error = 1;
-        goto l_exit;
-    }
+        if(S3_HLS_OK == S3_HLS_Pes_Wait_For_Space(ctx, buffer_ctx, &mark, &deadline, &has_deadline))
+            continue;
 
-    uint32_t remaining = S3_HLS_TS_PACKET_SIZE - ret;
-    PES_DEBUG("[Pes - Video] Remaining Size %d\n", remaining);
+        ret = S3_HLS_BUFFER_OVERFLOW;
 
-    // write PES info
-    ret = S3_HLS_Pes_Write_Video_Pes(buffer_ctx, pack->items[0].timestamp);
-    if(0 > ret) {
-        has_error = 1;
+        if(S3_HLS_OVERFLOW_DROP_NON_REF == ctx->overflow_policy && !is_reference) {
+            ctx->drop_counters.non_ref_frames++;
+            goto l_exit;
+        }
+
+        if(S3_HLS_OVERFLOW_IDR_ONLY == ctx->overflow_policy) {
+            PES_DEBUG("[Pes - Video] Buffer full, keep IDR only!\n");
+            ctx->idr_only = 1;
+            if(!random_access) {
+                ctx->drop_counters.non_idr_frames++;
+                goto l_exit;
+            }
+        }
+
+        // following frames depend on this one, skip until next seperate frame
+        program_ctx->has_error = 1;
+        ctx->drop_counters.skipped_frames++;
         goto l_exit;
     }
 
-    remaining -= ret;
-    content_length -= ret;
+    if(segment_empty)
+        ctx->segment_start_time = ctx->last_frame_time;
 
-    uint32_t packet_index = 0;
-    uint32_t packet_pos = 0;
+    // index is only a hint for players, IDR beyond the entries of a part is just not listed
+    if(ctx->iframe_index && random_access && 0 == program)
+        S3_HLS_Add_Index_Entry(buffer_ctx, frame_offset, S3_HLS_Get_Pending_Length(buffer_ctx) - frame_offset, (pack->items[0].timestamp / 100 * 9 + 63000) & 0x1FFFFFFFFULL); // PTS has 33 bits
 
-    while(content_length > 0) { // have data to send
-        PES_DEBUG("[Pes - Video] Remaining Size %d Content Length %d\n", remaining, content_length);
-        if(0 == remaining) { // start new ts header
-            PES_DEBUG("[Pes - Video] Start New TS Fragment\n");
-            S3_HLS_TS_Set_Pid(S3_HLS_Video_PID);
-            S3_HLS_TS_Fill_Remaining_Length(content_length);
-            ret = S3_HLS_TS_Write_To_Buffer(buffer_ctx);
-            PES_DEBUG("[Pes - Video] TS Header used %d\n", ret);
-            if(0 > ret) {
-                has_error = 1;
-                goto l_exit;
-            }
+    S3_HLS_Release_Ref_In_Buffer(buffer_ctx, ref_mark, release, user_data);
+    S3_HLS_Unlock_Buffer(buffer_ctx);
 
-            remaining = S3_HLS_TS_PACKET_SIZE - ret;
-        }
+    return S3_HLS_OK;
 
-        if(remaining > 0) {
-            // write data to buffer
-            uint8_t* start_pos;
-            uint32_t write_length;
-
-            if(packet_pos >= pack->items[packet_index].first_part_length) { // writing second part
-                // need to copy from second part
-                start_pos = pack->items[packet_index].second_part_start + (packet_pos - pack->items[packet_index].first_part_length);
-                write_length = remaining < (pack->items[packet_index].first_part_length + pack->items[packet_index].second_part_length - packet_pos) ? remaining : (pack->items[packet_index].first_part_length + pack->items[packet_index].second_part_length - packet_pos);
-                PES_DEBUG("Write From Second Part %d, %d, %d, %d, %d\n", remaining, write_length, pack->items[packet_index].first_part_length, pack->items[packet_index].second_part_length, packet_pos);
-            } else { // writing first part
-                start_pos = pack->items[packet_index].first_part_start + packet_pos;
-                write_length = remaining < (pack->items[packet_index].first_part_length - packet_pos) ? remaining : (pack->items[packet_index].first_part_length - packet_pos);
-                PES_DEBUG("Write From First Part %d, %d, %d, %d\n", remaining, write_length, pack->items[packet_index].first_part_length, packet_pos);
-            }
+l_exit:
+    S3_HLS_Release_Ref_In_Buffer(buffer_ctx, ref_mark, release, user_data);
+    S3_HLS_Unlock_Buffer(buffer_ctx);
 
-            ret = S3_HLS_Put_To_Buffer(buffer_ctx, start_pos, write_length);
-            PES_DEBUG("Write Buffer Ret %d\n", ret);
+    return ret;
+}
 
-            if(0 > ret) {
-                has_error = 1;
-                goto l_exit;
-            }
+int32_t S3_HLS_Pes_Write_Video_Frame(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t program, S3_HLS_FRAME_PACK* pack) {
+    return S3_HLS_Pes_Write_Video(ctx, buffer_ctx, program, pack, NULL, NULL);
+}
+
+int32_t S3_HLS_Pes_Write_Video_Frame_Ref(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t program, S3_HLS_FRAME_PACK* pack, BUFFER_RELEASE_CALL_BACK release, void* user_data) {
+    if(NULL == release)
+        return S3_HLS_INVALID_PARAMETER;
 
-            content_length -= write_length;
-            remaining -= write_length;
+    return S3_HLS_Pes_Write_Video(ctx, buffer_ctx, program, pack, release, user_data);
+}
 
-            packet_pos += write_length;
+/*
+ * Copy up to length bytes of frame items to dest, leaving out first skip bytes
+ * Returns number of bytes copied
+ */
+static uint32_t S3_HLS_Pes_Copy_Items(uint8_t* dest, S3_HLS_FRAME_PACK* pack, uint32_t skip, uint32_t length) {
+    uint32_t copied = 0;
 
-            PES_DEBUG("[Pes - Video] After Put: Remaining Size %d Content Length %d Packet Pos %d\n", remaining, content_length, packet_pos);
+    for(uint32_t cnt = 0; cnt < pack->item_count && copied < length; cnt++) {
+        uint8_t* parts[2] = { pack->items[cnt].first_part_start, pack->items[cnt].second_part_start };
+        uint32_t part_lengths[2] = { pack->items[cnt].first_part_length, pack->items[cnt].second_part_length };
 
-            if(packet_pos == pack->items[packet_index].first_part_length + pack->items[packet_index].second_part_length) {
-                PES_DEBUG("Goto Next Packet Remaining: %d\n", remaining);
-                packet_index++;
-                packet_pos = 0;
+        for(uint32_t part = 0; part < 2 && copied < length; part++) {
+            if(skip >= part_lengths[part]) {
+                skip -= part_lengths[part];
+                continue;
             }
+
+            uint32_t copy_length = part_lengths[part] - skip;
+            if(copy_length > length - copied)
+                copy_length = length - copied;
+
+            memcpy(dest + copied, parts[part] + skip, copy_length);
+            copied += copy_length;
+            skip = 0;
         }
     }
 
-    S3_HLS_Unlock_Buffer(buffer_ctx);
+    return copied;
+}
+
+/*
+ * Check ADTS header in front of AAC frame and set header_length to bytes in front of raw frame
+ * AAC config of first frame is kept for fMP4 init segment
+ */
+static int32_t S3_HLS_Pes_Read_ADTS_Header(S3_HLS_PES_CTX* ctx, S3_HLS_FRAME_PACK* pack, uint32_t content_length, uint32_t* header_length) {
+    uint8_t header[S3_HLS_PES_ADTS_HEADER_SIZE];
+
+    if(1 != ctx->audio_format || sizeof(header) != S3_HLS_Pes_Copy_Items(header, pack, 0, sizeof(header)))
+        return S3_HLS_INVALID_PARAMETER;
+
+    // syncword and layer 0
+    if(0xFF != header[0] || 0xF0 != (header[1] & 0xF6))
+        return S3_HLS_INVALID_PARAMETER;
+
+    // CRC follows header when protection absent is not set
+    *header_length = (header[1] & 0x01) ? S3_HLS_PES_ADTS_HEADER_SIZE : S3_HLS_PES_ADTS_HEADER_SIZE + 2;
+    if(*header_length >= content_length)
+        return S3_HLS_INVALID_PARAMETER;
+
+    if(ctx->fmp4_has_audio_config)
+        return S3_HLS_OK;
+
+    uint8_t object_type = (header[2] >> 6) + 1;
+    uint8_t rate_index = (header[2] >> 2) & 0x0F;
+    uint8_t channels = ((header[2] & 0x01) << 2) | (header[3] >> 6);
+
+    if(0 == adts_sample_rates[rate_index])
+        return S3_HLS_INVALID_PARAMETER;
+
+    // AudioSpecificConfig: object type (5 bits), sampling frequency index (4 bits), channel configuration (4 bits)
+    ctx->fmp4_audio_config[0] = (object_type << 3) | (rate_index >> 1);
+    ctx->fmp4_audio_config[1] = ((rate_index & 0x01) << 7) | (channels << 3);
+    ctx->fmp4_audio_sample_rate = adts_sample_rates[rate_index];
+    ctx->fmp4_audio_channels = channels;
+    ctx->fmp4_has_audio_config = 1;
 
     return S3_HLS_OK;
+}
 
-l_exit:
-    S3_HLS_Unlock_Buffer(buffer_ctx);
+/*
+ * Write staged AAC frames of program as one fMP4 fragment, each frame is a sample
+ */
+static int32_t S3_HLS_Pes_Write_Audio_Fragment(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t program, S3_HLS_FRAME_PACK* pack) {
+    S3_HLS_PES_PROGRAM* program_ctx = &ctx->programs[program];
+    S3_HLS_FMP4_FRAGMENT fragment;
+
+    fragment.track_id = S3_HLS_FMP4_AUDIO_TRACK_ID;
+    fragment.base_decode_time = (pack->items[0].timestamp * ctx->fmp4_audio_sample_rate + 500000) / 1000000; // round, timestamps are usually truncated to us
+    fragment.sample_duration = S3_HLS_FMP4_AAC_FRAME_SAMPLES;
+    fragment.composition_offset = 0;
+    fragment.random_access = S3_HLS_TRUE;
+
+    fragment.sample_count = program_ctx->audio_stage_frames;
+    memcpy(fragment.sample_sizes, program_ctx->audio_stage_sizes, program_ctx->audio_stage_frames * sizeof(uint32_t));
+
+    fragment.items = pack->items;
+    fragment.item_count = pack->item_count;
+
+    return S3_HLS_Pes_Write_Fragment(ctx, buffer_ctx, &fragment, NULL);
+}
+
+/*
+ * Write TS packets of an audio frame pack, content_length is length of all frame items
+ */
+static int32_t S3_HLS_Pes_Write_Audio_Packets(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t program, S3_HLS_FRAME_PACK* pack, uint32_t content_length, BUFFER_RELEASE_CALL_BACK release) {
+    if(S3_HLS_CONTAINER_FMP4 == ctx->container)
+        return S3_HLS_Pes_Write_Audio_Fragment(ctx, buffer_ctx, program, pack);
+
+    AUDIO_DEBUG("[Pes - Audio] Total Length: %d\n", content_length + (uint32_t)sizeof(ctx->audio_pes_header));
+
+    S3_HLS_Pes_Update_Audio_Pes(ctx, pack->items[0].timestamp, content_length);
+
+    S3_HLS_TS_FRAME frame;
+    frame.pid = S3_HLS_Program_Audio_PID(program);
+    frame.random_access = S3_HLS_TRUE;
+    frame.has_pcr = S3_HLS_FALSE;
+    frame.pcr_timestamp = 0;
+    frame.pes_header = ctx->audio_pes_header;
+    frame.pes_header_length = sizeof(ctx->audio_pes_header);
+    frame.item_prefix = NULL;
+    frame.item_prefix_length = 0;
+
+    return S3_HLS_Pes_Write_Frame(ctx, buffer_ctx, &frame, pack->items, pack->item_count, content_length, release);
+}
+
+/*
+ * Write audio frames of pack as one PES, frames are dropped when it does not fit
+ * Upload thread must not wait for space as it is the one freeing space
+ */
+static int32_t S3_HLS_Pes_Put_Audio(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t program, S3_HLS_FRAME_PACK* pack, uint32_t content_length, BUFFER_RELEASE_CALL_BACK release, uint8_t can_wait, uint32_t frames) {
+    int32_t ret;
+
+    uint8_t segment_empty = (0 == buffer_ctx->pending_length);
+
+    S3_HLS_PES_MARK mark;
+    S3_HLS_Pes_Mark(ctx, buffer_ctx, program, &mark);
+
+    struct timespec deadline;
+    uint8_t has_deadline = S3_HLS_FALSE;
+
+    while(0 > (ret = S3_HLS_Pes_Write_Audio_Packets(ctx, buffer_ctx, program, pack, content_length, release))) {
+        S3_HLS_Pes_Rollback(ctx, buffer_ctx, &mark);
+
+        if(S3_HLS_BUFFER_OVERFLOW != ret)
+            return ret;
+
+        if(can_wait && S3_HLS_OK == S3_HLS_Pes_Wait_For_Space(ctx, buffer_ctx, &mark, &deadline, &has_deadline))
+            continue;
+
+        // audio frames do not depend on each other, only drop these
+        ctx->drop_counters.audio_frames += frames;
+        return S3_HLS_BUFFER_OVERFLOW;
+    }
+
+    if(segment_empty)
+        ctx->segment_start_time = ctx->last_frame_time;
+
+    return S3_HLS_OK;
+}
+
+/*
+ * Write staged audio frames as one PES with timestamp of first frame
+ */
+static int32_t S3_HLS_Pes_Write_Staged_Audio(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t program, uint8_t can_wait) {
+    S3_HLS_PES_PROGRAM* program_ctx = &ctx->programs[program];
+
+    if(0 == program_ctx->audio_stage_frames)
+        return S3_HLS_OK;
+
+    S3_HLS_FRAME_PACK pack;
+    pack.item_count = 1;
+    pack.items[0].first_part_start = program_ctx->audio_stage;
+    pack.items[0].first_part_length = program_ctx->audio_stage_length;
+    pack.items[0].second_part_start = NULL;
+    pack.items[0].second_part_length = 0;
+    pack.items[0].timestamp = program_ctx->audio_stage_first_timestamp;
+
+    AUDIO_DEBUG("[Pes - Audio] Write %d staged frames, %d bytes\n", program_ctx->audio_stage_frames, program_ctx->audio_stage_length);
+    int32_t ret = S3_HLS_Pes_Put_Audio(ctx, buffer_ctx, program, &pack, program_ctx->audio_stage_length, NULL, can_wait, program_ctx->audio_stage_frames);
+
+    program_ctx->audio_stage_length = 0;
+    program_ctx->audio_stage_frames = 0;
 
     return ret;
 }
 
-int32_t S3_HLS_Pes_Write_Audio_Frame(S3_HLS_BUFFER_CTX* buffer_ctx, S3_HLS_FRAME_PACK* pack) {
+static uint8_t S3_HLS_Pes_Has_Staged_Audio(S3_HLS_PES_CTX* ctx) {
+    for(uint32_t program = 0; program < ctx->program_count; program++) {
+        if(0 < ctx->programs[program].audio_stage_frames)
+            return S3_HLS_TRUE;
+    }
+
+    return S3_HLS_FALSE;
+}
+
+/*
+ * Copy audio frame to stage without first header_length bytes, staged frames are written when they cover aggregation interval
+ * Frames in one PES are played back to back, so a gap or timestamp going back starts a new PES
+ */
+static int32_t S3_HLS_Pes_Stage_Audio(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t program, S3_HLS_FRAME_PACK* pack, uint32_t content_length, uint32_t header_length) {
+    S3_HLS_PES_PROGRAM* program_ctx = &ctx->programs[program];
+    uint64_t timestamp = pack->items[0].timestamp;
+
+    content_length -= header_length;
+
+    // fMP4 fragment lists each staged frame as a sample
+    if(S3_HLS_CONTAINER_FMP4 == ctx->container && S3_HLS_FMP4_MAX_SAMPLES <= program_ctx->audio_stage_frames)
+        S3_HLS_Pes_Write_Staged_Audio(ctx, buffer_ctx, program, S3_HLS_TRUE);
+
+    if(0 < program_ctx->audio_stage_frames) {
+        uint64_t frame_duration = program_ctx->audio_frame_duration;
+        uint8_t has_gap = timestamp < program_ctx->audio_stage_last_timestamp || (0 < frame_duration && timestamp - program_ctx->audio_stage_last_timestamp > frame_duration + frame_duration / 2);
+
+        if(has_gap || sizeof(program_ctx->audio_stage) - program_ctx->audio_stage_length < content_length)
+            S3_HLS_Pes_Write_Staged_Audio(ctx, buffer_ctx, program, S3_HLS_TRUE);
+        else
+            program_ctx->audio_frame_duration = timestamp - program_ctx->audio_stage_last_timestamp;
+    }
+
+    if(0 == program_ctx->audio_stage_frames) {
+        if(0 == buffer_ctx->pending_length && !S3_HLS_Pes_Has_Staged_Audio(ctx))
+            ctx->segment_start_time = ctx->last_frame_time; // watchdog counts staged audio as part of segment
+
+        program_ctx->audio_stage_first_timestamp = timestamp;
+    }
+
+    S3_HLS_Pes_Copy_Items(program_ctx->audio_stage + program_ctx->audio_stage_length, pack, header_length, content_length);
+
+    program_ctx->audio_stage_sizes[program_ctx->audio_stage_frames % S3_HLS_FMP4_MAX_SAMPLES] = content_length;
+    program_ctx->audio_stage_length += content_length;
+    program_ctx->audio_stage_frames++;
+    program_ctx->audio_stage_last_timestamp = timestamp;
+
+    // write now if waiting for next frame would go beyond interval
+    if(timestamp + program_ctx->audio_frame_duration - program_ctx->audio_stage_first_timestamp >= (uint64_t)ctx->audio_aggregation * 1000)
+        return S3_HLS_Pes_Write_Staged_Audio(ctx, buffer_ctx, program, S3_HLS_TRUE);
+
+    return S3_HLS_OK;
+}
+
+static int32_t S3_HLS_Pes_Write_Audio(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t program, S3_HLS_FRAME_PACK* pack, BUFFER_RELEASE_CALL_BACK release, void* user_data) {
     int32_t ret = S3_HLS_OK;
 
     uint32_t content_length = 0;
+    uint32_t header_length = 0;
 
     AUDIO_DEBUG("[Pes - Audio] Check Cnt\n");
-    if(0 == pack->item_count) {
+    if(0 == pack->item_count || NULL == ctx->programs || ctx->program_count <= program) {
+        S3_HLS_Release_Ref_In_Buffer(NULL, 0, release, user_data);
         return S3_HLS_INVALID_PARAMETER;
     }
 
     AUDIO_DEBUG("[Pes - Audio] Try Lock\n");
-    if (0 != S3_HLS_Lock_Buffer(buffer_ctx)) // lock failed
+    if (0 != S3_HLS_Lock_Buffer(buffer_ctx)) { // lock failed
+        S3_HLS_Release_Ref_In_Buffer(NULL, 0, release, user_data);
         return S3_HLS_LOCK_FAILED;
+    }
 
     AUDIO_DEBUG("[Pes - Audio] Locked\n");
 
+    uint32_t ref_mark = buffer_ctx->ref_total;
+
+    ctx->last_frame_time = S3_HLS_Pes_Now();
+
     for(uint32_t cnt = 0; cnt < pack->item_count; cnt++) {
         AUDIO_DEBUG("[Pes - Audio] Packet Item %d, %d, %d\n", pack->item_count, pack->items[cnt].first_part_length, pack->items[cnt].second_part_length);
         if(NULL == pack->items[cnt].first_part_start || (NULL == pack->items[cnt].second_part_start && pack->items[cnt].second_part_length != 0)) {
@@ -370,105 +1329,290 @@ int32_t S3_HLS_Pes_Write_Audio_Frame(S3_HLS_BUFFER_CTX* buffer_ctx, S3_HLS_FRAME
         content_length += pack->items[cnt].first_part_length + pack->items[cnt].second_part_length;
     }
 
-    content_length += sizeof(audio_pes_header); // calculate total length
+    if(ctx->first_call) {
+        S3_HLS_Flush_Buffer(buffer_ctx); // only update last timestamp
+        ctx->first_call = 0;
+    }
 
-    AUDIO_DEBUG("[Pes - Audio] Total Length: %d\n", content_length);
-    if(has_error) {
+    if(ctx->programs[program].has_error) {
         AUDIO_DEBUG("[Pes - Audio] Prev error detected, skip until next sperate frame!\n");
+        ctx->drop_counters.audio_frames++;
         goto l_exit;
     }
 
-    S3_HLS_TS_Set_Pid(S3_HLS_Audio_PID);
-
-    S3_HLS_TS_Set_Payload_Start();
+    // fMP4 samples are raw AAC frames, frames before init segment cannot be played
+    if(S3_HLS_CONTAINER_FMP4 == ctx->container) {
+        ret = S3_HLS_Pes_Read_ADTS_Header(ctx, pack, content_length, &header_length);
+        if(0 > ret)
+            goto l_exit;
 
-    S3_HLS_TS_Set_Random_Access();
+        if(!ctx->fmp4_init_written) {
+            ctx->drop_counters.audio_frames++;
+            goto l_exit;
+        }
+    }
 
-    S3_HLS_TS_Fill_Remaining_Length(content_length);
+    if(0 == program) {
+        ret = S3_HLS_Pes_Split_Segment(ctx, buffer_ctx, pack->items[0].timestamp, ctx->programs[0].audio_frame_duration, S3_HLS_FALSE, S3_HLS_FALSE, S3_HLS_FALSE);
+        if(0 > ret)
+            goto l_exit;
+    }
 
-    AUDIO_DEBUG("[Pes - Audio] Write TS Header\n");
-    // write TS header
-    ret = S3_HLS_TS_Write_To_Buffer(buffer_ctx);
+    // staged frames are copied, release is called right away, fMP4 audio is always staged to leave ADTS header out
+    if((0 != ctx->audio_aggregation || S3_HLS_CONTAINER_FMP4 == ctx->container) && S3_HLS_PES_MAX_AUDIO_PAYLOAD >= content_length) {
+        ret = S3_HLS_Pes_Stage_Audio(ctx, buffer_ctx, program, pack, content_length, header_length);
+        goto l_exit;
+    }
 
-    if(0 > ret) { // write error
-        AUDIO_DEBUG("[Pes - Audio] Write Buffer Failed! %d\n", ret);
+    if(S3_HLS_CONTAINER_FMP4 == ctx->container) {
+        ret = S3_HLS_INVALID_PARAMETER;
         goto l_exit;
     }
 
-    uint32_t remaining = S3_HLS_TS_PACKET_SIZE - ret;
+    // keep frame order when aggregation was just turned off
+    S3_HLS_Pes_Write_Staged_Audio(ctx, buffer_ctx, program, S3_HLS_TRUE);
 
-    AUDIO_DEBUG("[Pes - Audio] Write Audio PES Header, Remaining: %d\n", remaining);
-    // write PES info
-    ret = S3_HLS_Pes_Write_Audio_Pes(buffer_ctx, pack->items[0].timestamp, content_length - sizeof(audio_pes_header));
-    if(0 > ret) {
-        has_error = 1;
+    ret = S3_HLS_Pes_Put_Audio(ctx, buffer_ctx, program, pack, content_length, release, S3_HLS_TRUE, 1);
+
+l_exit:
+    S3_HLS_Release_Ref_In_Buffer(buffer_ctx, ref_mark, release, user_data);
+    S3_HLS_Unlock_Buffer(buffer_ctx);
+    return ret;
+}
+
+int32_t S3_HLS_Pes_Write_Audio_Frame(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t program, S3_HLS_FRAME_PACK* pack) {
+    return S3_HLS_Pes_Write_Audio(ctx, buffer_ctx, program, pack, NULL, NULL);
+}
+
+int32_t S3_HLS_Pes_Write_Audio_Frame_Ref(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t program, S3_HLS_FRAME_PACK* pack, BUFFER_RELEASE_CALL_BACK release, void* user_data) {
+    if(NULL == release)
+        return S3_HLS_INVALID_PARAMETER;
+
+    return S3_HLS_Pes_Write_Audio(ctx, buffer_ctx, program, pack, release, user_data);
+}
+
+int32_t S3_HLS_Pes_Set_Programs(S3_HLS_PES_CTX* ctx, uint32_t count) {
+    if(0 == count || S3_HLS_MAX_PROGRAMS < count || (S3_HLS_CONTAINER_FMP4 == ctx->container && 1 < count))
+        return S3_HLS_INVALID_PARAMETER;
+
+    if(NULL != ctx->programs)
+        return S3_HLS_INVALID_STATUS;
+
+    int32_t ret = S3_HLS_PAT_Set_Programs(&ctx->pat, count);
+    if(0 > ret)
+        return ret;
+
+    ret = S3_HLS_PMT_Set_Programs(&ctx->pmt, count);
+    if(0 > ret)
+        return ret;
+
+    ctx->program_count = count;
+
+    return S3_HLS_OK;
+}
+
+void S3_HLS_Pes_Set_Audio_Format(S3_HLS_PES_CTX* ctx, int audio) {
+  ctx->audio_format = audio;
+  S3_HLS_PMT_Set_Audio(&ctx->pmt, audio);
+}
+
+int32_t S3_HLS_Pes_Set_Nalu_Format(S3_HLS_PES_CTX* ctx, S3_HLS_NALU_FORMAT format) {
+    if(S3_HLS_NALU_FORMAT_ANNEXB != format && S3_HLS_NALU_FORMAT_LENGTH_PREFIXED != format)
+        return S3_HLS_INVALID_PARAMETER;
+
+    ctx->nalu_format = format;
+
+    return S3_HLS_OK;
+}
+
+int32_t S3_HLS_Pes_Set_Part_Duration(S3_HLS_PES_CTX* ctx, uint32_t part_ms) {
+    if(0 != part_ms && (S3_HLS_PES_MIN_PART_DURATION > part_ms || S3_HLS_PES_MAX_PART_DURATION < part_ms))
+        return S3_HLS_INVALID_PARAMETER;
+
+    ctx->part_target = part_ms;
+
+    return S3_HLS_OK;
+}
+
+int32_t S3_HLS_Pes_Set_Container(S3_HLS_PES_CTX* ctx, S3_HLS_CONTAINER new_container) {
+    if(S3_HLS_CONTAINER_TS != new_container && S3_HLS_CONTAINER_FMP4 != new_container)
+        return S3_HLS_INVALID_PARAMETER;
+
+    // fMP4 init segment describes one video and one audio track
+    if(S3_HLS_CONTAINER_FMP4 == new_container && 1 < ctx->program_count)
+        return S3_HLS_INVALID_PARAMETER;
+
+    ctx->container = new_container;
+
+    // init segment is written again before first fragment
+    ctx->fmp4_init_written = 0;
+    ctx->fmp4_has_audio_config = 0;
+    ctx->fmp4_sequence = 1;
+
+    return S3_HLS_OK;
+}
+
+int32_t S3_HLS_Pes_Set_Overflow_Policy(S3_HLS_PES_CTX* ctx, S3_HLS_OVERFLOW_POLICY policy, uint32_t timeout_ms) {
+    if(S3_HLS_OVERFLOW_SKIP_GOP > policy || S3_HLS_OVERFLOW_BLOCK < policy)
+        return S3_HLS_INVALID_PARAMETER;
+
+    ctx->overflow_policy = policy;
+    ctx->overflow_timeout_ms = timeout_ms;
+
+    if(S3_HLS_OVERFLOW_IDR_ONLY != policy)
+        ctx->idr_only = 0;
+
+    return S3_HLS_OK;
+}
+
+int32_t S3_HLS_Pes_Flush_Stale_Segment(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t max_age_ms, uint32_t max_idle_ms) {
+    int32_t ret = S3_HLS_OK;
+
+    if(NULL == buffer_ctx || NULL == ctx->programs)
+        return S3_HLS_INVALID_PARAMETER;
+
+    // writer may be waiting for space with lock held, never wait for it here
+    if (0 != S3_HLS_Try_Lock_Buffer(buffer_ctx))
+        return S3_HLS_LOCK_FAILED;
+
+    if(ctx->first_call || (0 == buffer_ctx->pending_length && !S3_HLS_Pes_Has_Staged_Audio(ctx)))
         goto l_exit;
+
+    int64_t now = S3_HLS_Pes_Now();
+
+    if((0 != max_age_ms && now - ctx->segment_start_time >= max_age_ms) || (0 != max_idle_ms && now - ctx->last_frame_time >= max_idle_ms)) {
+        PES_DEBUG("[Pes - Watchdog] Close stale segment, age %lld idle %lld\n", (long long)(now - ctx->segment_start_time), (long long)(now - ctx->last_frame_time));
+        ret = S3_HLS_Pes_Close_Segment(ctx, buffer_ctx, S3_HLS_FALSE);
     }
 
-    remaining -= ret;
-    content_length -= ret;
+l_exit:
+    S3_HLS_Unlock_Buffer(buffer_ctx);
 
-    uint32_t packet_index = 0;
-    uint32_t packet_pos = 0;
+    return ret;
+}
 
-    AUDIO_DEBUG("[Pes - Audio] Write Audio Content\n");
-    while(content_length > 0) { // have data to send
-        AUDIO_DEBUG("[Pes - Audio] Remaining Size %d Content Length %d\n", remaining, content_length);
-        if(0 == remaining) {
-            S3_HLS_TS_Set_Pid(S3_HLS_Audio_PID);
-            S3_HLS_TS_Fill_Remaining_Length(content_length);
-            ret = S3_HLS_TS_Write_To_Buffer(buffer_ctx);
-            if(0 > ret) {
-                has_error = 1;
-                AUDIO_DEBUG("[Pes - Audio] Write Buffer Failed 2! %d\n", ret);
-                goto l_exit;
-            }
+int32_t S3_HLS_Pes_Flush(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx) {
+    if(NULL == buffer_ctx || NULL == ctx->programs)
+        return S3_HLS_INVALID_PARAMETER;
 
-            remaining = S3_HLS_TS_PACKET_SIZE - ret;
-        }
+    if (0 != S3_HLS_Lock_Buffer(buffer_ctx))
+        return S3_HLS_LOCK_FAILED;
 
-        if(remaining > 0) {
-            // write data to buffer
-            uint8_t* start_pos;
-            uint32_t write_length;
-
-            if(packet_pos >= pack->items[packet_index].first_part_length) { // writing second part
-                // need to copy from second part
-                start_pos = pack->items[packet_index].second_part_start + (packet_pos - pack->items[packet_index].first_part_length);
-                write_length = remaining < (pack->items[packet_index].first_part_length + pack->items[packet_index].second_part_length - packet_pos) ? remaining : (pack->items[packet_index].first_part_length + pack->items[packet_index].second_part_length - packet_pos);
-            } else { // writing first part
-                start_pos = pack->items[packet_index].first_part_start + packet_pos;
-                write_length = remaining < (pack->items[packet_index].first_part_length - packet_pos) ? remaining : (pack->items[packet_index].first_part_length - packet_pos);
-            }
+    int32_t ret = S3_HLS_Pes_Close_Segment(ctx, buffer_ctx, S3_HLS_FALSE);
 
-            ret = S3_HLS_Put_To_Buffer(buffer_ctx, start_pos, write_length);
+    S3_HLS_Unlock_Buffer(buffer_ctx);
 
-            if(0 > ret) {
-                has_error = 1;
-                AUDIO_DEBUG("[Pes - Audio] Write Buffer Failed 3! %d\n", ret);
-                goto l_exit;
-            }
+    return ret;
+}
 
-            content_length -= write_length;
-            remaining -= write_length;
+int32_t S3_HLS_Pes_Set_Segment_Duration(S3_HLS_PES_CTX* ctx, uint32_t target_ms, uint32_t max_target_ms) {
+    if((0 < target_ms && S3_HLS_PES_MIN_TARGET_DURATION > target_ms) || (0 < max_target_ms && max_target_ms < target_ms))
+        return S3_HLS_INVALID_PARAMETER;
 
-            packet_pos += write_length;
+    ctx->segment_target = target_ms;
+    ctx->segment_max_target = max_target_ms;
+    ctx->segment_target_from_sps = 0;
 
-            if(packet_pos == pack->items[packet_index].first_part_length + pack->items[packet_index].second_part_length) {
-                packet_index++;
-                packet_pos = 0;
-            }
-        }
+    return S3_HLS_OK;
+}
+
+int32_t S3_HLS_Pes_Set_Video_Codec(S3_HLS_PES_CTX* ctx, S3_HLS_VIDEO_CODEC codec) {
+    if(S3_HLS_VIDEO_CODEC_H264 != codec && S3_HLS_VIDEO_CODEC_H265 != codec)
+        return S3_HLS_INVALID_PARAMETER;
+
+    ctx->video_codec = codec;
+
+    // AUD follows start code in PES header
+    if(S3_HLS_VIDEO_CODEC_H265 == codec) {
+        memcpy(ctx->video_aud + 4, h265_aud, sizeof(h265_aud));
+        ctx->video_aud_length = 7;
+    } else {
+        ctx->video_aud[4] = 0x09;
+        ctx->video_aud[5] = 0xF0;
+        ctx->video_aud_length = 6;
+    }
+
+    for(uint32_t program = 0; NULL != ctx->programs && program < ctx->program_count; program++) {
+        memset(ctx->programs[program].parameter_set_lengths, 0, sizeof(ctx->programs[program].parameter_set_lengths));
+        ctx->programs[program].has_video_info = 0;
     }
 
+    S3_HLS_PMT_Set_Video(&ctx->pmt, codec);
+
+    return S3_HLS_OK;
+}
+
+void S3_HLS_Pes_Set_Decode_Timestamp(S3_HLS_PES_CTX* ctx, uint8_t enable) {
+    ctx->has_decode_timestamp = enable ? 1 : 0;
+}
+
+void S3_HLS_Pes_Set_IFrame_Index(S3_HLS_PES_CTX* ctx, uint8_t enable) {
+    ctx->iframe_index = enable ? 1 : 0;
+}
+
+int32_t S3_HLS_Pes_Set_Audio_Aggregation(S3_HLS_PES_CTX* ctx, uint32_t duration_ms) {
+    if(S3_HLS_PES_MAX_AUDIO_AGGREGATION < duration_ms)
+        return S3_HLS_INVALID_PARAMETER;
+
+    ctx->audio_aggregation = duration_ms;
+
+    return S3_HLS_OK;
+}
+
+int32_t S3_HLS_Pes_Set_PSI_Interval(S3_HLS_PES_CTX* ctx, uint32_t pat_pmt_interval_ms, uint32_t pcr_interval_ms) {
+    if(S3_HLS_PES_MAX_PCR_INTERVAL < pcr_interval_ms)
+        return S3_HLS_INVALID_PARAMETER;
+
+    ctx->psi_interval = pat_pmt_interval_ms;
+    ctx->pcr_interval = pcr_interval_ms;
+
+    return S3_HLS_OK;
+}
+
+int32_t S3_HLS_Pes_Get_Mux_Info(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, S3_HLS_MUX_INFO* info) {
+    if(NULL == buffer_ctx || NULL == info)
+        return S3_HLS_INVALID_PARAMETER;
+
+    if (0 != S3_HLS_Lock_Buffer(buffer_ctx))
+        return S3_HLS_LOCK_FAILED;
+
+    *info = ctx->mux_info;
+
     S3_HLS_Unlock_Buffer(buffer_ctx);
+
     return S3_HLS_OK;
+}
+
+int32_t S3_HLS_Pes_Get_Video_Info(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t program, S3_HLS_VIDEO_INFO* info) {
+    if(NULL == buffer_ctx || NULL == info || ctx->program_count <= program)
+        return S3_HLS_INVALID_PARAMETER;
+
+    if (0 != S3_HLS_Lock_Buffer(buffer_ctx))
+        return S3_HLS_LOCK_FAILED;
+
+    int32_t ret = S3_HLS_INVALID_STATUS;
+    if(NULL != ctx->programs && ctx->programs[program].has_video_info) {
+        *info = ctx->programs[program].video_info;
+        ret = S3_HLS_OK;
+    }
 
-l_exit:
     S3_HLS_Unlock_Buffer(buffer_ctx);
+
     return ret;
 }
 
-void S3_HLS_Pes_Set_Audio_Format(int audio) {
-  S3_HLS_PMT_Set_Audio(audio);
+int32_t S3_HLS_Pes_Get_Drop_Counters(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, S3_HLS_DROP_COUNTERS* counters) {
+    if(NULL == buffer_ctx || NULL == counters)
+        return S3_HLS_INVALID_PARAMETER;
+
+    if (0 != S3_HLS_Lock_Buffer(buffer_ctx))
+        return S3_HLS_LOCK_FAILED;
+
+    *counters = ctx->drop_counters;
+
+    S3_HLS_Unlock_Buffer(buffer_ctx);
+
+    counters->evicted_segments = __atomic_load_n(&buffer_ctx->evicted_segments, __ATOMIC_RELAXED);
+
+    return S3_HLS_OK;
 }
@@ -21,6 +21,10 @@
 
 #include "S3_HLS_SDK.h"
 #include "S3_HLS_Buffer_Mgr.h"
+#include "S3_HLS_TS.h"
+#include "S3_HLS_Pat.h"
+#include "S3_HLS_Pmt.h"
+#include "S3_HLS_FMP4.h"
 
 #ifdef __cplusplus
 #if __cplusplus
@@ -31,21 +35,267 @@ extern "C" {
 #define ERR_S3_HLS_H264_PES_NULL_BUFFER                 -1
 #define ERR_S3_HLS_H264_PES_INVALID_BUFFER_LENGTH       -2
 
+#define S3_HLS_PES_VIDEO_HEADER_SIZE            26      // PES header with PTS and DTS, AUD of either codec
+#define S3_HLS_PES_AUDIO_HEADER_SIZE            14
+#define S3_HLS_PES_AUD_SIZE                     7
+
+#define S3_HLS_PES_MAX_AUDIO_PAYLOAD            (0xFFFF - (S3_HLS_PES_AUDIO_HEADER_SIZE - 6))  // PES packet length is 16 bits
+#define S3_HLS_PES_MAX_PARAMETER_SET            256
+
+// index of parameter set in cache, also the order they are put in front of a key frame
+#define S3_HLS_PES_PARAMETER_SET_NONE           -1
+#define S3_HLS_PES_PARAMETER_SET_VPS            0       // H265 only
+#define S3_HLS_PES_PARAMETER_SET_SPS            1
+#define S3_HLS_PES_PARAMETER_SET_PPS            2
+#define S3_HLS_PES_PARAMETER_SET_COUNT          3
+
+// state of each camera program muxed into the segment, segments are cut by program 0
+typedef struct s3_hls_pes_program_s {
+    uint8_t has_error;                      // skip frames until next SPS or IDR of this program
+
+    // latest VPS / SPS / PPS, put in front of a key frame that starts a segment without them
+    uint8_t parameter_sets[S3_HLS_PES_PARAMETER_SET_COUNT][S3_HLS_PES_MAX_PARAMETER_SET];
+    uint32_t parameter_set_lengths[S3_HLS_PES_PARAMETER_SET_COUNT];
+    uint8_t segment_has_sps;
+
+    S3_HLS_VIDEO_INFO video_info;           // from latest SPS that could be parsed
+    uint8_t has_video_info;
+
+    uint8_t pcr_written;                    // PCR written in current segment
+    uint64_t last_pcr_timestamp;
+    uint64_t last_video_timestamp;
+
+    // audio frames are copied here until written as one PES
+    uint8_t audio_stage[S3_HLS_PES_MAX_AUDIO_PAYLOAD];
+    uint32_t audio_stage_length;
+    uint32_t audio_stage_frames;
+    uint64_t audio_stage_first_timestamp;
+    uint64_t audio_stage_last_timestamp;
+    uint64_t audio_frame_duration;
+    uint32_t audio_stage_sizes[S3_HLS_FMP4_MAX_SAMPLES];   // each staged frame is one fMP4 sample
+} S3_HLS_PES_PROGRAM;
+
+/*
+ * Muxer state of one stream, every segment written to a buffer goes through one context
+ * Frames and flushes are serialized by buffer lock, setters should be called before first frame
+ */
+typedef struct s3_hls_pes_s {
+    uint8_t video_pes_header[S3_HLS_PES_VIDEO_HEADER_SIZE];
+    uint32_t video_pes_header_length;
+    uint8_t video_aud[S3_HLS_PES_AUD_SIZE];
+    uint32_t video_aud_length;
+    uint8_t audio_pes_header[S3_HLS_PES_AUDIO_HEADER_SIZE];
+
+    // continuity counters and PSI tables
+    S3_HLS_TS_CTX ts;
+    S3_HLS_PAT_CTX pat;
+    S3_HLS_PMT_CTX pmt;
+    uint32_t fmp4_sequence;                 // mfhd sequence number of next fragment
+
+    // use decode_timestamp of frame items for DTS and PCR
+    uint8_t has_decode_timestamp;
+
+    // PAT / PMT at segment start, then every psi_interval ms of input timestamp, 0 means segment start only
+    uint32_t psi_interval;
+    uint32_t pcr_interval;
+
+    uint8_t psi_needed;
+    uint64_t last_psi_timestamp;
+
+    // bytes of segment being written, overhead is everything except frame data
+    uint32_t segment_bytes;
+    uint32_t segment_overhead_bytes;
+    uint32_t segment_psi_bytes;
+
+    S3_HLS_MUX_INFO mux_info;
+
+    S3_HLS_VIDEO_CODEC video_codec;
+
+    // audio frames are written as one PES once they cover audio_aggregation ms, 0 writes every frame on its own
+    uint32_t audio_aggregation;
+
+    // record byte range of each IDR of program 0 with the segment
+    uint8_t iframe_index;
+
+    S3_HLS_CONTAINER container;
+
+    // length prefixed NALUs get start code written over their length
+    S3_HLS_NALU_FORMAT nalu_format;
+    int audio_format;                       // 1 AAC, 2 MP3, as passed to S3_HLS_Pes_Set_Audio_Format
+
+    // fMP4 segments start once init segment is written, it needs parameter sets and AAC config of first ADTS header
+    uint8_t fmp4_init_written;
+    uint8_t fmp4_has_audio_config;
+    uint8_t fmp4_audio_config[2];
+    uint32_t fmp4_audio_sample_rate;
+    uint32_t fmp4_audio_channels;
+
+    S3_HLS_PES_PROGRAM* programs;           // program_count entries, allocated when stream starts
+    uint32_t program_count;
+
+    // segments of program 0 are cut at first SPS or IDR once target duration passed, 0 cuts at every SPS
+    uint32_t segment_target;
+    uint32_t segment_max_target;            // lengthen segments up to this while uploads fall behind
+    uint8_t segment_target_from_sps;        // target follows SPS of program 0 until set by user
+
+    uint8_t segment_started;
+    uint64_t segment_start_timestamp;
+    uint8_t segment_has_video;              // segments without video of program 0 are cut by audio timestamp
+
+    // partial segments of program 0 are handed out at first key frame after part target, 0 hands out whole segments only
+    uint32_t part_target;
+    uint64_t part_start_timestamp;
+
+    uint8_t first_call;
+
+    S3_HLS_OVERFLOW_POLICY overflow_policy;
+    uint32_t overflow_timeout_ms;
+    uint8_t idr_only;
+
+    S3_HLS_DROP_COUNTERS drop_counters;
+
+    // monotonic ms, used by latency watchdog
+    int64_t segment_start_time;
+    int64_t last_frame_time;
+} S3_HLS_PES_CTX;
+
+/*
+ * Set context to defaults, single H264 program in MPEG-TS without audio
+ * Context should be zero filled, so parts not used by the stream are not touched
+ */
+void S3_HLS_Pes_Initialize(S3_HLS_PES_CTX* ctx);
+
+/*
+ * Allocate state of programs set by S3_HLS_Pes_Set_Programs, must be called before first frame
+ * Frames are rejected until programs are allocated
+ */
+int32_t S3_HLS_Pes_Allocate_Programs(S3_HLS_PES_CTX* ctx);
+
+/*
+ * Free state of programs, cached parameter sets and SPS info are dropped with it
+ */
+void S3_HLS_Pes_Free_Programs(S3_HLS_PES_CTX* ctx);
+
 /*
  * write PES header to buffer
  * internal execution will set stream types for different stream type
+ * program selects PIDs the frame is written to, segments are cut at SPS of program 0
  * returns number of bytes written to the buffer
  */
-int32_t S3_HLS_Pes_Write_Video_Frame(S3_HLS_BUFFER_CTX* ctx, S3_HLS_FRAME_PACK* pack);
+int32_t S3_HLS_Pes_Write_Video_Frame(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t program, S3_HLS_FRAME_PACK* pack);
 
 /*
  * write PES header to buffer
  * internal execution will set stream types for different stream type
  * returns number of bytes written to the buffer
  */
-int32_t S3_HLS_Pes_Write_Audio_Frame(S3_HLS_BUFFER_CTX* ctx, S3_HLS_FRAME_PACK* pack);
+int32_t S3_HLS_Pes_Write_Audio_Frame(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t program, S3_HLS_FRAME_PACK* pack);
+
+/*
+ * Same as write video frame but frame data is kept by reference instead of copied to buffer
+ * release is called with user_data once the segment contains the frame is uploaded or dropped
+ */
+int32_t S3_HLS_Pes_Write_Video_Frame_Ref(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t program, S3_HLS_FRAME_PACK* pack, BUFFER_RELEASE_CALL_BACK release, void* user_data);
+
+/*
+ * Same as write audio frame but frame data is kept by reference instead of copied to buffer
+ */
+int32_t S3_HLS_Pes_Write_Audio_Frame_Ref(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t program, S3_HLS_FRAME_PACK* pack, BUFFER_RELEASE_CALL_BACK release, void* user_data);
+
+/*
+ * Timestamp frames of stream are written in order of, decode_timestamp when enabled and timestamp otherwise
+ */
+uint64_t S3_HLS_Pes_Decode_Timestamp(S3_HLS_PES_CTX* ctx, S3_HLS_FRAME_ITEM* item);
 
-void S3_HLS_Pes_Set_Audio_Format(int audio);
+void S3_HLS_Pes_Set_Audio_Format(S3_HLS_PES_CTX* ctx, int audio);
+
+/*
+ * Set number of programs muxed into each segment and build PAT / PMT for them, must be called before first frame
+ */
+int32_t S3_HLS_Pes_Set_Programs(S3_HLS_PES_CTX* ctx, uint32_t count);
+
+/*
+ * Set how to handle frames that do not fit into buffer
+ */
+int32_t S3_HLS_Pes_Set_Overflow_Policy(S3_HLS_PES_CTX* ctx, S3_HLS_OVERFLOW_POLICY policy, uint32_t timeout_ms);
+
+/*
+ * Close current segment if its first frame is older than max_age_ms or no frame came in for max_idle_ms, 0 disables a limit
+ * Called from upload thread, returns S3_HLS_LOCK_FAILED without waiting when a writer holds the buffer
+ */
+int32_t S3_HLS_Pes_Flush_Stale_Segment(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t max_age_ms, uint32_t max_idle_ms);
+
+/*
+ * Write staged audio and close segment being written, called at finalize
+ */
+int32_t S3_HLS_Pes_Flush(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx);
+
+/*
+ * Cut segment at first SPS or IDR of program 0 once target_ms passed since segment start, 0 cuts at every SPS
+ * Until this is called, target follows segment_duration_ms of S3_HLS_VIDEO_INFO of program 0
+ * With max_target_ms above target_ms, target is multiplied by closed segments waiting for upload, up to max_target_ms
+ * Segments without video are cut at first audio frame once target_ms passed
+ */
+int32_t S3_HLS_Pes_Set_Segment_Duration(S3_HLS_PES_CTX* ctx, uint32_t target_ms, uint32_t max_target_ms);
+
+/*
+ * Classify NALUs, write AUD and PMT stream type of given codec, should be set before first frame
+ */
+int32_t S3_HLS_Pes_Set_Video_Codec(S3_HLS_PES_CTX* ctx, S3_HLS_VIDEO_CODEC codec);
+
+/*
+ * Video frame items start with start code or NALU length, should be set before first frame
+ */
+int32_t S3_HLS_Pes_Set_Nalu_Format(S3_HLS_PES_CTX* ctx, S3_HLS_NALU_FORMAT format);
+
+/*
+ * Hand out partial segments starting at key frames every part_ms, 0 disables
+ */
+int32_t S3_HLS_Pes_Set_Part_Duration(S3_HLS_PES_CTX* ctx, uint32_t part_ms);
+
+/*
+ * Write segments as MPEG-TS or fragmented MP4, should be set before first frame
+ * fMP4 supports one program only, init segment is written again after this call
+ */
+int32_t S3_HLS_Pes_Set_Container(S3_HLS_PES_CTX* ctx, S3_HLS_CONTAINER new_container);
+
+/*
+ * Write DTS from decode_timestamp of video frame items and derive PCR from it
+ */
+void S3_HLS_Pes_Set_Decode_Timestamp(S3_HLS_PES_CTX* ctx, uint8_t enable);
+
+/*
+ * Record offset, length and PTS of each IDR of program 0 in the part handed to flush call back
+ */
+void S3_HLS_Pes_Set_IFrame_Index(S3_HLS_PES_CTX* ctx, uint8_t enable);
+
+/*
+ * Copy audio frames to stage and write them as one PES once they cover duration_ms, 0 writes every frame as its own PES
+ * Staged audio is also written before a video frame duration_ms later than it and when segment is closed
+ */
+int32_t S3_HLS_Pes_Set_Audio_Aggregation(S3_HLS_PES_CTX* ctx, uint32_t duration_ms);
+
+/*
+ * Write PAT / PMT at segment start and then every pat_pmt_interval_ms, 0 means segment start only
+ * Write PCR so that gap between PCRs stays within pcr_interval_ms when frame rate allows, at most 100
+ * Intervals are measured in frame timestamps
+ */
+int32_t S3_HLS_Pes_Set_PSI_Interval(S3_HLS_PES_CTX* ctx, uint32_t pat_pmt_interval_ms, uint32_t pcr_interval_ms);
+
+/*
+ * Copy byte counters of segments closed by muxer
+ */
+int32_t S3_HLS_Pes_Get_Mux_Info(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, S3_HLS_MUX_INFO* info);
+
+/*
+ * Copy what latest SPS of program describes, S3_HLS_INVALID_STATUS until an SPS could be parsed
+ */
+int32_t S3_HLS_Pes_Get_Video_Info(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t program, S3_HLS_VIDEO_INFO* info);
+
+/*
+ * Copy drop counters, evicted segments are counted by buffer
+ */
+int32_t S3_HLS_Pes_Get_Drop_Counters(S3_HLS_PES_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, S3_HLS_DROP_COUNTERS* counters);
 
 #ifdef __cplusplus
 #if __cplusplus
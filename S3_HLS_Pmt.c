@@ -39,7 +39,7 @@
  *      0x00        0x00 last 8 bits for PID
  *      0xf0        reserved 0xf0, 4 bits for program_info_length (first 4 bits)
  *      0x00        last 8 bits of program_info_length
- *      0x1b        stream_type, 0x1b for H264 video, 0x0f for ISO13818-7 (AAC LC?), 0x03 for ISO 11172-3 (mp3?)
+ *      0x1b        stream_type, 0x1b for H264 video, 0x24 for H265 video, 0x0f for ISO13818-7 (AAC LC?), 0x03 for ISO 11172-3 (mp3?)
  *      0xe1        0xe0 reserved 0x01 first 5 bits of PID
  *      0x00        remaining 8 bits of PID
  *      0xf0        0xf0 reserved 0x00 first 4 bits of es info length
@@ -52,11 +52,14 @@
  *      0xf0        0xf0 reserved 0x00 first 4 bits of es info length
  *      0x00        0x00 remaining 8 bits of es info length
  *
- *      // CRC start
+ *      // CRC32 of section from table_id
  *      0x2f
  *      0x44
  *      0xb9
  *      0x9b
+ *
+ *  One PMT for each program, built when video codec, audio format or program count changes
+ *  Program n uses PMT PID 0x1000 + n, video PID 0x100 + 0x10 * n (also PCR PID) and audio PID 0x101 + 0x10 * n
  */
 
 
@@ -65,7 +68,7 @@
 #include <string.h>
 
 #include "S3_HLS_Pmt.h"
-#include "S3_HLS_Buffer_Mgr.h"
+#include "S3_HLS_CRC32.h"
 #include "S3_HLS_Return_Code.h"
 
 //#define S3_HLS_PMT_DEBUG
@@ -76,72 +79,151 @@
 #define PMT_DEBUG(x, ...)
 #endif
 
-#define S3_HLS_PMT_HEADER_LENGTH        188
+#define S3_HLS_PMT_SECTION_START        5       // TS header and pointer field
+#define S3_HLS_PMT_SECTION_HEADER       12      // table_id to program_info_length
+#define S3_HLS_PMT_STREAM_LENGTH        5
+#define S3_HLS_PMT_CRC_LENGTH           4
+
+#define S3_HLS_PMT_STREAM_TYPE_H264     0x1b
+#define S3_HLS_PMT_STREAM_TYPE_H265     0x24
+#define S3_HLS_PMT_STREAM_TYPE_AAC      0x0f
+#define S3_HLS_PMT_STREAM_TYPE_MP3      0x03
+
+static uint8_t* S3_HLS_PMT_Put_Stream(uint8_t* pos, uint8_t stream_type, uint32_t pid) {
+    *pos++ = stream_type;
+    *pos++ = 0xe0 | ((pid >> 8) & 0x1F);
+    *pos++ = pid & 0xFF;
+    *pos++ = 0xf0;
+    *pos++ = 0x00;
+
+    return pos;
+}
+
+static void S3_HLS_PMT_Build(S3_HLS_PMT_CTX* ctx, uint32_t program) {
+    uint8_t* packet = ctx->packets[program];
+    uint32_t pid = S3_HLS_Program_PMT_PID(program);
+    uint32_t pcr_pid = S3_HLS_Program_Video_PID(program);
+    uint32_t program_number = program + 1;
+
+    memset(packet, 0xFF, S3_HLS_TS_PACKET_SIZE);
+
+    packet[0] = 0x47;
+    packet[1] = 0x40 | ((pid >> 8) & 0x1F);  // payload start
+    packet[2] = pid & 0xFF;
+    packet[3] = 0x10;  // payload only, counter is set when written
+    packet[4] = 0x00;  // pointer field
+
+    uint8_t* section = packet + S3_HLS_PMT_SECTION_START;
+    uint32_t stream_count = 0 == ctx->audio_type ? 1 : 2;
+    uint32_t section_length = S3_HLS_PMT_SECTION_HEADER - 3 + S3_HLS_PMT_STREAM_LENGTH * stream_count + S3_HLS_PMT_CRC_LENGTH; // bytes after section length field
+
+    uint8_t* pos = section;
+    *pos++ = 0x02;
+    *pos++ = 0xb0 | ((section_length >> 8) & 0x0F);
+    *pos++ = section_length & 0xFF;
+    *pos++ = (program_number >> 8) & 0xFF;
+    *pos++ = program_number & 0xFF;
+    *pos++ = 0xc1;
+    *pos++ = 0x00;
+    *pos++ = 0x00;
+    *pos++ = 0xe0 | ((pcr_pid >> 8) & 0x1F);
+    *pos++ = pcr_pid & 0xFF;
+    *pos++ = 0xf0;
+    *pos++ = 0x00;
+
+    pos = S3_HLS_PMT_Put_Stream(pos, ctx->video_type, S3_HLS_Program_Video_PID(program));
+    if(0 != ctx->audio_type)
+        pos = S3_HLS_PMT_Put_Stream(pos, ctx->audio_type, S3_HLS_Program_Audio_PID(program));
+
+    uint32_t crc = S3_HLS_CRC32(section, pos - section);
+    *pos++ = (crc >> 24) & 0xFF;
+    *pos++ = (crc >> 16) & 0xFF;
+    *pos++ = (crc >> 8) & 0xFF;
+    *pos++ = crc & 0xFF;
+}
+
+static void S3_HLS_PMT_Build_All(S3_HLS_PMT_CTX* ctx) {
+    PMT_DEBUG("Building PMT for %d programs, audio type %d\n", ctx->program_count, ctx->audio_type);
+    for(uint32_t program = 0; program < ctx->program_count; program++)
+        S3_HLS_PMT_Build(ctx, program);
+
+    ctx->built = 1;
+}
 
-// Video + Audio AAC
-uint8_t const_pmt_aac[31] = { 0x47, 0x50, 0x00, 0x10, 0x00, 0x02, 0xb0, 0x17, // length
-                              0x00, 0x01, 0xc1, 0x00, 0x00, 0xe1, 0x00, 0xf0, // PCR PID = 0x0100,
-                              0x00, 0x1b, 0xe1, 0x00, 0xf0, 0x00, 0x0f, 0xe1, // PID 0x100 is video, PID 0x101 is audio
-                              0x01, 0xf0, 0x00, 0x2f, 0x44, 0xb9, 0x9b    }; // last 4 bytes are crc
+void S3_HLS_PMT_Initialize(S3_HLS_PMT_CTX* ctx) {
+    memset(ctx, 0, sizeof(S3_HLS_PMT_CTX));
 
-// // Video + Audio MP3? need generate crc
-uint8_t const_pmt_mp3[31] = { 0x47, 0x50, 0x00, 0x10, 0x00, 0x02, 0xb0, 0x17, // length
-                              0x00, 0x01, 0xc1, 0x00, 0x00, 0xe1, 0x00, 0xf0, // PCR PID = 0x0100,
-                              0x00, 0x1b, 0xe1, 0x00, 0xf0, 0x00, 0x03, 0xe1, // PID 0x100 is video, PID 0x101 is audio
-                              0x01, 0xf0, 0x00, 0x4e, 0x59, 0x3d, 0x1e    }; // last 4 bytes are crc
+    ctx->program_count = 1;
+    ctx->video_type = S3_HLS_PMT_STREAM_TYPE_H264;
+}
 
-// Video Only
-uint8_t const_pmt_video[26] = { 0x47, 0x50, 0x00, 0x10, 0x00, 0x02, 0xb0, 0x12, // length
-                                0x00, 0x01, 0xc1, 0x00, 0x00, 0xe1, 0x00, 0xf0, // PCR PID = 0x0100,
-                                0x00, 0x1b, 0xe1, 0x00, 0xf0, 0x00, 0x15, 0xbd,
-                                0x4d, 0x56  }; // last 4 bytes are crc
+int32_t S3_HLS_PMT_Set_Programs(S3_HLS_PMT_CTX* ctx, uint32_t program_count) {
+    if(0 == program_count || S3_HLS_MAX_PROGRAMS < program_count)
+        return S3_HLS_INVALID_PARAMETER;
 
-uint8_t *const_pmt = const_pmt_video;
-uint32_t pmt_size = sizeof(const_pmt_video);
+    ctx->program_count = program_count;
+    S3_HLS_PMT_Build_All(ctx);
 
-int8_t m_pmt_counter = 0;
+    return S3_HLS_OK;
+}
 
-int32_t S3_HLS_H264_PMT_Write_To_Buffer(S3_HLS_BUFFER_CTX* buffer_ctx) {
+int32_t S3_HLS_H264_PMT_Write_To_Buffer(S3_HLS_PMT_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t program) {
     PMT_DEBUG("Writing PMT!\n");
     int32_t ret;
 
-    const_pmt[S3_HLS_TS_COUNTER_INDEX] &= 0xF0;
-    const_pmt[S3_HLS_TS_COUNTER_INDEX] |= (m_pmt_counter & 0x0F);
+    if(ctx->program_count <= program)
+        return S3_HLS_INVALID_PARAMETER;
+
+    if(!ctx->built)
+        S3_HLS_PMT_Build_All(ctx);
+
+    uint8_t* packet = ctx->packets[program];
+    packet[S3_HLS_TS_COUNTER_INDEX] &= 0xF0;
+    packet[S3_HLS_TS_COUNTER_INDEX] |= (ctx->counters[program] & 0x0F);
 
     PMT_DEBUG("Put PMT to buffer!\n");
-    ret = S3_HLS_Put_To_Buffer(buffer_ctx, const_pmt, pmt_size);
+    ret = S3_HLS_Put_To_Buffer(buffer_ctx, packet, S3_HLS_TS_PACKET_SIZE);
     if(0 > ret)
         return ret;
 
-    ret = S3_HLS_Put_To_Buffer(buffer_ctx, const_fill_word, S3_HLS_PMT_HEADER_LENGTH - pmt_size);
-    if(0 > ret)
-        return ret;
+    ctx->counters[program]++;
 
-    m_pmt_counter++;
+    return S3_HLS_TS_PACKET_SIZE;
+}
 
-    return S3_HLS_PMT_HEADER_LENGTH;
+void S3_HLS_PMT_Reset_Counter(S3_HLS_PMT_CTX* ctx, uint32_t program) {
+    ctx->counters[program] = 0;
 }
 
-void S3_HLS_PMT_Reset_Counter() {
-    m_pmt_counter = 0;
+int8_t S3_HLS_PMT_Get_Counter(S3_HLS_PMT_CTX* ctx, uint32_t program) {
+    return ctx->counters[program];
 }
 
-void S3_HLS_PMT_Set_Audio(int audio) {
+void S3_HLS_PMT_Set_Counter(S3_HLS_PMT_CTX* ctx, uint32_t program, int8_t counter) {
+    ctx->counters[program] = counter;
+}
+
+void S3_HLS_PMT_Set_Audio(S3_HLS_PMT_CTX* ctx, int audio) {
   switch (audio) {
     case 1:
-      const_pmt = const_pmt_aac;
-      pmt_size = sizeof(const_pmt_aac);
+      ctx->audio_type = S3_HLS_PMT_STREAM_TYPE_AAC;
       printf("pmt aac\n");
       break;
     case 2:
-      const_pmt = const_pmt_mp3;
-      pmt_size = sizeof(const_pmt_mp3);
+      ctx->audio_type = S3_HLS_PMT_STREAM_TYPE_MP3;
       printf("pmt mp3\n");
       break;
     default:
-      const_pmt = const_pmt_video;
-      pmt_size = sizeof(const_pmt_video);
+      ctx->audio_type = 0;
       printf("pmt video\n");
       break;
   }
+
+  S3_HLS_PMT_Build_All(ctx);
+}
+
+void S3_HLS_PMT_Set_Video(S3_HLS_PMT_CTX* ctx, S3_HLS_VIDEO_CODEC codec) {
+    ctx->video_type = S3_HLS_VIDEO_CODEC_H265 == codec ? S3_HLS_PMT_STREAM_TYPE_H265 : S3_HLS_PMT_STREAM_TYPE_H264;
+
+    S3_HLS_PMT_Build_All(ctx);
 }
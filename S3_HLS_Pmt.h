@@ -20,6 +20,8 @@
 #define __S3_HLS_PMT_H__
 
 #include "stdint.h"
+#include "S3_HLS_Buffer_Mgr.h"
+#include "S3_HLS_Return_Code.h"
 
 #ifdef __cplusplus
 #if __cplusplus
@@ -31,14 +33,45 @@ extern "C" {
 #define ERR_S3_HLS_H264_PMT_INVALID_BUFFER_LENGTH       -2
 
 /*
- * write PMT header to buffer
- * as pmt is fixed for given stream will only verify size
+ * PMT packets and continuity counters of one muxer
+ */
+typedef struct s3_hls_pmt_s {
+    uint8_t packets[S3_HLS_MAX_PROGRAMS][S3_HLS_TS_PACKET_SIZE];
+    uint32_t program_count;
+    uint8_t video_type;
+    uint8_t audio_type;     // 0 for video only
+    uint8_t built;
+    int8_t counters[S3_HLS_MAX_PROGRAMS];
+} S3_HLS_PMT_CTX;
+
+/*
+ * Set context to single H264 program without audio
+ */
+void S3_HLS_PMT_Initialize(S3_HLS_PMT_CTX* ctx);
+
+/*
+ * Build PMT of programs 0 to program_count - 1, single program is built on first write when not called
+ */
+int32_t S3_HLS_PMT_Set_Programs(S3_HLS_PMT_CTX* ctx, uint32_t program_count);
+
+/*
+ * write PMT header of given program to buffer
  * returns number of bytes written to the buffer
  */
-int32_t S3_HLS_H264_PMT_Write_To_Buffer();
-void S3_HLS_PMT_Reset_Counter();
+int32_t S3_HLS_H264_PMT_Write_To_Buffer(S3_HLS_PMT_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, uint32_t program);
+void S3_HLS_PMT_Reset_Counter(S3_HLS_PMT_CTX* ctx, uint32_t program);
+int8_t S3_HLS_PMT_Get_Counter(S3_HLS_PMT_CTX* ctx, uint32_t program);
+void S3_HLS_PMT_Set_Counter(S3_HLS_PMT_CTX* ctx, uint32_t program, int8_t counter);
 
-void S3_HLS_PMT_Set_Audio();
+/*
+ * Set audio stream of every program, 1 for AAC, 2 for MP3, others for video only
+ */
+void S3_HLS_PMT_Set_Audio(S3_HLS_PMT_CTX* ctx, int audio);
+
+/*
+ * Set video stream type of every program, 0x1b for H264, 0x24 for H265
+ */
+void S3_HLS_PMT_Set_Video(S3_HLS_PMT_CTX* ctx, S3_HLS_VIDEO_CODEC codec);
 
 #ifdef __cplusplus
 #if __cplusplus
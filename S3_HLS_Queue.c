@@ -1,6 +1,8 @@
 #include "stdlib.h"
 #include "stdio.h"
+#include "time.h"
 #include "S3_HLS_Queue.h"
+#include "S3_HLS_Memory.h"
 #include "S3_HLS_Return_Code.h" 
 
 #define S3_HLS_QUEUE_DEBUG
@@ -11,135 +13,149 @@
 #define QUEUE_DEBUG(x, ...)
 #endif
 
+/*
+ * Items form a linked list in flush order: head -> ... -> dispatch -> ... -> tail
+ * head is a cleared item kept as sentinel, items up to dispatch are handed to workers, item right after dispatch is not
+ * Items after that may be taken out of order by scheduler, so dispatch is moved forward after each take
+ * Producer only moves tail, it publishes next pointer with release and workers load it with acquire
+ * Workers move dispatch and head under worker lock, head cannot pass an item not taken yet so it never passes dispatch
+ * Only items before head are freed and tail is never touched
+ */
+static int64_t S3_HLS_Queue_Now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static S3_HLS_QUEUE_ITEM* S3_HLS_Queue_New_Item(S3_HLS_QUEUE_CTX* ctx) {
+    if(NULL == ctx->spare_items) // take back all items cleared by workers at once
+        ctx->spare_items = __atomic_exchange_n(&ctx->free_items, NULL, __ATOMIC_ACQUIRE);
+
+    S3_HLS_QUEUE_ITEM* item = ctx->spare_items;
+    if(NULL != item) {
+        ctx->spare_items = item->next;
+        return item;
+    }
+
+    return (S3_HLS_QUEUE_ITEM*)S3_HLS_Malloc(sizeof(S3_HLS_QUEUE_ITEM));
+}
+
+static void S3_HLS_Queue_Recycle_Item(S3_HLS_QUEUE_CTX* ctx, S3_HLS_QUEUE_ITEM* item) {
+    // producer only swaps whole list out, so there is no ABA problem
+    item->next = __atomic_load_n(&ctx->free_items, __ATOMIC_RELAXED);
+    while(!__atomic_compare_exchange_n(&ctx->free_items, &item->next, item, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static void S3_HLS_Queue_Free_List(S3_HLS_QUEUE_ITEM* item) {
+    while(NULL != item) {
+        S3_HLS_QUEUE_ITEM* next = item->next;
+        S3_HLS_Free(item);
+        item = next;
+    }
+}
+
 S3_HLS_QUEUE_CTX* S3_HLS_Initialize_Queue() {
     QUEUE_DEBUG("Initializing Queue!\n");
     S3_HLS_QUEUE_CTX* ret = NULL;
     
-    ret = (S3_HLS_QUEUE_CTX*)malloc(sizeof(S3_HLS_QUEUE_CTX));
+    // allocator returns cache line aligned memory, so worker and producer fields stay on their own cache lines
+    ret = (S3_HLS_QUEUE_CTX*)S3_HLS_Malloc(sizeof(S3_HLS_QUEUE_CTX));
     if(NULL == ret) {
         QUEUE_DEBUG("[Init]Failed to allocate queue context!\n");
-        return ret;
-    }
-    
-    ret->queue_pos = 0;
-    ret->queue_length = 0;
-    
-    pthread_mutexattr_t mattr;
-    if(0 != pthread_mutexattr_init(&mattr)) {
-        QUEUE_DEBUG("[Init]Failed to initialize queue lock attribute!\n");
-        free(ret);
-        return NULL;
-    }
-    
-    int32_t protocol;
-    if(0 != pthread_mutexattr_getprotocol(&mattr, &protocol)) {
-        QUEUE_DEBUG("[Init]Failed to get queue lock protocol!\n");
-        free(ret);
         return NULL;
     }
-    
-    QUEUE_DEBUG("[Init]Queue Protocol: %d\n", protocol);
-    
-    if(0 != pthread_mutex_init(&ret->s3_hls_queue_lock, &mattr)) {
-        QUEUE_DEBUG("[Init]Failed to initialize queue lock!\n");
-        free(ret);
-        return NULL;
+
+    S3_HLS_QUEUE_ITEM* sentinel = (S3_HLS_QUEUE_ITEM*)S3_HLS_Malloc(sizeof(S3_HLS_QUEUE_ITEM));
+    if(NULL == sentinel) {
+        QUEUE_DEBUG("[Init]Failed to allocate queue item!\n");
+        goto l_free_ctx;
     }
-    
-    for(uint32_t i = 0; i < S3_HLS_MAX_PARTS_IN_BUFFER; i++) {
-        ret->queue[i].first_part_start = NULL;
-        ret->queue[i].second_part_start = NULL;
 
-        ret->queue[i].first_part_length = 0;
-        ret->queue[i].second_part_length = 0;
-        
-        ret->queue[i].timestamp = 0;
+    sentinel->state = S3_HLS_QUEUE_ITEM_DONE;
+    sentinel->seq = 0;
+    sentinel->next = NULL;
+
+    if(0 != pthread_mutex_init(&ret->worker_lock, NULL)) {
+        QUEUE_DEBUG("[Init]Failed to initialize worker lock!\n");
+        goto l_free_sentinel;
     }
-    
+
+    ret->head = sentinel;
+    ret->dispatch = sentinel;
+    ret->tail = sentinel;
+
+    ret->live_deadline = S3_HLS_QUEUE_DEFAULT_LIVE_DEADLINE;
+    ret->backlog_share = S3_HLS_QUEUE_DEFAULT_BACKLOG_SHARE;
+    ret->front_bytes = 0;
+    ret->backlog_bytes = 0;
+
+    ret->free_items = NULL;
+    ret->spare_items = NULL;
+
     return ret;
+
+l_free_sentinel:
+    S3_HLS_Free(sentinel);
+
+l_free_ctx:
+    S3_HLS_Free(ret);
+    return NULL;
 }
 
-int32_t S3_HLS_Add_To_Queue(S3_HLS_QUEUE_CTX* ctx, uint8_t* first_part, uint32_t first_length, uint8_t* second_part, uint32_t second_length, time_t timestamp) {
-    if(NULL == ctx) {
+int32_t S3_HLS_Add_To_Queue(S3_HLS_QUEUE_CTX* ctx, S3_HLS_BUFFER_PART_CTX* part_ctx, uint64_t seq, S3_HLS_UPLOAD_PRIORITY priority) {
+    if(NULL == ctx || NULL == part_ctx) {
         QUEUE_DEBUG("[Add]Invalid Queue Context!\n");
         return S3_HLS_INVALID_PARAMETER;
     }
-    
-    QUEUE_DEBUG("[Add]Locking queue! %lu\n", pthread_self());
-    int32_t ret = pthread_mutex_lock(&ctx->s3_hls_queue_lock);
-    if(0 != ret) {
-        QUEUE_DEBUG("[Add]Failed to lock queue lock! %d\n", ret);
-        return ret;
-    }
-    
-    QUEUE_DEBUG("Current queue length: %d\n", ctx->queue_length);
-    if(ctx->queue_length == S3_HLS_MAX_PARTS_IN_BUFFER) {
-        QUEUE_DEBUG("[Add]Queue is full!\n");
-        ret = pthread_mutex_unlock(&ctx->s3_hls_queue_lock);
-        if(0 != ret) {
-            QUEUE_DEBUG("[Add]Unlock queue failed! %d\n", ret);
-        }
-        return S3_HLS_QUEUE_FULL; // queue is full
-    }
 
-    uint8_t current_pos = ctx->queue_pos + ctx->queue_length;
-    if(current_pos >= S3_HLS_MAX_PARTS_IN_BUFFER)
-        current_pos -= S3_HLS_MAX_PARTS_IN_BUFFER;
+    S3_HLS_QUEUE_ITEM* item = S3_HLS_Queue_New_Item(ctx);
+    if(NULL == item) {
+        QUEUE_DEBUG("[Add]Failed to allocate queue item!\n");
+        return S3_HLS_OUT_OF_MEMORY;
+    }
 
-    ctx->queue[current_pos].first_part_start = first_part;
-    ctx->queue[current_pos].first_part_length = first_length;
-    ctx->queue[current_pos].second_part_start = second_part;
-    ctx->queue[current_pos].second_part_length = second_length;
-    ctx->queue[current_pos].timestamp = timestamp;
+    item->part = *part_ctx;
+    item->seq = seq;
+    item->deadline = S3_HLS_Queue_Now() + __atomic_load_n(&ctx->live_deadline, __ATOMIC_RELAXED);
+    item->priority = priority;
+    item->state = S3_HLS_QUEUE_ITEM_QUEUED;
+    item->next = NULL;
 
-    QUEUE_DEBUG("Before increase length: %d\n", ctx->queue_length);
+    // publish item to workers
+    __atomic_store_n(&ctx->tail->next, item, __ATOMIC_RELEASE);
+    ctx->tail = item;
 
-    ctx->queue_length++;
-    
-    QUEUE_DEBUG("Added to queue! length: %d\n", ctx->queue_length);
-    
-    QUEUE_DEBUG("[Add]Unlocking queue!%lu\n", pthread_self());
-    ret = pthread_mutex_unlock(&ctx->s3_hls_queue_lock);
-    if(0 != ret) {
-        QUEUE_DEBUG("[Add]Failed to unlock queue lock! %d\n", ret);
-        return ret;
-    }
+    QUEUE_DEBUG("Added to queue! seq: %llu\n", (unsigned long long)seq);
     
     return S3_HLS_OK;
 }
 
-int32_t S3_HLS_Release_Queue(S3_HLS_QUEUE_CTX* ctx) {
-    if(NULL == ctx) {
+int32_t S3_HLS_Release_Queue(S3_HLS_QUEUE_CTX* ctx, S3_HLS_QUEUE_ITEM* item, S3_HLS_BUFFER_CTX* buffer_ctx) {
+    if(NULL == ctx || NULL == item) {
         QUEUE_DEBUG("[Release]Invalid Queue Context!\n");
         return S3_HLS_INVALID_PARAMETER;
     }
-    
-    QUEUE_DEBUG("[Release]Locking queue!\n");
-	int32_t ret = pthread_mutex_lock(&ctx->s3_hls_queue_lock);
-    if(0 != ret) {
-        // unknown error
-        QUEUE_DEBUG("[Release]Get Queue Lock Failed! %d\n", ret);
-        return ret;
-    }
-    
-    if(ctx->queue_length > 0) {
-        ctx->queue_pos ++;
-        ctx->queue_length--;
-        QUEUE_DEBUG("Released queue! length: %d\n", ctx->queue_length);
-        
-        if(S3_HLS_MAX_PARTS_IN_BUFFER == ctx->queue_pos)
-            ctx->queue_pos = 0;
-    } else {
-        QUEUE_DEBUG("Queue is empty cannot release!\n");
+
+    if(0 != pthread_mutex_lock(&ctx->worker_lock))
+        return S3_HLS_LOCK_FAILED;
+
+    item->state = S3_HLS_QUEUE_ITEM_DONE;
+
+    // uploads finished early stay in queue until all older ones are done, buffer only supports clear in sequence
+    S3_HLS_QUEUE_ITEM* next = __atomic_load_n(&ctx->head->next, __ATOMIC_ACQUIRE);
+    while(NULL != next && S3_HLS_QUEUE_ITEM_DONE == next->state) {
+        S3_HLS_QUEUE_ITEM* cleared = ctx->head;
+        ctx->head = next;
+
+        S3_HLS_Clear_Buffer(buffer_ctx, &next->part);
+        S3_HLS_Queue_Recycle_Item(ctx, cleared);
+
+        QUEUE_DEBUG("Released queue! seq: %llu\n", (unsigned long long)next->seq);
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
     }
+
+    pthread_mutex_unlock(&ctx->worker_lock);
     
-    QUEUE_DEBUG("[Release]Unlocking queue!\n");
-    ret = pthread_mutex_unlock(&ctx->s3_hls_queue_lock);
-    if(0 != ret) {
-        // unknown error
-        QUEUE_DEBUG("[Release]Get Queue Unlock Failed! %d\n", ret);
-        return ret;
-    }
     return S3_HLS_OK;
 }
 
@@ -147,58 +163,133 @@ int32_t S3_HLS_Finalize_Queue(S3_HLS_QUEUE_CTX* ctx) {
     if(NULL == ctx) {
         return S3_HLS_INVALID_PARAMETER;
     }
+
+    S3_HLS_Queue_Free_List(ctx->head);
+    S3_HLS_Queue_Free_List(ctx->free_items);
+    S3_HLS_Queue_Free_List(ctx->spare_items);
+
+    pthread_mutex_destroy(&ctx->worker_lock);
+    S3_HLS_Free(ctx);
     
-    int32_t ret = pthread_mutex_destroy(&ctx->s3_hls_queue_lock);
-    if(0 != ret) {
-        QUEUE_DEBUG("Failed to destroy queue lock!\n");
+    return S3_HLS_OK;
+}
+
+int32_t S3_HLS_Set_Queue_Schedule(S3_HLS_QUEUE_CTX* ctx, uint32_t live_deadline, uint32_t backlog_share) {
+    if(NULL == ctx || backlog_share > 100)
+        return S3_HLS_INVALID_PARAMETER;
+
+    if(0 != pthread_mutex_lock(&ctx->worker_lock))
+        return S3_HLS_LOCK_FAILED;
+
+    __atomic_store_n(&ctx->live_deadline, live_deadline, __ATOMIC_RELAXED);
+    ctx->backlog_share = backlog_share;
+
+    pthread_mutex_unlock(&ctx->worker_lock);
+
+    return S3_HLS_OK;
+}
+
+/*
+ * Move dispatch over items already handed to workers, returns oldest item not taken yet
+ */
+static S3_HLS_QUEUE_ITEM* S3_HLS_Queue_Oldest(S3_HLS_QUEUE_CTX* ctx) {
+    S3_HLS_QUEUE_ITEM* next = __atomic_load_n(&ctx->dispatch->next, __ATOMIC_ACQUIRE);
+    while(NULL != next && S3_HLS_QUEUE_ITEM_QUEUED != next->state) {
+        ctx->dispatch = next;
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
     }
-    
-    free(ctx);
-    
-    return ret;
+
+    return next;
+}
+
+/*
+ * Hand item to worker and count its bytes for backlog share
+ */
+static void S3_HLS_Queue_Take(S3_HLS_QUEUE_CTX* ctx, S3_HLS_QUEUE_ITEM* item, uint8_t backlog) {
+    item->state = S3_HLS_QUEUE_ITEM_UPLOADING;
+
+    uint32_t length = S3_HLS_Get_Part_Length(&item->part);
+    if(backlog) {
+        ctx->backlog_bytes += length;
+    } else {
+        ctx->front_bytes += length;
+    }
+
+    if(ctx->front_bytes + ctx->backlog_bytes > S3_HLS_QUEUE_SHARE_WINDOW) {
+        ctx->front_bytes >>= 1;
+        ctx->backlog_bytes >>= 1;
+    }
+
+    S3_HLS_Queue_Oldest(ctx);
 }
 
-int32_t S3_HLS_Get_Item_From_Queue(S3_HLS_QUEUE_CTX* ctx, S3_HLS_BUFFER_PART_CTX* buffer_ctx) {
+static int32_t S3_HLS_Queue_Get(S3_HLS_QUEUE_CTX* ctx, S3_HLS_QUEUE_ITEM** item, uint8_t oldest_only) {
     QUEUE_DEBUG("Get Item From Queue!\n");
-    if(NULL == ctx || NULL == buffer_ctx) {
+    if(NULL == ctx || NULL == item) {
         QUEUE_DEBUG("Invalid Queue Context!\n");
         return S3_HLS_INVALID_PARAMETER;
     }
-    
-    QUEUE_DEBUG("[Get]Locking queue!\n");
-    int32_t ret = pthread_mutex_lock(&ctx->s3_hls_queue_lock);
-    if(0 != ret) {
-        QUEUE_DEBUG("[Get]Failed to lock queue lock! %d\n", ret);
-        return ret;
-    }
-    
-    
-    if(0 == ctx->queue_length) {
-        QUEUE_DEBUG("[Get]Queue is Empty!\n");
-        ret = pthread_mutex_unlock(&ctx->s3_hls_queue_lock);
-        if(0 != ret) {
-            QUEUE_DEBUG("[Get]Unlock queue failed! %d\n", ret);
+
+    if(0 != pthread_mutex_lock(&ctx->worker_lock))
+        return S3_HLS_LOCK_FAILED;
+
+    S3_HLS_QUEUE_ITEM* oldest = S3_HLS_Queue_Oldest(ctx);
+    S3_HLS_QUEUE_ITEM* newest = NULL;
+    S3_HLS_QUEUE_ITEM* live = NULL;
+    S3_HLS_QUEUE_ITEM* event = NULL;
+    S3_HLS_QUEUE_ITEM* backlog = NULL;
+
+    // only newest segment is live, once it is taken the older ones are filled in order
+    // one pass loads next with acquire and stops at last item published, so nothing past newest is read
+    for(S3_HLS_QUEUE_ITEM* current = oldest; NULL != current && !oldest_only; current = __atomic_load_n(&current->next, __ATOMIC_ACQUIRE)) {
+        newest = current;
+        if(S3_HLS_QUEUE_ITEM_QUEUED != current->state)
+            continue;
+
+        if(S3_HLS_UPLOAD_EVENT == current->priority) {
+            if(NULL == event)
+                event = current;
+        } else if(NULL == backlog) {
+            backlog = current;
         }
-        buffer_ctx->first_part_start = NULL;
-        buffer_ctx->first_part_length = 0;
-        buffer_ctx->second_part_start = NULL;
-        buffer_ctx->second_part_length = 0;
-        buffer_ctx->timestamp = 0;
-        return S3_HLS_QUEUE_EMPTY; //*by xxlang : queue is empty
     }
 
-    buffer_ctx->first_part_start = ctx->queue[ctx->queue_pos].first_part_start;
-    buffer_ctx->first_part_length = ctx->queue[ctx->queue_pos].first_part_length;
-    buffer_ctx->second_part_start = ctx->queue[ctx->queue_pos].second_part_start;
-    buffer_ctx->second_part_length = ctx->queue[ctx->queue_pos].second_part_length;
-    buffer_ctx->timestamp = ctx->queue[ctx->queue_pos].timestamp;
+    if(NULL != newest && S3_HLS_QUEUE_ITEM_QUEUED == newest->state && S3_HLS_UPLOAD_LIVE == newest->priority && newest->deadline > S3_HLS_Queue_Now()) {
+        live = newest;
+        if(backlog == live) // live segment is not part of backlog
+            backlog = NULL;
+    }
+
+    S3_HLS_QUEUE_ITEM* front = NULL != live ? live : event;
+    if(oldest_only) {
+        *item = oldest;
+        backlog = oldest;
+    } else if(NULL == front) {
+        *item = backlog;
+    } else if(NULL != backlog && ctx->backlog_bytes * 100 < (ctx->front_bytes + ctx->backlog_bytes) * ctx->backlog_share) {
+        *item = backlog; // backlog is behind its share
+    } else {
+        *item = front;
+    }
+
+    if(NULL != *item)
+        S3_HLS_Queue_Take(ctx, *item, *item == backlog);
+
+    pthread_mutex_unlock(&ctx->worker_lock);
 
-    QUEUE_DEBUG("[Get]Unlocking queue!\n");
-    ret = pthread_mutex_unlock(&ctx->s3_hls_queue_lock);
-    if(0 != ret) {
-        QUEUE_DEBUG("[Get]Failed to unlock queue lock! %d\n", ret);
-        return ret;
+    if(NULL == *item) {
+        QUEUE_DEBUG("[Get]Queue is Empty!\n");
+        return S3_HLS_QUEUE_EMPTY; //*by xxlang : queue is empty
     }
 
+    QUEUE_DEBUG("Take item seq: %llu, priority: %d\n", (unsigned long long)(*item)->seq, *item == backlog ? S3_HLS_UPLOAD_BACKLOG : (*item)->priority);
     return S3_HLS_OK;
 }
+
+int32_t S3_HLS_Get_Item_From_Queue(S3_HLS_QUEUE_CTX* ctx, S3_HLS_QUEUE_ITEM** item) {
+    return S3_HLS_Queue_Get(ctx, item, 0);
+}
+
+int32_t S3_HLS_Get_Oldest_Item_From_Queue(S3_HLS_QUEUE_CTX* ctx, S3_HLS_QUEUE_ITEM** item) {
+    return S3_HLS_Queue_Get(ctx, item, 1);
+}
@@ -21,6 +21,7 @@
 
 #include "stdint.h"
 #include "time.h"
+#include "pthread.h"
 
 #include "S3_HLS_Buffer_Mgr.h"
 
@@ -30,25 +31,91 @@ extern "C" {
 #endif
 #endif /* End of #ifdef __cplusplus */
 
-#define S3_HLS_MAX_PARTS_IN_BUFFER      10
+#define S3_HLS_QUEUE_DEFAULT_LIVE_DEADLINE      30000           // ms a segment counts as live after it is cut
+#define S3_HLS_QUEUE_DEFAULT_BACKLOG_SHARE      20              // percent of uploaded bytes reserved for backlog
+#define S3_HLS_QUEUE_SHARE_WINDOW               (64 << 20)      // bytes, older history is decayed so share follows recent traffic
 
+typedef enum {
+    S3_HLS_UPLOAD_LIVE = 0,     // newest segment goes first while within deadline
+    S3_HLS_UPLOAD_EVENT,        // promoted over backlog
+    S3_HLS_UPLOAD_BACKLOG       // oldest first, with a share of bandwidth
+} S3_HLS_UPLOAD_PRIORITY;
+
+typedef enum {
+    S3_HLS_QUEUE_ITEM_QUEUED = 0,
+    S3_HLS_QUEUE_ITEM_UPLOADING,
+    S3_HLS_QUEUE_ITEM_DONE      // buffer can be cleared once older items are done
+} S3_HLS_QUEUE_ITEM_STATE;
+
+/*
+ * One segment waiting for upload, items are linked in flush order
+ */
+typedef struct s3_hls_queue_item_s {
+    S3_HLS_BUFFER_PART_CTX part;
+    uint64_t seq;                               // x-amz-meta-seq, assigned when segment is flushed
+    int64_t deadline;                           // monotonic ms, live segment becomes backlog afterwards
+    S3_HLS_UPLOAD_PRIORITY priority;
+    S3_HLS_QUEUE_ITEM_STATE state;
+    struct s3_hls_queue_item_s* next;
+} S3_HLS_QUEUE_ITEM;
+
+/*
+ * Unbounded queue between buffer flush (single producer) and upload workers (multiple consumers)
+ * Uploads may finish out of order, buffer is still cleared in flush order
+ */
 typedef struct s3_hls_queue_s {
-    S3_HLS_BUFFER_PART_CTX queue[S3_HLS_MAX_PARTS_IN_BUFFER];
-    uint8_t queue_pos;
-    uint8_t queue_length;
-    
-    pthread_mutex_t s3_hls_queue_lock;
+    S3_HLS_QUEUE_ITEM* head;                    // last item cleared from buffer, moved by workers
+    S3_HLS_QUEUE_ITEM* dispatch;                // all items up to here are handed to workers, moved by workers
+    pthread_mutex_t worker_lock;
+
+    // scheduling, protected by worker lock
+    uint32_t live_deadline;
+    uint32_t backlog_share;
+    uint64_t front_bytes;                       // live and event bytes handed to workers
+    uint64_t backlog_bytes;
+
+    S3_HLS_QUEUE_ITEM* free_items;              // items cleared by workers, taken back by producer
+
+    S3_HLS_QUEUE_ITEM* tail S3_HLS_CACHE_ALIGNED;   // moved by producer
+    S3_HLS_QUEUE_ITEM* spare_items;             // producer only
 } S3_HLS_QUEUE_CTX;
 
 S3_HLS_QUEUE_CTX* S3_HLS_Initialize_Queue();
 
-int32_t S3_HLS_Add_To_Queue(S3_HLS_QUEUE_CTX* ctx, uint8_t* first_part, uint32_t first_length, uint8_t* second_part, uint32_t second_length, time_t timestamp);
+/*
+ * Called by buffer flush, item is allocated when no cleared item can be reused
+ * priority should be S3_HLS_UPLOAD_LIVE or S3_HLS_UPLOAD_EVENT, deadline is set from live deadline of queue
+ */
+int32_t S3_HLS_Add_To_Queue(S3_HLS_QUEUE_CTX* ctx, S3_HLS_BUFFER_PART_CTX* part_ctx, uint64_t seq, S3_HLS_UPLOAD_PRIORITY priority);
+
+/*
+ * live_deadline - ms after flush a segment is uploaded newest first, 0 makes queue first in first out
+ * backlog_share - percent of bytes given to backlog while live or event segments are waiting
+ */
+int32_t S3_HLS_Set_Queue_Schedule(S3_HLS_QUEUE_CTX* ctx, uint32_t live_deadline, uint32_t backlog_share);
 
-int32_t S3_HLS_Release_Queue(S3_HLS_QUEUE_CTX* ctx);
+/*
+ * Mark item as uploaded and clear buffer of all items that are done in flush order
+ * Item should not be used after calling this function
+ */
+int32_t S3_HLS_Release_Queue(S3_HLS_QUEUE_CTX* ctx, S3_HLS_QUEUE_ITEM* item, S3_HLS_BUFFER_CTX* buffer_ctx);
 
+/*
+ * Free all items, producer and workers should be stopped
+ */
 int32_t S3_HLS_Finalize_Queue(S3_HLS_QUEUE_CTX* ctx);
 
-int32_t S3_HLS_Get_Item_From_Queue(S3_HLS_QUEUE_CTX* ctx, S3_HLS_BUFFER_PART_CTX* buffer_ctx);
+/*
+ * Take next item by schedule: newest segment if still live, then event segments oldest first, then backlog oldest first
+ * Backlog is taken ahead of others while it got less than its share of bytes
+ * Returns S3_HLS_QUEUE_EMPTY if every item is handed to a worker
+ */
+int32_t S3_HLS_Get_Item_From_Queue(S3_HLS_QUEUE_CTX* ctx, S3_HLS_QUEUE_ITEM** item);
+
+/*
+ * Take oldest item not handed to a worker yet, used when writer asks to drop oldest segment
+ */
+int32_t S3_HLS_Get_Oldest_Item_From_Queue(S3_HLS_QUEUE_CTX* ctx, S3_HLS_QUEUE_ITEM** item);
 
 #ifdef __cplusplus
 #if __cplusplus
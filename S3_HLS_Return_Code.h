@@ -17,11 +17,20 @@
 #define S3_HLS_HTTP_CLIENT_INIT_ERROR               -10
 #define S3_HLS_THREAD_ALREADY_STOPPED               -11
 #define S3_HLS_UPLOAD_FAILED                        -12
+#define S3_HLS_TIMEOUT                              -13
+#define S3_HLS_SPOOL_FULL                           -14
+#define S3_HLS_IO_ERROR                             -15
 
 #define S3_HLS_TS_COUNTER_INDEX                     3
 
 #define S3_HLS_Video_PID                            0x100
 #define S3_HLS_Audio_PID                            0x101
+#define S3_HLS_PMT_PID                              0x1000
+
+// program n uses PMT PID 0x1000 + n and elementary stream PIDs 0x100 + 0x10 * n, program 0 keeps the PIDs above
+#define S3_HLS_Program_PMT_PID(program)             (S3_HLS_PMT_PID + (program))
+#define S3_HLS_Program_Video_PID(program)           (S3_HLS_Video_PID + ((program) << 4))
+#define S3_HLS_Program_Audio_PID(program)           (S3_HLS_Audio_PID + ((program) << 4))
 
 #define S3_HLS_TS_PACKET_SIZE                       188
 
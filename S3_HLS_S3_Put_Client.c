@@ -3,6 +3,7 @@
 #include <stdlib.h>
 
 #include "S3_HLS_Return_Code.h"
+#include "S3_HLS_Memory.h"
 #include "S3_HLS_S3_Put_Client.h"
 #include "S3_Crypto.h"
 
@@ -45,6 +46,9 @@
 #define S3_HLS_TAG_HEADER_IN_CANONICAL_REQUEST              ";x-amz-tagging"
 #define S3_HLS_TAG_HEADER_FORMAT                            "x-amz-tagging:%s"
 
+#define S3_HLS_CONTENT_TYPE_HEADER_FORMAT                   "Content-Type: %s"
+#define S3_HLS_DEFAULT_CONTENT_TYPE                         "video/mp2t"
+
 #define S3_HLS_AUTHENTICATION_HEADER_FORMAT                 "Authorization:AWS4-HMAC-SHA256 Credential=%s/%s/%s/s3/aws4_request,SignedHeaders=host;range;x-amz-content-sha256;x-amz-date%s%s%s,Signature=%s" // ak, date in yyyyMMdd, region, optional token heade, signature hex string
 
 #define S3_HLS_SECRET_ACCESS_KEY_FORMAT                     "AWS4%s" // sk
@@ -68,23 +72,52 @@ typedef struct s3_hls_upload_buffer_s{
 
     uint8_t* second_part_start;     // when using ring buffer there might have second part of video buffer
     uint32_t second_part_length;    // if not using ring buffer, just set second_part_start to NULL and set second_part_length to 0
+} S3_HLS_UPLOAD_BUFFER;
+
+typedef struct s3_hls_upload_ctx_s{
+    S3_HLS_CLIENT_READ_CALL_BACK read;
+    void* source;
 
+    uint32_t length;
     uint32_t pos;
 } S3_HLS_UPLOAD_CTX;
 
-static size_t S3_HLS_Upload_Data(void *ptr, size_t size, size_t nmemb, void *stream) {
-    S3_HLS_UPLOAD_CTX* ctx = (S3_HLS_UPLOAD_CTX*)stream;
-    PUT_DEBUG("Upload Data! %d %d %d %ld\n", size, nmemb, ctx->pos, stream);
-
-    if(NULL == ctx->first_part_start && 0 != ctx->first_part_length) {
-        return S3_HLS_INVALID_PARAMETER;
+static uint32_t S3_HLS_Read_Buffer(void* source, uint32_t pos, uint8_t** span) {
+    S3_HLS_UPLOAD_BUFFER* buffer = (S3_HLS_UPLOAD_BUFFER*)source;
+    if(pos < buffer->first_part_length) {
+        *span = buffer->first_part_start + pos;
+        return buffer->first_part_length - pos;
     }
 
-    if(NULL == ctx->second_part_start && 0 != ctx->second_part_length) {
-        return S3_HLS_INVALID_PARAMETER;
+    if(pos < buffer->first_part_length + buffer->second_part_length) {
+        *span = buffer->second_part_start + (pos - buffer->first_part_length);
+        return buffer->first_part_length + buffer->second_part_length - pos;
     }
 
-    if(ctx->pos == ctx->first_part_length + ctx->second_part_length) {
+    *span = NULL;
+    return 0;
+}
+
+/*
+ * Append header to list made of nodes inside client context, curl only reads the list so nothing is allocated
+ */
+static void S3_HLS_Client_Add_Header(S3_HLS_CLIENT_CTX* ctx, struct curl_slist** tail, uint32_t* count, const char* header) {
+    struct curl_slist* node = &ctx->headers[*count];
+    node->data = (char*)header;
+    node->next = NULL;
+
+    if(NULL != *tail)
+        (*tail)->next = node;
+
+    *tail = node;
+    (*count)++;
+}
+
+static size_t S3_HLS_Upload_Data(void *ptr, size_t size, size_t nmemb, void *stream) {
+    S3_HLS_UPLOAD_CTX* ctx = (S3_HLS_UPLOAD_CTX*)stream;
+    PUT_DEBUG("Upload Data! %d %d %d %ld\n", size, nmemb, ctx->pos, stream);
+
+    if(ctx->pos == ctx->length) {
         PUT_DEBUG("Upload Data Done! %d\n", ctx->pos);
         return 0;
     }
@@ -95,9 +128,14 @@ static size_t S3_HLS_Upload_Data(void *ptr, size_t size, size_t nmemb, void *str
 
     size_t len = size * nmemb;
     size_t bytes_written = 0;
-    if(ctx->pos < ctx->first_part_length) {
-        size_t bytes_to_write = len <= (ctx->first_part_length - ctx->pos) ? len : (ctx->first_part_length - ctx->pos);
-        memcpy(ptr, ctx->first_part_start + ctx->pos, bytes_to_write);
+    while(len > 0 && ctx->pos < ctx->length) {
+        uint8_t* span;
+        uint32_t span_length = ctx->read(ctx->source, ctx->pos, &span);
+        if(0 == span_length)
+            break;
+
+        size_t bytes_to_write = len <= span_length ? len : span_length;
+        memcpy(ptr, span, bytes_to_write);
         ctx->pos += bytes_to_write;
         len -= bytes_to_write;
         ptr += bytes_to_write;
@@ -105,27 +143,18 @@ static size_t S3_HLS_Upload_Data(void *ptr, size_t size, size_t nmemb, void *str
         bytes_written += bytes_to_write;
     }
 
-    if(len > 0) {
-        if(ctx->pos < ctx->first_part_length + ctx->second_part_length) { // write in second part
-        size_t bytes_to_write = len <= (ctx->first_part_length + ctx->second_part_length - ctx->pos) ? len : (ctx->first_part_length + ctx->second_part_length - ctx->pos);
-            memcpy(ptr, ctx->second_part_start + (ctx->pos - ctx->first_part_length), bytes_to_write);
-            ctx->pos += bytes_to_write;
-            bytes_written += bytes_to_write;
-        }
-    }
-
     PUT_DEBUG("Upload Bytes Written: %d\n", bytes_written);
     return bytes_written;
 }
 
-S3_HLS_CLIENT_CTX* S3_HLS_Client_Initialize(char* region, char* bucket, char* endpoint, uint64_t seq) {
+S3_HLS_CLIENT_CTX* S3_HLS_Client_Initialize(char* region, char* bucket, char* endpoint) {
     PUT_DEBUG("Initializing S3 Client!\n");
     if(NULL == region || NULL == bucket || strlen(region) < 3) {
         return NULL;
     }
 
     PUT_DEBUG("Allocate Client CTX!\n");
-    S3_HLS_CLIENT_CTX* ret = (S3_HLS_CLIENT_CTX*)malloc(sizeof(S3_HLS_CLIENT_CTX));
+    S3_HLS_CLIENT_CTX* ret = (S3_HLS_CLIENT_CTX*)S3_HLS_Malloc(sizeof(S3_HLS_CLIENT_CTX));
     if(NULL == ret) {
         PUT_DEBUG("Failed to allocate memory for client context!\n");
         return NULL;
@@ -153,10 +182,16 @@ S3_HLS_CLIENT_CTX* S3_HLS_Client_Initialize(char* region, char* bucket, char* en
     ret->tag_header = NULL;
     ret->tag_header_length = 0;
 
-    ret->seq = seq; //+by xxlang : x-amz-meta-seq
+    sprintf(ret->content_type_header, S3_HLS_CONTENT_TYPE_HEADER_FORMAT, S3_HLS_DEFAULT_CONTENT_TYPE);
 
     ret->curl = NULL;
 
+    ret->hmac_ctx = S3_HMAC_SHA256_New();
+    if(NULL == ret->hmac_ctx) {
+        PUT_DEBUG("Failed to allocate HMAC context!\n");
+        goto l_free_ctx;
+    }
+
 /*    ret->curl = curl_easy_init();
     curl_easy_setopt(ret->curl, CURLOPT_READFUNCTION, S3_HLS_Upload_Data);
 
@@ -167,7 +202,7 @@ S3_HLS_CLIENT_CTX* S3_HLS_Client_Initialize(char* region, char* bucket, char* en
 
     if(0 != pthread_mutex_init(&ret->credential_lock, NULL)) {
         PUT_DEBUG("Failed to initialize credential lock!\n");
-        goto l_free_ctx;
+        goto l_free_hmac_ctx;
     }
 
     int32_t length = 0;
@@ -186,7 +221,7 @@ S3_HLS_CLIENT_CTX* S3_HLS_Client_Initialize(char* region, char* bucket, char* en
             goto l_free_ctx;
         }
 
-        ret->endpoint = (char*)malloc(length + 1);
+        ret->endpoint = (char*)S3_HLS_Malloc(length + 1);
         if(NULL == ret->endpoint) {
             PUT_DEBUG("Out of memory!!\n");
             goto l_free_ctx;
@@ -207,7 +242,7 @@ S3_HLS_CLIENT_CTX* S3_HLS_Client_Initialize(char* region, char* bucket, char* en
     if(0 >= length)
         goto l_free_endpoint;
 
-    ret->host_header = (char*)malloc(length + 1); // for null pointer
+    ret->host_header = (char*)S3_HLS_Malloc(length + 1); // for null pointer
     if(NULL == ret->host_header)
         goto l_free_endpoint;
 
@@ -225,7 +260,7 @@ S3_HLS_CLIENT_CTX* S3_HLS_Client_Initialize(char* region, char* bucket, char* en
 
     length += S3_HLS_HEX_HASH_STIRNG_LENGTH; // Hash string used in format is empty string
 
-    ret->string_to_sign = (char*)malloc(length + 1); // null terminator
+    ret->string_to_sign = (char*)S3_HLS_Malloc(length + 1); // null terminator
     if(NULL == ret->string_to_sign) {
         PUT_DEBUG("Unable To Allocate Buffer For String To Sign!\n");
         goto l_free_host_header;
@@ -238,7 +273,7 @@ S3_HLS_CLIENT_CTX* S3_HLS_Client_Initialize(char* region, char* bucket, char* en
     }
 
     length += S3_HLS_MAX_KEY_LENGTH;
-    ret->uri = (char*)malloc(length + 1); // null terminator
+    ret->uri = (char*)S3_HLS_Malloc(length + 1); // null terminator
     if(NULL == ret->uri) {
         PUT_DEBUG("Unable To Allocate Memory For HTTPS URI!\n");
         goto l_free_string_to_sign;
@@ -250,20 +285,23 @@ S3_HLS_CLIENT_CTX* S3_HLS_Client_Initialize(char* region, char* bucket, char* en
     return ret;
 
 l_free_string_to_sign:
-    free(ret->string_to_sign);
+    S3_HLS_Free(ret->string_to_sign);
 
 l_free_host_header:
-    free(ret->host_header);
+    S3_HLS_Free(ret->host_header);
 
 l_free_endpoint:
     if(ret->free_endpoint)
-        free(ret->endpoint);
+        S3_HLS_Free(ret->endpoint);
 
     pthread_mutex_destroy(&ret->credential_lock);
     curl_easy_cleanup(ret->curl);
 
+l_free_hmac_ctx:
+    S3_HMAC_SHA256_Free(ret->hmac_ctx);
+
 l_free_ctx:
-    free(ret);
+    S3_HLS_Free(ret);
 
     return NULL;
 }
@@ -273,30 +311,45 @@ int32_t S3_HLS_Client_Finalize(S3_HLS_CLIENT_CTX* ctx) {
         curl_easy_cleanup(ctx->curl);
 
     if(NULL != ctx->uri)
-        free(ctx->uri);
+        S3_HLS_Free(ctx->uri);
 
     if(NULL != ctx->auth_header)
-        free(ctx->auth_header);
+        S3_HLS_Free(ctx->auth_header);
 
     if(NULL != ctx->token_header)
-        free(ctx->token_header);
+        S3_HLS_Free(ctx->token_header);
 
     if(NULL != ctx->tag_header)
-        free(ctx->tag_header);
+        S3_HLS_Free(ctx->tag_header);
 
     if(NULL != ctx->secret_access_key)
-        free(ctx->secret_access_key);
+        S3_HLS_Free(ctx->secret_access_key);
 
     if(ctx->free_endpoint)
-        free(ctx->endpoint);
+        S3_HLS_Free(ctx->endpoint);
 
     if(NULL != ctx->string_to_sign)
-        free(ctx->string_to_sign);
+        S3_HLS_Free(ctx->string_to_sign);
 
     if(NULL != ctx->host_header)
-        free(ctx->host_header);
+        S3_HLS_Free(ctx->host_header);
+
+    S3_HMAC_SHA256_Free(ctx->hmac_ctx);
+
+    S3_HLS_Free(ctx);
 
-    free(ctx);
+    return S3_HLS_OK;
+}
+
+int32_t S3_HLS_Client_Set_Content_Type(S3_HLS_CLIENT_CTX* ctx, char* content_type) {
+    if(NULL == ctx || NULL == content_type)
+        return S3_HLS_INVALID_PARAMETER;
+
+    if(sizeof(ctx->content_type_header) <= (size_t)snprintf(NULL, 0, S3_HLS_CONTENT_TYPE_HEADER_FORMAT, content_type))
+        return S3_HLS_INVALID_PARAMETER;
+
+    // header is not signed, only read by upload of same worker
+    sprintf(ctx->content_type_header, S3_HLS_CONTENT_TYPE_HEADER_FORMAT, content_type);
 
     return S3_HLS_OK;
 }
@@ -311,7 +364,7 @@ int32_t S3_HLS_Client_Set_Tag(S3_HLS_CLIENT_CTX* ctx, char* object_tag) {
 
     if(NULL == object_tag) {
         if(NULL != ctx->tag_header) {
-            free(ctx->tag_header);
+            S3_HLS_Free(ctx->tag_header);
             ctx->tag_header = NULL;
             ctx->tag_header_length = 0;
         }
@@ -338,7 +391,7 @@ int32_t S3_HLS_Client_Set_Tag(S3_HLS_CLIENT_CTX* ctx, char* object_tag) {
         goto l_unlock;
     }
 
-    temp_header = (char*)malloc(tag_length);
+    temp_header = (char*)S3_HLS_Malloc(tag_length);
     if(NULL == temp_header) {
         PUT_DEBUG("Allocate Space For Tag Header Failed\n");
         ret = S3_HLS_UNKNOWN_INTERNAL_ERROR;
@@ -349,12 +402,12 @@ int32_t S3_HLS_Client_Set_Tag(S3_HLS_CLIENT_CTX* ctx, char* object_tag) {
     if(0 >= tag_length) {
         PUT_DEBUG("Setting Tag Header Failed\n");
         ret = S3_HLS_UNKNOWN_INTERNAL_ERROR;
-        free(temp_header);
+        S3_HLS_Free(temp_header);
         goto l_unlock;
     }
 
     if(NULL != ctx->tag_header) {
-        free(ctx->tag_header);
+        S3_HLS_Free(ctx->tag_header);
     }
 
     ctx->tag_header = temp_header;
@@ -427,7 +480,7 @@ int32_t S3_HLS_Client_Set_Credential(S3_HLS_CLIENT_CTX* ctx, char* ak, char* sk,
     char* temp_auth_header = NULL;
 
     if(secret_access_key_length > ctx->secret_access_key_length) {
-        temp_secret_access_key = (char*)malloc(secret_access_key_length);
+        temp_secret_access_key = (char*)S3_HLS_Malloc(secret_access_key_length);
         if(NULL == temp_secret_access_key) {
             ret = S3_HLS_OUT_OF_MEMORY;
             goto l_unlock;
@@ -436,12 +489,12 @@ int32_t S3_HLS_Client_Set_Credential(S3_HLS_CLIENT_CTX* ctx, char* ak, char* sk,
 
     if(NULL != token) {
         if(token_header_length > ctx->token_header_length) {
-            temp_token_header = (char*)malloc(token_header_length);
+            temp_token_header = (char*)S3_HLS_Malloc(token_header_length);
             if(NULL == temp_token_header) {
                 ret = S3_HLS_OUT_OF_MEMORY;
 
                 if(NULL != temp_secret_access_key)
-                    free(temp_secret_access_key);
+                    S3_HLS_Free(temp_secret_access_key);
 
                 goto l_unlock;
             }
@@ -449,15 +502,15 @@ int32_t S3_HLS_Client_Set_Credential(S3_HLS_CLIENT_CTX* ctx, char* ak, char* sk,
     }
 
     if(auth_header_length > ctx->auth_header_length) {
-        temp_auth_header = (char*)malloc(auth_header_length);
+        temp_auth_header = (char*)S3_HLS_Malloc(auth_header_length);
         if(NULL == temp_auth_header) {
             ret = S3_HLS_OUT_OF_MEMORY;
 
             if(NULL != temp_secret_access_key)
-                free(temp_secret_access_key);
+                S3_HLS_Free(temp_secret_access_key);
 
             if(NULL != temp_token_header)
-                free(temp_token_header);
+                S3_HLS_Free(temp_token_header);
 
             goto l_unlock;
         }
@@ -466,7 +519,7 @@ int32_t S3_HLS_Client_Set_Credential(S3_HLS_CLIENT_CTX* ctx, char* ak, char* sk,
     // update pointer and length marks
     if(NULL != temp_secret_access_key) {
         if(NULL != ctx->secret_access_key) {
-            free(ctx->secret_access_key);
+            S3_HLS_Free(ctx->secret_access_key);
         }
 
         ctx->secret_access_key = temp_secret_access_key;
@@ -475,7 +528,7 @@ int32_t S3_HLS_Client_Set_Credential(S3_HLS_CLIENT_CTX* ctx, char* ak, char* sk,
 
     if(NULL != temp_token_header) {
         if(NULL != ctx->token_header) {
-            free(ctx->token_header);
+            S3_HLS_Free(ctx->token_header);
         }
 
         ctx->token_header = temp_token_header;
@@ -484,7 +537,7 @@ int32_t S3_HLS_Client_Set_Credential(S3_HLS_CLIENT_CTX* ctx, char* ak, char* sk,
 
     if(NULL != temp_auth_header) {
         if(NULL != ctx->auth_header) {
-            free(ctx->auth_header);
+            S3_HLS_Free(ctx->auth_header);
         }
 
         ctx->auth_header = temp_auth_header;
@@ -507,7 +560,7 @@ int32_t S3_HLS_Client_Set_Credential(S3_HLS_CLIENT_CTX* ctx, char* ak, char* sk,
             goto l_unlock;
         }
     } else if(NULL != ctx->token_header) { // in case of last token is not null and new one is null
-        free(ctx->token_header);
+        S3_HLS_Free(ctx->token_header);
         ctx->token_header = NULL;
         ctx->token_header_length = 0;
     }
@@ -584,7 +637,7 @@ static int32_t S3_HLS_Hash_Put_Canonical_Request(S3_HLS_CLIENT_CTX* ctx, char* o
     S3_SHA256_Update(&sha256_ctx, S3_HLS_CANONICAL_REQUEST_NEW_LINE, strlen(S3_HLS_CANONICAL_REQUEST_NEW_LINE));
 
     //+by xxlang : x-amz-meta-seq
-    char seq_header[128];
+    char seq_header[S3_HLS_SEQ_HEADER_BUFFER_SIZE];
     sprintf(seq_header, S3_HLS_SEQ_HEADER_FORMAT, seq);
     S3_SHA256_Update(&sha256_ctx, seq_header, strlen(seq_header));
     S3_SHA256_Update(&sha256_ctx, S3_HLS_CANONICAL_REQUEST_NEW_LINE, strlen(S3_HLS_CANONICAL_REQUEST_NEW_LINE));
@@ -637,12 +690,29 @@ static int32_t S3_HLS_Hash_Put_Canonical_Request(S3_HLS_CLIENT_CTX* ctx, char* o
     return S3_SHA256_Final(&sha256_ctx, result);
 }
 
-int32_t S3_HLS_Client_Upload_Buffer(S3_HLS_CLIENT_CTX* ctx, char* object_key, uint8_t* first_data, uint32_t first_length, uint8_t* second_data, uint32_t second_length) {
+int32_t S3_HLS_Client_Upload_Buffer(S3_HLS_CLIENT_CTX* ctx, char* object_key, uint64_t seq, uint8_t* first_data, uint32_t first_length, uint8_t* second_data, uint32_t second_length) {
+    if(NULL == first_data)
+        return S3_HLS_INVALID_PARAMETER;
+
+    if(NULL == second_data && 0 != second_length)
+        return S3_HLS_INVALID_PARAMETER;
+
+    S3_HLS_UPLOAD_BUFFER buffer;
+    buffer.first_part_start = first_data;
+    buffer.first_part_length = first_length;
+
+    buffer.second_part_start = second_data;
+    buffer.second_part_length = second_length;
+
+    return S3_HLS_Client_Upload_Reader(ctx, object_key, seq, S3_HLS_Read_Buffer, &buffer, first_length + second_length);
+}
+
+int32_t S3_HLS_Client_Upload_Reader(S3_HLS_CLIENT_CTX* ctx, char* object_key, uint64_t seq, S3_HLS_CLIENT_READ_CALL_BACK read, void* source, uint32_t payload_length) {
     uint8_t retry_flag = 0;
 
     PUT_DEBUG("Upload start!\n");
     PUT_DEBUG("Validate parameters\n");
-    if(NULL == ctx || NULL == object_key || NULL == first_data)
+    if(NULL == ctx || NULL == object_key || NULL == read)
         return S3_HLS_INVALID_PARAMETER;
 
     if(0 == strlen(object_key))
@@ -651,9 +721,6 @@ int32_t S3_HLS_Client_Upload_Buffer(S3_HLS_CLIENT_CTX* ctx, char* object_key, ui
     if('/' != object_key[0])
         return S3_HLS_INVALID_PARAMETER;
 
-    if(NULL == second_data && 0 != second_length)
-        return S3_HLS_INVALID_PARAMETER;
-
     PUT_DEBUG("Format date and timestamp!\n");
 
     time_t current_time;
@@ -672,9 +739,21 @@ int32_t S3_HLS_Client_Upload_Buffer(S3_HLS_CLIENT_CTX* ctx, char* object_key, ui
 
     S3_SHA256_CTX sha256_ctx;
     S3_SHA256_Init(&sha256_ctx);
-    S3_SHA256_Update(&sha256_ctx, first_data, first_length);
-    if(NULL != second_data)
-        S3_SHA256_Update(&sha256_ctx, second_data, second_length);
+    uint32_t hash_pos = 0;
+    while(hash_pos < payload_length) {
+        uint8_t* span;
+        uint32_t span_length = read(source, hash_pos, &span);
+        if(0 == span_length) {
+            PUT_DEBUG("Payload shorter than expected!\n");
+            return S3_HLS_INVALID_PARAMETER;
+        }
+
+        if(span_length > payload_length - hash_pos)
+            span_length = payload_length - hash_pos;
+
+        S3_SHA256_Update(&sha256_ctx, span, span_length);
+        hash_pos += span_length;
+    }
 
     S3_SHA256_HASH payload_hash;
     S3_SHA256_Final(&sha256_ctx, payload_hash);
@@ -692,7 +771,7 @@ int32_t S3_HLS_Client_Upload_Buffer(S3_HLS_CLIENT_CTX* ctx, char* object_key, ui
         return S3_HLS_UNKNOWN_INTERNAL_ERROR;
 
     S3_SHA256_HASH canonical_hash;
-    S3_HLS_Hash_Put_Canonical_Request(ctx, object_key, canonical_hash, ctx->seq);
+    S3_HLS_Hash_Put_Canonical_Request(ctx, object_key, canonical_hash, seq);
 
     char canonical_hash_string[S3_HLS_HEX_HASH_STIRNG_LENGTH + 1];
     for(uint8_t i = 0; i < S3_SHA256_DIGEST_LENGTH; i++) {
@@ -717,7 +796,8 @@ int32_t S3_HLS_Client_Upload_Buffer(S3_HLS_CLIENT_CTX* ctx, char* object_key, ui
         return S3_HLS_LOCK_FAILED;
 
     S3_SHA256_HASH date_key;
-    S3_HMAC_SHA256(
+    S3_HMAC_SHA256_With_Ctx(
+                    ctx->hmac_ctx,
                     ctx->secret_access_key,
                     strlen(ctx->secret_access_key),
                     ctx->date_buffer,
@@ -726,17 +806,17 @@ int32_t S3_HLS_Client_Upload_Buffer(S3_HLS_CLIENT_CTX* ctx, char* object_key, ui
                     );
 
     S3_SHA256_HASH region_key;
-    S3_HMAC_SHA256(date_key, SHA256_DIGEST_LENGTH, ctx->region, strlen(ctx->region), region_key);
+    S3_HMAC_SHA256_With_Ctx(ctx->hmac_ctx, date_key, SHA256_DIGEST_LENGTH, ctx->region, strlen(ctx->region), region_key);
 
     S3_SHA256_HASH service_key;
-    S3_HMAC_SHA256(region_key, SHA256_DIGEST_LENGTH, S3_SERVICE_KEY, strlen(S3_SERVICE_KEY), service_key);
+    S3_HMAC_SHA256_With_Ctx(ctx->hmac_ctx, region_key, SHA256_DIGEST_LENGTH, S3_SERVICE_KEY, strlen(S3_SERVICE_KEY), service_key);
 
     S3_SHA256_HASH signing_key;
-    S3_HMAC_SHA256(service_key, SHA256_DIGEST_LENGTH, AWS_SIGV4_REQUEST, strlen(AWS_SIGV4_REQUEST), signing_key);
+    S3_HMAC_SHA256_With_Ctx(ctx->hmac_ctx, service_key, SHA256_DIGEST_LENGTH, AWS_SIGV4_REQUEST, strlen(AWS_SIGV4_REQUEST), signing_key);
 
     PUT_DEBUG("String To Sign: \n%s\n", ctx->string_to_sign);
     S3_SHA256_HASH signature;
-    S3_HMAC_SHA256(signing_key, SHA256_DIGEST_LENGTH, ctx->string_to_sign, strlen(ctx->string_to_sign), signature);
+    S3_HMAC_SHA256_With_Ctx(ctx->hmac_ctx, signing_key, SHA256_DIGEST_LENGTH, ctx->string_to_sign, strlen(ctx->string_to_sign), signature);
 
     char signature_hash_string[S3_HLS_HEX_HASH_STIRNG_LENGTH + 1];
     for(uint8_t i = 0; i < S3_SHA256_DIGEST_LENGTH; i++) {
@@ -788,16 +868,15 @@ l_retry_entry:
     }
 
     S3_HLS_UPLOAD_CTX upload_ctx;
-    upload_ctx.first_part_start = first_data;
-    upload_ctx.first_part_length = first_length;
-
-    upload_ctx.second_part_start = second_data;
-    upload_ctx.second_part_length = second_length;
+    upload_ctx.read = read;
+    upload_ctx.source = source;
 
+    upload_ctx.length = payload_length;
     upload_ctx.pos = 0;
 
     // adding headers
-    struct curl_slist *headers = NULL;
+    struct curl_slist *tail = NULL;
+    uint32_t header_count = 0;
 
     // set upload methods
     curl_easy_setopt(ctx->curl, CURLOPT_UPLOAD, 1L);
@@ -809,7 +888,6 @@ l_retry_entry:
     PUT_DEBUG("Upload CTX: %ld\n", &upload_ctx);
     curl_easy_setopt(ctx->curl, CURLOPT_READDATA, &upload_ctx);
 
-    uint32_t payload_length = first_length + second_length;
     curl_easy_setopt(ctx->curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)payload_length);
 
     /* enable TCP keep-alive for this transfer */
@@ -826,30 +904,29 @@ l_retry_entry:
     curl_easy_setopt(ctx->curl, CURLOPT_SSL_VERIFYSTATUS, 0);
     curl_easy_setopt(ctx->curl, CURLOPT_SSL_VERIFYPEER, 0);
 
-    headers = curl_slist_append(headers, ctx->content_hash);
-    headers = curl_slist_append(headers, ctx->timestamp_buffer);
-    headers = curl_slist_append(headers, "Content-Type: video/mp2t"); //+by xxlang
-    headers = curl_slist_append(headers, "Expect:");
-    headers = curl_slist_append(headers, "Accept:");
+    S3_HLS_Client_Add_Header(ctx, &tail, &header_count, ctx->content_hash);
+    S3_HLS_Client_Add_Header(ctx, &tail, &header_count, ctx->timestamp_buffer);
+    S3_HLS_Client_Add_Header(ctx, &tail, &header_count, ctx->content_type_header); //+by xxlang
+    S3_HLS_Client_Add_Header(ctx, &tail, &header_count, "Expect:");
+    S3_HLS_Client_Add_Header(ctx, &tail, &header_count, "Accept:");
 
     if(NULL != ctx->token_header) {
-        headers = curl_slist_append(headers, ctx->token_header);
+        S3_HLS_Client_Add_Header(ctx, &tail, &header_count, ctx->token_header);
     }
 
     if(NULL != ctx->tag_header) {
-        headers = curl_slist_append(headers, ctx->tag_header);
+        S3_HLS_Client_Add_Header(ctx, &tail, &header_count, ctx->tag_header);
     }
 
     //+by xxlang : x-amz-meta-seq
-    char seq_header[128];
-    sprintf(seq_header, S3_HLS_SEQ_HEADER_FORMAT, ctx->seq);
-    headers = curl_slist_append(headers, seq_header);
+    sprintf(ctx->seq_header, S3_HLS_SEQ_HEADER_FORMAT, seq);
+    S3_HLS_Client_Add_Header(ctx, &tail, &header_count, ctx->seq_header);
 
     PUT_DEBUG("Auth Header: %s\n", ctx->auth_header);
-    headers = curl_slist_append(headers, ctx->auth_header);
+    S3_HLS_Client_Add_Header(ctx, &tail, &header_count, ctx->auth_header);
 
     /* Now specify we want to POST data */
-    curl_easy_setopt(ctx->curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(ctx->curl, CURLOPT_HTTPHEADER, ctx->headers);
 
     /* get verbose debug output please */
     curl_easy_setopt(ctx->curl, CURLOPT_VERBOSE, 1L);
@@ -859,8 +936,6 @@ l_retry_entry:
     CURLcode res = curl_easy_perform(ctx->curl);
     PUT_DEBUG("Put Done!\n");
 
-    curl_slist_free_all(headers);
-
     /* Check for errors */
     if(res != CURLE_OK) {
         fprintf(stderr, "curl_easy_perform() failed: %s\n",
@@ -880,10 +955,16 @@ l_retry_entry:
         return S3_HLS_UPLOAD_FAILED;
     }
 
-    ctx->seq++; //+by xxlang : x-amz-meta-seq
+    long response_code = 0;
+    curl_easy_getinfo(ctx->curl, CURLINFO_RESPONSE_CODE, &response_code);
+    if(response_code < 200 || response_code >= 300) { // e.g. expired credential, object is not stored
+        PUT_DEBUG("Upload rejected with HTTP status %ld!\n", response_code);
+        return S3_HLS_UPLOAD_FAILED;
+    }
+
     return S3_HLS_OK;
 }
 
-int32_t S3_HLS_Client_Upload_Object(S3_HLS_CLIENT_CTX* ctx, char* object_key, uint8_t* data, uint32_t length) {
-    return S3_HLS_Client_Upload_Buffer(ctx, object_key, data, length, NULL, 0);
+int32_t S3_HLS_Client_Upload_Object(S3_HLS_CLIENT_CTX* ctx, char* object_key, uint64_t seq, uint8_t* data, uint32_t length) {
+    return S3_HLS_Client_Upload_Buffer(ctx, object_key, seq, data, length, NULL, 0);
 }
@@ -24,11 +24,16 @@
 
 #include "curl/curl.h"
 
+#include "S3_Crypto.h"
+
 #define S3_HLS_MAX_KEY_LENGTH               1024
 
 #define S3_HLS_TIMESTAMP_HEADER_BUFFER_SIZE 28      // "%04d%02d%02dT%02d%02d%02dZ"
 #define S3_HLS_DATE_BUFFER_SIZE             9       // "%04d%02d%02d"
 #define S3_HLS_CONTENT_HASH_HEADER_LENGTH   86      // x-amz-content-sha256:......
+#define S3_HLS_SEQ_HEADER_BUFFER_SIZE       128     // x-amz-meta-seq:......
+#define S3_HLS_CONTENT_TYPE_HEADER_BUFFER_SIZE  64  // Content-Type: ......
+#define S3_HLS_MAX_REQUEST_HEADERS          9
 
 #ifdef __cplusplus
 #if __cplusplus
@@ -36,6 +41,12 @@ extern "C" {
 #endif
 #endif /* End of #ifdef __cplusplus */
 
+/*
+ * Read call back used by client to walk the payload
+ * Returns length of contiguous data starting at pos and set span to its address, returns 0 at end of payload
+ */
+typedef uint32_t (*S3_HLS_CLIENT_READ_CALL_BACK)(void* source, uint32_t pos, uint8_t** span);
+
 typedef struct s3_hls_client_s {
     char* endpoint;
     uint8_t free_endpoint;
@@ -68,17 +79,22 @@ typedef struct s3_hls_client_s {
     char* tag_header;
     uint32_t tag_header_length;
 
-    uint64_t seq; //+by xxlang : x-amz-meta-seq
+    char seq_header[S3_HLS_SEQ_HEADER_BUFFER_SIZE];
+    char content_type_header[S3_HLS_CONTENT_TYPE_HEADER_BUFFER_SIZE];
 
     pthread_mutex_t credential_lock;
 
+    // reused by every upload so signing and sending do not allocate
+    S3_HMAC_SHA256_CTX* hmac_ctx;
+    struct curl_slist headers[S3_HLS_MAX_REQUEST_HEADERS];
+
     CURL* curl;
 } S3_HLS_CLIENT_CTX;
 
 /*
  *
  */
-S3_HLS_CLIENT_CTX* S3_HLS_Client_Initialize(char* region, char* bucket, char* endpoint, uint64_t seq);
+S3_HLS_CLIENT_CTX* S3_HLS_Client_Initialize(char* region, char* bucket, char* endpoint);
 
 /*
  *
@@ -90,20 +106,31 @@ int32_t S3_HLS_Client_Finalize(S3_HLS_CLIENT_CTX* ctx);
  */
 int32_t S3_HLS_Client_Set_Tag(S3_HLS_CLIENT_CTX* ctx, char* object_tag);
 
+/*
+ * Content type of uploaded objects, default is video/mp2t
+ */
+int32_t S3_HLS_Client_Set_Content_Type(S3_HLS_CLIENT_CTX* ctx, char* content_type);
+
 /*
  *
  */
 int32_t S3_HLS_Client_Set_Credential(S3_HLS_CLIENT_CTX* ctx, char* ak, char* sk, char* token);
 
 /*
- *
+ * seq is sent as x-amz-meta-seq
+ */
+int32_t S3_HLS_Client_Upload_Buffer(S3_HLS_CLIENT_CTX* ctx, char* object_key, uint64_t seq, uint8_t* first_data, uint32_t first_length, uint8_t* second_data, uint32_t second_length);
+
+/*
+ * Upload payload of given length that is not stored in one or two contiguous parts
+ * The read call back is called from the beginning again when retrying
  */
-int32_t S3_HLS_Client_Upload_Buffer(S3_HLS_CLIENT_CTX* ctx, char* object_key, uint8_t* first_data, uint32_t first_length, uint8_t* second_data, uint32_t second_length);
+int32_t S3_HLS_Client_Upload_Reader(S3_HLS_CLIENT_CTX* ctx, char* object_key, uint64_t seq, S3_HLS_CLIENT_READ_CALL_BACK read, void* source, uint32_t length);
 
 /*
  *
  */
-int32_t S3_HLS_Client_Upload_Object(S3_HLS_CLIENT_CTX* ctx, char* object_key, uint8_t* data, uint32_t length);
+int32_t S3_HLS_Client_Upload_Object(S3_HLS_CLIENT_CTX* ctx, char* object_key, uint64_t seq, uint8_t* data, uint32_t length);
 
 #ifdef __cplusplus
 #if __cplusplus
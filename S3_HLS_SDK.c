@@ -16,8 +16,11 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <string.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <errno.h>
+#include <time.h>
 
 #include "curl/curl.h"
 
@@ -28,11 +31,30 @@
 #include "S3_HLS_Upload_Thread.h"
 #include "S3_HLS_S3_Put_Client.h"
 #include "S3_HLS_Queue.h"
+#include "S3_HLS_Memory.h"
+#include "S3_HLS_Spool.h"
+#include "S3_HLS_Interleave.h"
+#include "S3_HLS_Scheduler.h"
+#include "S3_Crypto.h"
 
 #define S3_HLS_TS_OBJECT_KEY_FORMAT "/%s/%04d/%02d/%02d/%02d/%02d/%02d.ts"
+#define S3_HLS_FMP4_OBJECT_KEY_FORMAT "/%s/%04d/%02d/%02d/%02d/%02d/%02d.m4s"
+#define S3_HLS_INIT_OBJECT_KEY_FORMAT "/%s/%04d/%02d/%02d/%02d/%02d/%02d_init.mp4"
+#define S3_HLS_TS_PART_OBJECT_KEY_FORMAT "/%s/%04d/%02d/%02d/%02d/%02d/%02d_%013llu.ts"      // key of segment, ms timestamp of first frame
+#define S3_HLS_FMP4_PART_OBJECT_KEY_FORMAT "/%s/%04d/%02d/%02d/%02d/%02d/%02d_%013llu.m4s"
+#define S3_HLS_FMP4_CONTENT_TYPE "video/mp4"
+#define S3_HLS_TS_CONTENT_TYPE "video/mp2t"
+#define S3_HLS_INDEX_OBJECT_KEY_FORMAT "%s.idx"     // key of segment
+#define S3_HLS_INDEX_LINE_FORMAT "%u %u %llu\n"    // offset, length, PTS
+#define S3_HLS_INDEX_LINE_MAX_LENGTH 34
 
 #define S3_HLS_SDK_EMPTY_STRING ""
 
+#define S3_HLS_SPOOL_RETRY_INTERVAL     5       // seconds to wait before draining spool again after an upload failed
+#define S3_HLS_WATCHDOG_INTERVAL        100     // ms between latency watchdog checks
+#define S3_HLS_WATCHDOG_MIN_LIMIT       1000    // object keys have second resolution, shorter segments would overwrite each other
+#define S3_HLS_GATEWAY_IDLE_WAIT        100     // ms gateway workers wait before serving watchdog and spool of streams
+
 #define S3_HLS_SDK_DEBUG
 
 #ifdef S3_HLS_SDK_DEBUG
@@ -41,72 +63,454 @@
 #define SDK_DEBUG(x, ...)
 #endif
 
-static S3_HLS_QUEUE_CTX*  s3_hls_queue_ctx = NULL;
-static S3_HLS_BUFFER_CTX* s3_hls_buffer_ctx = NULL;
-static S3_HLS_THREAD_CTX* s3_hls_worker_thread = NULL;
-static S3_HLS_CLIENT_CTX* s3_client = NULL;
+/*
+ * Each upload worker has its own thread and connection
+ * Worker of gateway uploads for the stream it took last
+ */
+typedef struct s3_hls_upload_worker_s {
+    S3_HLS_SDK_CTX* sdk;
+    S3_HLS_GATEWAY_CTX* gateway;
+    S3_HLS_THREAD_CTX* thread;
+    S3_HLS_CLIENT_CTX* client;
+    char object_key[S3_HLS_MAX_KEY_LENGTH + 1];
+
+    // I-frame index of segment being uploaded
+    char index_key[S3_HLS_MAX_KEY_LENGTH + 5];
+    char index_data[S3_HLS_BUFFER_MAX_INDEX_ENTRIES * S3_HLS_INDEX_LINE_MAX_LENGTH + 1];
+    uint32_t index_length;
+} S3_HLS_UPLOAD_WORKER;
+
+/*
+ * One stream with its own muxer, buffer, queue, upload workers and spool
+ */
+struct s3_hls_sdk_s {
+    S3_HLS_SDK_CONFIG config;
+
+    S3_HLS_PES_CTX pes;
+
+    // when set, segments are uploaded by workers of gateway and ring buffer is taken from its memory budget
+    S3_HLS_GATEWAY_CTX* gateway;
+    S3_HLS_SCHEDULER_STREAM stream;
+    uint64_t memory_reserved;
+
+    S3_HLS_QUEUE_CTX*  queue_ctx;
+    S3_HLS_BUFFER_CTX* buffer_ctx;
+
+    S3_HLS_UPLOAD_WORKER workers[S3_HLS_MAX_UPLOAD_WORKERS];
+    uint32_t worker_count;
+
+    S3_HLS_CONTAINER container;
+
+    uint64_t next_seq;      // assigned to segments on flush, writer side only
+    time_t segment_start;   // monotonic time current segment started, writer side only
+
+    time_t event_until;     // monotonic time, segments started before it are event segments
+
+    uint32_t upload_live_deadline;
+    uint32_t upload_backlog_share;
+
+    sem_t put_send_sem;
+    sem_t* send_sem;        // posted for each queued segment, semaphore of gateway when attached
 
-static sem_t s3_hls_put_send_sem;
+    char* object_prefix;
 
-static char* object_prefix = NULL;
+    uint32_t elastic_max_size;  // 0 means buffer size is fixed
+    uint32_t elastic_chunk_size;
 
-static char object_key_buffer[S3_HLS_MAX_KEY_LENGTH + 1];
+    uint32_t program_count;
+
+    S3_HLS_INTERLEAVE_CTX* interleave_ctx;
+    uint32_t interleave_window;     // 0 means frames are written when put
+    uint32_t interleave_video_stage;
+    uint32_t interleave_audio_stage;
+
+    S3_HLS_SPOOL_CTX* spool_ctx;
+    char* spool_directory;
+    uint64_t spool_max_size;
+    S3_HLS_SPOOL_EVICT_ORDER spool_evict_order;
+
+    pthread_mutex_t spool_lock;     // spool is shared by all workers
+    char spool_key_buffer[S3_HLS_MAX_KEY_LENGTH + 1];
+    time_t spool_retry_time;        // monotonic time after which spool can be drained
+
+    uint32_t watchdog_max_age;      // 0 means disabled
+    uint32_t watchdog_max_idle;
+
+    uint8_t finalizing;     // set by finalize, pending segments go to spool instead of being uploaded
+};
 
 /*
+ * Upload workers and connections shared by streams attached to it
  */
-static int S3_HLS_Upload_Queue_Item() {
-    SDK_DEBUG("Ready For Upload!\n");
-    int32_t ret = sem_wait(&s3_hls_put_send_sem);
-	if(0 != ret) {
-	    SDK_DEBUG("Error Semaphore impared! %d\n", ret);
-        return ret;
-	}
+struct s3_hls_gateway_s {
+    S3_HLS_GATEWAY_CONFIG config;
+
+    S3_HLS_UPLOAD_WORKER workers[S3_HLS_MAX_GATEWAY_WORKERS];
+    uint32_t worker_count;
+    uint32_t started_count;     // workers whose thread is running
+    uint8_t stopping;           // set by destroy, workers quit when nothing is queued
+
+    sem_t put_send_sem;
+    S3_HLS_SCHEDULER_CTX* scheduler;
+
+    pthread_mutex_t memory_lock;
+    uint64_t memory_reserved;   // ring buffers of attached streams
+};
+
+// instance behind functions without handle, static so setters called before S3_HLS_SDK_Set_Memory_Arena do not allocate
+static S3_HLS_SDK_CTX s3_hls_default_sdk;
+static pthread_once_t s3_hls_default_sdk_once = PTHREAD_ONCE_INIT;
+
+// curl, OpenSSL allocator and memory arena are process wide, set up by first initialized instance and released by last one
+static pthread_mutex_t s3_hls_global_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t s3_hls_active_instances = 0;
+static uint32_t s3_hls_created_instances = 0;   // allocated by S3_HLS_SDK_Create, initialized or not
+
+static time_t S3_HLS_Monotonic_Seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+static uint8_t S3_HLS_Watchdog_Enabled(S3_HLS_SDK_CTX* sdk) {
+    return 0 != __atomic_load_n(&sdk->watchdog_max_age, __ATOMIC_RELAXED) || 0 != __atomic_load_n(&sdk->watchdog_max_idle, __ATOMIC_RELAXED);
+}
+
+/*
+ * Returns S3_HLS_TIMEOUT when semaphore is not posted within wait_ms
+ */
+static int32_t S3_HLS_Timed_Wait(sem_t* sem, int64_t wait_ms) {
+    // sem_timedwait only accepts realtime clock, retry time is kept in monotonic clock
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+
+    deadline.tv_sec += wait_ms / 1000;
+    deadline.tv_nsec += (wait_ms % 1000) * 1000000;
+    if(deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    while(0 != sem_timedwait(sem, &deadline)) {
+        if(ETIMEDOUT == errno)
+            return S3_HLS_TIMEOUT;
+
+        if(EINTR != errno)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Wait for next segment from buffer
+ * Returns S3_HLS_TIMEOUT when nothing is queued and spooled segments can be uploaded, staged frames may be due or watchdog needs to check
+ */
+static int32_t S3_HLS_Wait_For_Segment(S3_HLS_SDK_CTX* sdk) {
+    int64_t wait_ms = -1; // wait forever
+
+    if(__atomic_load_n(&sdk->finalizing, __ATOMIC_ACQUIRE))
+        return sem_wait(&sdk->put_send_sem);
+
+    // only a hint whether there is something to drain, checked again under spool lock
+    if(!S3_HLS_Spool_Is_Empty(sdk->spool_ctx)) {
+        time_t now = S3_HLS_Monotonic_Seconds();
+        time_t retry_time = __atomic_load_n(&sdk->spool_retry_time, __ATOMIC_RELAXED);
+        wait_ms = retry_time > now ? (int64_t)(retry_time - now) * 1000 : 0;
+    }
+
+    // staged frames are written from here too once they waited window_ms
+    if((S3_HLS_Watchdog_Enabled(sdk) || NULL != sdk->interleave_ctx) && (0 > wait_ms || wait_ms > S3_HLS_WATCHDOG_INTERVAL))
+        wait_ms = S3_HLS_WATCHDOG_INTERVAL;
+
+    if(0 > wait_ms)
+        return sem_wait(&sdk->put_send_sem);
+
+    return S3_HLS_Timed_Wait(&sdk->put_send_sem, wait_ms);
+}
+
+/*
+ * Write segment to spool, segment is released from buffer afterwards regardless of result
+ */
+static int32_t S3_HLS_Spool_Segment(S3_HLS_UPLOAD_WORKER* worker, S3_HLS_QUEUE_ITEM* item) {
+    S3_HLS_SDK_CTX* sdk = worker->sdk;
+    S3_HLS_BUFFER_READER reader;
+    S3_HLS_Initialize_Reader(&reader, sdk->buffer_ctx, &item->part);
+
+    pthread_mutex_lock(&sdk->spool_lock);
+    int32_t ret = S3_HLS_Spool_Write(sdk->spool_ctx, worker->object_key, item->part.timestamp, item->seq, S3_HLS_Read_Part, &reader, S3_HLS_Get_Part_Length(&item->part));
+    pthread_mutex_unlock(&sdk->spool_lock);
+
+    if(S3_HLS_OK != ret) {
+        SDK_DEBUG("Spool segment failed! %d\n", ret);
+    }
+
+    return ret;
+}
 
-    S3_HLS_BUFFER_PART_CTX part_ctx;
-    ret = S3_HLS_Get_Item_From_Queue(s3_hls_queue_ctx, &part_ctx);
+/*
+ * Read call back of I-frame index, source is worker
+ */
+static uint32_t S3_HLS_Read_Index(void* source, uint32_t pos, uint8_t** span) {
+    S3_HLS_UPLOAD_WORKER* worker = (S3_HLS_UPLOAD_WORKER*)source;
+    if(pos >= worker->index_length)
+        return 0;
+
+    *span = (uint8_t*)worker->index_data + pos;
+    return worker->index_length - pos;
+}
+
+/*
+ * Build sidecar object of segment listing byte range and PTS of each IDR, one line per IDR
+ * Returns 0 if segment has no index
+ */
+static uint32_t S3_HLS_Build_Index(S3_HLS_UPLOAD_WORKER* worker, S3_HLS_BUFFER_PART_CTX* part_ctx) {
+    worker->index_length = 0;
+    if(0 == part_ctx->index_count)
+        return 0;
+
+    sprintf(worker->index_key, S3_HLS_INDEX_OBJECT_KEY_FORMAT, worker->object_key);
+
+    for(uint32_t cnt = 0; cnt < part_ctx->index_count; cnt++) {
+        S3_HLS_BUFFER_INDEX_ENTRY* entry = &part_ctx->index[cnt];
+        worker->index_length += sprintf(worker->index_data + worker->index_length, S3_HLS_INDEX_LINE_FORMAT, entry->offset, entry->length, (unsigned long long)entry->pts);
+    }
+
+    return worker->index_length;
+}
+
+/*
+ * Write I-frame index built for segment to spool, after the segment so it is uploaded after it
+ */
+static int32_t S3_HLS_Spool_Index(S3_HLS_UPLOAD_WORKER* worker, S3_HLS_QUEUE_ITEM* item) {
+    S3_HLS_SDK_CTX* sdk = worker->sdk;
+    pthread_mutex_lock(&sdk->spool_lock);
+    int32_t ret = S3_HLS_Spool_Write(sdk->spool_ctx, worker->index_key, item->part.timestamp, item->seq, S3_HLS_Read_Index, worker, worker->index_length);
+    pthread_mutex_unlock(&sdk->spool_lock);
+
+    if(S3_HLS_OK != ret) {
+        SDK_DEBUG("Spool index failed! %d\n", ret);
+    }
+
+    return ret;
+}
+
+/*
+ * Upload oldest spooled segment, stop draining for a while if it fails
+ * Only one worker drains at a time, others go back to wait for segments
+ */
+static void S3_HLS_Drain_Spool(S3_HLS_UPLOAD_WORKER* worker) {
+    S3_HLS_SDK_CTX* sdk = worker->sdk;
+    if(0 != pthread_mutex_trylock(&sdk->spool_lock))
+        return;
+
+    uint64_t seq;
+    uint32_t length;
+    if(S3_HLS_OK != S3_HLS_Spool_Peek(sdk->spool_ctx, sdk->spool_key_buffer, &seq, &length))
+        goto l_unlock;
+
+    SDK_DEBUG("Upload spooled segment %s!\n", sdk->spool_key_buffer);
+    if(S3_HLS_OK != S3_HLS_Client_Upload_Reader(worker->client, sdk->spool_key_buffer, seq, S3_HLS_Spool_Read, sdk->spool_ctx, length)) {
+        SDK_DEBUG("Upload spooled segment failed, retry later!\n");
+        __atomic_store_n(&sdk->spool_retry_time, S3_HLS_Monotonic_Seconds() + S3_HLS_SPOOL_RETRY_INTERVAL, __ATOMIC_RELAXED);
+        goto l_unlock;
+    }
+
+    S3_HLS_Spool_Remove(sdk->spool_ctx);
+
+l_unlock:
+    pthread_mutex_unlock(&sdk->spool_lock);
+}
+
+/*
+ * Upload thread is idle, write staged frames and close stale segment of stream, then catch up with its spooled segments
+ */
+static void S3_HLS_Maintain_Stream(S3_HLS_UPLOAD_WORKER* worker) {
+    S3_HLS_SDK_CTX* sdk = worker->sdk;
+
+    // merge stage otherwise only runs on put, frames staged before every producer stalled would stay there
+    if(NULL != sdk->interleave_ctx)
+        S3_HLS_Interleave_Merge(sdk->interleave_ctx);
+
+    if(S3_HLS_Watchdog_Enabled(sdk))
+        S3_HLS_Pes_Flush_Stale_Segment(&sdk->pes, sdk->buffer_ctx, __atomic_load_n(&sdk->watchdog_max_age, __ATOMIC_RELAXED), __atomic_load_n(&sdk->watchdog_max_idle, __ATOMIC_RELAXED));
+
+    if(!S3_HLS_Spool_Is_Empty(sdk->spool_ctx) && S3_HLS_Monotonic_Seconds() >= __atomic_load_n(&sdk->spool_retry_time, __ATOMIC_RELAXED))
+        S3_HLS_Drain_Spool(worker);
+}
+
+/*
+ * Upload next segment of stream of worker, uploads may finish out of order and queue clears buffer in flush order
+ * uploaded is set to length of segment, 0 if segment is dropped
+ */
+static int32_t S3_HLS_Upload_Segment(S3_HLS_UPLOAD_WORKER* worker, uint32_t* uploaded) {
+    S3_HLS_SDK_CTX* sdk = worker->sdk;
+    int32_t ret;
+
+    *uploaded = 0;
+
+    S3_HLS_QUEUE_ITEM* item;
+    uint8_t evict = S3_HLS_Take_Evict_Request(sdk->buffer_ctx);
+    if(evict) { // writer is out of room, drop oldest segment instead of the one scheduled next
+        ret = S3_HLS_Get_Oldest_Item_From_Queue(sdk->queue_ctx, &item);
+    } else {
+        ret = S3_HLS_Get_Item_From_Queue(sdk->queue_ctx, &item);
+    }
 
 	if(S3_HLS_OK != ret) {
 	    SDK_DEBUG("Failed to get item from queue!\n");
 	    return ret;
 	}
 
-    struct tm* time_tm = gmtime(&part_ctx.timestamp);
+    S3_HLS_BUFFER_PART_CTX* part_ctx = &item->part;
+
+    // fragments cannot be played without init segment, upload it instead of dropping
+    if(evict && part_ctx->is_init)
+        evict = 0;
+
+    // dropping partial segment frees nothing, drop next one as well
+    if(evict && part_ctx->is_partial)
+        S3_HLS_Set_Evict_Request(sdk->buffer_ctx, 1);
 
-    if(0 >= sprintf(object_key_buffer, S3_HLS_TS_OBJECT_KEY_FORMAT, object_prefix ? object_prefix : S3_HLS_SDK_EMPTY_STRING, time_tm->tm_year + 1900, time_tm->tm_mon + 1, time_tm->tm_mday, time_tm->tm_hour, time_tm->tm_min, time_tm->tm_sec)) {
+    struct tm time_tm;
+    gmtime_r(&part_ctx->timestamp, &time_tm);
+
+    char* key_format = S3_HLS_TS_OBJECT_KEY_FORMAT;
+    if(part_ctx->is_init)
+        key_format = S3_HLS_INIT_OBJECT_KEY_FORMAT;
+    else if(part_ctx->is_partial)
+        key_format = S3_HLS_CONTAINER_FMP4 == sdk->container ? S3_HLS_FMP4_PART_OBJECT_KEY_FORMAT : S3_HLS_TS_PART_OBJECT_KEY_FORMAT;
+    else if(S3_HLS_CONTAINER_FMP4 == sdk->container)
+        key_format = S3_HLS_FMP4_OBJECT_KEY_FORMAT;
+
+    // formats without partial timestamp ignore the extra argument
+    if(0 >= sprintf(worker->object_key, key_format, sdk->object_prefix ? sdk->object_prefix : S3_HLS_SDK_EMPTY_STRING, time_tm.tm_year + 1900, time_tm.tm_mon + 1, time_tm.tm_mday, time_tm.tm_hour, time_tm.tm_min, time_tm.tm_sec, (unsigned long long)part_ctx->part_timestamp)) {
         SDK_DEBUG("Unkown Internal Error!\n");
         return -1;
     }
 
 	SDK_DEBUG("Get Queue Info!\n");
-	SDK_DEBUG("Queue Info: %p, %u, %p, %u\n", part_ctx.first_part_start, part_ctx.first_part_length, part_ctx.second_part_start, part_ctx.second_part_length);
-	S3_HLS_Client_Upload_Buffer(s3_client, object_key_buffer, part_ctx.first_part_start, part_ctx.first_part_length, part_ctx.second_part_start, part_ctx.second_part_length);
+	SDK_DEBUG("Queue Info: %p, %u, %p, %u, %u, seq %llu\n", part_ctx->first_part_start, part_ctx->first_part_length, part_ctx->second_part_start, part_ctx->second_part_length, part_ctx->ref_count, (unsigned long long)item->seq);
+	if(evict) {
+	    SDK_DEBUG("Evict segment without uploading!\n");
+	} else if(part_ctx->is_partial && __atomic_load_n(&sdk->finalizing, __ATOMIC_ACQUIRE)) { // parent segment carries same frames
+	    SDK_DEBUG("Exiting, drop partial segment!\n");
+	} else if(NULL != sdk->spool_ctx && __atomic_load_n(&sdk->finalizing, __ATOMIC_ACQUIRE)) { // do not block exit on network
+	    SDK_DEBUG("Exiting, keep segment in spool!\n");
+	    if(S3_HLS_OK == S3_HLS_Spool_Segment(worker, item) && 0 < S3_HLS_Build_Index(worker, part_ctx))
+	        S3_HLS_Spool_Index(worker, item);
+	} else {
+	    if(0 == part_ctx->ref_count) {
+	        ret = S3_HLS_Client_Upload_Buffer(worker->client, worker->object_key, item->seq, part_ctx->first_part_start, part_ctx->first_part_length, part_ctx->second_part_start, part_ctx->second_part_length);
+	    } else { // interleave ring bytes with referenced frame data
+	        S3_HLS_BUFFER_READER reader;
+	        S3_HLS_Initialize_Reader(&reader, sdk->buffer_ctx, part_ctx);
+	        ret = S3_HLS_Client_Upload_Reader(worker->client, worker->object_key, item->seq, S3_HLS_Read_Part, &reader, S3_HLS_Get_Part_Length(part_ctx));
+	    }
+
+	    if(S3_HLS_OK == ret) {
+	        __atomic_store_n(&sdk->spool_retry_time, 0, __ATOMIC_RELAXED); // connection is back, drain spool when idle
+	    } else if(NULL != sdk->spool_ctx && !part_ctx->is_partial) {
+	        SDK_DEBUG("Upload failed, keep segment in spool!\n");
+	        __atomic_store_n(&sdk->spool_retry_time, S3_HLS_Monotonic_Seconds() + S3_HLS_SPOOL_RETRY_INTERVAL, __ATOMIC_RELAXED);
+	        ret = S3_HLS_Spool_Segment(worker, item);
+	    }
+
+	    // index goes after its segment, so it never points into a segment that is not uploaded or spooled
+	    if(S3_HLS_OK == ret && 0 < S3_HLS_Build_Index(worker, part_ctx)) {
+	        if(S3_HLS_OK != S3_HLS_Client_Upload_Object(worker->client, worker->index_key, item->seq, (uint8_t*)worker->index_data, worker->index_length) && NULL != sdk->spool_ctx) {
+	            SDK_DEBUG("Upload index failed, keep index in spool!\n");
+	            S3_HLS_Spool_Index(worker, item);
+	        }
+	    }
+	}
 
 	SDK_DEBUG("Upload Complete, Clear Queue Buffer!\n");
+	if(!evict)
+	    *uploaded = S3_HLS_Get_Part_Length(part_ctx);
 
-	if(S3_HLS_OK != S3_HLS_Release_Queue(s3_hls_queue_ctx)) {
+    // buffer is cleared by queue once all older segments are done, no need to block writers here
+	if(S3_HLS_OK != S3_HLS_Release_Queue(sdk->queue_ctx, item, sdk->buffer_ctx)) {
         SDK_DEBUG("Release Queue Failed!\n");
 	    return -1;
 	}
 
-    if(S3_HLS_OK != S3_HLS_Lock_Buffer(s3_hls_buffer_ctx)) {
-        SDK_DEBUG("Get Buffer Lock Failed!\n");
-        return -1;
+    return 0;
+}
+
+/*
+ * Run by each upload worker of instance
+ */
+static int S3_HLS_Upload_Queue_Item(void* user_data) {
+    S3_HLS_UPLOAD_WORKER* worker = (S3_HLS_UPLOAD_WORKER*)user_data;
+    uint32_t uploaded;
+
+    SDK_DEBUG("Ready For Upload!\n");
+    int32_t ret = S3_HLS_Wait_For_Segment(worker->sdk);
+    if(S3_HLS_TIMEOUT == ret) {
+        S3_HLS_Maintain_Stream(worker);
+        return 0;
     }
 
-    SDK_DEBUG("Release Buffer!\n");
-    S3_HLS_Clear_Buffer(s3_hls_buffer_ctx, &part_ctx);
+	if(0 != ret) {
+	    SDK_DEBUG("Error Semaphore impared! %d\n", ret);
+        return ret;
+	}
+
+    return S3_HLS_Upload_Segment(worker, &uploaded);
+}
 
-    if(S3_HLS_OK != S3_HLS_Unlock_Buffer(s3_hls_buffer_ctx)) {
-        SDK_DEBUG("Get Buffer Unlock Failed!\n");
-        return -1;
+/*
+ * Run by each worker of gateway, takes segment of the stream that scheduler picks so busy streams cannot starve quiet ones
+ */
+static int S3_HLS_Gateway_Upload_Item(void* user_data) {
+    S3_HLS_UPLOAD_WORKER* worker = (S3_HLS_UPLOAD_WORKER*)user_data;
+    S3_HLS_GATEWAY_CTX* gateway = worker->gateway;
+    S3_HLS_SCHEDULER_STREAM* stream;
+    uint32_t position = 0;
+    uint32_t uploaded = 0;
+
+    int32_t ret = S3_HLS_Timed_Wait(&gateway->put_send_sem, S3_HLS_GATEWAY_IDLE_WAIT);
+    if(S3_HLS_TIMEOUT == ret) { // pool is idle, serve watchdog and spool of each stream
+        while(NULL != (stream = S3_HLS_Scheduler_Acquire(gateway->scheduler, &position))) {
+            worker->sdk = (S3_HLS_SDK_CTX*)stream->user_data;
+            if(!__atomic_load_n(&worker->sdk->finalizing, __ATOMIC_ACQUIRE)) {
+                S3_HLS_Client_Set_Content_Type(worker->client, S3_HLS_CONTAINER_FMP4 == worker->sdk->container ? S3_HLS_FMP4_CONTENT_TYPE : S3_HLS_TS_CONTENT_TYPE);
+                S3_HLS_Maintain_Stream(worker);
+            }
+            S3_HLS_Scheduler_Release(gateway->scheduler, stream);
+        }
+        worker->sdk = NULL;
+        return __atomic_load_n(&gateway->stopping, __ATOMIC_ACQUIRE);
     }
 
-    return 0;
+    if(0 != ret) {
+        SDK_DEBUG("Error Semaphore impared! %d\n", ret);
+        return ret;
+    }
+
+    stream = S3_HLS_Scheduler_Take(gateway->scheduler);
+    if(NULL == stream) // posted by destroy
+        return __atomic_load_n(&gateway->stopping, __ATOMIC_ACQUIRE);
+
+    worker->sdk = (S3_HLS_SDK_CTX*)stream->user_data;
+    S3_HLS_Client_Set_Content_Type(worker->client, S3_HLS_CONTAINER_FMP4 == worker->sdk->container ? S3_HLS_FMP4_CONTENT_TYPE : S3_HLS_TS_CONTENT_TYPE);
+
+    ret = S3_HLS_Upload_Segment(worker, &uploaded);
+    worker->sdk = NULL;
+    S3_HLS_Scheduler_Done(gateway->scheduler, stream, uploaded);
+    if(0 != ret)
+        SDK_DEBUG("Upload segment of stream %u failed! %d\n", stream->index, ret);
+
+    return 0; // one stream failing must not stop workers shared by others
 }
 
 /*
+ * Buffer call back, user_data is instance the buffer belongs to
  */
-static void  S3_HLS_Add_Buffer_To_Queue(S3_HLS_BUFFER_PART_CTX* ctx) {
+static void  S3_HLS_Add_Buffer_To_Queue(S3_HLS_BUFFER_PART_CTX* ctx, void* user_data) {
+    S3_HLS_SDK_CTX* sdk = (S3_HLS_SDK_CTX*)user_data;
+
     SDK_DEBUG("Adding buffer to queue!\n");
     if(NULL == ctx) {
         SDK_DEBUG("Invalid CTX!\n");
@@ -123,24 +527,198 @@ static void  S3_HLS_Add_Buffer_To_Queue(S3_HLS_BUFFER_PART_CTX* ctx) {
         return;
     }
 
-    if(0 == ctx->first_part_length + ctx->second_part_length) {
+    if(0 == S3_HLS_Get_Part_Length(ctx)) {
         SDK_DEBUG("Empty Part!\n");
         return;
     }
 
-    int32_t ret = S3_HLS_Add_To_Queue(s3_hls_queue_ctx, ctx->first_part_start, ctx->first_part_length, ctx->second_part_start, ctx->second_part_length, ctx->timestamp);
+    // called under buffer lock, so seq follows the order segments are cut
+    time_t now = S3_HLS_Monotonic_Seconds();
+    S3_HLS_UPLOAD_PRIORITY priority = sdk->segment_start <= __atomic_load_n(&sdk->event_until, __ATOMIC_RELAXED) ? S3_HLS_UPLOAD_EVENT : S3_HLS_UPLOAD_LIVE;
+    if(!ctx->is_partial)
+        sdk->segment_start = now;
+
+    int32_t ret = S3_HLS_Add_To_Queue(sdk->queue_ctx, ctx, sdk->next_seq, priority);
     if(0 != ret) {
         // unknown error
         SDK_DEBUG("Add item to queue failed! %d\n", ret);
         return;
     }
 
+    // partial segments carry seq of the segment they belong to
+    if(!ctx->is_partial)
+        sdk->next_seq++;
+
     SDK_DEBUG("Added to queue!\n");
 
-	ret = sem_post(&s3_hls_put_send_sem);
-	if(0 != ret) {
-	    SDK_DEBUG("Error, post semaphore failed! %d\n", ret);
-	}
+    if(NULL != sdk->gateway)
+        S3_HLS_Scheduler_Push(sdk->gateway->scheduler, &sdk->stream, S3_HLS_Get_Part_Length(ctx));
+
+    ret = sem_post(sdk->send_sem);
+    if(0 != ret) {
+        SDK_DEBUG("Error, post semaphore failed! %d\n", ret);
+    }
+}
+
+/*
+ * Set default values of instance, done once for each instance
+ */
+static void S3_HLS_SDK_Initialize_Ctx(S3_HLS_SDK_CTX* sdk) {
+    memset(sdk, 0, sizeof(S3_HLS_SDK_CTX));
+
+    S3_HLS_Pes_Initialize(&sdk->pes);
+
+    sdk->worker_count = 1;
+    sdk->container = S3_HLS_CONTAINER_TS;
+    sdk->event_until = -1;
+    sdk->upload_live_deadline = S3_HLS_QUEUE_DEFAULT_LIVE_DEADLINE;
+    sdk->upload_backlog_share = S3_HLS_QUEUE_DEFAULT_BACKLOG_SHARE;
+    sdk->program_count = 1;
+    sdk->spool_evict_order = S3_HLS_SPOOL_EVICT_OLDEST;
+
+    pthread_mutex_init(&sdk->spool_lock, NULL);
+
+    for(uint32_t i = 0; i < S3_HLS_MAX_UPLOAD_WORKERS; i++) {
+        sdk->workers[i].sdk = sdk;
+    }
+}
+
+static void S3_HLS_SDK_Initialize_Default() {
+    S3_HLS_SDK_Initialize_Ctx(&s3_hls_default_sdk);
+}
+
+static S3_HLS_SDK_CTX* S3_HLS_SDK_Default() {
+    pthread_once(&s3_hls_default_sdk_once, S3_HLS_SDK_Initialize_Default);
+    return &s3_hls_default_sdk;
+}
+
+/*
+ * Initialize curl with allocator in use when first instance is initialized
+ */
+static int32_t S3_HLS_SDK_Global_Initialize() {
+    int32_t ret = S3_HLS_OK;
+
+    pthread_mutex_lock(&s3_hls_global_lock);
+    if(0 == s3_hls_active_instances) {
+        CURLcode res;
+        if(S3_HLS_Memory_Is_Default()) {
+            res = curl_global_init(CURL_GLOBAL_DEFAULT);
+        } else {
+            // route OpenSSL and curl allocations to user allocator or arena, must be done before their first allocation
+            if(S3_CRYPTO_OK != S3_Crypto_Use_SDK_Allocator()) {
+                SDK_DEBUG("OpenSSL already allocated memory, keep using its default allocator!\n");
+            }
+
+            res = curl_global_init_mem(CURL_GLOBAL_DEFAULT, S3_HLS_Malloc, S3_HLS_Free, S3_HLS_Realloc, S3_HLS_Strdup, S3_HLS_Calloc);
+        }
+
+        /* Check for errors */
+        if(res != CURLE_OK) {
+            SDK_DEBUG("CURL Init Failed!\n");
+            curl_global_cleanup();
+            ret = S3_HLS_UNKNOWN_INTERNAL_ERROR;
+            goto l_unlock;
+        }
+    }
+
+    s3_hls_active_instances++;
+
+l_unlock:
+    pthread_mutex_unlock(&s3_hls_global_lock);
+    return ret;
+}
+
+/*
+ * Arena and allocator hooks are kept while any instance is initialized or still allocated from them, global lock is held
+ */
+static void S3_HLS_SDK_Release_Arena() {
+    if(0 == s3_hls_active_instances && 0 == s3_hls_created_instances)
+        S3_HLS_Memory_Finalize_Arena();
+}
+
+/*
+ * Clean up curl when last instance is finalized, arena is only released at finalize so a failed initialize can be retried
+ */
+static void S3_HLS_SDK_Global_Finalize(uint8_t release_arena) {
+    pthread_mutex_lock(&s3_hls_global_lock);
+    s3_hls_active_instances--;
+    if(0 == s3_hls_active_instances) {
+        curl_global_cleanup();
+
+        if(release_arena)
+            S3_HLS_SDK_Release_Arena();
+    }
+    pthread_mutex_unlock(&s3_hls_global_lock);
+}
+
+/*
+ * Allocator must not change under an instance that is initialized or was allocated by it
+ */
+static uint8_t S3_HLS_SDK_Has_Active_Instance() {
+    pthread_mutex_lock(&s3_hls_global_lock);
+    uint8_t ret = 0 != s3_hls_active_instances || 0 != s3_hls_created_instances;
+    pthread_mutex_unlock(&s3_hls_global_lock);
+
+    return ret;
+}
+
+/*
+ * Give ring buffer reservation of instance back to gateway
+ */
+static void S3_HLS_SDK_Release_Memory(S3_HLS_SDK_CTX* sdk) {
+    if(NULL == sdk->gateway || 0 == sdk->memory_reserved)
+        return;
+
+    pthread_mutex_lock(&sdk->gateway->memory_lock);
+    sdk->gateway->memory_reserved -= sdk->memory_reserved;
+    pthread_mutex_unlock(&sdk->gateway->memory_lock);
+
+    sdk->memory_reserved = 0;
+}
+
+/*
+ * Create instance with its own muxer, buffer, upload queue and connections
+ */
+S3_HLS_SDK_CTX* S3_HLS_SDK_Create(S3_HLS_SDK_CONFIG* config) {
+    if(NULL == config)
+        return NULL;
+
+    S3_HLS_SDK_CTX* sdk = (S3_HLS_SDK_CTX*)S3_HLS_Malloc(sizeof(S3_HLS_SDK_CTX));
+    if(NULL == sdk) {
+        SDK_DEBUG("Allocate SDK Instance Failed!\n");
+        return NULL;
+    }
+
+    S3_HLS_SDK_Initialize_Ctx(sdk);
+    sdk->config = *config;
+
+    pthread_mutex_lock(&s3_hls_global_lock);
+    s3_hls_created_instances++;
+    pthread_mutex_unlock(&s3_hls_global_lock);
+
+    return sdk;
+}
+
+/*
+ * Finalize instance if needed and free it
+ */
+int32_t S3_HLS_SDK_Destroy(S3_HLS_SDK_CTX* sdk) {
+    if(NULL == sdk || &s3_hls_default_sdk == sdk)
+        return S3_HLS_INVALID_PARAMETER;
+
+    if(NULL != sdk->buffer_ctx)
+        S3_HLS_SDK_Instance_Finalize(sdk);
+
+    pthread_mutex_destroy(&sdk->spool_lock);
+    S3_HLS_Free(sdk);
+
+    // arena is kept by finalize while instance is allocated from it, released here with last created instance
+    pthread_mutex_lock(&s3_hls_global_lock);
+    s3_hls_created_instances--;
+    S3_HLS_SDK_Release_Arena();
+    pthread_mutex_unlock(&s3_hls_global_lock);
+
+    return S3_HLS_OK;
 }
 
 /*
@@ -154,69 +732,179 @@ static void  S3_HLS_Add_Buffer_To_Queue(S3_HLS_BUFFER_PART_CTX* ctx) {
  * Note:
  *   These paremeters are not allowed to change after initialized.
  */
-int32_t S3_HLS_SDK_Initialize(uint32_t buffer_size, char* region, char* bucket, char* prefix, char* endpint, uint64_t seq, int audio) {
+int32_t S3_HLS_SDK_Instance_Initialize(S3_HLS_SDK_CTX* sdk) {
     SDK_DEBUG("SDK Init!\n");
-    S3_HLS_Pes_Set_Audio_Format(audio);
+    if(NULL == sdk)
+        return S3_HLS_INVALID_PARAMETER;
 
-    CURLcode res = curl_global_init(CURL_GLOBAL_DEFAULT);
+    if(NULL != sdk->buffer_ctx)
+        return S3_HLS_INVALID_STATUS;
 
-    /* Check for errors */
-    if(res != CURLE_OK) {
-        SDK_DEBUG("CURL Init Failed!\n");
-        goto l_cleanup_curl;
+    S3_HLS_SDK_CONFIG* config = &sdk->config;
+    S3_HLS_GATEWAY_CTX* gateway = sdk->gateway;
+    uint32_t buffer_size = config->buffer_size;
+    int32_t ret = S3_HLS_UNKNOWN_INTERNAL_ERROR;
+
+    S3_HLS_Pes_Set_Audio_Format(&sdk->pes, config->audio);
+
+    if(NULL != gateway) {
+        // ring buffer is taken from budget of gateway, elastic buffer may grow up to its max size
+        if(0 == buffer_size)
+            buffer_size = (uint32_t)(gateway->config.memory_budget / gateway->config.stream_count);
+
+        uint64_t reserve = sdk->elastic_max_size > buffer_size ? sdk->elastic_max_size : buffer_size;
+
+        pthread_mutex_lock(&gateway->memory_lock);
+        if(gateway->memory_reserved + reserve > gateway->config.memory_budget) {
+            pthread_mutex_unlock(&gateway->memory_lock);
+            SDK_DEBUG("Memory budget of gateway used up!\n");
+            return S3_HLS_OUT_OF_MEMORY;
+        }
+
+        gateway->memory_reserved += reserve;
+        sdk->memory_reserved = reserve;
+        pthread_mutex_unlock(&gateway->memory_lock);
     }
 
-    if(0 !=sem_init(&s3_hls_put_send_sem, 0 ,0)) {
+    if(S3_HLS_OK != S3_HLS_SDK_Global_Initialize())
+        goto l_release_memory;
+
+    if(0 !=sem_init(&sdk->put_send_sem, 0 ,0)) {
         SDK_DEBUG("Semaphore Init Failed!\n");
         goto l_cleanup_curl;
     }
 
+    sdk->send_sem = NULL != gateway ? &gateway->put_send_sem : &sdk->put_send_sem;
+
+    ret = S3_HLS_Pes_Allocate_Programs(&sdk->pes);
+    if(S3_HLS_OK != ret) {
+        SDK_DEBUG("Allocate Programs Failed!\n");
+        goto l_cleanup_curl;
+    }
+
+    ret = S3_HLS_UNKNOWN_INTERNAL_ERROR;
+
     SDK_DEBUG("SDK Buffer Init!\n");
-    s3_hls_buffer_ctx = S3_HLS_Initialize_Buffer(buffer_size, S3_HLS_Add_Buffer_To_Queue);
-    if(NULL == s3_hls_buffer_ctx) {
+    if(sdk->elastic_max_size > buffer_size) {
+        sdk->buffer_ctx = S3_HLS_Initialize_Elastic_Buffer(buffer_size, sdk->elastic_max_size, sdk->elastic_chunk_size, S3_HLS_Add_Buffer_To_Queue, sdk);
+    } else {
+        sdk->buffer_ctx = S3_HLS_Initialize_Buffer(buffer_size, S3_HLS_Add_Buffer_To_Queue, sdk);
+    }
+    if(NULL == sdk->buffer_ctx) {
         SDK_DEBUG("Buffer Init Failed!\n");
-        goto l_cleanup_curl;
+        goto l_free_programs;
     }
 
-    SDK_DEBUG("SDK S3 Client Init!\n");
-    // initialize S3 upload process
-    s3_client = S3_HLS_Client_Initialize(region, bucket, endpint, seq);
-    if(NULL == s3_client) {
-        SDK_DEBUG("S3 Client Init Failed!\n");
-        goto l_finalize_buffer;
+    if(0 < sdk->interleave_window) {
+        SDK_DEBUG("Interleave Init!\n");
+        sdk->interleave_ctx = S3_HLS_Interleave_Initialize(&sdk->pes, sdk->buffer_ctx, sdk->program_count, sdk->interleave_window, sdk->interleave_video_stage, sdk->interleave_audio_stage);
+        if(NULL == sdk->interleave_ctx) {
+            SDK_DEBUG("Interleave Init Failed!\n");
+            goto l_finalize_buffer;
+        }
     }
 
-    SDK_DEBUG("Upload Thread Init!\n");
-    s3_hls_worker_thread = S3_HLS_Upload_Thread_Initialize(S3_HLS_Upload_Queue_Item);
-    if(NULL == s3_hls_worker_thread) {
-        SDK_DEBUG("Upload Thread Init Failed!\n");
-        goto l_finalize_client;
+    if(NULL != sdk->spool_directory) {
+        SDK_DEBUG("Spool Init!\n");
+        sdk->spool_ctx = S3_HLS_Spool_Initialize(sdk->spool_directory, sdk->spool_max_size, sdk->spool_evict_order);
+        if(NULL == sdk->spool_ctx) {
+            SDK_DEBUG("Spool Init Failed!\n");
+            goto l_finalize_interleave;
+        }
     }
 
+    sdk->spool_retry_time = 0;
+    sdk->finalizing = 0;
+    sdk->next_seq = config->seq;
+    sdk->segment_start = S3_HLS_Monotonic_Seconds();
+    sdk->event_until = -1;
+
     SDK_DEBUG("Upload Queue Init!\n");
-    s3_hls_queue_ctx = S3_HLS_Initialize_Queue();
-    if(NULL == s3_hls_queue_ctx) {
+    sdk->queue_ctx = S3_HLS_Initialize_Queue();
+    if(NULL == sdk->queue_ctx) {
         SDK_DEBUG("Upload Queue Init Failed!\n");
-        goto l_finalize_client;
+        goto l_finalize_spool;
+    }
+
+    S3_HLS_Set_Queue_Schedule(sdk->queue_ctx, sdk->upload_live_deadline, sdk->upload_backlog_share);
+
+    uint32_t worker_index = 0;
+    if(NULL != gateway) { // workers of gateway upload the stream
+        SDK_DEBUG("Attach To Gateway!\n");
+        if(S3_HLS_OK != S3_HLS_Scheduler_Add_Stream(gateway->scheduler, &sdk->stream, sdk)) {
+            SDK_DEBUG("Too Many Streams On Gateway!\n");
+            goto l_finalize_queue;
+        }
+    }
+
+    for(; NULL == gateway && worker_index < sdk->worker_count; worker_index++) {
+        S3_HLS_UPLOAD_WORKER* worker = &sdk->workers[worker_index];
+
+        SDK_DEBUG("SDK S3 Client Init!\n");
+        // initialize S3 upload process, each worker has its own connection
+        worker->client = S3_HLS_Client_Initialize(config->region, config->bucket, config->endpoint);
+        if(NULL == worker->client) {
+            SDK_DEBUG("S3 Client Init Failed!\n");
+            goto l_finalize_workers;
+        }
+
+        if(S3_HLS_CONTAINER_FMP4 == sdk->container)
+            S3_HLS_Client_Set_Content_Type(worker->client, S3_HLS_FMP4_CONTENT_TYPE);
+
+        SDK_DEBUG("Upload Thread Init!\n");
+        worker->thread = S3_HLS_Upload_Thread_Initialize(S3_HLS_Upload_Queue_Item, worker);
+        if(NULL == worker->thread) {
+            SDK_DEBUG("Upload Thread Init Failed!\n");
+            S3_HLS_Client_Finalize(worker->client);
+            goto l_finalize_workers;
+        }
     }
 
-	object_prefix = prefix;
+    // init segment is written again for each session
+    S3_HLS_Pes_Set_Container(&sdk->pes, sdk->container);
+
+	sdk->object_prefix = config->prefix;
 
     SDK_DEBUG("SDK Init Finished!\n");
     return S3_HLS_OK;
 
-l_finalize_client:
-    S3_HLS_Client_Finalize(s3_client);
-    s3_client = NULL;
+l_finalize_workers:
+    while(worker_index > 0) { // threads are not started yet
+        worker_index--;
+        S3_HLS_Free(sdk->workers[worker_index].thread);
+        S3_HLS_Client_Finalize(sdk->workers[worker_index].client);
+        sdk->workers[worker_index].thread = NULL;
+        sdk->workers[worker_index].client = NULL;
+    }
+
+l_finalize_queue:
+    S3_HLS_Finalize_Queue(sdk->queue_ctx);
+    sdk->queue_ctx = NULL;
+
+l_finalize_spool:
+    if(NULL != sdk->spool_ctx) {
+        S3_HLS_Spool_Finalize(sdk->spool_ctx);
+        sdk->spool_ctx = NULL;
+    }
+
+l_finalize_interleave:
+    S3_HLS_Interleave_Finalize(sdk->interleave_ctx);
+    sdk->interleave_ctx = NULL;
 
 l_finalize_buffer:
-    S3_HLS_Finalize_Buffer(s3_hls_buffer_ctx);
-    s3_hls_buffer_ctx = NULL;
+    S3_HLS_Finalize_Buffer(sdk->buffer_ctx);
+    sdk->buffer_ctx = NULL;
+
+l_free_programs:
+    S3_HLS_Pes_Free_Programs(&sdk->pes);
 
 l_cleanup_curl:
-    curl_global_cleanup();
+    S3_HLS_SDK_Global_Finalize(0);
+
+l_release_memory:
+    S3_HLS_SDK_Release_Memory(sdk);
 
-    return S3_HLS_UNKNOWN_INTERNAL_ERROR;
+    return ret;
 }
 
 /*
@@ -231,47 +919,312 @@ l_cleanup_curl:
  *   Suggest to use this SDK with AWS IoT Things Management. JITP will be a good choice.
  *   Suggest to rotate credential several minutes/seconds before old credential expires to avoid unsuccessful upload
  */
-int32_t S3_HLS_SDK_Set_Credential(char* ak, char* sk, char* token) {
-    return S3_HLS_Client_Set_Credential(s3_client, ak, sk, token);
+int32_t S3_HLS_SDK_Instance_Set_Credential(S3_HLS_SDK_CTX* sdk, char* ak, char* sk, char* token) {
+    if(NULL != sdk->gateway) // connections belong to gateway
+        return S3_HLS_INVALID_STATUS;
+
+    for(uint32_t i = 0; i < sdk->worker_count; i++) {
+        int32_t ret = S3_HLS_Client_Set_Credential(sdk->workers[i].client, ak, sk, token);
+        if(S3_HLS_OK != ret)
+            return ret;
+    }
+
+    return S3_HLS_OK;
 }
 
 /*
  * Call this function to set upload tag for item
  */
-int32_t S3_HLS_SDK_Set_Tag(char* object_tag) {
-    return S3_HLS_Client_Set_Tag(s3_client, object_tag);
+int32_t S3_HLS_SDK_Instance_Set_Tag(S3_HLS_SDK_CTX* sdk, char* object_tag) {
+    if(NULL != sdk->gateway)
+        return S3_HLS_INVALID_STATUS;
+
+    for(uint32_t i = 0; i < sdk->worker_count; i++) {
+        int32_t ret = S3_HLS_Client_Set_Tag(sdk->workers[i].client, object_tag);
+        if(S3_HLS_OK != ret)
+            return ret;
+    }
+
+    return S3_HLS_OK;
 }
 
 /*
- * Start a back ground thread for uploading
+ * Start back ground threads for uploading
  */
-int32_t S3_HLS_SDK_Start_Upload() {
-    return S3_HLS_Upload_Thread_Start(s3_hls_worker_thread);
-}
+int32_t S3_HLS_SDK_Instance_Start_Upload(S3_HLS_SDK_CTX* sdk) {
+    if(NULL != sdk->gateway) // started by S3_HLS_SDK_Gateway_Start_Upload
+        return S3_HLS_OK;
 
-/*
- * Finalize will release resources allocated
+    for(uint32_t i = 0; i < sdk->worker_count; i++) {
+        int32_t ret = S3_HLS_Upload_Thread_Start(sdk->workers[i].thread);
+        if(S3_HLS_OK != ret)
+            return ret;
+    }
+
+    return S3_HLS_OK;
+}
+
+/*
+ * Finalize will release resources allocated
  * Note: Finalize will not free input parameter like ak, sk, token, region, bucket, prefix, endpoint etc.
  */
-int32_t S3_HLS_SDK_Finalize() {
-    S3_HLS_Flush_Buffer(s3_hls_buffer_ctx);
+int32_t S3_HLS_SDK_Instance_Finalize(S3_HLS_SDK_CTX* sdk) {
+    if(NULL == sdk->buffer_ctx)
+        return S3_HLS_INVALID_STATUS;
+
+    __atomic_store_n(&sdk->finalizing, 1, __ATOMIC_RELEASE);
+
+    // staged frames go into last segment
+    if(NULL != sdk->interleave_ctx)
+        S3_HLS_Interleave_Flush(sdk->interleave_ctx);
+
+    S3_HLS_Pes_Flush(&sdk->pes, sdk->buffer_ctx);
+
+    if(NULL != sdk->gateway) {
+        // workers of gateway take what is still queued, once they run
+        S3_HLS_Scheduler_Remove_Stream(sdk->gateway->scheduler, &sdk->stream, 0 != __atomic_load_n(&sdk->gateway->started_count, __ATOMIC_ACQUIRE));
+    } else {
+        // each worker quits when it wakes up and finds queue empty
+        for(uint32_t i = 0; i < sdk->worker_count; i++) {
+            sem_post(&sdk->put_send_sem); //+by xxlang : avoid dead lock
+        }
+
+        for(uint32_t i = 0; i < sdk->worker_count; i++) {
+            S3_HLS_Upload_Thread_Stop(sdk->workers[i].thread);
+        }
+    }
+
+    if(NULL != sdk->spool_ctx) {
+        S3_HLS_Spool_Finalize(sdk->spool_ctx);
+        sdk->spool_ctx = NULL;
+    }
+
+    for(uint32_t i = 0; NULL == sdk->gateway && i < sdk->worker_count; i++) {
+        S3_HLS_Client_Finalize(sdk->workers[i].client);
+        sdk->workers[i].client = NULL;
+        sdk->workers[i].thread = NULL;
+    }
+
+    S3_HLS_Interleave_Finalize(sdk->interleave_ctx);
+    sdk->interleave_ctx = NULL;
+
+    S3_HLS_Finalize_Buffer(sdk->buffer_ctx);
+    sdk->buffer_ctx = NULL;
+
+    S3_HLS_Finalize_Queue(sdk->queue_ctx);
+    sdk->queue_ctx = NULL;
+
+    S3_HLS_Pes_Free_Programs(&sdk->pes);
+
+    sem_destroy(&sdk->put_send_sem);
+
+    S3_HLS_SDK_Release_Memory(sdk);
+
+    S3_HLS_SDK_Global_Finalize(1);
+
+    return S3_HLS_OK;
+}
+
+/*
+ * Let ring buffer grow under upload backlog
+ */
+int32_t S3_HLS_SDK_Instance_Set_Elastic_Buffer(S3_HLS_SDK_CTX* sdk, uint32_t max_size, uint32_t chunk_size) {
+    if(NULL != sdk->buffer_ctx)
+        return S3_HLS_INVALID_STATUS;
+
+    if(0 != max_size && (0 == chunk_size || chunk_size > max_size))
+        return S3_HLS_INVALID_PARAMETER;
+
+    sdk->elastic_max_size = max_size;
+    sdk->elastic_chunk_size = chunk_size;
+
+    return S3_HLS_OK;
+}
+
+/*
+ * Upload segments in parallel
+ */
+int32_t S3_HLS_SDK_Instance_Set_Upload_Workers(S3_HLS_SDK_CTX* sdk, uint32_t worker_count) {
+    if(NULL != sdk->buffer_ctx)
+        return S3_HLS_INVALID_STATUS;
+
+    if(0 == worker_count || worker_count > S3_HLS_MAX_UPLOAD_WORKERS)
+        return S3_HLS_INVALID_PARAMETER;
+
+    sdk->worker_count = worker_count;
+
+    return S3_HLS_OK;
+}
+
+/*
+ * Mux several camera programs into each segment
+ */
+int32_t S3_HLS_SDK_Instance_Set_Programs(S3_HLS_SDK_CTX* sdk, uint32_t program_count) {
+    if(NULL != sdk->buffer_ctx)
+        return S3_HLS_INVALID_STATUS;
+
+    int32_t ret = S3_HLS_Pes_Set_Programs(&sdk->pes, program_count);
+    if(S3_HLS_OK == ret)
+        sdk->program_count = program_count;
+
+    return ret;
+}
+
+/*
+ * Stage frames per elementary stream and write them in DTS order
+ */
+int32_t S3_HLS_SDK_Instance_Set_Interleave(S3_HLS_SDK_CTX* sdk, uint32_t window_ms, uint32_t video_stage_size, uint32_t audio_stage_size) {
+    if(NULL != sdk->buffer_ctx)
+        return S3_HLS_INVALID_STATUS;
+
+    if(S3_HLS_INTERLEAVE_MAX_WINDOW < window_ms)
+        return S3_HLS_INVALID_PARAMETER;
+
+    sdk->interleave_window = window_ms;
+    sdk->interleave_video_stage = video_stage_size;
+    sdk->interleave_audio_stage = audio_stage_size;
+
+    return S3_HLS_OK;
+}
+
+/*
+ * Set codec of video frames, must be called before initialize
+ */
+int32_t S3_HLS_SDK_Instance_Set_Video_Codec(S3_HLS_SDK_CTX* sdk, S3_HLS_VIDEO_CODEC codec) {
+    if(NULL != sdk->buffer_ctx)
+        return S3_HLS_INVALID_STATUS;
+
+    return S3_HLS_Pes_Set_Video_Codec(&sdk->pes, codec);
+}
+
+/*
+ * Set how NALUs of video frames are delimited, must be called before initialize
+ */
+int32_t S3_HLS_SDK_Instance_Set_Nalu_Format(S3_HLS_SDK_CTX* sdk, S3_HLS_NALU_FORMAT format) {
+    if(NULL != sdk->buffer_ctx)
+        return S3_HLS_INVALID_STATUS;
+
+    return S3_HLS_Pes_Set_Nalu_Format(&sdk->pes, format);
+}
+
+/*
+ * Set container of segments, must be called before initialize
+ */
+int32_t S3_HLS_SDK_Instance_Set_Container(S3_HLS_SDK_CTX* sdk, S3_HLS_CONTAINER container) {
+    if(NULL != sdk->buffer_ctx)
+        return S3_HLS_INVALID_STATUS;
+
+    int32_t ret = S3_HLS_Pes_Set_Container(&sdk->pes, container);
+    if(0 > ret)
+        return ret;
+
+    sdk->container = container;
+
+    return S3_HLS_OK;
+}
+
+/*
+ * Write DTS of B frame streams, must be called before initialize
+ */
+int32_t S3_HLS_SDK_Instance_Set_Decode_Timestamp(S3_HLS_SDK_CTX* sdk, uint8_t enable) {
+    if(NULL != sdk->buffer_ctx)
+        return S3_HLS_INVALID_STATUS;
+
+    S3_HLS_Pes_Set_Decode_Timestamp(&sdk->pes, enable);
+    return S3_HLS_OK;
+}
+
+/*
+ * Set how waiting segments are ordered, can be called before or after initialize
+ */
+int32_t S3_HLS_SDK_Instance_Set_Upload_Schedule(S3_HLS_SDK_CTX* sdk, uint32_t live_deadline_ms, uint32_t backlog_share) {
+    if(backlog_share > 100)
+        return S3_HLS_INVALID_PARAMETER;
+
+    sdk->upload_live_deadline = live_deadline_ms;
+    sdk->upload_backlog_share = backlog_share;
+
+    if(NULL != sdk->queue_ctx)
+        return S3_HLS_Set_Queue_Schedule(sdk->queue_ctx, live_deadline_ms, backlog_share);
+
+    return S3_HLS_OK;
+}
+
+int32_t S3_HLS_SDK_Instance_Set_Latency_Watchdog(S3_HLS_SDK_CTX* sdk, uint32_t max_segment_age_ms, uint32_t max_idle_ms) {
+    if((0 != max_segment_age_ms && max_segment_age_ms < S3_HLS_WATCHDOG_MIN_LIMIT) || (0 != max_idle_ms && max_idle_ms < S3_HLS_WATCHDOG_MIN_LIMIT))
+        return S3_HLS_INVALID_PARAMETER;
 
-    sem_post(&s3_hls_put_send_sem); //+by xxlang : avoid dead lock
-    S3_HLS_Upload_Thread_Stop(s3_hls_worker_thread);
+    __atomic_store_n(&sdk->watchdog_max_age, max_segment_age_ms, __ATOMIC_RELAXED);
+    __atomic_store_n(&sdk->watchdog_max_idle, max_idle_ms, __ATOMIC_RELAXED);
+
+    return S3_HLS_OK;
+}
 
-    S3_HLS_Client_Finalize(s3_client);
+/*
+ * Promote segment being written and segments started within duration
+ */
+int32_t S3_HLS_SDK_Instance_Mark_Event(S3_HLS_SDK_CTX* sdk, uint32_t duration_ms) {
+    if(NULL == sdk->queue_ctx)
+        return S3_HLS_INVALID_STATUS;
 
-    S3_HLS_Finalize_Buffer(s3_hls_buffer_ctx);
+    __atomic_store_n(&sdk->event_until, S3_HLS_Monotonic_Seconds() + (duration_ms + 999) / 1000, __ATOMIC_RELAXED);
 
-    S3_HLS_Finalize_Queue(s3_hls_queue_ctx);
+    return S3_HLS_OK;
+}
 
-    sem_destroy(&s3_hls_put_send_sem);
+/*
+ * Keep segments that cannot be uploaded in directory
+ */
+int32_t S3_HLS_SDK_Instance_Set_Spool(S3_HLS_SDK_CTX* sdk, char* directory, uint64_t max_size, S3_HLS_SPOOL_EVICT_ORDER evict_order) {
+    if(NULL != sdk->buffer_ctx)
+        return S3_HLS_INVALID_STATUS;
 
-    curl_global_cleanup();
+    if(NULL != directory && 0 == max_size)
+        return S3_HLS_INVALID_PARAMETER;
+
+    if(S3_HLS_SPOOL_EVICT_OLDEST != evict_order && S3_HLS_SPOOL_DROP_NEWEST != evict_order)
+        return S3_HLS_INVALID_PARAMETER;
+
+    sdk->spool_directory = directory;
+    sdk->spool_max_size = max_size;
+    sdk->spool_evict_order = evict_order;
 
     return S3_HLS_OK;
 }
 
+/*
+ * Replace allocator used by SDK, curl and OpenSSL
+ */
+int32_t S3_HLS_SDK_Set_Allocator(S3_HLS_MALLOC_CALL_BACK malloc_call_back, S3_HLS_REALLOC_CALL_BACK realloc_call_back, S3_HLS_FREE_CALL_BACK free_call_back) {
+    if(S3_HLS_SDK_Has_Active_Instance())
+        return S3_HLS_INVALID_STATUS;
+
+    return S3_HLS_Memory_Set_Allocator(malloc_call_back, realloc_call_back, free_call_back);
+}
+
+/*
+ * Preallocate one arena that serves every allocation made by SDK, curl and OpenSSL
+ */
+int32_t S3_HLS_SDK_Set_Memory_Arena(uint32_t arena_size, uint32_t flags) {
+    if(S3_HLS_SDK_Has_Active_Instance())
+        return S3_HLS_INVALID_STATUS;
+
+    return S3_HLS_Memory_Initialize_Arena(arena_size, flags);
+}
+
+/*
+ * Write frame to buffer, or stage it when frames are interleaved
+ */
+static int32_t S3_HLS_Put_Frame(S3_HLS_SDK_CTX* sdk, uint32_t program, uint8_t is_audio, S3_HLS_FRAME_PACK* pack, uint8_t by_reference, S3_HLS_FRAME_RELEASE_CALL_BACK release, void* user_data) {
+    if(NULL != sdk->interleave_ctx)
+        return S3_HLS_Interleave_Put(sdk->interleave_ctx, program, is_audio, pack, by_reference, release, user_data);
+
+    if(is_audio)
+        return by_reference ? S3_HLS_Pes_Write_Audio_Frame_Ref(&sdk->pes, sdk->buffer_ctx, program, pack, release, user_data) : S3_HLS_Pes_Write_Audio_Frame(&sdk->pes, sdk->buffer_ctx, program, pack);
+
+    return by_reference ? S3_HLS_Pes_Write_Video_Frame_Ref(&sdk->pes, sdk->buffer_ctx, program, pack, release, user_data) : S3_HLS_Pes_Write_Video_Frame(&sdk->pes, sdk->buffer_ctx, program, pack);
+}
+
 /*
  * User call this method to put video stream into buffer
  * The pack contains an array of H264 frames.
@@ -279,14 +1232,497 @@ int32_t S3_HLS_SDK_Finalize() {
  * But usually SPS/PPS/SEI frames comes together with I frame within a pack
  * In that case, the pack will contains 4 frames
  */
-int32_t S3_HLS_SDK_Put_Video_Frame(S3_HLS_FRAME_PACK* pack) {
-    return S3_HLS_Pes_Write_Video_Frame(s3_hls_buffer_ctx, pack);
+int32_t S3_HLS_SDK_Instance_Put_Video_Frame(S3_HLS_SDK_CTX* sdk, S3_HLS_FRAME_PACK* pack) {
+    return S3_HLS_Put_Frame(sdk, 0, 0, pack, 0, NULL, NULL);
 }
 
 /*
  * User call this method to put audio stream into buffer
  * Currently the only supported audio frame type is AAC encoded frame
  */
+int32_t S3_HLS_SDK_Instance_Put_Audio_Frame(S3_HLS_SDK_CTX* sdk, S3_HLS_FRAME_PACK* pack) {
+    return S3_HLS_Put_Frame(sdk, 0, 1, pack, 0, NULL, NULL);
+}
+
+/*
+ * Same as S3_HLS_SDK_Instance_Put_Video_Frame but frame data is not copied
+ */
+int32_t S3_HLS_SDK_Instance_Put_Video_Frame_Ref(S3_HLS_SDK_CTX* sdk, S3_HLS_FRAME_PACK* pack, S3_HLS_FRAME_RELEASE_CALL_BACK release, void* user_data) {
+    return S3_HLS_Put_Frame(sdk, 0, 0, pack, 1, release, user_data);
+}
+
+/*
+ * Same as S3_HLS_SDK_Instance_Put_Audio_Frame but frame data is not copied
+ */
+int32_t S3_HLS_SDK_Instance_Put_Audio_Frame_Ref(S3_HLS_SDK_CTX* sdk, S3_HLS_FRAME_PACK* pack, S3_HLS_FRAME_RELEASE_CALL_BACK release, void* user_data) {
+    return S3_HLS_Put_Frame(sdk, 0, 1, pack, 1, release, user_data);
+}
+
+/*
+ * Put video frame of given camera program, program 0 is the same as S3_HLS_SDK_Instance_Put_Video_Frame
+ */
+int32_t S3_HLS_SDK_Instance_Put_Program_Video_Frame(S3_HLS_SDK_CTX* sdk, uint32_t program, S3_HLS_FRAME_PACK* pack) {
+    return S3_HLS_Put_Frame(sdk, program, 0, pack, 0, NULL, NULL);
+}
+
+/*
+ * Put audio frame of given camera program, program 0 is the same as S3_HLS_SDK_Instance_Put_Audio_Frame
+ */
+int32_t S3_HLS_SDK_Instance_Put_Program_Audio_Frame(S3_HLS_SDK_CTX* sdk, uint32_t program, S3_HLS_FRAME_PACK* pack) {
+    return S3_HLS_Put_Frame(sdk, program, 1, pack, 0, NULL, NULL);
+}
+
+/*
+ * Same as S3_HLS_SDK_Instance_Put_Program_Video_Frame but frame data is not copied
+ */
+int32_t S3_HLS_SDK_Instance_Put_Program_Video_Frame_Ref(S3_HLS_SDK_CTX* sdk, uint32_t program, S3_HLS_FRAME_PACK* pack, S3_HLS_FRAME_RELEASE_CALL_BACK release, void* user_data) {
+    return S3_HLS_Put_Frame(sdk, program, 0, pack, 1, release, user_data);
+}
+
+/*
+ * Same as S3_HLS_SDK_Instance_Put_Program_Audio_Frame but frame data is not copied
+ */
+int32_t S3_HLS_SDK_Instance_Put_Program_Audio_Frame_Ref(S3_HLS_SDK_CTX* sdk, uint32_t program, S3_HLS_FRAME_PACK* pack, S3_HLS_FRAME_RELEASE_CALL_BACK release, void* user_data) {
+    return S3_HLS_Put_Frame(sdk, program, 1, pack, 1, release, user_data);
+}
+
+/*
+ * Set how to handle frames that do not fit into buffer
+ */
+int32_t S3_HLS_SDK_Instance_Set_Overflow_Policy(S3_HLS_SDK_CTX* sdk, S3_HLS_OVERFLOW_POLICY policy, uint32_t timeout_ms) {
+    return S3_HLS_Pes_Set_Overflow_Policy(&sdk->pes, policy, timeout_ms);
+}
+
+/*
+ * Get number of frames and segments dropped since initialized
+ */
+int32_t S3_HLS_SDK_Instance_Get_Drop_Counters(S3_HLS_SDK_CTX* sdk, S3_HLS_DROP_COUNTERS* counters) {
+    return S3_HLS_Pes_Get_Drop_Counters(&sdk->pes, sdk->buffer_ctx, counters);
+}
+
+/*
+ * Set intervals of PAT / PMT and PCR
+ */
+int32_t S3_HLS_SDK_Instance_Set_PSI_Interval(S3_HLS_SDK_CTX* sdk, uint32_t pat_pmt_interval_ms, uint32_t pcr_interval_ms) {
+    return S3_HLS_Pes_Set_PSI_Interval(&sdk->pes, pat_pmt_interval_ms, pcr_interval_ms);
+}
+
+/*
+ * Set how long segments are
+ */
+int32_t S3_HLS_SDK_Instance_Set_Segment_Duration(S3_HLS_SDK_CTX* sdk, uint32_t target_ms, uint32_t max_target_ms) {
+    return S3_HLS_Pes_Set_Segment_Duration(&sdk->pes, target_ms, max_target_ms);
+}
+
+/*
+ * Set how long partial segments are, 0 to disable
+ */
+int32_t S3_HLS_SDK_Instance_Set_Part_Duration(S3_HLS_SDK_CTX* sdk, uint32_t part_ms) {
+    return S3_HLS_Pes_Set_Part_Duration(&sdk->pes, part_ms);
+}
+
+/*
+ * Upload I-frame index next to each segment
+ */
+int32_t S3_HLS_SDK_Instance_Set_IFrame_Index(S3_HLS_SDK_CTX* sdk, uint8_t enable) {
+    S3_HLS_Pes_Set_IFrame_Index(&sdk->pes, enable);
+    return S3_HLS_OK;
+}
+
+/*
+ * Set how much audio is written as one PES
+ */
+int32_t S3_HLS_SDK_Instance_Set_Audio_Aggregation(S3_HLS_SDK_CTX* sdk, uint32_t duration_ms) {
+    return S3_HLS_Pes_Set_Audio_Aggregation(&sdk->pes, duration_ms);
+}
+
+/*
+ * Get muxing overhead of last segment and totals since initialized
+ */
+int32_t S3_HLS_SDK_Instance_Get_Mux_Info(S3_HLS_SDK_CTX* sdk, S3_HLS_MUX_INFO* info) {
+    return S3_HLS_Pes_Get_Mux_Info(&sdk->pes, sdk->buffer_ctx, info);
+}
+
+/*
+ * Get number of segments waiting in spool and spool counters since initialized
+ */
+int32_t S3_HLS_SDK_Instance_Get_Spool_Info(S3_HLS_SDK_CTX* sdk, S3_HLS_SPOOL_INFO* info) {
+    if(NULL == sdk->spool_ctx)
+        return S3_HLS_INVALID_STATUS;
+
+    return S3_HLS_Spool_Get_Info(sdk->spool_ctx, info);
+}
+
+/*
+ * Get current and peak size of ring buffer
+ */
+int32_t S3_HLS_SDK_Instance_Get_Buffer_Info(S3_HLS_SDK_CTX* sdk, S3_HLS_BUFFER_INFO* info) {
+    if(NULL == sdk->buffer_ctx)
+        return S3_HLS_INVALID_STATUS;
+
+    return S3_HLS_Get_Buffer_Info(sdk->buffer_ctx, info);
+}
+
+/*
+ * Get what latest SPS of program describes
+ */
+int32_t S3_HLS_SDK_Instance_Get_Video_Info(S3_HLS_SDK_CTX* sdk, uint32_t program, S3_HLS_VIDEO_INFO* info) {
+    if(NULL == sdk->buffer_ctx)
+        return S3_HLS_INVALID_STATUS;
+
+    return S3_HLS_Pes_Get_Video_Info(&sdk->pes, sdk->buffer_ctx, program, info);
+}
+
+/*
+ * Create gateway with upload workers and connections shared by attached instances
+ */
+S3_HLS_GATEWAY_CTX* S3_HLS_SDK_Gateway_Create(S3_HLS_GATEWAY_CONFIG* config) {
+    if(NULL == config || 0 == config->worker_count || S3_HLS_MAX_GATEWAY_WORKERS < config->worker_count || 0 == config->memory_budget)
+        return NULL;
+
+    if(S3_HLS_OK != S3_HLS_SDK_Global_Initialize())
+        return NULL;
+
+    S3_HLS_GATEWAY_CTX* gateway = (S3_HLS_GATEWAY_CTX*)S3_HLS_Calloc(1, sizeof(S3_HLS_GATEWAY_CTX));
+    if(NULL == gateway) {
+        SDK_DEBUG("Allocate Gateway Failed!\n");
+        goto l_cleanup_curl;
+    }
+
+    gateway->config = *config;
+    if(0 == gateway->config.stream_count)
+        gateway->config.stream_count = 1;
+
+    if(0 != sem_init(&gateway->put_send_sem, 0, 0)) {
+        SDK_DEBUG("Semaphore Init Failed!\n");
+        goto l_free_gateway;
+    }
+
+    pthread_mutex_init(&gateway->memory_lock, NULL);
+
+    gateway->scheduler = S3_HLS_Scheduler_Initialize();
+    if(NULL == gateway->scheduler) {
+        SDK_DEBUG("Scheduler Init Failed!\n");
+        goto l_destroy_sem;
+    }
+
+    for(; gateway->worker_count < config->worker_count; gateway->worker_count++) {
+        S3_HLS_UPLOAD_WORKER* worker = &gateway->workers[gateway->worker_count];
+        worker->gateway = gateway;
+
+        // each worker keeps its connection open across streams
+        worker->client = S3_HLS_Client_Initialize(config->region, config->bucket, config->endpoint);
+        if(NULL == worker->client) {
+            SDK_DEBUG("S3 Client Init Failed!\n");
+            goto l_finalize_workers;
+        }
+
+        worker->thread = S3_HLS_Upload_Thread_Initialize(S3_HLS_Gateway_Upload_Item, worker);
+        if(NULL == worker->thread) {
+            SDK_DEBUG("Upload Thread Init Failed!\n");
+            S3_HLS_Client_Finalize(worker->client);
+            goto l_finalize_workers;
+        }
+    }
+
+    return gateway;
+
+l_finalize_workers:
+    while(gateway->worker_count > 0) { // threads are not started yet
+        gateway->worker_count--;
+        S3_HLS_Free(gateway->workers[gateway->worker_count].thread);
+        S3_HLS_Client_Finalize(gateway->workers[gateway->worker_count].client);
+    }
+
+    S3_HLS_Scheduler_Finalize(gateway->scheduler);
+
+l_destroy_sem:
+    pthread_mutex_destroy(&gateway->memory_lock);
+    sem_destroy(&gateway->put_send_sem);
+
+l_free_gateway:
+    S3_HLS_Free(gateway);
+
+l_cleanup_curl:
+    S3_HLS_SDK_Global_Finalize(0);
+
+    return NULL;
+}
+
+/*
+ * Stop workers once nothing is queued and free gateway
+ */
+int32_t S3_HLS_SDK_Gateway_Destroy(S3_HLS_GATEWAY_CTX* gateway) {
+    if(NULL == gateway)
+        return S3_HLS_INVALID_PARAMETER;
+
+    uint32_t stream_count;
+    uint64_t uploaded_bytes;
+    uint64_t uploaded_segments;
+    S3_HLS_Scheduler_Get_Info(gateway->scheduler, &stream_count, &uploaded_bytes, &uploaded_segments);
+    if(0 != stream_count)
+        return S3_HLS_INVALID_STATUS;
+
+    __atomic_store_n(&gateway->stopping, 1, __ATOMIC_RELEASE);
+
+    // each worker quits when it wakes up and finds nothing to take
+    for(uint32_t i = 0; i < gateway->started_count; i++) {
+        sem_post(&gateway->put_send_sem);
+    }
+
+    for(uint32_t i = 0; i < gateway->worker_count; i++) {
+        if(i < gateway->started_count) {
+            S3_HLS_Upload_Thread_Stop(gateway->workers[i].thread);
+        } else { // thread is not started
+            S3_HLS_Free(gateway->workers[i].thread);
+        }
+
+        S3_HLS_Client_Finalize(gateway->workers[i].client);
+    }
+
+    S3_HLS_Scheduler_Finalize(gateway->scheduler);
+    pthread_mutex_destroy(&gateway->memory_lock);
+    sem_destroy(&gateway->put_send_sem);
+    S3_HLS_Free(gateway);
+
+    S3_HLS_SDK_Global_Finalize(1);
+
+    return S3_HLS_OK;
+}
+
+/*
+ * Same as S3_HLS_SDK_Set_Credential, used by all connections of gateway
+ */
+int32_t S3_HLS_SDK_Gateway_Set_Credential(S3_HLS_GATEWAY_CTX* gateway, char* ak, char* sk, char* token) {
+    if(NULL == gateway)
+        return S3_HLS_INVALID_PARAMETER;
+
+    for(uint32_t i = 0; i < gateway->worker_count; i++) {
+        int32_t ret = S3_HLS_Client_Set_Credential(gateway->workers[i].client, ak, sk, token);
+        if(S3_HLS_OK != ret)
+            return ret;
+    }
+
+    return S3_HLS_OK;
+}
+
+int32_t S3_HLS_SDK_Gateway_Set_Tag(S3_HLS_GATEWAY_CTX* gateway, char* object_tag) {
+    if(NULL == gateway)
+        return S3_HLS_INVALID_PARAMETER;
+
+    for(uint32_t i = 0; i < gateway->worker_count; i++) {
+        int32_t ret = S3_HLS_Client_Set_Tag(gateway->workers[i].client, object_tag);
+        if(S3_HLS_OK != ret)
+            return ret;
+    }
+
+    return S3_HLS_OK;
+}
+
+/*
+ * Start threads of workers, workers started before are kept running
+ */
+int32_t S3_HLS_SDK_Gateway_Start_Upload(S3_HLS_GATEWAY_CTX* gateway) {
+    if(NULL == gateway)
+        return S3_HLS_INVALID_PARAMETER;
+
+    while(gateway->started_count < gateway->worker_count) {
+        S3_HLS_UPLOAD_WORKER* worker = &gateway->workers[gateway->started_count];
+
+        int32_t ret = S3_HLS_Upload_Thread_Start(worker->thread);
+        if(S3_HLS_OK != ret) { // thread context is freed on failure, prepare a new one for next try
+            worker->thread = S3_HLS_Upload_Thread_Initialize(S3_HLS_Gateway_Upload_Item, worker);
+            return ret;
+        }
+
+        __atomic_store_n(&gateway->started_count, gateway->started_count + 1, __ATOMIC_RELEASE);
+    }
+
+    return S3_HLS_OK;
+}
+
+int32_t S3_HLS_SDK_Gateway_Get_Info(S3_HLS_GATEWAY_CTX* gateway, S3_HLS_GATEWAY_INFO* info) {
+    if(NULL == gateway || NULL == info)
+        return S3_HLS_INVALID_PARAMETER;
+
+    S3_HLS_Scheduler_Get_Info(gateway->scheduler, &info->stream_count, &info->uploaded_bytes, &info->uploaded_segments);
+    info->worker_count = gateway->worker_count;
+    info->memory_budget = gateway->config.memory_budget;
+
+    pthread_mutex_lock(&gateway->memory_lock);
+    info->memory_reserved = gateway->memory_reserved;
+    pthread_mutex_unlock(&gateway->memory_lock);
+
+    return S3_HLS_OK;
+}
+
+/*
+ * Let workers of gateway upload the instance
+ */
+int32_t S3_HLS_SDK_Instance_Set_Gateway(S3_HLS_SDK_CTX* sdk, S3_HLS_GATEWAY_CTX* gateway) {
+    if(NULL != sdk->buffer_ctx)
+        return S3_HLS_INVALID_STATUS;
+
+    sdk->gateway = gateway;
+
+    return S3_HLS_OK;
+}
+
+/*
+ * Functions below work on default instance, for processes uploading one stream
+ */
+int32_t S3_HLS_SDK_Initialize(uint32_t buffer_size, char* region, char* bucket, char* prefix, char* endpint, uint64_t seq, int audio) {
+    S3_HLS_SDK_CTX* sdk = S3_HLS_SDK_Default();
+    if(NULL != sdk->buffer_ctx)
+        return S3_HLS_INVALID_STATUS;
+
+    sdk->config.buffer_size = buffer_size;
+    sdk->config.region = region;
+    sdk->config.bucket = bucket;
+    sdk->config.prefix = prefix;
+    sdk->config.endpoint = endpint;
+    sdk->config.seq = seq;
+    sdk->config.audio = audio;
+
+    return S3_HLS_SDK_Instance_Initialize(sdk);
+}
+
+int32_t S3_HLS_SDK_Set_Credential(char* ak, char* sk, char* token) {
+    return S3_HLS_SDK_Instance_Set_Credential(S3_HLS_SDK_Default(), ak, sk, token);
+}
+
+int32_t S3_HLS_SDK_Set_Tag(char* object_tag) {
+    return S3_HLS_SDK_Instance_Set_Tag(S3_HLS_SDK_Default(), object_tag);
+}
+
+int32_t S3_HLS_SDK_Start_Upload() {
+    return S3_HLS_SDK_Instance_Start_Upload(S3_HLS_SDK_Default());
+}
+
+int32_t S3_HLS_SDK_Finalize() {
+    return S3_HLS_SDK_Instance_Finalize(S3_HLS_SDK_Default());
+}
+
+int32_t S3_HLS_SDK_Set_Elastic_Buffer(uint32_t max_size, uint32_t chunk_size) {
+    return S3_HLS_SDK_Instance_Set_Elastic_Buffer(S3_HLS_SDK_Default(), max_size, chunk_size);
+}
+
+int32_t S3_HLS_SDK_Set_Upload_Workers(uint32_t worker_count) {
+    return S3_HLS_SDK_Instance_Set_Upload_Workers(S3_HLS_SDK_Default(), worker_count);
+}
+
+int32_t S3_HLS_SDK_Set_Programs(uint32_t program_count) {
+    return S3_HLS_SDK_Instance_Set_Programs(S3_HLS_SDK_Default(), program_count);
+}
+
+int32_t S3_HLS_SDK_Set_Interleave(uint32_t window_ms, uint32_t video_stage_size, uint32_t audio_stage_size) {
+    return S3_HLS_SDK_Instance_Set_Interleave(S3_HLS_SDK_Default(), window_ms, video_stage_size, audio_stage_size);
+}
+
+int32_t S3_HLS_SDK_Set_Video_Codec(S3_HLS_VIDEO_CODEC codec) {
+    return S3_HLS_SDK_Instance_Set_Video_Codec(S3_HLS_SDK_Default(), codec);
+}
+
+int32_t S3_HLS_SDK_Set_Nalu_Format(S3_HLS_NALU_FORMAT format) {
+    return S3_HLS_SDK_Instance_Set_Nalu_Format(S3_HLS_SDK_Default(), format);
+}
+
+int32_t S3_HLS_SDK_Set_Container(S3_HLS_CONTAINER container) {
+    return S3_HLS_SDK_Instance_Set_Container(S3_HLS_SDK_Default(), container);
+}
+
+int32_t S3_HLS_SDK_Set_Decode_Timestamp(uint8_t enable) {
+    return S3_HLS_SDK_Instance_Set_Decode_Timestamp(S3_HLS_SDK_Default(), enable);
+}
+
+int32_t S3_HLS_SDK_Set_Upload_Schedule(uint32_t live_deadline_ms, uint32_t backlog_share) {
+    return S3_HLS_SDK_Instance_Set_Upload_Schedule(S3_HLS_SDK_Default(), live_deadline_ms, backlog_share);
+}
+
+int32_t S3_HLS_SDK_Set_Latency_Watchdog(uint32_t max_segment_age_ms, uint32_t max_idle_ms) {
+    return S3_HLS_SDK_Instance_Set_Latency_Watchdog(S3_HLS_SDK_Default(), max_segment_age_ms, max_idle_ms);
+}
+
+int32_t S3_HLS_SDK_Mark_Event(uint32_t duration_ms) {
+    return S3_HLS_SDK_Instance_Mark_Event(S3_HLS_SDK_Default(), duration_ms);
+}
+
+int32_t S3_HLS_SDK_Set_Spool(char* directory, uint64_t max_size, S3_HLS_SPOOL_EVICT_ORDER evict_order) {
+    return S3_HLS_SDK_Instance_Set_Spool(S3_HLS_SDK_Default(), directory, max_size, evict_order);
+}
+
+int32_t S3_HLS_SDK_Put_Video_Frame(S3_HLS_FRAME_PACK* pack) {
+    return S3_HLS_Put_Frame(S3_HLS_SDK_Default(), 0, 0, pack, 0, NULL, NULL);
+}
+
 int32_t S3_HLS_SDK_Put_Audio_Frame(S3_HLS_FRAME_PACK* pack) {
-    return S3_HLS_Pes_Write_Audio_Frame(s3_hls_buffer_ctx, pack);
-}
\ No newline at end of file
+    return S3_HLS_Put_Frame(S3_HLS_SDK_Default(), 0, 1, pack, 0, NULL, NULL);
+}
+
+int32_t S3_HLS_SDK_Put_Video_Frame_Ref(S3_HLS_FRAME_PACK* pack, S3_HLS_FRAME_RELEASE_CALL_BACK release, void* user_data) {
+    return S3_HLS_Put_Frame(S3_HLS_SDK_Default(), 0, 0, pack, 1, release, user_data);
+}
+
+int32_t S3_HLS_SDK_Put_Audio_Frame_Ref(S3_HLS_FRAME_PACK* pack, S3_HLS_FRAME_RELEASE_CALL_BACK release, void* user_data) {
+    return S3_HLS_Put_Frame(S3_HLS_SDK_Default(), 0, 1, pack, 1, release, user_data);
+}
+
+int32_t S3_HLS_SDK_Put_Program_Video_Frame(uint32_t program, S3_HLS_FRAME_PACK* pack) {
+    return S3_HLS_Put_Frame(S3_HLS_SDK_Default(), program, 0, pack, 0, NULL, NULL);
+}
+
+int32_t S3_HLS_SDK_Put_Program_Audio_Frame(uint32_t program, S3_HLS_FRAME_PACK* pack) {
+    return S3_HLS_Put_Frame(S3_HLS_SDK_Default(), program, 1, pack, 0, NULL, NULL);
+}
+
+int32_t S3_HLS_SDK_Put_Program_Video_Frame_Ref(uint32_t program, S3_HLS_FRAME_PACK* pack, S3_HLS_FRAME_RELEASE_CALL_BACK release, void* user_data) {
+    return S3_HLS_Put_Frame(S3_HLS_SDK_Default(), program, 0, pack, 1, release, user_data);
+}
+
+int32_t S3_HLS_SDK_Put_Program_Audio_Frame_Ref(uint32_t program, S3_HLS_FRAME_PACK* pack, S3_HLS_FRAME_RELEASE_CALL_BACK release, void* user_data) {
+    return S3_HLS_Put_Frame(S3_HLS_SDK_Default(), program, 1, pack, 1, release, user_data);
+}
+
+int32_t S3_HLS_SDK_Set_Overflow_Policy(S3_HLS_OVERFLOW_POLICY policy, uint32_t timeout_ms) {
+    return S3_HLS_SDK_Instance_Set_Overflow_Policy(S3_HLS_SDK_Default(), policy, timeout_ms);
+}
+
+int32_t S3_HLS_SDK_Get_Drop_Counters(S3_HLS_DROP_COUNTERS* counters) {
+    return S3_HLS_SDK_Instance_Get_Drop_Counters(S3_HLS_SDK_Default(), counters);
+}
+
+int32_t S3_HLS_SDK_Set_PSI_Interval(uint32_t pat_pmt_interval_ms, uint32_t pcr_interval_ms) {
+    return S3_HLS_SDK_Instance_Set_PSI_Interval(S3_HLS_SDK_Default(), pat_pmt_interval_ms, pcr_interval_ms);
+}
+
+int32_t S3_HLS_SDK_Set_Segment_Duration(uint32_t target_ms, uint32_t max_target_ms) {
+    return S3_HLS_SDK_Instance_Set_Segment_Duration(S3_HLS_SDK_Default(), target_ms, max_target_ms);
+}
+
+int32_t S3_HLS_SDK_Set_Part_Duration(uint32_t part_ms) {
+    return S3_HLS_SDK_Instance_Set_Part_Duration(S3_HLS_SDK_Default(), part_ms);
+}
+
+int32_t S3_HLS_SDK_Set_IFrame_Index(uint8_t enable) {
+    return S3_HLS_SDK_Instance_Set_IFrame_Index(S3_HLS_SDK_Default(), enable);
+}
+
+int32_t S3_HLS_SDK_Set_Audio_Aggregation(uint32_t duration_ms) {
+    return S3_HLS_SDK_Instance_Set_Audio_Aggregation(S3_HLS_SDK_Default(), duration_ms);
+}
+
+int32_t S3_HLS_SDK_Get_Mux_Info(S3_HLS_MUX_INFO* info) {
+    return S3_HLS_SDK_Instance_Get_Mux_Info(S3_HLS_SDK_Default(), info);
+}
+
+int32_t S3_HLS_SDK_Get_Spool_Info(S3_HLS_SPOOL_INFO* info) {
+    return S3_HLS_SDK_Instance_Get_Spool_Info(S3_HLS_SDK_Default(), info);
+}
+
+int32_t S3_HLS_SDK_Get_Buffer_Info(S3_HLS_BUFFER_INFO* info) {
+    return S3_HLS_SDK_Instance_Get_Buffer_Info(S3_HLS_SDK_Default(), info);
+}
+
+int32_t S3_HLS_SDK_Get_Video_Info(uint32_t program, S3_HLS_VIDEO_INFO* info) {
+    return S3_HLS_SDK_Instance_Get_Video_Info(S3_HLS_SDK_Default(), program, info);
+}
@@ -21,6 +21,7 @@
 #define __S3_HLS_SDK_H__
 
 #include "stdint.h"
+#include "stddef.h"
 
 #ifdef __cplusplus
 #if __cplusplus
@@ -30,6 +31,13 @@ extern "C" {
 
 #define S3_HLS_SIMPLE_PUT_MAX_FRAME_PER_PACK        4
 
+#define S3_HLS_MAX_UPLOAD_WORKERS                   8
+
+#define S3_HLS_MAX_PROGRAMS                         8       // camera programs muxed into one segment
+
+#define S3_HLS_MAX_GATEWAY_WORKERS                  32      // upload workers and connections shared by streams of a gateway
+#define S3_HLS_MAX_GATEWAY_STREAMS                  256
+
 typedef struct s3_hls_frame_item_s {
     uint8_t* first_part_start;      // start of the buffer address
     uint32_t first_part_length;     // the length of the first part video buffer
@@ -37,7 +45,8 @@ typedef struct s3_hls_frame_item_s {
     uint8_t* second_part_start;     // when using ring buffer there might have second part of video buffer
     uint32_t second_part_length;    // if not using ring buffer, just set second_part_start to NULL and set second_part_length to 0
 
-    uint64_t timestamp;
+    uint64_t timestamp;             // presentation timestamp in microseconds
+    uint64_t decode_timestamp;      // video only, read when enabled by S3_HLS_SDK_Set_Decode_Timestamp, same as timestamp unless frames are reordered
 } S3_HLS_FRAME_ITEM;
 
 typedef struct frame_packs_s {
@@ -45,6 +54,307 @@ typedef struct frame_packs_s {
     uint32_t            item_count;
 } S3_HLS_FRAME_PACK;
 
+/*
+ * Video elementary stream of all programs
+ */
+typedef enum {
+    S3_HLS_VIDEO_CODEC_H264 = 0,        // default
+    S3_HLS_VIDEO_CODEC_H265
+} S3_HLS_VIDEO_CODEC;
+
+/*
+ * How NALUs of video frame items start, items may hold several NALUs, e.g. a whole access unit
+ */
+typedef enum {
+    S3_HLS_NALU_FORMAT_ANNEXB = 0,      // start code 00 00 00 01 or 00 00 01, default
+    S3_HLS_NALU_FORMAT_LENGTH_PREFIXED  // 4 bytes big endian NALU length (AVCC / HVCC, as in MP4)
+} S3_HLS_NALU_FORMAT;
+
+/*
+ * Container segments are written in
+ */
+typedef enum {
+    S3_HLS_CONTAINER_TS = 0,            // MPEG-TS, default
+    S3_HLS_CONTAINER_FMP4               // fragmented MP4 (CMAF), init segment then moof / mdat fragments
+} S3_HLS_CONTAINER;
+
+/*
+ * What to do when a frame does not fit into buffer, frames are always written as a whole or not at all
+ */
+typedef enum {
+    S3_HLS_OVERFLOW_SKIP_GOP = 0,       // drop video frames until next SPS (default)
+    S3_HLS_OVERFLOW_EVICT_OLDEST,       // drop oldest segment not uploaded yet to make room
+    S3_HLS_OVERFLOW_DROP_NON_REF,       // drop non reference frames (nal_ref_idc == 0) first when buffer is nearly full
+    S3_HLS_OVERFLOW_IDR_ONLY,           // keep only IDR frames until buffer drains to half
+    S3_HLS_OVERFLOW_BLOCK               // block caller until buffer has room or timeout
+} S3_HLS_OVERFLOW_POLICY;
+
+/*
+ * Number of frames / segments dropped by each overflow handling
+ */
+typedef struct s3_hls_drop_counters_s {
+    uint32_t skipped_frames;        // video frames dropped until next SPS
+    uint32_t evicted_segments;      // segments dropped without uploading
+    uint32_t non_ref_frames;        // non reference video frames dropped
+    uint32_t non_idr_frames;        // video frames dropped while keeping IDR only
+    uint32_t audio_frames;          // audio frames dropped
+    uint32_t block_timeouts;        // times caller blocked until timeout
+} S3_HLS_DROP_COUNTERS;
+
+/*
+ * What to remove when the on-disk spool reaches its size limit
+ */
+typedef enum {
+    S3_HLS_SPOOL_EVICT_OLDEST = 0,      // delete oldest spooled segments to make room (default)
+    S3_HLS_SPOOL_DROP_NEWEST            // keep spooled segments, drop segment that does not fit
+} S3_HLS_SPOOL_EVICT_ORDER;
+
+/*
+ * State of the on-disk spool
+ */
+typedef struct s3_hls_spool_info_s {
+    uint32_t pending_segments;      // segments on disk waiting for upload
+    uint64_t pending_bytes;         // disk space used by those segments
+    uint32_t spooled_segments;      // segments written to spool since initialized
+    uint32_t drained_segments;      // spooled segments uploaded since initialized
+    uint32_t evicted_segments;      // spooled segments deleted to make room
+    uint32_t dropped_segments;      // segments not spooled because spool is full
+} S3_HLS_SPOOL_INFO;
+
+/*
+ * Memory footprint of the ring buffer
+ */
+typedef struct s3_hls_buffer_info_s {
+    uint32_t current_size;          // bytes of buffer backed by memory now
+    uint32_t min_size;              // buffer never shrinks below it, size given to initialize or raised to buffer_size of S3_HLS_VIDEO_INFO
+    uint32_t max_size;              // ceiling of elastic buffer, same as min_size for fixed buffer
+    uint32_t peak_size;
+    uint32_t used_size;             // bytes not uploaded yet
+    uint32_t grow_events;
+    uint32_t shrink_events;
+} S3_HLS_BUFFER_INFO;
+
+/*
+ * Bytes written by muxer, overhead is everything except frame data: PAT / PMT, TS headers, adaption fields and PES headers
+ */
+typedef struct s3_hls_mux_info_s {
+    uint32_t segments;                      // segments closed by separate frame or latency watchdog
+    uint32_t last_segment_bytes;
+    uint32_t last_segment_overhead_bytes;
+    uint32_t last_segment_psi_bytes;        // PAT / PMT part of overhead
+    uint64_t total_bytes;
+    uint64_t total_overhead_bytes;
+    uint32_t target_duration_ms;            // segment length in use, above target while uploads fall behind
+} S3_HLS_MUX_INFO;
+
+#define S3_HLS_CODECS_STRING_SIZE       32
+
+/*
+ * Video stream as described by latest SPS of a program, and sizing derived from it
+ */
+typedef struct s3_hls_video_info_s {
+    uint32_t width;                 // picture size after cropping
+    uint32_t height;
+    uint32_t frame_rate_num;        // frame rate num / den from VUI timing info, both 0 when SPS has none
+    uint32_t frame_rate_den;
+    uint8_t profile_idc;
+    uint8_t level_idc;              // H264 level * 10, H265 level * 30
+    uint8_t bit_depth;              // luma bit depth
+    uint8_t bit_depth_chroma;
+    uint8_t chroma_format;          // chroma_format_idc, 1 is 4:2:0
+    uint8_t interlaced;             // H264 field coding (frame_mbs_only_flag 0)
+    char codecs[S3_HLS_CODECS_STRING_SIZE];    // CODECS attribute of EXT-X-STREAM-INF, e.g. "avc1.64001f" or "hvc1.1.6.L93.B0"
+
+    uint32_t bitrate_estimate;      // bits per second expected for picture size and frame rate
+    uint32_t segment_duration_ms;   // default segment duration picked for that bitrate
+    uint32_t buffer_size;           // ring buffer size that holds a few such segments
+} S3_HLS_VIDEO_INFO;
+
+/*
+ * Allocator used by SDK and its http / crypto libraries instead of malloc, realloc and free
+ */
+typedef void* (*S3_HLS_MALLOC_CALL_BACK)(size_t size);
+typedef void* (*S3_HLS_REALLOC_CALL_BACK)(void* ptr, size_t size);
+typedef void (*S3_HLS_FREE_CALL_BACK)(void* ptr);
+
+#define S3_HLS_ARENA_HUGE_PAGE          0x01    // try to back arena with huge pages
+#define S3_HLS_ARENA_LOCK               0x02    // lock arena in memory
+
+/*
+ * Called when the SDK no longer uses the frame buffers put by reference
+ */
+typedef void (*S3_HLS_FRAME_RELEASE_CALL_BACK)(void* user_data);
+
+/*
+ * Handle of one stream uploaded by its own muxer, buffer, queue and connections, see S3_HLS_SDK_Create
+ */
+typedef struct s3_hls_sdk_s S3_HLS_SDK_CTX;
+
+/*
+ * Parameters of S3_HLS_SDK_Initialize for an instance, strings are not copied and must stay valid until instance is finalized
+ */
+typedef struct s3_hls_sdk_config_s {
+    uint32_t buffer_size;
+    char* region;
+    char* bucket;
+    char* prefix;
+    char* endpoint;
+    uint64_t seq;
+    int audio;
+} S3_HLS_SDK_CONFIG;
+
+/*
+ * Handle of upload workers, connections and memory budget shared by many instances, see S3_HLS_SDK_Gateway_Create
+ */
+typedef struct s3_hls_gateway_s S3_HLS_GATEWAY_CTX;
+
+/*
+ * Parameters of S3_HLS_SDK_Gateway_Create, strings are not copied and must stay valid until gateway is destroyed
+ */
+typedef struct s3_hls_gateway_config_s {
+    char* region;
+    char* bucket;
+    char* endpoint;
+    uint32_t worker_count;      // upload workers, each keeps one connection, 1 to S3_HLS_MAX_GATEWAY_WORKERS
+    uint64_t memory_budget;     // bytes of ring buffers of all attached instances
+    uint32_t stream_count;      // expected instances, instance with buffer_size 0 gets memory_budget / stream_count
+} S3_HLS_GATEWAY_CONFIG;
+
+typedef struct s3_hls_gateway_info_s {
+    uint32_t stream_count;      // attached instances that are initialized
+    uint32_t worker_count;      // upload workers, same as open connections at most
+    uint64_t memory_budget;
+    uint64_t memory_reserved;   // ring buffers of initialized instances, elastic buffers are counted at max_size
+    uint64_t uploaded_bytes;
+    uint64_t uploaded_segments;
+} S3_HLS_GATEWAY_INFO;
+
+/*
+ * Use user provided allocator for all memory of SDK, including ring buffer and memory used by curl and OpenSSL
+ * Must be called before S3_HLS_SDK_Initialize, pass all NULL to go back to default allocator
+ */
+int32_t S3_HLS_SDK_Set_Allocator(S3_HLS_MALLOC_CALL_BACK malloc_call_back, S3_HLS_REALLOC_CALL_BACK realloc_call_back, S3_HLS_FREE_CALL_BACK free_call_back);
+
+/*
+ * Map one region of arena_size bytes and serve all memory of SDK from it, so heap is not used after initialize
+ * The region must be larger than buffer_size passed to S3_HLS_SDK_Initialize, about 1MB more is enough for curl and OpenSSL
+ * Parameter:
+ *   flags - combination of S3_HLS_ARENA_HUGE_PAGE and S3_HLS_ARENA_LOCK
+ * Note:
+ *   Must be called before S3_HLS_SDK_Initialize. Ring buffer is not mirror mapped when using arena.
+ */
+int32_t S3_HLS_SDK_Set_Memory_Arena(uint32_t arena_size, uint32_t flags);
+
+/*
+ * Let the ring buffer grow in chunk_size steps up to max_size when upload falls behind, and shrink back to
+ * buffer_size of S3_HLS_SDK_Initialize when backlog is drained
+ * Note:
+ *   Must be called before S3_HLS_SDK_Initialize. Elastic buffer is not mirror mapped, and is not available with user allocator or arena.
+ */
+int32_t S3_HLS_SDK_Set_Elastic_Buffer(uint32_t max_size, uint32_t chunk_size);
+
+/*
+ * Upload segments with worker_count threads in parallel, each with its own connection, default is 1
+ * Segments are numbered (x-amz-meta-seq) in the order they are cut, regardless of which upload finishes first
+ * Note:
+ *   Must be called before S3_HLS_SDK_Initialize. worker_count should be between 1 and S3_HLS_MAX_UPLOAD_WORKERS.
+ */
+int32_t S3_HLS_SDK_Set_Upload_Workers(uint32_t worker_count);
+
+/*
+ * Mux program_count camera programs into each segment, so one object is uploaded per segment instead of one per camera, default is 1
+ * Program n has program number n + 1, PMT PID 0x1000 + n, video PID 0x100 + 0x10 * n and audio PID 0x101 + 0x10 * n
+ * Segments are cut at key frames of program 0, other programs should use same or shorter GOP so every segment has their key frames
+ * Note:
+ *   Must be called before S3_HLS_SDK_Initialize. program_count should be between 1 and S3_HLS_MAX_PROGRAMS.
+ *   Frames of program n are put with S3_HLS_SDK_Put_Program_Video_Frame / S3_HLS_SDK_Put_Program_Audio_Frame.
+ */
+int32_t S3_HLS_SDK_Set_Programs(uint32_t program_count);
+
+/*
+ * Stage frames of each elementary stream in its own queue and write them to segment in DTS order
+ * Each capture thread puts into the queue of its stream and does not wait for threads putting other streams,
+ * whoever puts a frame writes the staged frames that are due unless another thread is already writing them
+ * Parameter:
+ *   window_ms - frame waits for frames of other streams with lower DTS at most window_ms in DTS and in time, 0 (default) disables,
+ *               at most 2000. Video streams are waited for from the start, audio streams once they put a frame
+ *   video_stage_size / audio_stage_size - bytes allocated up front for each video / audio stream, frames put by copy are copied there
+ * Note:
+ *   Must be called before S3_HLS_SDK_Initialize. Each stream has 64 frame slots.
+ *   Put returns S3_HLS_OK once frame is staged, or S3_HLS_BUFFER_OVERFLOW when its queue is full. Frames that fail to be written
+ *   later are counted in drop counters. Frames staged at S3_HLS_SDK_Finalize are written before the last segment is closed.
+ *   When no thread puts frames, idle upload threads write staged frames that waited window_ms, before the latency watchdog runs.
+ */
+int32_t S3_HLS_SDK_Set_Interleave(uint32_t window_ms, uint32_t video_stage_size, uint32_t audio_stage_size);
+
+/*
+ * Set codec of video frames, default is S3_HLS_VIDEO_CODEC_H264
+ * With S3_HLS_VIDEO_CODEC_H265, segments are cut at VPS / SPS or IRAP (IDR, CRA, BLA) frames, PMT carries stream type 0x24
+ * and each frame is preceded by an H265 AUD. Frame items are NALUs with start codes as for H264.
+ * Note:
+ *   Must be called before S3_HLS_SDK_Initialize.
+ */
+int32_t S3_HLS_SDK_Set_Video_Codec(S3_HLS_VIDEO_CODEC codec);
+
+/*
+ * Set how video frame items start, default is S3_HLS_NALU_FORMAT_ANNEXB
+ * With S3_HLS_NALU_FORMAT_LENGTH_PREFIXED, each NALU is behind its 4 bytes length, an item may hold one NALU or a whole AVCC access unit
+ * as read from MP4, also across the two parts of the item. Lengths are replaced by start codes while writing TS packets without copying,
+ * frames with lengths not ending exactly at the end of an item or with more than 32 NALUs are rejected.
+ * Latest VPS / SPS / PPS are cached and put in front of every key frame that comes without them, as MP4 sources usually carry them only once.
+ * Note:
+ *   Must be called before S3_HLS_SDK_Initialize.
+ */
+int32_t S3_HLS_SDK_Set_Nalu_Format(S3_HLS_NALU_FORMAT format);
+
+/*
+ * Set container of segments, default is S3_HLS_CONTAINER_TS
+ * With S3_HLS_CONTAINER_FMP4, an init segment (ftyp / moov) is uploaded once as "<time>_init.mp4" when the first key frame
+ * with its parameter sets (and the first AAC frame when audio is enabled) is put. Frames before it are dropped, so are frames
+ * until an SPS could be parsed: picture size, chroma format and bit depth of the sample entry come from it.
+ * Media segments are uploaded as "<time>.m4s", made of one moof / mdat fragment per video frame and per written audio PES
+ * (see S3_HLS_SDK_Set_Audio_Aggregation). Objects are uploaded with content type video/mp4.
+ * Note:
+ *   Must be called before S3_HLS_SDK_Initialize.
+ *   Frame items are NALUs with start codes as for TS, they are written as length prefixed NALUs, at most 32 per frame.
+ *   Audio must be AAC with ADTS header, the header is removed. Only one program is supported.
+ */
+int32_t S3_HLS_SDK_Set_Container(S3_HLS_CONTAINER container);
+
+/*
+ * Read decode_timestamp of video frame items, for encoders producing B frames
+ * Parameter:
+ *   enable - 0 (default) ignores decode_timestamp, DTS is the same as PTS
+ * Note:
+ *   Must be called before S3_HLS_SDK_Initialize.
+ *   decode_timestamp of first item of a pack must not be larger than its timestamp, otherwise the pack is rejected.
+ *   PES header carries DTS only when it differs from PTS. PCR, segment cut and PAT / PMT interval follow DTS.
+ */
+int32_t S3_HLS_SDK_Set_Decode_Timestamp(uint8_t enable);
+
+/*
+ * Order in which waiting segments are uploaded, useful after connection comes back with a backlog
+ * Newest segment within live_deadline_ms after it is cut goes first, then event segments, then older segments (backlog) oldest first
+ * Parameter:
+ *   live_deadline_ms - how long a segment counts as live, default 30000. 0 uploads strictly in order
+ *   backlog_share - percent of uploaded bytes reserved for backlog while newer segments are waiting, default 20
+ * Note:
+ *   Can be called before or after S3_HLS_SDK_Initialize. x-amz-meta-seq and object keys still follow the order segments are cut.
+ */
+int32_t S3_HLS_SDK_Set_Upload_Schedule(uint32_t live_deadline_ms, uint32_t backlog_share);
+
+/*
+ * Keep segments that fail to upload, or are still pending at S3_HLS_SDK_Finalize, in directory
+ * Spooled segments are uploaded in background when connection is back, also after process restarts
+ * Parameter:
+ *   directory - created if not exists, should be on persistent storage like SD card
+ *   max_size - disk space the spool may use
+ *   evict_order - what to remove when max_size is reached
+ * Note:
+ *   Must be called before S3_HLS_SDK_Initialize. The directory string is not copied until initialize.
+ */
+int32_t S3_HLS_SDK_Set_Spool(char* directory, uint64_t max_size, S3_HLS_SPOOL_EVICT_ORDER evict_order);
+
 /*
  * Initialize S3 client
  * Parameters:
@@ -84,7 +394,7 @@ int32_t S3_HLS_SDK_Set_Tag(char* object_tag);
 int32_t S3_HLS_SDK_Finalize();
 
 /*
- * Start a back ground thread for uploading
+ * Start back ground threads for uploading
  */
 int32_t S3_HLS_SDK_Start_Upload();
 
@@ -94,6 +404,7 @@ int32_t S3_HLS_SDK_Start_Upload();
  * For most of the time, each image pack will contain only one frame
  * But usually SPS/PPS/SEI frames comes together with I frame within a pack
  * In that case, the pack will contains 4 frames
+ * An item may also hold several NALUs with 3 or 4 bytes start codes, e.g. a whole access unit, the frame is classified by all of them
  */
 int32_t S3_HLS_SDK_Put_Video_Frame(S3_HLS_FRAME_PACK* pack);
 
@@ -103,6 +414,283 @@ int32_t S3_HLS_SDK_Put_Video_Frame(S3_HLS_FRAME_PACK* pack);
  */
 int32_t S3_HLS_SDK_Put_Audio_Frame(S3_HLS_FRAME_PACK* pack);
 
+/*
+ * User call this method to put video stream into buffer without copying frame data
+ * Only TS and PES headers are written to buffer, frame data is kept by reference and sent directly when uploading
+ * Frame buffers must stay valid until release is called with user_data
+ * release is called exactly once, after the segment contains the frame is uploaded or when the frame is dropped
+ * release is called from SDK internal thread and should not call back into SDK
+ */
+int32_t S3_HLS_SDK_Put_Video_Frame_Ref(S3_HLS_FRAME_PACK* pack, S3_HLS_FRAME_RELEASE_CALL_BACK release, void* user_data);
+
+/*
+ * User call this method to put audio stream into buffer without copying frame data
+ * Same rules as S3_HLS_SDK_Put_Video_Frame_Ref
+ */
+int32_t S3_HLS_SDK_Put_Audio_Frame_Ref(S3_HLS_FRAME_PACK* pack, S3_HLS_FRAME_RELEASE_CALL_BACK release, void* user_data);
+
+/*
+ * Put frames of given camera program when S3_HLS_SDK_Set_Programs is used, program 0 is the same as functions above
+ * Returns S3_HLS_INVALID_PARAMETER when program is not less than program count
+ */
+int32_t S3_HLS_SDK_Put_Program_Video_Frame(uint32_t program, S3_HLS_FRAME_PACK* pack);
+
+int32_t S3_HLS_SDK_Put_Program_Audio_Frame(uint32_t program, S3_HLS_FRAME_PACK* pack);
+
+int32_t S3_HLS_SDK_Put_Program_Video_Frame_Ref(uint32_t program, S3_HLS_FRAME_PACK* pack, S3_HLS_FRAME_RELEASE_CALL_BACK release, void* user_data);
+
+int32_t S3_HLS_SDK_Put_Program_Audio_Frame_Ref(uint32_t program, S3_HLS_FRAME_PACK* pack, S3_HLS_FRAME_RELEASE_CALL_BACK release, void* user_data);
+
+/*
+ * Set how to handle frames that do not fit into buffer
+ * Parameter:
+ *   policy - see S3_HLS_OVERFLOW_POLICY
+ *   timeout_ms - longest time put call waits for room with S3_HLS_OVERFLOW_EVICT_OLDEST and S3_HLS_OVERFLOW_BLOCK
+ *                falls back to S3_HLS_OVERFLOW_SKIP_GOP after timeout
+ */
+int32_t S3_HLS_SDK_Set_Overflow_Policy(S3_HLS_OVERFLOW_POLICY policy, uint32_t timeout_ms);
+
+/*
+ * Get number of frames and segments dropped since initialized
+ */
+int32_t S3_HLS_SDK_Get_Drop_Counters(S3_HLS_DROP_COUNTERS* counters);
+
+/*
+ * Set how often program tables and clock reference are written
+ * Parameter:
+ *   pat_pmt_interval_ms - PAT / PMT are always written at segment start, then again every interval. 0 (default) writes them at segment start only
+ *   pcr_interval_ms - longest gap between PCRs, default 40, at most 100. Every video frame carries PCR when frames are further apart
+ * Note:
+ *   Intervals are measured in frame timestamps. Can be called before or after S3_HLS_SDK_Initialize.
+ */
+int32_t S3_HLS_SDK_Set_PSI_Interval(uint32_t pat_pmt_interval_ms, uint32_t pcr_interval_ms);
+
+/*
+ * Set how long segments are
+ * Parameter:
+ *   target_ms - segment is cut at first key frame (SPS or IDR) of program 0 after target_ms, default 2000 or picked from SPS, at least 1000.
+ *               0 cuts at every SPS as older versions did
+ *   max_target_ms - 0 (default) keeps target fixed. Otherwise target grows with segments waiting for upload, up to max_target_ms
+ * Note:
+ *   Durations are measured in frame timestamps. Segments without video are cut by audio timestamps.
+ *   IDR starting a segment without SPS / PPS gets the latest ones put in front of it, such frame is copied even when put by reference.
+ *   Can be called before or after S3_HLS_SDK_Initialize. Until called, target is picked from SPS (see S3_HLS_SDK_Get_Video_Info).
+ */
+int32_t S3_HLS_SDK_Set_Segment_Duration(uint32_t target_ms, uint32_t max_target_ms);
+
+/*
+ * Upload partial segments for Low-Latency HLS (EXT-X-PART) while segment is being written
+ * Parameter:
+ *   part_ms - partial segment is cut at first key frame of program 0 after part_ms, 0 (default) disables, otherwise 100 to 1000.
+ *             Segments without video are cut at any audio frame.
+ * Note:
+ *   Partial segment is uploaded as "<segment time>_<ms>.ts" (".m4s" for fMP4), ms is the zero padded timestamp of its first frame
+ *   in milliseconds, next to the segment it belongs to. Segments are still cut and uploaded as whole objects as before.
+ *   Every partial segment starts with PAT / PMT and parameter sets, so it can be played on its own (INDEPENDENT=YES).
+ *   Partial segments of a segment are sent with its x-amz-meta-seq. They are not spooled when upload fails.
+ *   Encoder GOP should not be longer than part_ms. Can be called before or after S3_HLS_SDK_Initialize.
+ */
+int32_t S3_HLS_SDK_Set_Part_Duration(uint32_t part_ms);
+
+/*
+ * Upload an I-frame index object next to each segment, at segment key with ".idx" appended
+ * Parameter:
+ *   enable - 0 (default) uploads segments only
+ * Note:
+ *   Index is text with one line per IDR of program 0: "<byte offset> <byte length> <PTS in 90kHz>".
+ *   The range starts at the first TS packet written for the IDR (PAT / PMT in front of it included) and ends after its last packet,
+ *   so it can be used for EXT-X-I-FRAMES-ONLY playlists and range GETs. At most 32 IDRs are listed per segment.
+ *   Index is uploaded with seq of its segment after the segment, spooled with it when upload fails.
+ *   Can be called before or after S3_HLS_SDK_Initialize, takes effect from next IDR.
+ */
+int32_t S3_HLS_SDK_Set_IFrame_Index(uint8_t enable);
+
+/*
+ * Set how much audio is written as one PES
+ * Parameter:
+ *   duration_ms - audio frames are collected until they cover duration_ms, default 100, at most 1000. 0 writes every frame as its own PES
+ * Note:
+ *   Collected frames are copied, so release call back of S3_HLS_SDK_Put_Audio_Frame_Ref is called before it returns.
+ *   Collected audio is also written before a video frame duration_ms later than it, when a segment is cut and at finalize.
+ */
+int32_t S3_HLS_SDK_Set_Audio_Aggregation(uint32_t duration_ms);
+
+/*
+ * Get bytes and muxing overhead of last segment and totals since initialized
+ */
+int32_t S3_HLS_SDK_Get_Mux_Info(S3_HLS_MUX_INFO* info);
+
+/*
+ * Get number of segments waiting in spool and spool counters since initialized
+ */
+int32_t S3_HLS_SDK_Get_Spool_Info(S3_HLS_SPOOL_INFO* info);
+
+/*
+ * Promote the segment being written, and segments started within duration_ms from now, over backlog
+ * Call this when motion detection or other event is triggered
+ */
+int32_t S3_HLS_SDK_Mark_Event(uint32_t duration_ms);
+
+/*
+ * Close segment being written when no separate frame comes in time, bounds the delay between capture and upload
+ * Parameter:
+ *   max_segment_age_ms - close segment this long after its first frame was written, 0 disables, otherwise at least 1000
+ *   max_idle_ms - close segment when no frame was written for this long, 0 disables, otherwise at least 1000
+ * Note:
+ *   Can be called before or after S3_HLS_SDK_Initialize. Checked by upload threads every 100ms.
+ *   Segment closed by age may not start with key frame, set age well above key frame interval.
+ */
+int32_t S3_HLS_SDK_Set_Latency_Watchdog(uint32_t max_segment_age_ms, uint32_t max_idle_ms);
+
+/*
+ * Get current and peak size of ring buffer and number of grow / shrink events
+ */
+int32_t S3_HLS_SDK_Get_Buffer_Info(S3_HLS_BUFFER_INFO* info);
+
+/*
+ * Get picture size, frame rate, profile / level and CODECS string from latest SPS of program, with sizing derived from them
+ * Parameter:
+ *   program - 0 for single camera, otherwise below count given to S3_HLS_SDK_Set_Programs
+ * Note:
+ *   Returns S3_HLS_INVALID_STATUS until an SPS of program could be parsed. Every SPS is parsed when it is cached.
+ *   Until S3_HLS_SDK_Set_Segment_Duration is called, segment duration follows segment_duration_ms of program 0:
+ *   whole seconds making segments of at least 512KB at bitrate_estimate, 2000 to 6000.
+ *   Elastic buffer grows to buffer_size of program 0 and does not shrink below it, within max_size of S3_HLS_SDK_Set_Elastic_Buffer.
+ *   Fixed buffer keeps size given to S3_HLS_SDK_Initialize, buffer_size can be used for it next time.
+ */
+int32_t S3_HLS_SDK_Get_Video_Info(uint32_t program, S3_HLS_VIDEO_INFO* info);
+
+/*
+ * Create an instance to upload one more stream from the same process, e.g. sub stream or another sensor
+ * Functions above work on a default instance, which is independent from instances created here.
+ * Parameter:
+ *   config - same parameters as S3_HLS_SDK_Initialize, copied into instance
+ * Note:
+ *   Instance is allocated by S3_HLS_SDK_Set_Allocator / S3_HLS_SDK_Set_Memory_Arena allocator when set, about 30KB each and 65KB more per program while initialized.
+ *   Each instance has its own muxer state, ring buffer, upload queue, workers, connections and spool, so prefix or spool
+ *   directory should differ between instances. Functions of different instances can be called from different threads.
+ *   Allocator, arena and curl are process wide: curl is set up when first instance is initialized and cleaned up when last one
+ *   is finalized. Arena and allocator are released once no instance is initialized and every created instance is destroyed,
+ *   S3_HLS_SDK_Set_Allocator / S3_HLS_SDK_Set_Memory_Arena fail until then.
+ */
+S3_HLS_SDK_CTX* S3_HLS_SDK_Create(S3_HLS_SDK_CONFIG* config);
+
+/*
+ * Finalize instance if it is initialized and free it
+ */
+int32_t S3_HLS_SDK_Destroy(S3_HLS_SDK_CTX* sdk);
+
+/*
+ * Same as S3_HLS_SDK_Initialize with parameters given to S3_HLS_SDK_Create
+ * Setters that must be called before S3_HLS_SDK_Initialize must be called before this for the instance.
+ */
+int32_t S3_HLS_SDK_Instance_Initialize(S3_HLS_SDK_CTX* sdk);
+
+/*
+ * Functions below are the same as functions above without "Instance_", applied to given instance
+ */
+int32_t S3_HLS_SDK_Instance_Set_Credential(S3_HLS_SDK_CTX* sdk, char* ak, char* sk, char* token);
+
+int32_t S3_HLS_SDK_Instance_Set_Tag(S3_HLS_SDK_CTX* sdk, char* object_tag);
+
+int32_t S3_HLS_SDK_Instance_Start_Upload(S3_HLS_SDK_CTX* sdk);
+
+int32_t S3_HLS_SDK_Instance_Finalize(S3_HLS_SDK_CTX* sdk);
+
+int32_t S3_HLS_SDK_Instance_Set_Elastic_Buffer(S3_HLS_SDK_CTX* sdk, uint32_t max_size, uint32_t chunk_size);
+
+int32_t S3_HLS_SDK_Instance_Set_Upload_Workers(S3_HLS_SDK_CTX* sdk, uint32_t worker_count);
+
+int32_t S3_HLS_SDK_Instance_Set_Programs(S3_HLS_SDK_CTX* sdk, uint32_t program_count);
+
+int32_t S3_HLS_SDK_Instance_Set_Interleave(S3_HLS_SDK_CTX* sdk, uint32_t window_ms, uint32_t video_stage_size, uint32_t audio_stage_size);
+
+int32_t S3_HLS_SDK_Instance_Set_Video_Codec(S3_HLS_SDK_CTX* sdk, S3_HLS_VIDEO_CODEC codec);
+
+int32_t S3_HLS_SDK_Instance_Set_Nalu_Format(S3_HLS_SDK_CTX* sdk, S3_HLS_NALU_FORMAT format);
+
+int32_t S3_HLS_SDK_Instance_Set_Container(S3_HLS_SDK_CTX* sdk, S3_HLS_CONTAINER container);
+
+int32_t S3_HLS_SDK_Instance_Set_Decode_Timestamp(S3_HLS_SDK_CTX* sdk, uint8_t enable);
+
+int32_t S3_HLS_SDK_Instance_Set_Upload_Schedule(S3_HLS_SDK_CTX* sdk, uint32_t live_deadline_ms, uint32_t backlog_share);
+
+int32_t S3_HLS_SDK_Instance_Set_Spool(S3_HLS_SDK_CTX* sdk, char* directory, uint64_t max_size, S3_HLS_SPOOL_EVICT_ORDER evict_order);
+
+int32_t S3_HLS_SDK_Instance_Put_Video_Frame(S3_HLS_SDK_CTX* sdk, S3_HLS_FRAME_PACK* pack);
+
+int32_t S3_HLS_SDK_Instance_Put_Audio_Frame(S3_HLS_SDK_CTX* sdk, S3_HLS_FRAME_PACK* pack);
+
+int32_t S3_HLS_SDK_Instance_Put_Video_Frame_Ref(S3_HLS_SDK_CTX* sdk, S3_HLS_FRAME_PACK* pack, S3_HLS_FRAME_RELEASE_CALL_BACK release, void* user_data);
+
+int32_t S3_HLS_SDK_Instance_Put_Audio_Frame_Ref(S3_HLS_SDK_CTX* sdk, S3_HLS_FRAME_PACK* pack, S3_HLS_FRAME_RELEASE_CALL_BACK release, void* user_data);
+
+int32_t S3_HLS_SDK_Instance_Put_Program_Video_Frame(S3_HLS_SDK_CTX* sdk, uint32_t program, S3_HLS_FRAME_PACK* pack);
+
+int32_t S3_HLS_SDK_Instance_Put_Program_Audio_Frame(S3_HLS_SDK_CTX* sdk, uint32_t program, S3_HLS_FRAME_PACK* pack);
+
+int32_t S3_HLS_SDK_Instance_Put_Program_Video_Frame_Ref(S3_HLS_SDK_CTX* sdk, uint32_t program, S3_HLS_FRAME_PACK* pack, S3_HLS_FRAME_RELEASE_CALL_BACK release, void* user_data);
+
+int32_t S3_HLS_SDK_Instance_Put_Program_Audio_Frame_Ref(S3_HLS_SDK_CTX* sdk, uint32_t program, S3_HLS_FRAME_PACK* pack, S3_HLS_FRAME_RELEASE_CALL_BACK release, void* user_data);
+
+int32_t S3_HLS_SDK_Instance_Set_Overflow_Policy(S3_HLS_SDK_CTX* sdk, S3_HLS_OVERFLOW_POLICY policy, uint32_t timeout_ms);
+
+int32_t S3_HLS_SDK_Instance_Get_Drop_Counters(S3_HLS_SDK_CTX* sdk, S3_HLS_DROP_COUNTERS* counters);
+
+int32_t S3_HLS_SDK_Instance_Set_PSI_Interval(S3_HLS_SDK_CTX* sdk, uint32_t pat_pmt_interval_ms, uint32_t pcr_interval_ms);
+
+int32_t S3_HLS_SDK_Instance_Set_Segment_Duration(S3_HLS_SDK_CTX* sdk, uint32_t target_ms, uint32_t max_target_ms);
+
+int32_t S3_HLS_SDK_Instance_Set_Part_Duration(S3_HLS_SDK_CTX* sdk, uint32_t part_ms);
+
+int32_t S3_HLS_SDK_Instance_Set_IFrame_Index(S3_HLS_SDK_CTX* sdk, uint8_t enable);
+
+int32_t S3_HLS_SDK_Instance_Set_Audio_Aggregation(S3_HLS_SDK_CTX* sdk, uint32_t duration_ms);
+
+int32_t S3_HLS_SDK_Instance_Get_Mux_Info(S3_HLS_SDK_CTX* sdk, S3_HLS_MUX_INFO* info);
+
+int32_t S3_HLS_SDK_Instance_Get_Spool_Info(S3_HLS_SDK_CTX* sdk, S3_HLS_SPOOL_INFO* info);
+
+int32_t S3_HLS_SDK_Instance_Mark_Event(S3_HLS_SDK_CTX* sdk, uint32_t duration_ms);
+
+int32_t S3_HLS_SDK_Instance_Set_Latency_Watchdog(S3_HLS_SDK_CTX* sdk, uint32_t max_segment_age_ms, uint32_t max_idle_ms);
+
+int32_t S3_HLS_SDK_Instance_Get_Buffer_Info(S3_HLS_SDK_CTX* sdk, S3_HLS_BUFFER_INFO* info);
+
+int32_t S3_HLS_SDK_Instance_Get_Video_Info(S3_HLS_SDK_CTX* sdk, uint32_t program, S3_HLS_VIDEO_INFO* info);
+
+/*
+ * Create a gateway to upload many instances, e.g. all cameras of an edge gateway, from one process
+ * Workers and their connections are shared by attached instances and started with the gateway, segments are taken
+ * stream by stream in deficit round robin weighted by bitrate, so a busy stream cannot starve others.
+ * Parameter:
+ *   config - copied into gateway, region, bucket and endpoint are used for all attached instances
+ * Note:
+ *   Credential and tag are set on gateway, S3_HLS_SDK_Instance_Set_Credential / S3_HLS_SDK_Instance_Set_Tag fail for attached instances.
+ *   Ring buffers of attached instances are reserved from memory_budget when they are initialized, initialize returns
+ *   S3_HLS_OUT_OF_MEMORY when budget is used up. S3_HLS_SDK_Instance_Set_Upload_Workers is ignored for attached instances.
+ */
+S3_HLS_GATEWAY_CTX* S3_HLS_SDK_Gateway_Create(S3_HLS_GATEWAY_CONFIG* config);
+
+/*
+ * Stop workers and free gateway, returns S3_HLS_INVALID_STATUS while any attached instance is initialized
+ */
+int32_t S3_HLS_SDK_Gateway_Destroy(S3_HLS_GATEWAY_CTX* gateway);
+
+int32_t S3_HLS_SDK_Gateway_Set_Credential(S3_HLS_GATEWAY_CTX* gateway, char* ak, char* sk, char* token);
+
+int32_t S3_HLS_SDK_Gateway_Set_Tag(S3_HLS_GATEWAY_CTX* gateway, char* object_tag);
+
+int32_t S3_HLS_SDK_Gateway_Start_Upload(S3_HLS_GATEWAY_CTX* gateway);
+
+int32_t S3_HLS_SDK_Gateway_Get_Info(S3_HLS_GATEWAY_CTX* gateway, S3_HLS_GATEWAY_INFO* info);
+
+/*
+ * Upload instance by workers of gateway, must be called before S3_HLS_SDK_Instance_Initialize, pass NULL to detach
+ * Gateway must not be destroyed before instance is finalized.
+ */
+int32_t S3_HLS_SDK_Instance_Set_Gateway(S3_HLS_SDK_CTX* sdk, S3_HLS_GATEWAY_CTX* gateway);
+
 #ifdef __cplusplus
 #if __cplusplus
 }
@@ -0,0 +1,517 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT-0
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "stdio.h"
+#include "string.h"
+
+#include "S3_HLS_SPS.h"
+#include "S3_HLS_Return_Code.h"
+
+//#define S3_HLS_SPS_DEBUG
+
+#ifdef S3_HLS_SPS_DEBUG
+#define SPS_DEBUG(x, ...) printf(x, ##__VA_ARGS__)
+#else
+#define SPS_DEBUG(x, ...)
+#endif
+
+#define S3_HLS_SPS_MAX_GOLOMB_ZEROS         31      // ue(v) of SPS fields fit in 32 bits
+#define S3_HLS_SPS_MAX_SHORT_TERM_RPS       64      // H265 num_short_term_ref_pic_sets
+#define S3_HLS_SPS_MAX_LONG_TERM_PICS       32      // H265 num_long_term_ref_pics_sps
+#define S3_HLS_SPS_MAX_POC_CYCLE            255     // H264 num_ref_frames_in_pic_order_cnt_cycle
+#define S3_HLS_SPS_MAX_MBS                  1024    // H264 picture width or height in macroblocks
+#define S3_HLS_SPS_MAX_PICTURE_SIZE         16384   // H265 picture width or height in luma samples
+#define S3_HLS_SPS_MAX_BIT_DEPTH            16      // bit_depth_minus8 is 0 to 8
+
+#define S3_HLS_SPS_EXTENDED_SAR             255     // aspect_ratio_idc followed by sar_width and sar_height
+
+/*
+ * Bit reader over RBSP of a NALU, 00 00 03 has its 03 dropped as it is read
+ * Reading past the end gives zero bits and sets overrun, so fields are read without checks and the result is checked once
+ */
+typedef struct s3_hls_sps_reader_s {
+    const uint8_t* data;
+    uint32_t length;
+    uint32_t pos;
+    uint32_t zeros;         // zero bytes just before pos
+    uint64_t cache;
+    uint32_t cache_bits;
+    uint8_t overrun;
+} S3_HLS_SPS_READER;
+
+static uint8_t S3_HLS_SPS_Next_Byte(S3_HLS_SPS_READER* reader) {
+    if(reader->pos < reader->length && 2 <= reader->zeros && 0x03 == reader->data[reader->pos]) { // emulation prevention byte
+        reader->pos++;
+        reader->zeros = 0;
+    }
+
+    if(reader->pos >= reader->length) {
+        reader->overrun = 1;
+        return 0;
+    }
+
+    uint8_t byte = reader->data[reader->pos++];
+    reader->zeros = 0 == byte ? reader->zeros + 1 : 0;
+
+    return byte;
+}
+
+static uint32_t S3_HLS_SPS_Read_Bits(S3_HLS_SPS_READER* reader, uint32_t count) {
+    if(0 == count)
+        return 0;
+
+    while(reader->cache_bits < count) {
+        reader->cache = (reader->cache << 8) | S3_HLS_SPS_Next_Byte(reader);
+        reader->cache_bits += 8;
+    }
+
+    reader->cache_bits -= count;
+    return (uint32_t)(reader->cache >> reader->cache_bits) & (uint32_t)((1ULL << count) - 1);
+}
+
+static void S3_HLS_SPS_Skip_Bits(S3_HLS_SPS_READER* reader, uint32_t count) {
+    for(; 32 < count; count -= 32)
+        S3_HLS_SPS_Read_Bits(reader, 32);
+
+    S3_HLS_SPS_Read_Bits(reader, count);
+}
+
+/*
+ * Exp-Golomb ue(v), leading zeros are counted a byte of cache at a time
+ */
+static uint32_t S3_HLS_SPS_Read_UE(S3_HLS_SPS_READER* reader) {
+    uint32_t zeros = 0;
+    while(!reader->overrun) {
+        if(0 == reader->cache_bits) {
+            reader->cache = (reader->cache << 8) | S3_HLS_SPS_Next_Byte(reader);
+            reader->cache_bits = 8;
+        }
+
+        uint32_t bits = (uint32_t)reader->cache & ((1U << reader->cache_bits) - 1);
+        if(0 == bits) { // rest of cache is zero
+            zeros += reader->cache_bits;
+            reader->cache_bits = 0;
+        } else {
+            uint32_t leading = reader->cache_bits - (32 - __builtin_clz(bits));
+            zeros += leading;
+            reader->cache_bits -= leading + 1; // the 1 ending prefix
+            break;
+        }
+
+        if(S3_HLS_SPS_MAX_GOLOMB_ZEROS < zeros)
+            reader->overrun = 1;
+    }
+
+    if(S3_HLS_SPS_MAX_GOLOMB_ZEROS < zeros || reader->overrun) {
+        reader->overrun = 1;
+        return 0;
+    }
+
+    return (uint32_t)((1ULL << zeros) - 1 + S3_HLS_SPS_Read_Bits(reader, zeros));
+}
+
+static int32_t S3_HLS_SPS_Read_SE(S3_HLS_SPS_READER* reader) {
+    uint32_t value = S3_HLS_SPS_Read_UE(reader);
+    return value & 1 ? (int32_t)((value + 1) / 2) : -(int32_t)(value / 2);
+}
+
+static void S3_HLS_SPS_Initialize_Reader(S3_HLS_SPS_READER* reader, const uint8_t* nalu, uint32_t length) {
+    memset(reader, 0, sizeof(S3_HLS_SPS_READER));
+    reader->data = nalu;
+    reader->length = length;
+}
+
+/*
+ * H264 scaling_list(), only read to get past it
+ */
+static void S3_HLS_SPS_Skip_H264_Scaling_List(S3_HLS_SPS_READER* reader, uint32_t size) {
+    int32_t last_scale = 8;
+    int32_t next_scale = 8;
+
+    for(uint32_t cnt = 0; cnt < size && !reader->overrun; cnt++) {
+        if(0 != next_scale)
+            next_scale = (last_scale + S3_HLS_SPS_Read_SE(reader) + 256) % 256;
+
+        last_scale = 0 == next_scale ? last_scale : next_scale;
+    }
+}
+
+/*
+ * Fields of vui_parameters() before timing info are the same in H264 and H265 up to chroma sample location
+ */
+static void S3_HLS_SPS_Skip_VUI_Head(S3_HLS_SPS_READER* reader) {
+    if(S3_HLS_SPS_Read_Bits(reader, 1)) { // aspect_ratio_info_present_flag
+        if(S3_HLS_SPS_EXTENDED_SAR == S3_HLS_SPS_Read_Bits(reader, 8))
+            S3_HLS_SPS_Skip_Bits(reader, 32); // sar_width, sar_height
+    }
+
+    if(S3_HLS_SPS_Read_Bits(reader, 1)) // overscan_info_present_flag
+        S3_HLS_SPS_Skip_Bits(reader, 1);
+
+    if(S3_HLS_SPS_Read_Bits(reader, 1)) { // video_signal_type_present_flag
+        S3_HLS_SPS_Skip_Bits(reader, 4); // video_format, video_full_range_flag
+        if(S3_HLS_SPS_Read_Bits(reader, 1)) // colour_description_present_flag
+            S3_HLS_SPS_Skip_Bits(reader, 24);
+    }
+
+    if(S3_HLS_SPS_Read_Bits(reader, 1)) { // chroma_loc_info_present_flag
+        S3_HLS_SPS_Read_UE(reader);
+        S3_HLS_SPS_Read_UE(reader);
+    }
+}
+
+static int32_t S3_HLS_SPS_Parse_H264(S3_HLS_SPS_READER* reader, S3_HLS_VIDEO_INFO* info) {
+    S3_HLS_SPS_Skip_Bits(reader, 8); // NALU header
+
+    uint32_t profile_idc = S3_HLS_SPS_Read_Bits(reader, 8);
+    uint32_t constraint_flags = S3_HLS_SPS_Read_Bits(reader, 8);
+    uint32_t level_idc = S3_HLS_SPS_Read_Bits(reader, 8);
+    S3_HLS_SPS_Read_UE(reader); // seq_parameter_set_id
+
+    uint32_t chroma_format_idc = 1;
+    uint32_t separate_colour_plane = 0;
+    uint32_t bit_depth = 8;
+    uint32_t bit_depth_chroma = 8;
+    switch(profile_idc) { // profiles that carry chroma format and bit depth
+        case 100: case 110: case 122: case 244: case 44: case 83: case 86: case 118: case 128: case 138: case 139: case 134: case 135:
+            chroma_format_idc = S3_HLS_SPS_Read_UE(reader);
+            if(3 == chroma_format_idc)
+                separate_colour_plane = S3_HLS_SPS_Read_Bits(reader, 1);
+
+            bit_depth = S3_HLS_SPS_Read_UE(reader) + 8;
+            bit_depth_chroma = S3_HLS_SPS_Read_UE(reader) + 8;
+            S3_HLS_SPS_Skip_Bits(reader, 1); // qpprime_y_zero_transform_bypass_flag
+
+            if(S3_HLS_SPS_Read_Bits(reader, 1)) { // seq_scaling_matrix_present_flag
+                uint32_t lists = 3 != chroma_format_idc ? 8 : 12;
+                for(uint32_t cnt = 0; cnt < lists; cnt++) {
+                    if(S3_HLS_SPS_Read_Bits(reader, 1))
+                        S3_HLS_SPS_Skip_H264_Scaling_List(reader, 6 > cnt ? 16 : 64);
+                }
+            }
+            break;
+        default:
+            break;
+    }
+
+    if(3 < chroma_format_idc || S3_HLS_SPS_MAX_BIT_DEPTH < bit_depth || S3_HLS_SPS_MAX_BIT_DEPTH < bit_depth_chroma)
+        return S3_HLS_INVALID_PARAMETER;
+
+    S3_HLS_SPS_Read_UE(reader); // log2_max_frame_num_minus4
+
+    uint32_t pic_order_cnt_type = S3_HLS_SPS_Read_UE(reader);
+    if(0 == pic_order_cnt_type) {
+        S3_HLS_SPS_Read_UE(reader); // log2_max_pic_order_cnt_lsb_minus4
+    } else if(1 == pic_order_cnt_type) {
+        S3_HLS_SPS_Skip_Bits(reader, 1); // delta_pic_order_always_zero_flag
+        S3_HLS_SPS_Read_SE(reader); // offset_for_non_ref_pic
+        S3_HLS_SPS_Read_SE(reader); // offset_for_top_to_bottom_field
+
+        uint32_t cycle = S3_HLS_SPS_Read_UE(reader);
+        if(S3_HLS_SPS_MAX_POC_CYCLE < cycle)
+            return S3_HLS_INVALID_PARAMETER;
+
+        for(uint32_t cnt = 0; cnt < cycle; cnt++)
+            S3_HLS_SPS_Read_SE(reader); // offset_for_ref_frame
+    }
+
+    S3_HLS_SPS_Read_UE(reader); // max_num_ref_frames
+    S3_HLS_SPS_Skip_Bits(reader, 1); // gaps_in_frame_num_value_allowed_flag
+
+    uint32_t width_in_mbs = S3_HLS_SPS_Read_UE(reader) + 1;
+    uint32_t height_in_map_units = S3_HLS_SPS_Read_UE(reader) + 1;
+    uint32_t frame_mbs_only = S3_HLS_SPS_Read_Bits(reader, 1);
+    if(!frame_mbs_only)
+        S3_HLS_SPS_Skip_Bits(reader, 1); // mb_adaptive_frame_field_flag
+
+    S3_HLS_SPS_Skip_Bits(reader, 1); // direct_8x8_inference_flag
+
+    uint32_t width = width_in_mbs * 16;
+    uint32_t height = (2 - frame_mbs_only) * height_in_map_units * 16;
+    if(S3_HLS_SPS_MAX_MBS < width_in_mbs || S3_HLS_SPS_MAX_MBS < height_in_map_units)
+        return S3_HLS_INVALID_PARAMETER;
+
+    if(S3_HLS_SPS_Read_Bits(reader, 1)) { // frame_cropping_flag
+        // crop units depend on chroma subsampling, 4:2:0 crops in 2 luma samples
+        uint32_t crop_x = 0 == chroma_format_idc || separate_colour_plane ? 1 : (3 == chroma_format_idc ? 1 : 2);
+        uint32_t crop_y = (0 == chroma_format_idc || separate_colour_plane ? 1 : (1 == chroma_format_idc ? 2 : 1)) * (2 - frame_mbs_only);
+
+        uint32_t left = S3_HLS_SPS_Read_UE(reader);
+        uint32_t right = S3_HLS_SPS_Read_UE(reader);
+        uint32_t top = S3_HLS_SPS_Read_UE(reader);
+        uint32_t bottom = S3_HLS_SPS_Read_UE(reader);
+
+        if((uint64_t)crop_x * ((uint64_t)left + right) >= width || (uint64_t)crop_y * ((uint64_t)top + bottom) >= height)
+            return S3_HLS_INVALID_PARAMETER;
+
+        width -= crop_x * (left + right);
+        height -= crop_y * (top + bottom);
+    }
+
+    uint32_t num_units_in_tick = 0;
+    uint32_t time_scale = 0;
+    if(S3_HLS_SPS_Read_Bits(reader, 1)) { // vui_parameters_present_flag
+        S3_HLS_SPS_Skip_VUI_Head(reader);
+        if(S3_HLS_SPS_Read_Bits(reader, 1)) { // timing_info_present_flag
+            num_units_in_tick = S3_HLS_SPS_Read_Bits(reader, 32);
+            time_scale = S3_HLS_SPS_Read_Bits(reader, 32);
+        }
+    }
+
+    if(reader->overrun)
+        return S3_HLS_INVALID_PARAMETER;
+
+    info->width = width;
+    info->height = height;
+    info->profile_idc = (uint8_t)profile_idc;
+    info->level_idc = (uint8_t)level_idc;
+    info->bit_depth = (uint8_t)bit_depth;
+    info->bit_depth_chroma = (uint8_t)bit_depth_chroma;
+    info->chroma_format = (uint8_t)chroma_format_idc;
+    info->interlaced = !frame_mbs_only;
+
+    // a frame is two field ticks
+    uint8_t has_timing = 0 < num_units_in_tick && 0x80000000 > num_units_in_tick && 0 < time_scale;
+    info->frame_rate_num = has_timing ? time_scale : 0;
+    info->frame_rate_den = has_timing ? num_units_in_tick * 2 : 0;
+
+    snprintf(info->codecs, sizeof(info->codecs), "avc1.%02x%02x%02x", profile_idc, constraint_flags, level_idc);
+
+    return S3_HLS_OK;
+}
+
+/*
+ * H265 short term reference picture sets, only number of delta POCs of each set is kept as later sets are predicted from it
+ */
+static int32_t S3_HLS_SPS_Skip_H265_Short_Term_RPS(S3_HLS_SPS_READER* reader, uint32_t count) {
+    uint32_t delta_pocs[S3_HLS_SPS_MAX_SHORT_TERM_RPS];
+
+    for(uint32_t idx = 0; idx < count; idx++) {
+        uint32_t inter_rps_pred = 0 < idx ? S3_HLS_SPS_Read_Bits(reader, 1) : 0;
+        if(inter_rps_pred) { // predicted from previous set, delta_idx_minus1 is only sent in slice header
+            S3_HLS_SPS_Skip_Bits(reader, 1); // delta_rps_sign
+            S3_HLS_SPS_Read_UE(reader); // abs_delta_rps_minus1
+
+            delta_pocs[idx] = 0;
+            for(uint32_t cnt = 0; cnt <= delta_pocs[idx - 1]; cnt++) {
+                uint32_t used = S3_HLS_SPS_Read_Bits(reader, 1);
+                uint32_t use_delta = used ? 1 : S3_HLS_SPS_Read_Bits(reader, 1);
+                delta_pocs[idx] += use_delta;
+            }
+        } else {
+            uint32_t negative = S3_HLS_SPS_Read_UE(reader);
+            uint32_t positive = S3_HLS_SPS_Read_UE(reader);
+            if(S3_HLS_SPS_MAX_SHORT_TERM_RPS < negative || S3_HLS_SPS_MAX_SHORT_TERM_RPS < positive)
+                return S3_HLS_INVALID_PARAMETER;
+
+            for(uint32_t cnt = 0; cnt < negative + positive; cnt++) {
+                S3_HLS_SPS_Read_UE(reader); // delta_poc_minus1
+                S3_HLS_SPS_Skip_Bits(reader, 1); // used_by_curr_pic_flag
+            }
+
+            delta_pocs[idx] = negative + positive;
+        }
+
+        if(reader->overrun)
+            return S3_HLS_INVALID_PARAMETER;
+    }
+
+    return S3_HLS_OK;
+}
+
+static void S3_HLS_SPS_Skip_H265_Scaling_List(S3_HLS_SPS_READER* reader) {
+    for(uint32_t size_id = 0; size_id < 4; size_id++) {
+        for(uint32_t matrix_id = 0; matrix_id < 6; matrix_id += 3 == size_id ? 3 : 1) {
+            if(!S3_HLS_SPS_Read_Bits(reader, 1)) { // scaling_list_pred_mode_flag
+                S3_HLS_SPS_Read_UE(reader); // scaling_list_pred_matrix_id_delta
+                continue;
+            }
+
+            uint32_t coefficients = 0 == size_id ? 16 : 64;
+            if(1 < size_id)
+                S3_HLS_SPS_Read_SE(reader); // scaling_list_dc_coef_minus8
+
+            for(uint32_t cnt = 0; cnt < coefficients; cnt++)
+                S3_HLS_SPS_Read_SE(reader); // scaling_list_delta_coef
+        }
+    }
+}
+
+static int32_t S3_HLS_SPS_Parse_H265(S3_HLS_SPS_READER* reader, S3_HLS_VIDEO_INFO* info) {
+    S3_HLS_SPS_Skip_Bits(reader, 16); // NALU header
+    S3_HLS_SPS_Skip_Bits(reader, 4); // sps_video_parameter_set_id
+
+    uint32_t max_sub_layers_minus1 = S3_HLS_SPS_Read_Bits(reader, 3);
+    S3_HLS_SPS_Skip_Bits(reader, 1); // sps_temporal_id_nesting_flag
+
+    // profile_tier_level(), general part is what CODECS describes
+    uint32_t profile_space = S3_HLS_SPS_Read_Bits(reader, 2);
+    uint32_t tier = S3_HLS_SPS_Read_Bits(reader, 1);
+    uint32_t profile_idc = S3_HLS_SPS_Read_Bits(reader, 5);
+    uint32_t compatibility_flags = S3_HLS_SPS_Read_Bits(reader, 32);
+    uint8_t constraint_flags[6];
+    for(uint32_t cnt = 0; cnt < sizeof(constraint_flags); cnt++)
+        constraint_flags[cnt] = (uint8_t)S3_HLS_SPS_Read_Bits(reader, 8);
+    uint32_t level_idc = S3_HLS_SPS_Read_Bits(reader, 8);
+
+    uint32_t sub_layer_flags = 0 < max_sub_layers_minus1 ? S3_HLS_SPS_Read_Bits(reader, 16) : 0; // 2 bits per layer of 8, rest reserved
+    for(uint32_t layer = 0; layer < max_sub_layers_minus1; layer++) {
+        if(sub_layer_flags & (0x8000 >> (layer * 2))) // sub_layer_profile_present_flag
+            S3_HLS_SPS_Skip_Bits(reader, 88);
+
+        if(sub_layer_flags & (0x4000 >> (layer * 2))) // sub_layer_level_present_flag
+            S3_HLS_SPS_Skip_Bits(reader, 8);
+    }
+
+    S3_HLS_SPS_Read_UE(reader); // sps_seq_parameter_set_id
+
+    uint32_t chroma_format_idc = S3_HLS_SPS_Read_UE(reader);
+    uint32_t separate_colour_plane = 3 == chroma_format_idc ? S3_HLS_SPS_Read_Bits(reader, 1) : 0;
+    if(3 < chroma_format_idc)
+        return S3_HLS_INVALID_PARAMETER;
+
+    uint32_t width = S3_HLS_SPS_Read_UE(reader);
+    uint32_t height = S3_HLS_SPS_Read_UE(reader);
+
+    if(S3_HLS_SPS_Read_Bits(reader, 1)) { // conformance_window_flag
+        uint32_t crop_x = 0 == chroma_format_idc || separate_colour_plane ? 1 : (3 == chroma_format_idc ? 1 : 2);
+        uint32_t crop_y = 0 == chroma_format_idc || separate_colour_plane ? 1 : (1 == chroma_format_idc ? 2 : 1);
+
+        uint32_t left = S3_HLS_SPS_Read_UE(reader);
+        uint32_t right = S3_HLS_SPS_Read_UE(reader);
+        uint32_t top = S3_HLS_SPS_Read_UE(reader);
+        uint32_t bottom = S3_HLS_SPS_Read_UE(reader);
+
+        if((uint64_t)crop_x * ((uint64_t)left + right) >= width || (uint64_t)crop_y * ((uint64_t)top + bottom) >= height)
+            return S3_HLS_INVALID_PARAMETER;
+
+        width -= crop_x * (left + right);
+        height -= crop_y * (top + bottom);
+    }
+
+    uint32_t bit_depth = S3_HLS_SPS_Read_UE(reader) + 8;
+    uint32_t bit_depth_chroma = S3_HLS_SPS_Read_UE(reader) + 8;
+    if(S3_HLS_SPS_MAX_BIT_DEPTH < bit_depth || S3_HLS_SPS_MAX_BIT_DEPTH < bit_depth_chroma)
+        return S3_HLS_INVALID_PARAMETER;
+
+    uint32_t log2_max_poc_lsb = S3_HLS_SPS_Read_UE(reader) + 4;
+    if(16 < log2_max_poc_lsb)
+        return S3_HLS_INVALID_PARAMETER;
+
+    uint32_t ordering_info_present = S3_HLS_SPS_Read_Bits(reader, 1);
+    for(uint32_t layer = ordering_info_present ? 0 : max_sub_layers_minus1; layer <= max_sub_layers_minus1; layer++) {
+        S3_HLS_SPS_Read_UE(reader); // sps_max_dec_pic_buffering_minus1
+        S3_HLS_SPS_Read_UE(reader); // sps_max_num_reorder_pics
+        S3_HLS_SPS_Read_UE(reader); // sps_max_latency_increase_plus1
+    }
+
+    for(uint32_t cnt = 0; cnt < 6; cnt++) // coding and transform block sizes, transform hierarchy depths
+        S3_HLS_SPS_Read_UE(reader);
+
+    if(S3_HLS_SPS_Read_Bits(reader, 1) && S3_HLS_SPS_Read_Bits(reader, 1)) // scaling_list_enabled_flag, sps_scaling_list_data_present_flag
+        S3_HLS_SPS_Skip_H265_Scaling_List(reader);
+
+    S3_HLS_SPS_Skip_Bits(reader, 2); // amp_enabled_flag, sample_adaptive_offset_enabled_flag
+    if(S3_HLS_SPS_Read_Bits(reader, 1)) { // pcm_enabled_flag
+        S3_HLS_SPS_Skip_Bits(reader, 8); // pcm sample bit depths
+        S3_HLS_SPS_Read_UE(reader);
+        S3_HLS_SPS_Read_UE(reader);
+        S3_HLS_SPS_Skip_Bits(reader, 1); // pcm_loop_filter_disabled_flag
+    }
+
+    uint32_t short_term_rps = S3_HLS_SPS_Read_UE(reader);
+    if(S3_HLS_SPS_MAX_SHORT_TERM_RPS < short_term_rps || S3_HLS_OK != S3_HLS_SPS_Skip_H265_Short_Term_RPS(reader, short_term_rps))
+        return S3_HLS_INVALID_PARAMETER;
+
+    if(S3_HLS_SPS_Read_Bits(reader, 1)) { // long_term_ref_pics_present_flag
+        uint32_t long_term_pics = S3_HLS_SPS_Read_UE(reader);
+        if(S3_HLS_SPS_MAX_LONG_TERM_PICS < long_term_pics)
+            return S3_HLS_INVALID_PARAMETER;
+
+        for(uint32_t cnt = 0; cnt < long_term_pics; cnt++)
+            S3_HLS_SPS_Skip_Bits(reader, log2_max_poc_lsb + 1); // lt_ref_pic_poc_lsb_sps, used_by_curr_pic_lt_sps_flag
+    }
+
+    S3_HLS_SPS_Skip_Bits(reader, 2); // sps_temporal_mvp_enabled_flag, strong_intra_smoothing_enabled_flag
+
+    uint32_t num_units_in_tick = 0;
+    uint32_t time_scale = 0;
+    if(S3_HLS_SPS_Read_Bits(reader, 1)) { // vui_parameters_present_flag
+        S3_HLS_SPS_Skip_VUI_Head(reader);
+        S3_HLS_SPS_Skip_Bits(reader, 3); // neutral_chroma_indication_flag, field_seq_flag, frame_field_info_present_flag
+
+        if(S3_HLS_SPS_Read_Bits(reader, 1)) { // default_display_window_flag
+            for(uint32_t cnt = 0; cnt < 4; cnt++)
+                S3_HLS_SPS_Read_UE(reader);
+        }
+
+        if(S3_HLS_SPS_Read_Bits(reader, 1)) { // vui_timing_info_present_flag
+            num_units_in_tick = S3_HLS_SPS_Read_Bits(reader, 32);
+            time_scale = S3_HLS_SPS_Read_Bits(reader, 32);
+        }
+    }
+
+    if(reader->overrun || 0 == width || 0 == height || S3_HLS_SPS_MAX_PICTURE_SIZE < width || S3_HLS_SPS_MAX_PICTURE_SIZE < height)
+        return S3_HLS_INVALID_PARAMETER;
+
+    info->width = width;
+    info->height = height;
+    info->profile_idc = (uint8_t)profile_idc;
+    info->level_idc = (uint8_t)level_idc;
+    info->bit_depth = (uint8_t)bit_depth;
+    info->bit_depth_chroma = (uint8_t)bit_depth_chroma;
+    info->chroma_format = (uint8_t)chroma_format_idc;
+    info->interlaced = 0;
+
+    info->frame_rate_num = 0 < num_units_in_tick && 0 < time_scale ? time_scale : 0;
+    info->frame_rate_den = 0 < info->frame_rate_num ? num_units_in_tick : 0;
+
+    // ISO/IEC 14496-15 E.3: compatibility flags in reverse bit order, constraint bytes without trailing zero bytes
+    uint32_t reversed = 0;
+    for(uint32_t cnt = 0; cnt < 32; cnt++)
+        reversed |= ((compatibility_flags >> cnt) & 1) << (31 - cnt);
+
+    static const char* profile_spaces[4] = { "", "A", "B", "C" };
+    int length = snprintf(info->codecs, sizeof(info->codecs), "hvc1.%s%u.%X.%c%u", profile_spaces[profile_space], profile_idc, reversed, tier ? 'H' : 'L', level_idc);
+
+    uint32_t constraint_bytes = sizeof(constraint_flags);
+    while(0 < constraint_bytes && 0 == constraint_flags[constraint_bytes - 1])
+        constraint_bytes--;
+
+    for(uint32_t cnt = 0; cnt < constraint_bytes && 0 < length && (uint32_t)length < sizeof(info->codecs); cnt++)
+        length += snprintf(info->codecs + length, sizeof(info->codecs) - length, ".%X", constraint_flags[cnt]);
+
+    return S3_HLS_OK;
+}
+
+int32_t S3_HLS_SPS_Parse(S3_HLS_VIDEO_CODEC codec, const uint8_t* nalu, uint32_t length, S3_HLS_VIDEO_INFO* info) {
+    if(NULL == nalu || NULL == info)
+        return S3_HLS_INVALID_PARAMETER;
+
+    S3_HLS_SPS_READER reader;
+    S3_HLS_SPS_Initialize_Reader(&reader, nalu, length);
+
+    int32_t ret = S3_HLS_VIDEO_CODEC_H265 == codec ? S3_HLS_SPS_Parse_H265(&reader, info) : S3_HLS_SPS_Parse_H264(&reader, info);
+    if(S3_HLS_OK != ret) {
+        SPS_DEBUG("[SPS] Failed to parse SPS of %u bytes!\n", length);
+        return ret;
+    }
+
+    SPS_DEBUG("[SPS] %ux%u %u/%u fps %s\n", info->width, info->height, info->frame_rate_num, info->frame_rate_den, info->codecs);
+    return S3_HLS_OK;
+}
@@ -0,0 +1,248 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT-0
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "S3_HLS_Scheduler.h"
+#include "S3_HLS_Memory.h"
+#include "S3_HLS_Return_Code.h"
+
+//#define S3_HLS_SCHEDULER_DEBUG
+
+#ifdef S3_HLS_SCHEDULER_DEBUG
+#define SCHEDULER_DEBUG(x, ...) printf(x, ##__VA_ARGS__)
+#else
+#define SCHEDULER_DEBUG(x, ...)
+#endif
+
+static int64_t S3_HLS_Scheduler_Now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static int64_t S3_HLS_Scheduler_Quantum(S3_HLS_SCHEDULER_STREAM* stream) {
+    int64_t quantum = (int64_t)stream->bitrate * S3_HLS_SCHEDULER_QUANTUM_MS / 1000;
+    return quantum > S3_HLS_SCHEDULER_MIN_QUANTUM ? quantum : S3_HLS_SCHEDULER_MIN_QUANTUM;
+}
+
+S3_HLS_SCHEDULER_CTX* S3_HLS_Scheduler_Initialize() {
+    S3_HLS_SCHEDULER_CTX* ctx = (S3_HLS_SCHEDULER_CTX*)S3_HLS_Calloc(1, sizeof(S3_HLS_SCHEDULER_CTX));
+    if(NULL == ctx) {
+        SCHEDULER_DEBUG("[Init]Failed to allocate scheduler context!\n");
+        return NULL;
+    }
+
+    if(0 != pthread_mutex_init(&ctx->lock, NULL)) {
+        SCHEDULER_DEBUG("[Init]Failed to initialize lock!\n");
+        goto l_free_ctx;
+    }
+
+    if(0 != pthread_cond_init(&ctx->idle_cond, NULL)) {
+        SCHEDULER_DEBUG("[Init]Failed to initialize condition!\n");
+        goto l_destroy_lock;
+    }
+
+    return ctx;
+
+l_destroy_lock:
+    pthread_mutex_destroy(&ctx->lock);
+
+l_free_ctx:
+    S3_HLS_Free(ctx);
+    return NULL;
+}
+
+void S3_HLS_Scheduler_Finalize(S3_HLS_SCHEDULER_CTX* ctx) {
+    if(NULL == ctx)
+        return;
+
+    pthread_cond_destroy(&ctx->idle_cond);
+    pthread_mutex_destroy(&ctx->lock);
+    S3_HLS_Free(ctx);
+}
+
+int32_t S3_HLS_Scheduler_Add_Stream(S3_HLS_SCHEDULER_CTX* ctx, S3_HLS_SCHEDULER_STREAM* stream, void* user_data) {
+    if(NULL == ctx || NULL == stream)
+        return S3_HLS_INVALID_PARAMETER;
+
+    int32_t ret = S3_HLS_OK;
+
+    pthread_mutex_lock(&ctx->lock);
+    if(S3_HLS_SCHEDULER_MAX_STREAMS <= ctx->stream_count) {
+        SCHEDULER_DEBUG("[Add]Too many streams!\n");
+        ret = S3_HLS_QUEUE_FULL;
+        goto l_unlock;
+    }
+
+    stream->user_data = user_data;
+    stream->index = ctx->stream_count;
+    stream->deficit = 0;
+    stream->queued = 0;
+    stream->busy = 0;
+    stream->rate_bytes = 0;
+    stream->rate_start = S3_HLS_Scheduler_Now();
+    stream->bitrate = 0;
+
+    ctx->streams[ctx->stream_count++] = stream;
+
+l_unlock:
+    pthread_mutex_unlock(&ctx->lock);
+    return ret;
+}
+
+void S3_HLS_Scheduler_Remove_Stream(S3_HLS_SCHEDULER_CTX* ctx, S3_HLS_SCHEDULER_STREAM* stream, uint8_t drain) {
+    pthread_mutex_lock(&ctx->lock);
+    while(0 != stream->busy || (drain && 0 != stream->queued))
+        pthread_cond_wait(&ctx->idle_cond, &ctx->lock);
+
+    // last stream takes the slot, order of streams does not matter for fairness
+    S3_HLS_SCHEDULER_STREAM* last = ctx->streams[--ctx->stream_count];
+    ctx->streams[stream->index] = last;
+    last->index = stream->index;
+
+    if(ctx->cursor >= ctx->stream_count)
+        ctx->cursor = 0;
+
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+void S3_HLS_Scheduler_Push(S3_HLS_SCHEDULER_CTX* ctx, S3_HLS_SCHEDULER_STREAM* stream, uint32_t length) {
+    int64_t now = S3_HLS_Scheduler_Now();
+
+    pthread_mutex_lock(&ctx->lock);
+    stream->queued++;
+
+    stream->rate_bytes += length;
+    int64_t elapsed = now - stream->rate_start;
+    if(S3_HLS_SCHEDULER_RATE_INTERVAL <= elapsed) {
+        uint64_t rate = stream->rate_bytes * 1000 / elapsed;
+        if(UINT32_MAX < rate)
+            rate = UINT32_MAX;
+
+        stream->bitrate = 0 == stream->bitrate ? (uint32_t)rate : (uint32_t)(((uint64_t)stream->bitrate * 3 + rate) / 4);
+        stream->rate_bytes = 0;
+        stream->rate_start = now;
+    }
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+S3_HLS_SCHEDULER_STREAM* S3_HLS_Scheduler_Take(S3_HLS_SCHEDULER_CTX* ctx) {
+    S3_HLS_SCHEDULER_STREAM* ret = NULL;
+
+    pthread_mutex_lock(&ctx->lock);
+    for(uint32_t round = 0; round < 2; round++) {
+        // stream taken last keeps the turn while it has credit
+        for(uint32_t cnt = 0; cnt < ctx->stream_count; cnt++) {
+            uint32_t index = (ctx->cursor + cnt) % ctx->stream_count;
+            S3_HLS_SCHEDULER_STREAM* stream = ctx->streams[index];
+
+            if(0 == stream->queued) {
+                // idle stream does not save credit, debt is kept
+                if(0 < stream->deficit)
+                    stream->deficit = 0;
+
+                continue;
+            }
+
+            if(0 < stream->deficit) {
+                ret = stream;
+                ctx->cursor = index;
+                goto l_take;
+            }
+        }
+
+        // no waiting stream has credit, skip the rounds until one has
+        int64_t rounds = INT64_MAX;
+        for(uint32_t cnt = 0; cnt < ctx->stream_count; cnt++) {
+            S3_HLS_SCHEDULER_STREAM* stream = ctx->streams[cnt];
+            if(0 == stream->queued)
+                continue;
+
+            int64_t quantum = S3_HLS_Scheduler_Quantum(stream);
+            int64_t needed = (quantum - stream->deficit) / quantum;
+            if(needed < rounds)
+                rounds = needed;
+        }
+
+        if(INT64_MAX == rounds) // nothing queued
+            break;
+
+        for(uint32_t cnt = 0; cnt < ctx->stream_count; cnt++) {
+            S3_HLS_SCHEDULER_STREAM* stream = ctx->streams[cnt];
+            if(0 != stream->queued)
+                stream->deficit += rounds * S3_HLS_Scheduler_Quantum(stream);
+        }
+    }
+
+    pthread_mutex_unlock(&ctx->lock);
+    return NULL;
+
+l_take:
+    ret->queued--;
+    ret->busy++;
+    pthread_mutex_unlock(&ctx->lock);
+
+    SCHEDULER_DEBUG("Take stream %u, deficit %lld, bitrate %u\n", ret->index, (long long)ret->deficit, ret->bitrate);
+    return ret;
+}
+
+void S3_HLS_Scheduler_Done(S3_HLS_SCHEDULER_CTX* ctx, S3_HLS_SCHEDULER_STREAM* stream, uint32_t length) {
+    pthread_mutex_lock(&ctx->lock);
+    stream->deficit -= length;
+    if(0 < length) {
+        ctx->uploaded_bytes += length;
+        ctx->uploaded_segments++;
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    S3_HLS_Scheduler_Release(ctx, stream);
+}
+
+S3_HLS_SCHEDULER_STREAM* S3_HLS_Scheduler_Acquire(S3_HLS_SCHEDULER_CTX* ctx, uint32_t* position) {
+    S3_HLS_SCHEDULER_STREAM* ret = NULL;
+
+    pthread_mutex_lock(&ctx->lock);
+    if(*position < ctx->stream_count) {
+        ret = ctx->streams[*position];
+        ret->busy++;
+        (*position)++;
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    return ret;
+}
+
+void S3_HLS_Scheduler_Release(S3_HLS_SCHEDULER_CTX* ctx, S3_HLS_SCHEDULER_STREAM* stream) {
+    pthread_mutex_lock(&ctx->lock);
+    stream->busy--;
+    if(0 == stream->busy)
+        pthread_cond_broadcast(&ctx->idle_cond);
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+void S3_HLS_Scheduler_Get_Info(S3_HLS_SCHEDULER_CTX* ctx, uint32_t* stream_count, uint64_t* uploaded_bytes, uint64_t* uploaded_segments) {
+    pthread_mutex_lock(&ctx->lock);
+    *stream_count = ctx->stream_count;
+    *uploaded_bytes = ctx->uploaded_bytes;
+    *uploaded_segments = ctx->uploaded_segments;
+    pthread_mutex_unlock(&ctx->lock);
+}
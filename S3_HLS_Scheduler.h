@@ -0,0 +1,119 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT-0
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __S3_HLS_SCHEDULER_H__
+#define __S3_HLS_SCHEDULER_H__
+
+#include "stdint.h"
+#include "pthread.h"
+
+#ifdef __cplusplus
+#if __cplusplus
+extern "C" {
+#endif
+#endif /* End of #ifdef __cplusplus */
+
+#define S3_HLS_SCHEDULER_MAX_STREAMS        256
+#define S3_HLS_SCHEDULER_QUANTUM_MS         1000        // credit given each round covers this long of stream bitrate
+#define S3_HLS_SCHEDULER_MIN_QUANTUM        (64 << 10)  // bytes, credit of streams without measured bitrate
+#define S3_HLS_SCHEDULER_RATE_INTERVAL      1000        // ms, bitrate is measured over at least this long
+
+/*
+ * One stream sharing upload workers, owned by caller and linked into scheduler while added
+ */
+typedef struct s3_hls_scheduler_stream_s {
+    void* user_data;
+    uint32_t index;                 // position in scheduler
+
+    int64_t deficit;                // bytes stream may upload before others get their turn, negative after a segment larger than credit
+    uint32_t queued;                // segments waiting to be taken
+    uint32_t busy;                  // workers using the stream, stream is not removed while set
+
+    // bitrate measured from queued bytes, quantum follows it
+    uint64_t rate_bytes;
+    int64_t rate_start;             // monotonic ms
+    uint32_t bitrate;               // bytes per second, smoothed
+} S3_HLS_SCHEDULER_STREAM;
+
+/*
+ * Deficit round robin over streams, each round a waiting stream gets credit in proportion to its bitrate
+ * Segment is charged to credit of its stream after upload, so a stream with credit keeps the turn until credit runs out
+ */
+typedef struct s3_hls_scheduler_s {
+    pthread_mutex_t lock;
+    pthread_cond_t idle_cond;       // signaled when a stream is no longer busy
+
+    S3_HLS_SCHEDULER_STREAM* streams[S3_HLS_SCHEDULER_MAX_STREAMS];
+    uint32_t stream_count;
+    uint32_t cursor;                // stream taken last
+
+    uint64_t uploaded_bytes;
+    uint64_t uploaded_segments;
+} S3_HLS_SCHEDULER_CTX;
+
+S3_HLS_SCHEDULER_CTX* S3_HLS_Scheduler_Initialize();
+
+/*
+ * Free scheduler, all streams should be removed
+ */
+void S3_HLS_Scheduler_Finalize(S3_HLS_SCHEDULER_CTX* ctx);
+
+/*
+ * Link stream into scheduler, returns S3_HLS_QUEUE_FULL when S3_HLS_SCHEDULER_MAX_STREAMS streams are added
+ */
+int32_t S3_HLS_Scheduler_Add_Stream(S3_HLS_SCHEDULER_CTX* ctx, S3_HLS_SCHEDULER_STREAM* stream, void* user_data);
+
+/*
+ * Wait until no worker uses stream and unlink it
+ * When drain is set, also wait until every queued segment of stream is taken
+ */
+void S3_HLS_Scheduler_Remove_Stream(S3_HLS_SCHEDULER_CTX* ctx, S3_HLS_SCHEDULER_STREAM* stream, uint8_t drain);
+
+/*
+ * Called by producer of stream after a segment of length bytes is queued
+ */
+void S3_HLS_Scheduler_Push(S3_HLS_SCHEDULER_CTX* ctx, S3_HLS_SCHEDULER_STREAM* stream, uint32_t length);
+
+/*
+ * Take one queued segment from the stream whose turn it is and mark stream busy
+ * Returns NULL when no segment is queued
+ */
+S3_HLS_SCHEDULER_STREAM* S3_HLS_Scheduler_Take(S3_HLS_SCHEDULER_CTX* ctx);
+
+/*
+ * Charge length bytes uploaded for segment taken from stream and clear busy mark, 0 if segment was dropped
+ */
+void S3_HLS_Scheduler_Done(S3_HLS_SCHEDULER_CTX* ctx, S3_HLS_SCHEDULER_STREAM* stream, uint32_t length);
+
+/*
+ * Walk streams for maintenance, position starts at 0
+ * Returned stream is marked busy until released, returns NULL after last stream
+ */
+S3_HLS_SCHEDULER_STREAM* S3_HLS_Scheduler_Acquire(S3_HLS_SCHEDULER_CTX* ctx, uint32_t* position);
+
+void S3_HLS_Scheduler_Release(S3_HLS_SCHEDULER_CTX* ctx, S3_HLS_SCHEDULER_STREAM* stream);
+
+void S3_HLS_Scheduler_Get_Info(S3_HLS_SCHEDULER_CTX* ctx, uint32_t* stream_count, uint64_t* uploaded_bytes, uint64_t* uploaded_segments);
+
+#ifdef __cplusplus
+#if __cplusplus
+}
+#endif
+#endif /* End of #ifdef __cplusplus */
+
+#endif
@@ -0,0 +1,632 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT-0
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "S3_HLS_Spool.h"
+#include "S3_HLS_Memory.h"
+#include "S3_HLS_Return_Code.h"
+
+//#define S3_HLS_SPOOL_DEBUG
+
+#ifdef S3_HLS_SPOOL_DEBUG
+#define SPOOL_DEBUG(x, ...) printf(x, ##__VA_ARGS__)
+#else
+#define SPOOL_DEBUG(x, ...)
+#endif
+
+#define S3_HLS_SPOOL_INDEX_MAGIC        0x53334849  // "S3HI"
+#define S3_HLS_SPOOL_RECORD_MAGIC       0x53334853  // "S3HS", record with seq
+
+#define S3_HLS_SPOOL_INDEX_FORMAT       "%s/spool.idx"
+#define S3_HLS_SPOOL_LOG_FORMAT         "%s/%08u.log"
+
+#define S3_HLS_SPOOL_CHECKSUM_SEED      2166136261u
+#define S3_HLS_SPOOL_CHECKSUM_PRIME     16777619u
+
+#define S3_HLS_SPOOL_MAX_KEY_LENGTH     (S3_HLS_MAX_KEY_LENGTH + 1)
+
+/*
+ * FNV-1a, only used to tell torn or stale headers from valid ones
+ */
+static uint32_t S3_HLS_Spool_Checksum(const void* data, uint32_t length, uint32_t hash) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    for(uint32_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= S3_HLS_SPOOL_CHECKSUM_PRIME;
+    }
+
+    return hash;
+}
+
+static uint32_t S3_HLS_Spool_Record_Size(uint32_t key_length, uint32_t payload_length) {
+    uint64_t size = sizeof(S3_HLS_SPOOL_RECORD) + (uint64_t)key_length + payload_length;
+    return (uint32_t)((size + S3_HLS_SPOOL_ALIGNMENT - 1) & ~((uint64_t)S3_HLS_SPOOL_ALIGNMENT - 1));
+}
+
+static void S3_HLS_Spool_Log_Path(S3_HLS_SPOOL_CTX* ctx, uint32_t file, char* path) {
+    snprintf(path, S3_HLS_SPOOL_MAX_PATH_LENGTH, S3_HLS_SPOOL_LOG_FORMAT, ctx->directory, file);
+}
+
+static int S3_HLS_Spool_Open_Log(S3_HLS_SPOOL_CTX* ctx, uint32_t file, int flags) {
+    char path[S3_HLS_SPOOL_MAX_PATH_LENGTH];
+    S3_HLS_Spool_Log_Path(ctx, file, path);
+    return open(path, flags, 0644);
+}
+
+static void S3_HLS_Spool_Remove_Log(S3_HLS_SPOOL_CTX* ctx, uint32_t file) {
+    char path[S3_HLS_SPOOL_MAX_PATH_LENGTH];
+    S3_HLS_Spool_Log_Path(ctx, file, path);
+    SPOOL_DEBUG("Remove log file %s\n", path);
+    unlink(path);
+}
+
+static int32_t S3_HLS_Spool_Write_All(int fd, uint8_t* data, uint32_t length, uint32_t offset) {
+    while(length > 0) {
+        ssize_t written = pwrite(fd, data, length, offset);
+        if(written < 0) {
+            if(EINTR == errno)
+                continue;
+
+            SPOOL_DEBUG("Write spool failed! %d\n", errno);
+            return S3_HLS_IO_ERROR;
+        }
+
+        data += written;
+        length -= written;
+        offset += written;
+    }
+
+    return S3_HLS_OK;
+}
+
+static int32_t S3_HLS_Spool_Save_Index(S3_HLS_SPOOL_CTX* ctx, uint8_t sync) {
+    ctx->index.checksum = S3_HLS_Spool_Checksum(&ctx->index, offsetof(S3_HLS_SPOOL_INDEX, checksum), S3_HLS_SPOOL_CHECKSUM_SEED);
+
+    int32_t ret = S3_HLS_Spool_Write_All(ctx->index_fd, (uint8_t*)&ctx->index, sizeof(S3_HLS_SPOOL_INDEX), 0);
+    if(S3_HLS_OK != ret)
+        return ret;
+
+    if(sync && 0 != fdatasync(ctx->index_fd))
+        return S3_HLS_IO_ERROR;
+
+    return S3_HLS_OK;
+}
+
+static void S3_HLS_Spool_Update_Info(S3_HLS_SPOOL_CTX* ctx) {
+    pthread_mutex_lock(&ctx->info_lock);
+    ctx->info.pending_segments = ctx->index.record_count;
+    ctx->info.pending_bytes = ctx->index.record_bytes;
+    pthread_mutex_unlock(&ctx->info_lock);
+}
+
+static void S3_HLS_Spool_Count_Event(S3_HLS_SPOOL_CTX* ctx, uint32_t* counter) {
+    pthread_mutex_lock(&ctx->info_lock);
+    (*counter)++;
+    pthread_mutex_unlock(&ctx->info_lock);
+}
+
+/*
+ * Read and validate record header at offset, key is copied to key_buffer if it is not NULL
+ */
+static int32_t S3_HLS_Spool_Read_Record(int fd, uint32_t offset, S3_HLS_SPOOL_RECORD* record, char* key_buffer) {
+    char key[S3_HLS_SPOOL_MAX_KEY_LENGTH];
+
+    if(sizeof(S3_HLS_SPOOL_RECORD) != pread(fd, record, sizeof(S3_HLS_SPOOL_RECORD), offset))
+        return S3_HLS_INVALID_STATUS;
+
+    if(S3_HLS_SPOOL_RECORD_MAGIC != record->magic || 0 == record->key_length || record->key_length > S3_HLS_SPOOL_MAX_KEY_LENGTH)
+        return S3_HLS_INVALID_STATUS;
+
+    if(record->key_length != pread(fd, key, record->key_length, offset + sizeof(S3_HLS_SPOOL_RECORD)))
+        return S3_HLS_INVALID_STATUS;
+
+    S3_HLS_SPOOL_RECORD header = *record;
+    header.checksum = 0;
+    uint32_t checksum = S3_HLS_Spool_Checksum(&header, sizeof(S3_HLS_SPOOL_RECORD), S3_HLS_SPOOL_CHECKSUM_SEED);
+    checksum = S3_HLS_Spool_Checksum(key, record->key_length, checksum);
+
+    if(checksum != record->checksum || 0 != key[record->key_length - 1])
+        return S3_HLS_INVALID_STATUS;
+
+    if(NULL != key_buffer)
+        memcpy(key_buffer, key, record->key_length);
+
+    return S3_HLS_OK;
+}
+
+/*
+ * Walk records from head to tail to rebuild record count and size
+ */
+static void S3_HLS_Spool_Count_Records(S3_HLS_SPOOL_CTX* ctx) {
+    S3_HLS_SPOOL_RECORD record;
+    struct stat file_stat;
+
+    ctx->index.record_count = 0;
+    ctx->index.record_bytes = 0;
+
+    for(uint32_t file = ctx->index.head_file; file <= ctx->index.tail_file; file++) {
+        int fd = S3_HLS_Spool_Open_Log(ctx, file, O_RDONLY);
+        if(fd < 0)
+            continue;
+
+        uint32_t offset = file == ctx->index.head_file ? ctx->index.head_offset : 0;
+        uint32_t end = file == ctx->index.tail_file ? ctx->index.tail_offset : (0 == fstat(fd, &file_stat) ? (uint32_t)file_stat.st_size : 0);
+
+        while(offset < end && S3_HLS_OK == S3_HLS_Spool_Read_Record(fd, offset, &record, NULL)) {
+            uint32_t size = S3_HLS_Spool_Record_Size(record.key_length, record.payload_length);
+            if(offset + size > end)
+                break;
+
+            ctx->index.record_count++;
+            ctx->index.record_bytes += size;
+            offset += size;
+        }
+
+        close(fd);
+    }
+
+    SPOOL_DEBUG("Spool has %u records, %llu bytes\n", ctx->index.record_count, (unsigned long long)ctx->index.record_bytes);
+}
+
+/*
+ * Records appended after index was last saved are kept if fully written, a torn record at the end is cut off
+ */
+static int32_t S3_HLS_Spool_Recover_Tail(S3_HLS_SPOOL_CTX* ctx) {
+    S3_HLS_SPOOL_RECORD record;
+    struct stat file_stat;
+
+    while(1) {
+        if(0 != fstat(ctx->tail_fd, &file_stat))
+            return S3_HLS_IO_ERROR;
+
+        // index was saved but data did not reach disk, scan log file again
+        if((uint64_t)ctx->index.tail_offset > (uint64_t)file_stat.st_size) {
+            if(ctx->index.head_file == ctx->index.tail_file && (uint64_t)ctx->index.head_offset > (uint64_t)file_stat.st_size)
+                ctx->index.head_offset = 0;
+
+            ctx->index.tail_offset = ctx->index.head_file == ctx->index.tail_file ? ctx->index.head_offset : 0;
+        }
+
+        while(S3_HLS_OK == S3_HLS_Spool_Read_Record(ctx->tail_fd, ctx->index.tail_offset, &record, NULL)) {
+            uint32_t size = S3_HLS_Spool_Record_Size(record.key_length, record.payload_length);
+            if((uint64_t)ctx->index.tail_offset + size > (uint64_t)file_stat.st_size)
+                break;
+
+            ctx->index.tail_offset += size;
+        }
+
+        if(0 != ftruncate(ctx->tail_fd, ctx->index.tail_offset))
+            return S3_HLS_IO_ERROR;
+
+        // writer may have rolled to next log file
+        int next_fd = S3_HLS_Spool_Open_Log(ctx, ctx->index.tail_file + 1, O_RDWR);
+        if(next_fd < 0)
+            break;
+
+        if(S3_HLS_OK != S3_HLS_Spool_Read_Record(next_fd, 0, &record, NULL)) {
+            close(next_fd);
+            break;
+        }
+
+        SPOOL_DEBUG("Recover next log file %u\n", ctx->index.tail_file + 1);
+        close(ctx->tail_fd);
+        ctx->tail_fd = next_fd;
+        ctx->index.tail_file++;
+        ctx->index.tail_offset = 0;
+    }
+
+    return S3_HLS_OK;
+}
+
+/*
+ * Read header of oldest record, log files that are missing or broken are skipped
+ */
+static int32_t S3_HLS_Spool_Load_Head(S3_HLS_SPOOL_CTX* ctx, char* key_buffer) {
+    while(1) {
+        if(0 == ctx->index.record_count)
+            return S3_HLS_QUEUE_EMPTY;
+
+        if(ctx->head_fd < 0 || ctx->head_fd_file != ctx->index.head_file) {
+            if(ctx->head_fd >= 0)
+                close(ctx->head_fd);
+
+            ctx->head_fd = S3_HLS_Spool_Open_Log(ctx, ctx->index.head_file, O_RDONLY);
+            ctx->head_fd_file = ctx->index.head_file;
+            ctx->block_valid = 0;
+        }
+
+        if(ctx->head_fd >= 0 && S3_HLS_OK == S3_HLS_Spool_Read_Record(ctx->head_fd, ctx->index.head_offset, &ctx->head_record, key_buffer)) {
+            ctx->head_record_valid = 1;
+            return S3_HLS_OK;
+        }
+
+        SPOOL_DEBUG("Broken record at %u:%u, skip!\n", ctx->index.head_file, ctx->index.head_offset);
+        if(ctx->index.head_file < ctx->index.tail_file) {
+            if(ctx->head_fd >= 0) {
+                close(ctx->head_fd);
+                ctx->head_fd = -1;
+            }
+
+            S3_HLS_Spool_Remove_Log(ctx, ctx->index.head_file);
+            ctx->index.head_file++;
+            ctx->index.head_offset = 0;
+        } else {
+            ctx->index.head_offset = ctx->index.tail_offset;
+        }
+
+        S3_HLS_Spool_Count_Records(ctx);
+        S3_HLS_Spool_Update_Info(ctx);
+    }
+}
+
+/*
+ * Move head past oldest record, log files left behind are deleted
+ */
+static int32_t S3_HLS_Spool_Remove_Head(S3_HLS_SPOOL_CTX* ctx) {
+    if(!ctx->head_record_valid && S3_HLS_OK != S3_HLS_Spool_Load_Head(ctx, NULL))
+        return S3_HLS_QUEUE_EMPTY;
+
+    uint32_t size = S3_HLS_Spool_Record_Size(ctx->head_record.key_length, ctx->head_record.payload_length);
+    ctx->index.head_offset += size;
+    ctx->index.record_count--;
+    ctx->index.record_bytes -= size;
+    ctx->head_record_valid = 0;
+
+    if(0 == ctx->index.record_count) {
+        // start over with a new log file so all disk space is given back
+        if(ctx->head_fd >= 0) {
+            close(ctx->head_fd);
+            ctx->head_fd = -1;
+        }
+
+        close(ctx->tail_fd);
+        for(uint32_t file = ctx->index.head_file; file <= ctx->index.tail_file; file++)
+            S3_HLS_Spool_Remove_Log(ctx, file);
+
+        ctx->index.tail_file++;
+        ctx->index.tail_offset = 0;
+        ctx->index.head_file = ctx->index.tail_file;
+        ctx->index.head_offset = 0;
+        ctx->index.record_bytes = 0;
+
+        ctx->tail_fd = S3_HLS_Spool_Open_Log(ctx, ctx->index.tail_file, O_RDWR | O_CREAT | O_TRUNC);
+        if(ctx->tail_fd < 0)
+            return S3_HLS_IO_ERROR;
+    } else {
+        struct stat file_stat;
+        while(ctx->index.head_file < ctx->index.tail_file) {
+            if(ctx->head_fd >= 0 && ctx->head_fd_file == ctx->index.head_file && 0 == fstat(ctx->head_fd, &file_stat) && ctx->index.head_offset < file_stat.st_size)
+                break;
+
+            if(ctx->head_fd >= 0) {
+                close(ctx->head_fd);
+                ctx->head_fd = -1;
+            }
+
+            S3_HLS_Spool_Remove_Log(ctx, ctx->index.head_file);
+            ctx->index.head_file++;
+            ctx->index.head_offset = 0;
+        }
+    }
+
+    S3_HLS_Spool_Update_Info(ctx);
+
+    // losing this update only means a segment is uploaded twice, no need to sync
+    return S3_HLS_Spool_Save_Index(ctx, 0);
+}
+
+S3_HLS_SPOOL_CTX* S3_HLS_Spool_Initialize(char* directory, uint64_t max_size, S3_HLS_SPOOL_EVICT_ORDER evict_order) {
+    if(NULL == directory || strlen(directory) >= S3_HLS_SPOOL_MAX_DIR_LENGTH || 0 == max_size)
+        return NULL;
+
+    SPOOL_DEBUG("Initialize spool in %s\n", directory);
+    S3_HLS_SPOOL_CTX* ctx = (S3_HLS_SPOOL_CTX*)S3_HLS_Calloc(1, sizeof(S3_HLS_SPOOL_CTX));
+    if(NULL == ctx) {
+        SPOOL_DEBUG("Allocate spool ctx failed!\n");
+        return NULL;
+    }
+
+    strcpy(ctx->directory, directory);
+    ctx->max_size = max_size;
+    ctx->evict_order = evict_order;
+    ctx->index_fd = -1;
+    ctx->tail_fd = -1;
+    ctx->head_fd = -1;
+
+    ctx->block = (uint8_t*)S3_HLS_Malloc(S3_HLS_SPOOL_BLOCK_SIZE);
+    if(NULL == ctx->block) {
+        SPOOL_DEBUG("Allocate spool block failed!\n");
+        goto l_free_ctx;
+    }
+
+    if(0 != pthread_mutex_init(&ctx->info_lock, NULL)) {
+        SPOOL_DEBUG("Initialize spool lock failed!\n");
+        goto l_free_block;
+    }
+
+    if(0 != mkdir(directory, 0755) && EEXIST != errno) {
+        SPOOL_DEBUG("Create spool directory failed! %d\n", errno);
+        goto l_destroy_lock;
+    }
+
+    char path[S3_HLS_SPOOL_MAX_PATH_LENGTH];
+    snprintf(path, S3_HLS_SPOOL_MAX_PATH_LENGTH, S3_HLS_SPOOL_INDEX_FORMAT, directory);
+    ctx->index_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(ctx->index_fd < 0) {
+        SPOOL_DEBUG("Open spool index failed! %d\n", errno);
+        goto l_destroy_lock;
+    }
+
+    if(sizeof(S3_HLS_SPOOL_INDEX) != pread(ctx->index_fd, &ctx->index, sizeof(S3_HLS_SPOOL_INDEX), 0)
+        || S3_HLS_SPOOL_INDEX_MAGIC != ctx->index.magic
+        || ctx->index.checksum != S3_HLS_Spool_Checksum(&ctx->index, offsetof(S3_HLS_SPOOL_INDEX, checksum), S3_HLS_SPOOL_CHECKSUM_SEED)
+        || ctx->index.head_file > ctx->index.tail_file) {
+        SPOOL_DEBUG("No valid spool index, start new spool!\n");
+        memset(&ctx->index, 0, sizeof(S3_HLS_SPOOL_INDEX));
+        ctx->index.magic = S3_HLS_SPOOL_INDEX_MAGIC;
+    }
+
+    ctx->tail_fd = S3_HLS_Spool_Open_Log(ctx, ctx->index.tail_file, O_RDWR | O_CREAT);
+    if(ctx->tail_fd < 0) {
+        SPOOL_DEBUG("Open spool log failed! %d\n", errno);
+        goto l_close_index;
+    }
+
+    if(S3_HLS_OK != S3_HLS_Spool_Recover_Tail(ctx)) {
+        SPOOL_DEBUG("Recover spool log failed!\n");
+        goto l_close_tail;
+    }
+
+    S3_HLS_Spool_Count_Records(ctx);
+    S3_HLS_Spool_Update_Info(ctx);
+
+    if(S3_HLS_OK != S3_HLS_Spool_Save_Index(ctx, 1)) {
+        SPOOL_DEBUG("Save spool index failed!\n");
+        goto l_close_tail;
+    }
+
+    return ctx;
+
+l_close_tail:
+    close(ctx->tail_fd);
+
+l_close_index:
+    close(ctx->index_fd);
+
+l_destroy_lock:
+    pthread_mutex_destroy(&ctx->info_lock);
+
+l_free_block:
+    S3_HLS_Free(ctx->block);
+
+l_free_ctx:
+    S3_HLS_Free(ctx);
+
+    return NULL;
+}
+
+int32_t S3_HLS_Spool_Finalize(S3_HLS_SPOOL_CTX* ctx) {
+    if(NULL == ctx)
+        return S3_HLS_INVALID_PARAMETER;
+
+    int32_t ret = S3_HLS_Spool_Save_Index(ctx, 1);
+
+    if(ctx->head_fd >= 0)
+        close(ctx->head_fd);
+
+    if(ctx->tail_fd >= 0)
+        close(ctx->tail_fd);
+
+    close(ctx->index_fd);
+
+    pthread_mutex_destroy(&ctx->info_lock);
+    S3_HLS_Free(ctx->block);
+    S3_HLS_Free(ctx);
+
+    return ret;
+}
+
+int32_t S3_HLS_Spool_Write(S3_HLS_SPOOL_CTX* ctx, char* object_key, time_t timestamp, uint64_t seq, S3_HLS_CLIENT_READ_CALL_BACK read, void* source, uint32_t length) {
+    if(NULL == ctx || NULL == object_key || NULL == read)
+        return S3_HLS_INVALID_PARAMETER;
+
+    uint32_t key_length = strlen(object_key) + 1;
+    if(key_length > S3_HLS_SPOOL_MAX_KEY_LENGTH)
+        return S3_HLS_INVALID_PARAMETER;
+
+    uint32_t size = S3_HLS_Spool_Record_Size(key_length, length);
+    if(size > ctx->max_size) {
+        S3_HLS_Spool_Count_Event(ctx, &ctx->info.dropped_segments);
+        return S3_HLS_SPOOL_FULL;
+    }
+
+    while(ctx->index.record_bytes + size > ctx->max_size) {
+        if(S3_HLS_SPOOL_DROP_NEWEST == ctx->evict_order) {
+            SPOOL_DEBUG("Spool full, drop segment %s\n", object_key);
+            S3_HLS_Spool_Count_Event(ctx, &ctx->info.dropped_segments);
+            return S3_HLS_SPOOL_FULL;
+        }
+
+        SPOOL_DEBUG("Spool full, evict oldest segment!\n");
+        if(S3_HLS_OK != S3_HLS_Spool_Remove_Head(ctx))
+            break;
+
+        S3_HLS_Spool_Count_Event(ctx, &ctx->info.evicted_segments);
+    }
+
+    if(ctx->tail_fd < 0)
+        return S3_HLS_IO_ERROR;
+
+    if(ctx->index.tail_offset > 0 && (uint64_t)ctx->index.tail_offset + size > S3_HLS_SPOOL_FILE_SIZE) {
+        SPOOL_DEBUG("Roll to log file %u\n", ctx->index.tail_file + 1);
+        int fd = S3_HLS_Spool_Open_Log(ctx, ctx->index.tail_file + 1, O_RDWR | O_CREAT | O_TRUNC);
+        if(fd < 0)
+            return S3_HLS_IO_ERROR;
+
+        close(ctx->tail_fd);
+        ctx->tail_fd = fd;
+        ctx->index.tail_file++;
+        ctx->index.tail_offset = 0;
+    }
+
+    S3_HLS_SPOOL_RECORD record;
+    record.magic = S3_HLS_SPOOL_RECORD_MAGIC;
+    record.key_length = key_length;
+    record.payload_length = length;
+    record.checksum = 0;
+    record.timestamp = timestamp;
+    record.seq = seq;
+    record.checksum = S3_HLS_Spool_Checksum(&record, sizeof(S3_HLS_SPOOL_RECORD), S3_HLS_SPOOL_CHECKSUM_SEED);
+    record.checksum = S3_HLS_Spool_Checksum(object_key, key_length, record.checksum);
+
+    // block is shared with reads of head record
+    ctx->block_valid = 0;
+
+    uint32_t file_pos = ctx->index.tail_offset;
+    uint32_t fill = 0;
+    memcpy(ctx->block, &record, sizeof(S3_HLS_SPOOL_RECORD));
+    fill += sizeof(S3_HLS_SPOOL_RECORD);
+    memcpy(ctx->block + fill, object_key, key_length);
+    fill += key_length;
+
+    uint32_t pos = 0;
+    while(pos < length) {
+        uint8_t* span;
+        uint32_t span_length = read(source, pos, &span);
+        if(0 == span_length) {
+            SPOOL_DEBUG("Segment data ends at %u of %u!\n", pos, length);
+            return S3_HLS_UNKNOWN_INTERNAL_ERROR;
+        }
+
+        if(span_length > length - pos)
+            span_length = length - pos;
+
+        pos += span_length;
+        while(span_length > 0) {
+            uint32_t copy = S3_HLS_SPOOL_BLOCK_SIZE - fill < span_length ? S3_HLS_SPOOL_BLOCK_SIZE - fill : span_length;
+            memcpy(ctx->block + fill, span, copy);
+            fill += copy;
+            span += copy;
+            span_length -= copy;
+
+            if(S3_HLS_SPOOL_BLOCK_SIZE == fill) {
+                if(S3_HLS_OK != S3_HLS_Spool_Write_All(ctx->tail_fd, ctx->block, fill, file_pos))
+                    return S3_HLS_IO_ERROR;
+
+                file_pos += fill;
+                fill = 0;
+            }
+        }
+    }
+
+    // pad last write to alignment so next record starts at page boundary
+    uint32_t padded = ctx->index.tail_offset + size - file_pos;
+    if(padded > 0) {
+        memset(ctx->block + fill, 0, padded - fill);
+        if(S3_HLS_OK != S3_HLS_Spool_Write_All(ctx->tail_fd, ctx->block, padded, file_pos))
+            return S3_HLS_IO_ERROR;
+    }
+
+    if(0 != fdatasync(ctx->tail_fd))
+        return S3_HLS_IO_ERROR;
+
+    ctx->index.tail_offset += size;
+    ctx->index.record_count++;
+    ctx->index.record_bytes += size;
+
+    S3_HLS_Spool_Count_Event(ctx, &ctx->info.spooled_segments);
+    S3_HLS_Spool_Update_Info(ctx);
+
+    SPOOL_DEBUG("Spooled %s, %u bytes at %u:%u\n", object_key, length, ctx->index.tail_file, ctx->index.tail_offset - size);
+    return S3_HLS_Spool_Save_Index(ctx, 1);
+}
+
+int32_t S3_HLS_Spool_Peek(S3_HLS_SPOOL_CTX* ctx, char* key_buffer, uint64_t* seq, uint32_t* length) {
+    if(NULL == ctx || NULL == key_buffer || NULL == seq || NULL == length)
+        return S3_HLS_INVALID_PARAMETER;
+
+    int32_t ret = S3_HLS_Spool_Load_Head(ctx, key_buffer);
+    if(S3_HLS_OK != ret)
+        return ret;
+
+    *seq = ctx->head_record.seq;
+    *length = ctx->head_record.payload_length;
+    return S3_HLS_OK;
+}
+
+uint32_t S3_HLS_Spool_Read(void* source, uint32_t pos, uint8_t** span) {
+    S3_HLS_SPOOL_CTX* ctx = (S3_HLS_SPOOL_CTX*)source;
+    if(NULL == ctx || NULL == span || !ctx->head_record_valid || pos >= ctx->head_record.payload_length)
+        return 0;
+
+    uint32_t file_pos = ctx->index.head_offset + sizeof(S3_HLS_SPOOL_RECORD) + ctx->head_record.key_length + pos;
+    if(!ctx->block_valid || ctx->block_file != ctx->index.head_file || file_pos < ctx->block_offset || file_pos >= ctx->block_offset + ctx->block_length) {
+        ctx->block_offset = file_pos & ~(S3_HLS_SPOOL_ALIGNMENT - 1);
+        ssize_t read_length = pread(ctx->head_fd, ctx->block, S3_HLS_SPOOL_BLOCK_SIZE, ctx->block_offset);
+        if(read_length <= 0 || ctx->block_offset + read_length <= file_pos) {
+            SPOOL_DEBUG("Read spool failed at %u!\n", file_pos);
+            ctx->block_valid = 0;
+            return 0;
+        }
+
+        ctx->block_file = ctx->index.head_file;
+        ctx->block_length = read_length;
+        ctx->block_valid = 1;
+    }
+
+    uint32_t available = ctx->block_offset + ctx->block_length - file_pos;
+    uint32_t remaining = ctx->head_record.payload_length - pos;
+
+    *span = ctx->block + (file_pos - ctx->block_offset);
+    return available < remaining ? available : remaining;
+}
+
+int32_t S3_HLS_Spool_Remove(S3_HLS_SPOOL_CTX* ctx) {
+    if(NULL == ctx)
+        return S3_HLS_INVALID_PARAMETER;
+
+    int32_t ret = S3_HLS_Spool_Remove_Head(ctx);
+    if(S3_HLS_QUEUE_EMPTY != ret)
+        S3_HLS_Spool_Count_Event(ctx, &ctx->info.drained_segments);
+
+    return ret;
+}
+
+uint8_t S3_HLS_Spool_Is_Empty(S3_HLS_SPOOL_CTX* ctx) {
+    return NULL == ctx || 0 == ctx->index.record_count;
+}
+
+int32_t S3_HLS_Spool_Get_Info(S3_HLS_SPOOL_CTX* ctx, S3_HLS_SPOOL_INFO* info) {
+    if(NULL == ctx || NULL == info)
+        return S3_HLS_INVALID_PARAMETER;
+
+    pthread_mutex_lock(&ctx->info_lock);
+    *info = ctx->info;
+    pthread_mutex_unlock(&ctx->info_lock);
+
+    return S3_HLS_OK;
+}
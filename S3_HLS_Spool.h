@@ -0,0 +1,136 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: MIT-0
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify,
+ * merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __S3_HLS_SPOOL_H__
+#define __S3_HLS_SPOOL_H__
+
+#include "stdint.h"
+#include "time.h"
+#include "pthread.h"
+
+#include "S3_HLS_SDK.h"
+#include "S3_HLS_S3_Put_Client.h"
+
+#ifdef __cplusplus
+#if __cplusplus
+extern "C" {
+#endif
+#endif /* End of #ifdef __cplusplus */
+
+#define S3_HLS_SPOOL_ALIGNMENT          4096                // records start at page boundary of log file
+#define S3_HLS_SPOOL_BLOCK_SIZE         (64 * 1024)         // size of each write to log file
+#define S3_HLS_SPOOL_FILE_SIZE          (16 * 1024 * 1024)  // roll to next log file after this size
+#define S3_HLS_SPOOL_MAX_PATH_LENGTH    1024
+#define S3_HLS_SPOOL_MAX_DIR_LENGTH     (S3_HLS_SPOOL_MAX_PATH_LENGTH - 32)     // leave room for log file names
+
+/*
+ * Index file kept next to log files, points to first record not uploaded and end of last record written
+ */
+typedef struct s3_hls_spool_index_s {
+    uint32_t magic;
+    uint32_t head_file;
+    uint32_t head_offset;
+    uint32_t tail_file;
+    uint32_t tail_offset;
+    uint32_t record_count;
+    uint64_t record_bytes;
+    uint32_t reserved;
+    uint32_t checksum;
+} S3_HLS_SPOOL_INDEX;
+
+/*
+ * Header of each record in log file, followed by object key (including ending 0) and segment data
+ */
+typedef struct s3_hls_spool_record_s {
+    uint32_t magic;
+    uint32_t key_length;
+    uint32_t payload_length;
+    uint32_t checksum;          // of header and key
+    int64_t timestamp;
+    uint64_t seq;               // x-amz-meta-seq assigned when segment was flushed
+} S3_HLS_SPOOL_RECORD;
+
+typedef struct s3_hls_spool_s {
+    char directory[S3_HLS_SPOOL_MAX_DIR_LENGTH];
+    uint64_t max_size;
+    S3_HLS_SPOOL_EVICT_ORDER evict_order;
+
+    S3_HLS_SPOOL_INDEX index;
+    int index_fd;
+
+    int tail_fd;                // log file being appended
+    int head_fd;                // log file being drained
+    uint32_t head_fd_file;
+
+    S3_HLS_SPOOL_RECORD head_record;
+    uint8_t head_record_valid;
+
+    // staging block for writes, also caches reads of head record
+    uint8_t* block;
+    uint32_t block_file;
+    uint32_t block_offset;
+    uint32_t block_length;
+    uint8_t block_valid;
+
+    pthread_mutex_t info_lock;
+    S3_HLS_SPOOL_INFO info;
+} S3_HLS_SPOOL_CTX;
+
+/*
+ * Open or create spool in directory and recover records written before last exit
+ */
+S3_HLS_SPOOL_CTX* S3_HLS_Spool_Initialize(char* directory, uint64_t max_size, S3_HLS_SPOOL_EVICT_ORDER evict_order);
+
+/*
+ * Persist index and close files, records not uploaded stay on disk for next start
+ */
+int32_t S3_HLS_Spool_Finalize(S3_HLS_SPOOL_CTX* ctx);
+
+/*
+ * Append one segment read through call back to the end of spool
+ * Oldest records are removed or this segment is dropped when spool is full, depending on evict order
+ */
+int32_t S3_HLS_Spool_Write(S3_HLS_SPOOL_CTX* ctx, char* object_key, time_t timestamp, uint64_t seq, S3_HLS_CLIENT_READ_CALL_BACK read, void* source, uint32_t length);
+
+/*
+ * Get object key, seq and length of oldest record, returns S3_HLS_QUEUE_EMPTY if nothing is spooled
+ * key_buffer should be at least S3_HLS_MAX_KEY_LENGTH + 1 bytes
+ */
+int32_t S3_HLS_Spool_Peek(S3_HLS_SPOOL_CTX* ctx, char* key_buffer, uint64_t* seq, uint32_t* length);
+
+/*
+ * Read call back for data of oldest record, source is spool ctx
+ */
+uint32_t S3_HLS_Spool_Read(void* source, uint32_t pos, uint8_t** span);
+
+/*
+ * Remove oldest record after it is uploaded
+ */
+int32_t S3_HLS_Spool_Remove(S3_HLS_SPOOL_CTX* ctx);
+
+uint8_t S3_HLS_Spool_Is_Empty(S3_HLS_SPOOL_CTX* ctx);
+
+int32_t S3_HLS_Spool_Get_Info(S3_HLS_SPOOL_CTX* ctx, S3_HLS_SPOOL_INFO* info);
+
+#ifdef __cplusplus
+#if __cplusplus
+}
+#endif
+#endif /* End of #ifdef __cplusplus */
+
+#endif
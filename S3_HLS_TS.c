@@ -95,9 +95,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "S3_HLS_TS.h"
-#include "S3_HLS_Buffer_Mgr.h"
 #include "S3_HLS_Return_Code.h"
 
 #define S3_HLS_TS_PAYLOAD_START_POS         1
@@ -110,11 +110,22 @@
 
 #define S3_HLS_PCR_START_POS                6
 
+#define S3_HLS_TS_TEMPLATE_FLAGS_POS        3   // adoption flags of first packet
+#define S3_HLS_TS_TEMPLATE_PCR_POS          4
+#define S3_HLS_TS_TEMPLATE_SIZE             10
+
 #define S3_HLS_TS_PAYLOAD_START_FLAG    0x40
 #define S3_HLS_TS_PID_HEX_CODE          0x1FFF
 #define S3_HLS_TS_RANDOM_ACCESS_FLAG    0x40
 #define S3_HLS_TS_PCR_FLAG              0x10
 #define S3_HLS_TS_ADOPTION_FLAG         0x20
+#define S3_HLS_TS_NO_ADOPTION_FLAG      0x10
+
+#define S3_HLS_TS_HEADER_SIZE           4
+#define S3_HLS_TS_PAYLOAD_SIZE          (S3_HLS_TS_PACKET_SIZE - S3_HLS_TS_HEADER_SIZE)
+
+#define S3_HLS_TS_RANDOM_ACCESS_SIZE    2   // adoption length + adoption flags
+#define S3_HLS_TS_PCR_SIZE              8   // adoption length + adoption flags + pcr
 
 // #define S3_HLS_TS_DEBUG
 
@@ -124,205 +135,400 @@
 #define TS_DEBUG(x, ...)
 #endif
 
-uint8_t ts_header[12] = {   0x47, /* Start Code */
-                            0x00, /* 3 bit flags only 0x40 is used as payload start, other 5 bits are first 5 bits of PID */
-                            0x00, /* last 8 bits of pid 0x100 is video ,0x101 is audio */
-                            0x10, /* 0x30 has adoption field, 0x10 doesn't have aoption field, and last 4 bits are ts counter  */
-                            
-                            0x00, /* adoption length only exists when 4th bytes contains 0x20 flag */
-                            
-                            0x00, /* adoption flag fields only exists when 5th bytes >= 1 */
-                            
-                            0x00, 0x00, 0x00, 0x00, 0x00, 0x00 /* PCR field only exists when */
-                        }; // last 4 bytes are crc
-
-int8_t m_ts_video_counter = 0; 
-int8_t m_ts_audio_counter = 0; 
-
+// unaligned 16 bytes vector, compiled to SSE / NEON loads and stores
+typedef uint8_t S3_HLS_TS_VECTOR __attribute__((vector_size(16), aligned(1), may_alias));
 
 /*
- * Clear flags and prepare for next TS header
- * Call this function after write to buffer
+ * Walks frame items, PES header is read before first item
  */
-void S3_HLS_TS_Reset_Header_Info() {
-    ts_header[1] = 0;
-    ts_header[2] = 0;
-    ts_header[3] = 0x10;
-    ts_header[4] = 0;
-    ts_header[5] = 0;
-    ts_header[6] = 0;
-    ts_header[7] = 0;
-    ts_header[8] = 0;
-    ts_header[9] = 0;
-    ts_header[10] = 0;
-    ts_header[11] = 0;
+typedef struct s3_hls_ts_reader_s {
+    S3_HLS_TS_FRAME* frame;
+
+    uint8_t* span;              // current contiguous source
+    uint32_t span_length;
+
+    uint32_t item_index;
+    uint8_t item_part;          // S3_HLS_TS_ITEM_XXX read next
+    uint8_t in_prefix;          // span is item prefix of frame, not caller data
+    uint32_t skip;              // bytes of item replaced by prefix not skipped yet
+} S3_HLS_TS_READER;
+
+#define S3_HLS_TS_ITEM_PREFIX       0
+#define S3_HLS_TS_ITEM_FIRST_PART   1
+#define S3_HLS_TS_ITEM_SECOND_PART  2
+
+static int8_t* S3_HLS_TS_Counter(S3_HLS_TS_CTX* ctx, uint32_t pid) {
+    uint32_t program = (pid - S3_HLS_Video_PID) >> 4;
+    if(S3_HLS_Video_PID > pid || S3_HLS_MAX_PROGRAMS <= program)
+        return NULL;
+
+    if(S3_HLS_Program_Video_PID(program) == pid)
+        return &ctx->video_counters[program];
+
+    if(S3_HLS_Program_Audio_PID(program) == pid)
+        return &ctx->audio_counters[program];
+
+    return NULL;
 }
 
 /*
- * Call this function to write TS header and adoption field to buffer
+ * Move reader to next non empty part of frame items
  */
-int32_t S3_HLS_TS_Write_To_Buffer(S3_HLS_BUFFER_CTX* ctx) {
-    uint32_t ret = 0;
-    uint32_t pid = ts_header[S3_HLS_TS_PID_HIGH_POS] & 0x1F;
-    pid *= 256;
-    pid += ts_header[S3_HLS_TS_PID_LOW_POS];
-    
-    ts_header[S3_HLS_TS_COUNTER_INDEX] &= 0xF0;
-    switch(pid) {
-        case S3_HLS_Video_PID:
-            ts_header[S3_HLS_TS_COUNTER_INDEX] |= (m_ts_video_counter & 0x0F);
-            break;
-        case S3_HLS_Audio_PID:
-            ts_header[S3_HLS_TS_COUNTER_INDEX] |= (m_ts_audio_counter & 0x0F);
-            break;
-    }
+static void S3_HLS_TS_Next_Span(S3_HLS_TS_READER* reader) {
+    S3_HLS_TS_FRAME* frame = reader->frame;
 
-    // write to buffer
-    uint8_t* first_part_start = ts_header;
-    uint32_t first_part_length = 4;
-    
-    uint8_t* second_part_start = NULL;
-    uint32_t second_part_length = 0;
-    
-    if(ts_header[S3_HLS_TS_ADOPTION_FLAG_POS] & S3_HLS_TS_ADOPTION_FLAG) { // do have adoption field
-        first_part_length++; // adoption length field
-        if(ts_header[S3_HLS_TS_ADOPTION_LENGTH_POS] > 0) {
-            if(ts_header[S3_HLS_TS_PCR_FLAG_POS] & S3_HLS_TS_PCR_FLAG) {
-                first_part_length += 7; // adoption flags 1 + pcr 6
-            } else {
-                first_part_length += 1; // adoption flags 1
-            }
+    if(0 == reader->span_length)
+        reader->in_prefix = 0;
+
+    while(0 == reader->span_length && reader->item_index < frame->item_count) {
+        S3_HLS_FRAME_ITEM* item = &frame->items[reader->item_index];
+        uint8_t* start;
+        uint32_t length;
+
+        if(S3_HLS_TS_ITEM_PREFIX == reader->item_part) {
+            reader->item_part = S3_HLS_TS_ITEM_FIRST_PART;
+            if(NULL == frame->item_prefix)
+                continue;
+
+            reader->span = frame->item_prefix;
+            reader->span_length = frame->item_prefix_length;
+            reader->in_prefix = 1;
+            reader->skip = frame->item_prefix_length;
+            continue;
         }
-        
-        if(ts_header[S3_HLS_TS_ADOPTION_LENGTH_POS] > first_part_length - 5) {
-            // need to fill remaining fields
-            second_part_start = const_fill_word;
-            second_part_length = ts_header[S3_HLS_TS_ADOPTION_LENGTH_POS] - (first_part_length - 5);
+
+        if(S3_HLS_TS_ITEM_FIRST_PART == reader->item_part) {
+            start = item->first_part_start;
+            length = item->first_part_length;
+            reader->item_part = S3_HLS_TS_ITEM_SECOND_PART;
+        } else {
+            start = item->second_part_start;
+            length = item->second_part_length;
+            reader->item_part = S3_HLS_TS_ITEM_PREFIX;
+            reader->item_index++;
         }
-    } 
 
-    ret = S3_HLS_Put_To_Buffer(ctx, first_part_start, first_part_length);
-    if(0 > ret)
-        return ret;
-    
-    int32_t length = ret;
-    ret = S3_HLS_Put_To_Buffer(ctx, second_part_start, second_part_length);
-    if(0 > ret)
-        return ret;
-        
-    length += ret;
-    
-    S3_HLS_TS_Reset_Header_Info();
-    
-    switch(pid) {
-        case S3_HLS_Video_PID:
-            m_ts_video_counter++;
-            break;
-        case S3_HLS_Audio_PID:
-            m_ts_audio_counter++;
-            break;
+        uint32_t skip = reader->skip < length ? reader->skip : length;
+        reader->skip -= skip;
+        reader->span = start + skip;
+        reader->span_length = length - skip;
     }
-    
-    return  length;
+}
+
+static void S3_HLS_TS_Initialize_Reader(S3_HLS_TS_READER* reader, S3_HLS_TS_FRAME* frame) {
+    reader->frame = frame;
+    reader->span = frame->pes_header;
+    reader->span_length = frame->pes_header_length;
+    reader->item_index = 0;
+    reader->item_part = S3_HLS_TS_ITEM_PREFIX;
+    reader->in_prefix = 0;
+    reader->skip = 0;
+
+    S3_HLS_TS_Next_Span(reader);
 }
 
 /*
- * Call this function to set pid before write TS Header to buffer
+ * Copy payload of a full packet, 11 vectors and 8 bytes
  */
-void S3_HLS_TS_Set_Pid(uint32_t pid) {
-    ts_header[S3_HLS_TS_PID_HIGH_POS] |= (pid & S3_HLS_TS_PID_HEX_CODE) >> 8;
-    ts_header[S3_HLS_TS_PID_LOW_POS] = (pid & 0xFF);
+static inline void S3_HLS_TS_Copy_Packet_Payload(uint8_t* dest, const uint8_t* src) {
+    S3_HLS_TS_VECTOR* vector_dest = (S3_HLS_TS_VECTOR*)dest;
+    const S3_HLS_TS_VECTOR* vector_src = (const S3_HLS_TS_VECTOR*)src;
+
+    for(uint32_t cnt = 0; cnt < S3_HLS_TS_PAYLOAD_SIZE / sizeof(S3_HLS_TS_VECTOR); cnt++)
+        vector_dest[cnt] = vector_src[cnt];
+
+    uint64_t tail;
+    memcpy(&tail, src + S3_HLS_TS_PAYLOAD_SIZE - sizeof(tail), sizeof(tail));
+    memcpy(dest + S3_HLS_TS_PAYLOAD_SIZE - sizeof(tail), &tail, sizeof(tail));
 }
 
 /*
- * Call this function to set payload start flag before write TS Header to buffer
+ * Copy length bytes of frame to dest
  */
-void S3_HLS_TS_Set_Payload_Start() {
-    ts_header[S3_HLS_TS_PAYLOAD_START_POS] |= S3_HLS_TS_PAYLOAD_START_FLAG;
+static void S3_HLS_TS_Copy_Payload(S3_HLS_TS_READER* reader, uint8_t* dest, uint32_t length) {
+    while(length > 0) {
+        uint32_t copy_length = length < reader->span_length ? length : reader->span_length;
+        memcpy(dest, reader->span, copy_length);
+
+        dest += copy_length;
+        length -= copy_length;
+        reader->span += copy_length;
+        reader->span_length -= copy_length;
+
+        S3_HLS_TS_Next_Span(reader);
+    }
 }
 
 /*
- * Call this function to set random access flag before write TS Header to buffer
+ * Put length bytes of frame items into buffer as references
  */
-void S3_HLS_TS_Set_Random_Access() {
-    ts_header[S3_HLS_TS_ADOPTION_FLAG_POS] |= S3_HLS_TS_ADOPTION_FLAG; // random access need adoption part
-    ts_header[S3_HLS_TS_RANDOM_ACCESS_FLAG_POS] |= S3_HLS_TS_RANDOM_ACCESS_FLAG;
-    
-    if(ts_header[S3_HLS_TS_PCR_FLAG_POS] & S3_HLS_TS_PCR_FLAG) {
-        // also contains pcr
-        ts_header[S3_HLS_TS_ADOPTION_LENGTH_POS] = 7;
-    } else {
-        // no pcr
-        ts_header[S3_HLS_TS_ADOPTION_LENGTH_POS] = 1;
+static int32_t S3_HLS_TS_Put_Payload_Ref(S3_HLS_TS_READER* reader, S3_HLS_BUFFER_CTX* ctx, uint32_t length) {
+    int32_t ret;
+
+    while(length > 0) {
+        uint32_t put_length = length < reader->span_length ? length : reader->span_length;
+        if(reader->in_prefix) { // a few bytes, not worth a reference
+            ret = S3_HLS_Put_To_Buffer(ctx, reader->span, put_length);
+        } else {
+            ret = S3_HLS_Put_Ref_To_Buffer(ctx, reader->span, put_length);
+        }
+        if(0 > ret)
+            return ret;
+
+        length -= put_length;
+        reader->span += put_length;
+        reader->span_length -= put_length;
+
+        S3_HLS_TS_Next_Span(reader);
     }
+
+    return S3_HLS_OK;
 }
 
 /*
- * Call this function to set PCR flag and value before write TS Header to buffer
+ * Write TS header of one packet to dest, data_length is frame data not written yet
+ * Adoption field is stuffed when data left does not fill the packet
+ * Returns header length including adoption field
  */
-void S3_HLS_TS_Set_PCR(uint64_t input_timestamp) {
-    ts_header[S3_HLS_TS_ADOPTION_FLAG_POS] |= S3_HLS_TS_ADOPTION_FLAG;
-    ts_header[S3_HLS_TS_PCR_FLAG_POS] |= S3_HLS_TS_PCR_FLAG;
-    
-    ts_header[S3_HLS_TS_ADOPTION_LENGTH_POS] = 7;
-    
-    uint64_t timestamp = input_timestamp / 100 * 9; // convert nanosecond based timestamp to 90K signal
-    
-    ts_header[S3_HLS_PCR_START_POS] = ((timestamp >> 25) & 0xFF);
-    ts_header[S3_HLS_PCR_START_POS + 1] = ((timestamp >> 17) & 0xFF);
-    ts_header[S3_HLS_PCR_START_POS + 2] = ((timestamp >> 9) & 0xFF);
-    ts_header[S3_HLS_PCR_START_POS + 3] = ((timestamp >> 1) & 0xFF);
-    ts_header[S3_HLS_PCR_START_POS + 4] = (timestamp << 7) | 0x7E;
-    ts_header[S3_HLS_PCR_START_POS + 5] = 0;
+static uint32_t S3_HLS_TS_Build_Header(uint8_t* dest, const uint8_t* template, uint8_t first_packet, uint32_t data_length, uint8_t counter) {
+    uint8_t flags = 0;
+    uint32_t adoption_length = 0; // bytes after adoption length field
+    uint8_t has_adoption = 0;
+
+    dest[0] = template[0];
+    dest[S3_HLS_TS_PID_HIGH_POS] = template[S3_HLS_TS_PID_HIGH_POS];
+    dest[S3_HLS_TS_PID_LOW_POS] = template[S3_HLS_TS_PID_LOW_POS];
+
+    if(first_packet) {
+        dest[S3_HLS_TS_PAYLOAD_START_POS] |= S3_HLS_TS_PAYLOAD_START_FLAG;
+        flags = template[S3_HLS_TS_TEMPLATE_FLAGS_POS];
+        if(flags) {
+            has_adoption = 1;
+            adoption_length = (flags & S3_HLS_TS_PCR_FLAG) ? S3_HLS_TS_PCR_SIZE - 1 : S3_HLS_TS_RANDOM_ACCESS_SIZE - 1;
+        }
+    }
+
+    if(has_adoption) {
+        if(S3_HLS_TS_PAYLOAD_SIZE - 1 - adoption_length > data_length)
+            adoption_length = S3_HLS_TS_PAYLOAD_SIZE - 1 - data_length;
+    } else if(S3_HLS_TS_PAYLOAD_SIZE > data_length) {
+        has_adoption = 1;
+        adoption_length = S3_HLS_TS_PAYLOAD_SIZE - 1 - data_length; // may be 0 if only one byte to fill
+    }
+
+    if(!has_adoption) {
+        dest[S3_HLS_TS_ADOPTION_FLAG_POS] = S3_HLS_TS_NO_ADOPTION_FLAG | (counter & 0x0F);
+        return S3_HLS_TS_HEADER_SIZE;
+    }
+
+    dest[S3_HLS_TS_ADOPTION_FLAG_POS] = S3_HLS_TS_NO_ADOPTION_FLAG | S3_HLS_TS_ADOPTION_FLAG | (counter & 0x0F);
+    dest[S3_HLS_TS_ADOPTION_LENGTH_POS] = adoption_length;
+    if(0 == adoption_length)
+        return S3_HLS_TS_HEADER_SIZE + 1;
+
+    uint32_t length = S3_HLS_TS_HEADER_SIZE + 2;
+    dest[S3_HLS_TS_RANDOM_ACCESS_FLAG_POS] = flags;
+    if(flags & S3_HLS_TS_PCR_FLAG) {
+        memcpy(dest + S3_HLS_PCR_START_POS, template + S3_HLS_TS_TEMPLATE_PCR_POS, 6);
+        length += 6;
+    }
+
+    memset(dest + length, 0xFF, S3_HLS_TS_HEADER_SIZE + 1 + adoption_length - length); // stuffing
+    return S3_HLS_TS_HEADER_SIZE + 1 + adoption_length;
 }
 
 /*
- * Call this function to fill adoption fields if data_length is less than remaining bytes. 
- * Call this function before write TS Header to buffer and after set random access and pcr
+ * Header template of a frame, sync byte, pid, adoption flags of first packet and pcr
  */
-void S3_HLS_TS_Fill_Remaining_Length(uint32_t data_length) {
-    TS_DEBUG("Input Data Length:%d\n", data_length);
-    uint8_t length = 4; // base length
-    if(ts_header[S3_HLS_TS_ADOPTION_FLAG_POS] & S3_HLS_TS_ADOPTION_FLAG) {
-        TS_DEBUG("Has Adoption\n");
-        length ++; // do have adoption length field
-    }
-    
-    if(ts_header[S3_HLS_TS_ADOPTION_LENGTH_POS] > 0) {
-        TS_DEBUG("Adoption Length: %d\n", ts_header[S3_HLS_TS_ADOPTION_LENGTH_POS]);
-        length += ts_header[S3_HLS_TS_ADOPTION_LENGTH_POS]; // do have adoption length
+static void S3_HLS_TS_Build_Template(uint8_t* template, S3_HLS_TS_FRAME* frame) {
+    template[0] = 0x47;
+    template[S3_HLS_TS_PID_HIGH_POS] = (frame->pid & S3_HLS_TS_PID_HEX_CODE) >> 8;
+    template[S3_HLS_TS_PID_LOW_POS] = frame->pid & 0xFF;
+    template[S3_HLS_TS_TEMPLATE_FLAGS_POS] = 0;
+
+    if(frame->random_access)
+        template[S3_HLS_TS_TEMPLATE_FLAGS_POS] |= S3_HLS_TS_RANDOM_ACCESS_FLAG;
+
+    if(frame->has_pcr) {
+        template[S3_HLS_TS_TEMPLATE_FLAGS_POS] |= S3_HLS_TS_PCR_FLAG;
+
+        uint64_t timestamp = frame->pcr_timestamp / 100 * 9; // convert nanosecond based timestamp to 90K signal
+        uint8_t* pcr = template + S3_HLS_TS_TEMPLATE_PCR_POS;
+
+        pcr[0] = ((timestamp >> 25) & 0xFF);
+        pcr[1] = ((timestamp >> 17) & 0xFF);
+        pcr[2] = ((timestamp >> 9) & 0xFF);
+        pcr[3] = ((timestamp >> 1) & 0xFF);
+        pcr[4] = (timestamp << 7) | 0x7E;
+        pcr[5] = 0;
     }
-    
-    TS_DEBUG("Data + Header Length: %d\n", length + data_length);
-    if(S3_HLS_TS_PACKET_SIZE > length + data_length) {
-        // need to fill some part
-        uint8_t gap = S3_HLS_TS_PACKET_SIZE - length - data_length;
-        if(ts_header[S3_HLS_TS_ADOPTION_FLAG_POS] & S3_HLS_TS_ADOPTION_FLAG) {
-            // already contains an adoption length field
-            ts_header[S3_HLS_TS_ADOPTION_LENGTH_POS] += gap;
+}
+
+static uint32_t S3_HLS_TS_First_Payload_Size(S3_HLS_TS_FRAME* frame) {
+    if(frame->has_pcr)
+        return S3_HLS_TS_PAYLOAD_SIZE - S3_HLS_TS_PCR_SIZE;
+
+    if(frame->random_access)
+        return S3_HLS_TS_PAYLOAD_SIZE - S3_HLS_TS_RANDOM_ACCESS_SIZE;
+
+    return S3_HLS_TS_PAYLOAD_SIZE;
+}
+
+uint32_t S3_HLS_TS_Get_Packet_Count(S3_HLS_TS_FRAME* frame) {
+    uint32_t data_length = frame->pes_header_length + frame->content_length;
+    uint32_t first_payload = S3_HLS_TS_First_Payload_Size(frame);
+
+    if(data_length <= first_payload)
+        return 1;
+
+    return 1 + (data_length - first_payload + S3_HLS_TS_PAYLOAD_SIZE - 1) / S3_HLS_TS_PAYLOAD_SIZE;
+}
+
+/*
+ * Copy frame into room reserved once for all packets, packets are built in place
+ * Only a packet across end of a buffer that is not mirrored is built aside and copied in two parts
+ */
+static int32_t S3_HLS_TS_Write_Frame_Copy(S3_HLS_BUFFER_CTX* ctx, S3_HLS_TS_FRAME* frame, const uint8_t* template, int8_t* counter) {
+    uint32_t packet_count = S3_HLS_TS_Get_Packet_Count(frame);
+    uint32_t length = packet_count * S3_HLS_TS_PACKET_SIZE;
+
+    S3_HLS_BUFFER_SPAN span;
+    int32_t ret = S3_HLS_Reserve_Buffer(ctx, length, &span);
+    if(0 > ret)
+        return ret;
+
+    S3_HLS_TS_READER reader;
+    S3_HLS_TS_Initialize_Reader(&reader, frame);
+
+    uint32_t data_length = frame->pes_header_length + frame->content_length;
+    uint8_t packet[S3_HLS_TS_PACKET_SIZE];
+
+    for(uint32_t cnt = 0, offset = 0; cnt < packet_count; cnt++, offset += S3_HLS_TS_PACKET_SIZE) {
+        uint8_t* packet_start;
+        if(offset + S3_HLS_TS_PACKET_SIZE <= span.first_part_length) {
+            packet_start = span.first_part_start + offset;
+        } else if(offset >= span.first_part_length) {
+            packet_start = span.second_part_start + offset - span.first_part_length;
         } else {
-            // need add an adoption length
-            gap--; // due to need add adoption length so minus 1
-            ts_header[S3_HLS_TS_ADOPTION_FLAG_POS] |= S3_HLS_TS_ADOPTION_FLAG;
-            ts_header[S3_HLS_TS_ADOPTION_LENGTH_POS] = gap;
-            if(gap > 0) {
-                ts_header[S3_HLS_TS_RANDOM_ACCESS_FLAG_POS] = 0; // mark as no flags
+            packet_start = packet; // across buffer end
+        }
+
+        if(0 < cnt && S3_HLS_TS_PAYLOAD_SIZE <= data_length && packet != packet_start) { // full packet in the middle, header is template with counter
+            packet_start[0] = template[0];
+            packet_start[S3_HLS_TS_PID_HIGH_POS] = template[S3_HLS_TS_PID_HIGH_POS];
+            packet_start[S3_HLS_TS_PID_LOW_POS] = template[S3_HLS_TS_PID_LOW_POS];
+            packet_start[S3_HLS_TS_ADOPTION_FLAG_POS] = S3_HLS_TS_NO_ADOPTION_FLAG | ((*counter + cnt) & 0x0F);
+
+            if(reader.span_length > S3_HLS_TS_PAYLOAD_SIZE) {
+                S3_HLS_TS_Copy_Packet_Payload(packet_start + S3_HLS_TS_HEADER_SIZE, reader.span);
+                reader.span += S3_HLS_TS_PAYLOAD_SIZE;
+                reader.span_length -= S3_HLS_TS_PAYLOAD_SIZE;
+            } else {
+                S3_HLS_TS_Copy_Payload(&reader, packet_start + S3_HLS_TS_HEADER_SIZE, S3_HLS_TS_PAYLOAD_SIZE);
             }
+
+            data_length -= S3_HLS_TS_PAYLOAD_SIZE;
+            continue;
+        }
+
+        uint32_t header_length = S3_HLS_TS_Build_Header(packet_start, template, 0 == cnt, data_length, *counter + cnt);
+        uint32_t payload_length = S3_HLS_TS_PACKET_SIZE - header_length;
+        S3_HLS_TS_Copy_Payload(&reader, packet_start + header_length, payload_length);
+        data_length -= payload_length;
+
+        if(packet == packet_start) {
+            uint32_t first_length = span.first_part_length - offset;
+            memcpy(span.first_part_start + offset, packet, first_length);
+            memcpy(span.second_part_start, packet + first_length, S3_HLS_TS_PACKET_SIZE - first_length);
         }
     }
+
+    *counter = (*counter + packet_count) & 0x0F;
+
+    S3_HLS_Commit_Buffer(ctx, length);
+
+    return S3_HLS_OK;
+}
+
+/*
+ * Copy TS headers and PES header into buffer, keep reference of frame data
+ */
+static int32_t S3_HLS_TS_Write_Frame_Ref(S3_HLS_BUFFER_CTX* ctx, S3_HLS_TS_FRAME* frame, const uint8_t* template, int8_t* counter) {
+    int32_t ret;
+    uint32_t packet_count = S3_HLS_TS_Get_Packet_Count(frame);
+
+    S3_HLS_TS_READER reader;
+    S3_HLS_TS_Initialize_Reader(&reader, frame);
+
+    uint32_t data_length = frame->pes_header_length + frame->content_length;
+    uint8_t header[S3_HLS_TS_PACKET_SIZE];
+
+    for(uint32_t cnt = 0; cnt < packet_count; cnt++) {
+        uint32_t header_length = S3_HLS_TS_Build_Header(header, template, 0 == cnt, data_length, *counter + cnt);
+        uint32_t payload_length = S3_HLS_TS_PACKET_SIZE - header_length;
+        if(0 == cnt) { // PES header is small, copy it with TS header
+            S3_HLS_TS_Copy_Payload(&reader, header + header_length, frame->pes_header_length);
+            header_length += frame->pes_header_length;
+        }
+
+        ret = S3_HLS_Put_To_Buffer(ctx, header, header_length);
+        if(0 > ret)
+            return ret;
+
+        ret = S3_HLS_TS_Put_Payload_Ref(&reader, ctx, S3_HLS_TS_PACKET_SIZE - header_length);
+        if(0 > ret)
+            return ret;
+
+        data_length -= payload_length;
+    }
+
+    *counter = (*counter + packet_count) & 0x0F;
+
+    return S3_HLS_OK;
+}
+
+/*
+ * Write PES header and frame items as TS packets
+ */
+int32_t S3_HLS_TS_Write_Frame(S3_HLS_TS_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, S3_HLS_TS_FRAME* frame, uint8_t by_reference) {
+    if(NULL == ctx || NULL == buffer_ctx || NULL == frame)
+        return S3_HLS_INVALID_PARAMETER;
+
+    int8_t* counter = S3_HLS_TS_Counter(ctx, frame->pid);
+    if(NULL == counter)
+        return S3_HLS_INVALID_PARAMETER;
+
+    uint8_t template[S3_HLS_TS_TEMPLATE_SIZE];
+    S3_HLS_TS_Build_Template(template, frame);
+
+    TS_DEBUG("Write Frame Pid: %d Length: %d Packets: %d\n", frame->pid, frame->content_length, S3_HLS_TS_Get_Packet_Count(frame));
+    if(by_reference)
+        return S3_HLS_TS_Write_Frame_Ref(buffer_ctx, frame, template, counter);
+
+    return S3_HLS_TS_Write_Frame_Copy(buffer_ctx, frame, template, counter);
 }
 
 /*
  * Call this function to reset the counter field in ts header
  * need to think about mapping for different PID
  */
-void S3_HLS_TS_Reset_Counter(uint32_t pid) {
-    switch(pid) {
-        case S3_HLS_Video_PID:
-            m_ts_video_counter = 0;
-            break;
-        case S3_HLS_Audio_PID:
-            m_ts_audio_counter = 0;
-            break;
-    }
-}
\ No newline at end of file
+void S3_HLS_TS_Reset_Counter(S3_HLS_TS_CTX* ctx, uint32_t pid) {
+    int8_t* counter = S3_HLS_TS_Counter(ctx, pid);
+    if(NULL != counter)
+        *counter = 0;
+}
+
+/*
+ * Call these functions to save and restore the counter field of given pid when packets are taken back from buffer
+ */
+int8_t S3_HLS_TS_Get_Counter(S3_HLS_TS_CTX* ctx, uint32_t pid) {
+    int8_t* counter = S3_HLS_TS_Counter(ctx, pid);
+
+    return NULL == counter ? 0 : *counter;
+}
+
+void S3_HLS_TS_Set_Counter(S3_HLS_TS_CTX* ctx, uint32_t pid, int8_t counter) {
+    int8_t* ts_counter = S3_HLS_TS_Counter(ctx, pid);
+    if(NULL != ts_counter)
+        *ts_counter = counter;
+}
@@ -16,52 +16,71 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
-#ifndef __S3_HLS_H264_PMT_H__
-#define __S3_HLS_H264_PMT_H__
+#ifndef __S3_HLS_TS_H__
+#define __S3_HLS_TS_H__
 
 #include "stdint.h"
 
+#include "S3_HLS_SDK.h"
+#include "S3_HLS_Buffer_Mgr.h"
+
 #ifdef __cplusplus
 #if __cplusplus
 extern "C" {
 #endif
 #endif /* End of #ifdef __cplusplus */
 
-/*
- * Call this function to write TS header and adoption field to buffer
- */
-int32_t S3_HLS_TS_Write_To_Buffer();
+typedef struct s3_hls_ts_frame_s {
+    uint32_t pid;
+    uint8_t random_access;
+    uint8_t has_pcr;
+    uint64_t pcr_timestamp;
 
-/*
- * Call this function to set pid before write TS Header to buffer
- */
-void S3_HLS_TS_Set_Pid(uint32_t pid);
+    // written at start of first packet, before frame items
+    uint8_t* pes_header;
+    uint32_t pes_header_length;
+
+    S3_HLS_FRAME_ITEM* items;
+    uint32_t item_count;
+    uint32_t content_length;        // length of all items
+
+    // when set, written in place of the first item_prefix_length bytes of each item, e.g. start code over NALU length
+    uint8_t* item_prefix;
+    uint32_t item_prefix_length;
+} S3_HLS_TS_FRAME;
 
 /*
- * Call this function to set payload start flag before write TS Header to buffer
+ * Continuity counters of video and audio PIDs of one muxer, zero filled context is ready to use
  */
-void S3_HLS_TS_Set_Payload_Start();
+typedef struct s3_hls_ts_s {
+    int8_t video_counters[S3_HLS_MAX_PROGRAMS];
+    int8_t audio_counters[S3_HLS_MAX_PROGRAMS];
+} S3_HLS_TS_CTX;
 
 /*
- * Call this function to set random access flag before write TS Header to buffer
+ * Number of TS packets needed for PES header and frame items
  */
-void S3_HLS_TS_Set_Random_Access();
+uint32_t S3_HLS_TS_Get_Packet_Count(S3_HLS_TS_FRAME* frame);
 
 /*
- * Call this function to set PCR flag and value before write TS Header to buffer
+ * Call this function to write PES header and frame items as TS packets
+ * When not by reference, room for all packets is reserved once and packets are built in place
+ * When by reference, only TS and PES headers are copied and frame items are referenced
+ * Continuity counter of pid is updated, partially written frame should be rolled back by caller
  */
-void S3_HLS_TS_Set_PCR(uint64_t input_timestamp);
+int32_t S3_HLS_TS_Write_Frame(S3_HLS_TS_CTX* ctx, S3_HLS_BUFFER_CTX* buffer_ctx, S3_HLS_TS_FRAME* frame, uint8_t by_reference);
 
 /*
- * Call this function to fill adoption fields if data_length is less than remaining bytes. 
- * Call this function before write TS Header to buffer and after set random access and pcr
+ * Call this function to reset the counter field in ts header
  */
-void S3_HLS_TS_Fill_Remaining_Length(uint32_t data_length);
+void S3_HLS_TS_Reset_Counter(S3_HLS_TS_CTX* ctx, uint32_t pid);
 
 /*
- * Call this function to reset the counter field in ts header
+ * Call these functions to save and restore the counter field of given pid when packets are taken back from buffer
  */
-void S3_HLS_TS_Reset_Counter(uint32_t pid);
+int8_t S3_HLS_TS_Get_Counter(S3_HLS_TS_CTX* ctx, uint32_t pid);
+
+void S3_HLS_TS_Set_Counter(S3_HLS_TS_CTX* ctx, uint32_t pid, int8_t counter);
 
 #ifdef __cplusplus
 #if __cplusplus
@@ -21,6 +21,7 @@
 #include <string.h>
 
 #include "S3_HLS_Upload_Thread.h"
+#include "S3_HLS_Memory.h"
 #include "S3_HLS_Return_Code.h"
 
 //#define S3_HLS_THREAD_DEBUG
@@ -42,7 +43,7 @@ static void S3_HLS_Thread_Loop(void* ctx) {
     S3_HLS_THREAD_CTX* thread_ctx = (S3_HLS_THREAD_CTX*)ctx;
     while(!thread_ctx->exit_flag) {
         THREAD_DEBUG("Thread Run!\n");
-        if (thread_ctx->run()) { //*by xxlang
+        if (thread_ctx->run(thread_ctx->user_data)) { //*by xxlang
             THREAD_DEBUG("Thread Quit!\n");
             break;
         }
@@ -52,12 +53,12 @@ static void S3_HLS_Thread_Loop(void* ctx) {
 /*
  * Initialize resources and create thread context but not start the thread
  */
-S3_HLS_THREAD_CTX* S3_HLS_Upload_Thread_Initialize(THREAD_RUN call_back) {
+S3_HLS_THREAD_CTX* S3_HLS_Upload_Thread_Initialize(THREAD_RUN call_back, void* user_data) {
     if(NULL == call_back)
         return NULL;
         
     THREAD_DEBUG("Creating thread context!\n");
-    S3_HLS_THREAD_CTX* ctx = (S3_HLS_THREAD_CTX*)malloc(sizeof(S3_HLS_THREAD_CTX));
+    S3_HLS_THREAD_CTX* ctx = (S3_HLS_THREAD_CTX*)S3_HLS_Malloc(sizeof(S3_HLS_THREAD_CTX));
     if(NULL == ctx) {
         THREAD_DEBUG("Allocate memory for thread context failed!\n");
         return NULL;
@@ -65,6 +66,7 @@ S3_HLS_THREAD_CTX* S3_HLS_Upload_Thread_Initialize(THREAD_RUN call_back) {
         
     ctx->exit_flag = 0;
     ctx->run = call_back;
+    ctx->user_data = user_data;
     
     THREAD_DEBUG("Creating thread context finished!\n");
 	return ctx;
@@ -80,7 +82,7 @@ int32_t S3_HLS_Upload_Thread_Start(S3_HLS_THREAD_CTX* ctx) {
     THREAD_DEBUG("Starting thread!\n");
     int32_t ret = pthread_create(&ctx->thread_id, NULL, (void*)S3_HLS_Thread_Loop, ctx);
 	if(0 != ret) {
-	    free(ctx);
+	    S3_HLS_Free(ctx);
         return S3_HLS_UNKNOWN_INTERNAL_ERROR;
 	}
 
@@ -104,7 +106,7 @@ int32_t S3_HLS_Upload_Thread_Stop(S3_HLS_THREAD_CTX* ctx) {
 
     pthread_join(ctx->thread_id, NULL);
     
-    free(ctx);
+    S3_HLS_Free(ctx);
     
     return S3_HLS_OK;
 }
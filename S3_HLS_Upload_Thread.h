@@ -28,19 +28,20 @@ extern "C" {
 #endif
 #endif /* End of #ifdef __cplusplus */
 
-typedef int (*THREAD_RUN)();
+typedef int (*THREAD_RUN)(void* user_data);
 
 typedef struct s3_hls_thread_s {
     pthread_t thread_id;
     uint8_t exit_flag;
 
     THREAD_RUN run;
+    void* user_data;
 } S3_HLS_THREAD_CTX;
 
 /*
  * Initialize resources and create thread context but not start the thread
  */
-S3_HLS_THREAD_CTX* S3_HLS_Upload_Thread_Initialize(THREAD_RUN call_back);
+S3_HLS_THREAD_CTX* S3_HLS_Upload_Thread_Initialize(THREAD_RUN call_back, void* user_data);
 
 /*
  * Start thread in given thread ctx
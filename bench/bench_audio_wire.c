@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "S3_HLS_Buffer_Mgr.h"
+#include "S3_HLS_Pes.h"
+#include "S3_HLS_Return_Code.h"
+
+#define RING_SIZE       (8 * 1024 * 1024)
+#define DURATION_S      60
+#define VIDEO_GAP_US    40000   // 25 fps
+#define GOP_SIZE        50
+#define IDR_SIZE        (60 * 1024)
+#define P_SIZE          (6 * 1024)
+#define AAC_SIZE        200     // AAC LC 48 kHz mono at about 64 kbps
+#define AAC_GAP_US      21333   // 1024 samples
+
+static S3_HLS_BUFFER_CTX* buffer_ctx;
+
+static uint8_t sps[] = { 0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x1f, 0xac, 0xd9, 0x40, 0x50, 0x05, 0xbb, 0x01, 0x10, 0x00, 0x00, 0x03, 0x00, 0x10, 0x00, 0x00, 0x03, 0x03, 0xc0, 0xf1, 0x83, 0x19, 0x60 };
+static uint8_t pps[] = { 0x00, 0x00, 0x00, 0x01, 0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc0 };
+
+// bytes are counted by muxer, parts are released as soon as they are flushed
+static void on_part(S3_HLS_BUFFER_PART_CTX* part, void* user_data) {
+    S3_HLS_Clear_Buffer(buffer_ctx, part);
+}
+
+static void put_video(S3_HLS_PES_CTX* pes_ctx, uint8_t* video, uint32_t frame) {
+    uint8_t idr = (0 == frame % GOP_SIZE);
+    video[4] = idr ? 0x65 : 0x41;
+
+    S3_HLS_FRAME_PACK pack;
+    memset(&pack, 0, sizeof(pack));
+    if(idr) {
+        pack.items[0].first_part_start = sps;
+        pack.items[0].first_part_length = sizeof(sps);
+        pack.items[1].first_part_start = pps;
+        pack.items[1].first_part_length = sizeof(pps);
+        pack.item_count = 2;
+    }
+
+    pack.items[pack.item_count].first_part_start = video;
+    pack.items[pack.item_count].first_part_length = idr ? IDR_SIZE : P_SIZE;
+    pack.item_count++;
+
+    for(uint32_t cnt = 0; cnt < pack.item_count; cnt++)
+        pack.items[cnt].timestamp = (uint64_t)frame * VIDEO_GAP_US;
+
+    S3_HLS_Pes_Write_Video_Frame(pes_ctx, buffer_ctx, 0, &pack);
+}
+
+static void put_audio(S3_HLS_PES_CTX* pes_ctx, uint8_t* audio, uint32_t frame) {
+    S3_HLS_FRAME_PACK pack;
+    memset(&pack, 0, sizeof(pack));
+    pack.item_count = 1;
+    pack.items[0].first_part_start = audio;
+    pack.items[0].first_part_length = AAC_SIZE;
+    pack.items[0].timestamp = (uint64_t)frame * AAC_GAP_US;
+
+    S3_HLS_Pes_Write_Audio_Frame(pes_ctx, buffer_ctx, 0, &pack);
+}
+
+/*
+ * Mux DURATION_S of 25 fps video, with or without 48 kHz AAC interleaved, and return bytes muxer wrote
+ */
+static uint64_t mux(uint8_t* video, uint8_t* audio, uint8_t with_audio, uint32_t aggregation_ms, uint64_t* audio_bytes) {
+    S3_HLS_PES_CTX pes_ctx;
+    memset(&pes_ctx, 0, sizeof(pes_ctx));
+    S3_HLS_Pes_Initialize(&pes_ctx);
+    if(S3_HLS_OK != S3_HLS_Pes_Allocate_Programs(&pes_ctx))
+        return 0;
+
+    S3_HLS_Pes_Set_Audio_Aggregation(&pes_ctx, aggregation_ms);
+
+    buffer_ctx = S3_HLS_Initialize_Buffer(RING_SIZE, on_part, NULL);
+    if(NULL == buffer_ctx)
+        return 0;
+
+    uint32_t video_frame = 0;
+    uint32_t audio_frame = 0;
+    *audio_bytes = 0;
+    while((uint64_t)video_frame * VIDEO_GAP_US < (uint64_t)DURATION_S * 1000000) {
+        if(with_audio && (uint64_t)audio_frame * AAC_GAP_US < (uint64_t)video_frame * VIDEO_GAP_US) {
+            put_audio(&pes_ctx, audio, audio_frame++);
+            *audio_bytes += AAC_SIZE;
+        } else {
+            put_video(&pes_ctx, video, video_frame++);
+        }
+    }
+
+    S3_HLS_Pes_Flush(&pes_ctx, buffer_ctx);
+
+    S3_HLS_MUX_INFO info;
+    S3_HLS_Pes_Get_Mux_Info(&pes_ctx, buffer_ctx, &info);
+
+    S3_HLS_Finalize_Buffer(buffer_ctx);
+    S3_HLS_Pes_Free_Programs(&pes_ctx);
+    return info.total_bytes;
+}
+
+/*
+ * Usage: bench_audio_wire [aggregation ms]
+ * Bytes on the wire per second of audio, taken as difference between video with and without audio, default aggregation 100 ms
+ * SDK debug output goes to stdout, results to stderr
+ */
+int main(int argc, char* argv[]) {
+    uint32_t aggregation_ms = 1 < argc ? atoi(argv[1]) : 100;
+
+    uint8_t* video = malloc(IDR_SIZE);
+    uint8_t* audio = malloc(AAC_SIZE);
+    if(NULL == video || NULL == audio)
+        return 1;
+
+    for(uint32_t cnt = 0; cnt < IDR_SIZE; cnt++)
+        video[cnt] = (uint8_t)(cnt * 13 + 5) | 0x04; // no start code emulation
+
+    video[0] = video[1] = video[2] = 0x00;
+    video[3] = 0x01;
+
+    // ADTS header, AAC LC 48 kHz mono
+    memset(audio, 0x5a, AAC_SIZE);
+    audio[0] = 0xff;
+    audio[1] = 0xf1;
+    audio[2] = 0x4c;
+    audio[3] = 0x40;
+    audio[4] = (AAC_SIZE >> 3) & 0xff;
+    audio[5] = ((AAC_SIZE & 0x07) << 5) | 0x1f;
+    audio[6] = 0xfc;
+
+    uint64_t audio_bytes;
+    uint64_t video_only = mux(video, audio, 0, aggregation_ms, &audio_bytes);
+    uint64_t with_audio = mux(video, audio, 1, aggregation_ms, &audio_bytes);
+    if(0 == video_only || with_audio < video_only)
+        return 1;
+
+    uint64_t wire_bytes = with_audio - video_only;
+    fprintf(stderr, "aggregation %u ms: %llu audio bytes per second take %llu bytes per second on the wire (%.2fx)\n",
+        aggregation_ms, (unsigned long long)(audio_bytes / DURATION_S), (unsigned long long)(wire_bytes / DURATION_S), (double)wire_bytes / audio_bytes);
+
+    free(audio);
+    free(video);
+    return 0;
+}
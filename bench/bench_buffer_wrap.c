@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "S3_Crypto.h"
+#include "S3_HLS_Buffer_Mgr.h"
+#include "S3_HLS_Memory.h"
+#include "S3_HLS_Return_Code.h"
+
+// wrap heavy workload: parts of about half the ring, so most of them straddle its end
+#define RING_SIZE       (64 * 1024)
+#define PART_SIZE       (30 * 1024)
+#define TOTAL_BYTES     (2048ULL * 1024 * 1024)
+
+static S3_HLS_BUFFER_CTX* buffer_ctx;
+
+static uint64_t part_count = 0;
+static uint64_t wrapped_parts = 0;
+static uint64_t hash_ns = 0;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// same work as upload thread, hash part span by span then release it
+static void on_part(S3_HLS_BUFFER_PART_CTX* part, void* user_data) {
+    uint64_t start = now_ns();
+
+    S3_SHA256_CTX sha256_ctx;
+    S3_SHA256_HASH hash;
+    S3_SHA256_Init(&sha256_ctx);
+
+    S3_HLS_BUFFER_READER reader;
+    S3_HLS_Initialize_Reader(&reader, buffer_ctx, part);
+
+    uint32_t length = S3_HLS_Get_Part_Length(part);
+    uint32_t pos = 0;
+    while(pos < length) {
+        uint8_t* span;
+        uint32_t span_length = S3_HLS_Read_Part(&reader, pos, &span);
+        if(0 == span_length)
+            break;
+
+        S3_SHA256_Update(&sha256_ctx, span, span_length);
+        pos += span_length;
+    }
+
+    S3_SHA256_Final(&sha256_ctx, hash);
+
+    part_count++;
+    if(0 < part->second_part_length)
+        wrapped_parts++;
+
+    hash_ns += now_ns() - start;
+
+    S3_HLS_Clear_Buffer(buffer_ctx, part);
+}
+
+static void* pass_malloc(size_t size) {
+    return malloc(size);
+}
+
+static void* pass_realloc(void* ptr, size_t size) {
+    return realloc(ptr, size);
+}
+
+static void pass_free(void* ptr) {
+    free(ptr);
+}
+
+static int run(int mirror) {
+    // ring is only mirrored with the default allocator, a pass through allocator gives the malloc ring
+    if(!mirror)
+        S3_HLS_Memory_Set_Allocator(pass_malloc, pass_realloc, pass_free);
+
+    buffer_ctx = S3_HLS_Initialize_Buffer(RING_SIZE, on_part, NULL);
+    if(NULL == buffer_ctx || (mirror && !buffer_ctx->mirrored)) {
+        fprintf(stderr, "initialize %s buffer failed\n", mirror ? "mirror" : "malloc");
+        return -1;
+    }
+
+    // TS packet multiples of odd sizes, writes hit the ring end at every offset
+    uint8_t packets[188 * 16];
+    for(uint32_t cnt = 0; cnt < sizeof(packets); cnt++)
+        packets[cnt] = (uint8_t)(cnt * 31 + 7);
+
+    part_count = wrapped_parts = hash_ns = 0;
+
+    uint64_t written = 0;
+    uint32_t step = 0;
+    uint64_t start = now_ns();
+    while(written < TOTAL_BYTES) {
+        uint32_t length = 188 * (1 + step++ % 16);
+        if(S3_HLS_OK > S3_HLS_Put_To_Buffer(buffer_ctx, packets, length)) {
+            fprintf(stderr, "put failed\n");
+            return -1;
+        }
+
+        written += length;
+
+        if(PART_SIZE <= S3_HLS_Get_Pending_Length(buffer_ctx))
+            S3_HLS_Flush_Buffer(buffer_ctx);
+    }
+    uint64_t total_ns = now_ns() - start;
+
+    fprintf(stderr, "%-6s ring %d KB part %d KB: %.0f MB/s, write %.1f ms/GB, hash and release %.1f ms/GB, %llu of %llu parts wrapped\n",
+        mirror ? "mirror" : "malloc", RING_SIZE / 1024, PART_SIZE / 1024,
+        written / 1048576.0 / (total_ns / 1e9),
+        (total_ns - hash_ns) / 1e6 / (written / 1073741824.0),
+        hash_ns / 1e6 / (written / 1073741824.0),
+        (unsigned long long)wrapped_parts, (unsigned long long)part_count);
+
+    S3_HLS_Finalize_Buffer(buffer_ctx);
+    return 0;
+}
+
+/*
+ * Usage: bench_buffer_wrap [mirror|malloc]
+ * SDK debug output goes to stdout, results to stderr
+ */
+int main(int argc, char* argv[]) {
+    int mirror = !(1 < argc && 0 == strcmp(argv[1], "malloc"));
+    return 0 == run(mirror) ? 0 : 1;
+}
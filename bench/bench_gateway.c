@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "S3_HLS_SDK.h"
+#include "S3_HLS_Return_Code.h"
+
+#define RING_SIZE       (1024 * 1024)
+#define FRAME_GAP_US    40000   // 25 fps
+#define GOP_SIZE        25      // 1 s segments
+#define IDR_SIZE        20000   // frame sizes are scaled by 1 to 4 per stream, 544 to 2176 kbps
+#define P_SIZE          2000
+#define PREFIX_SIZE     16
+
+typedef struct bench_stream_s {
+    S3_HLS_SDK_CTX* sdk;
+    uint32_t scale;
+    char prefix[PREFIX_SIZE];
+} BENCH_STREAM;
+
+static uint8_t sps[] = { 0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x1f, 0xac, 0xd9, 0x40, 0x50, 0x05, 0xbb, 0x01, 0x10, 0x00, 0x00, 0x03, 0x00, 0x10, 0x00, 0x00, 0x03, 0x03, 0xc0, 0xf1, 0x83, 0x19, 0x60 };
+static uint8_t pps[] = { 0x00, 0x00, 0x00, 0x01, 0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc0 };
+
+static uint32_t seconds = 10;
+static uint64_t start_timestamp;
+
+// SDK heap, counted by allocator given to SDK, size is kept in front of each block
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t heap_live = 0;
+static size_t heap_peak = 0;
+
+static void* count_malloc(size_t size) {
+    size_t* block = malloc(size + 2 * sizeof(size_t));
+    if(NULL == block)
+        return NULL;
+
+    block[0] = size;
+
+    pthread_mutex_lock(&heap_lock);
+    heap_live += size;
+    if(heap_live > heap_peak)
+        heap_peak = heap_live;
+    pthread_mutex_unlock(&heap_lock);
+
+    return block + 2;
+}
+
+static void count_free(void* ptr) {
+    if(NULL == ptr)
+        return;
+
+    size_t* block = (size_t*)ptr - 2;
+
+    pthread_mutex_lock(&heap_lock);
+    heap_live -= block[0];
+    pthread_mutex_unlock(&heap_lock);
+
+    free(block);
+}
+
+static void* count_realloc(void* ptr, size_t size) {
+    if(NULL == ptr)
+        return count_malloc(size);
+
+    size_t old_size = ((size_t*)ptr - 2)[0];
+    void* new_ptr = count_malloc(size);
+    if(NULL == new_ptr)
+        return NULL;
+
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    count_free(ptr);
+    return new_ptr;
+}
+
+static size_t heap_read(size_t* peak) {
+    pthread_mutex_lock(&heap_lock);
+    size_t live = heap_live;
+    if(NULL != peak)
+        *peak = heap_peak;
+    pthread_mutex_unlock(&heap_lock);
+
+    return live;
+}
+
+static uint32_t count_threads() {
+    uint32_t count = 0;
+    DIR* dir = opendir("/proc/self/task");
+    if(NULL == dir)
+        return 0;
+
+    struct dirent* entry;
+    while(NULL != (entry = readdir(dir))) {
+        if('.' != entry->d_name[0])
+            count++;
+    }
+
+    closedir(dir);
+    return count;
+}
+
+/*
+ * Established connections to port, the local server only talks to this process
+ */
+static uint32_t count_connections(uint32_t port) {
+    const char* tables[] = { "/proc/net/tcp", "/proc/net/tcp6" };
+    uint32_t count = 0;
+
+    for(uint32_t table = 0; table < sizeof(tables) / sizeof(tables[0]); table++) {
+        FILE* file = fopen(tables[table], "r");
+        if(NULL == file)
+            continue;
+
+        char line[512];
+        while(NULL != fgets(line, sizeof(line), file)) {
+            char local[64], remote[64];
+            unsigned int state;
+            if(3 != sscanf(line, "%*d: %63s %63s %x", local, remote, &state))
+                continue;
+
+            char* remote_port = strrchr(remote, ':');
+            if(0x01 == state && NULL != remote_port && port == strtoul(remote_port + 1, NULL, 16))
+                count++;
+        }
+
+        fclose(file);
+    }
+
+    return count;
+}
+
+// KB of SDK heap per stream beyond its ring
+static long long heap_per_stream(size_t heap, size_t base_heap, uint32_t stream_count) {
+    return ((long long)(heap - base_heap) / stream_count - RING_SIZE) / 1024;
+}
+
+static double cpu_seconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static void* produce(void* arg) {
+    BENCH_STREAM* stream = (BENCH_STREAM*)arg;
+    uint32_t max_size = IDR_SIZE * stream->scale;
+    uint8_t* video = malloc(max_size);
+    if(NULL == video)
+        return NULL;
+
+    for(uint32_t cnt = 0; cnt < max_size; cnt++)
+        video[cnt] = (uint8_t)(cnt * 13 + 5) | 0x04; // no start code emulation
+
+    video[0] = video[1] = video[2] = 0x00;
+    video[3] = 0x01;
+
+    for(uint32_t frame = 0; frame < seconds * 1000000 / FRAME_GAP_US; frame++) {
+        uint8_t idr = (0 == frame % GOP_SIZE);
+        video[4] = idr ? 0x65 : 0x41;
+
+        S3_HLS_FRAME_PACK pack;
+        memset(&pack, 0, sizeof(pack));
+        if(idr) {
+            pack.items[0].first_part_start = sps;
+            pack.items[0].first_part_length = sizeof(sps);
+            pack.items[1].first_part_start = pps;
+            pack.items[1].first_part_length = sizeof(pps);
+            pack.item_count = 2;
+        }
+
+        pack.items[pack.item_count].first_part_start = video;
+        pack.items[pack.item_count].first_part_length = (idr ? IDR_SIZE : P_SIZE) * stream->scale;
+        pack.item_count++;
+
+        for(uint32_t cnt = 0; cnt < pack.item_count; cnt++)
+            pack.items[cnt].timestamp = start_timestamp + (uint64_t)frame * FRAME_GAP_US;
+
+        S3_HLS_SDK_Instance_Put_Video_Frame(stream->sdk, &pack);
+        usleep(FRAME_GAP_US);
+    }
+
+    free(video);
+    return NULL;
+}
+
+/*
+ * Usage: bench_gateway endpoint streams [workers] [seconds]
+ * streams cameras put 25 fps video in real time, each into 1 MB of ring, and are uploaded to endpoint (host:port of put_server.py)
+ * With workers 0 (default) every stream is its own instance with its own upload thread and connection,
+ * otherwise all streams are attached to one gateway with that many workers
+ * Threads, connections and SDK heap are sampled a second before producers stop, CPU covers the whole run
+ * SDK debug output goes to stdout, curl log and results to stderr
+ */
+int main(int argc, char* argv[]) {
+    if(3 > argc) {
+        fprintf(stderr, "usage: %s endpoint streams [workers] [seconds]\n", argv[0]);
+        return 2;
+    }
+
+    char* endpoint = argv[1];
+    uint32_t stream_count = atoi(argv[2]);
+    uint32_t worker_count = 3 < argc ? atoi(argv[3]) : 0;
+    if(4 < argc)
+        seconds = atoi(argv[4]);
+
+    char* port = strrchr(endpoint, ':');
+    if(0 == stream_count || 2 > seconds || NULL == port)
+        return 2;
+
+    S3_HLS_SDK_Set_Allocator(count_malloc, count_realloc, count_free);
+
+    // gateway itself is shared by streams and counted with them
+    uint32_t base_threads = count_threads();
+    size_t base_heap = heap_read(NULL);
+
+    S3_HLS_GATEWAY_CTX* gateway = NULL;
+    if(0 < worker_count) {
+        S3_HLS_GATEWAY_CONFIG gateway_config = { "us-east-1", "bench", endpoint, worker_count, (uint64_t)stream_count * RING_SIZE, stream_count };
+        gateway = S3_HLS_SDK_Gateway_Create(&gateway_config);
+        if(NULL == gateway) {
+            fprintf(stderr, "create gateway failed\n");
+            return 1;
+        }
+
+        S3_HLS_SDK_Gateway_Set_Credential(gateway, "ak", "sk", NULL);
+    }
+
+    BENCH_STREAM* streams = calloc(stream_count, sizeof(BENCH_STREAM));
+    pthread_t* threads = calloc(stream_count, sizeof(pthread_t));
+    if(NULL == streams || NULL == threads)
+        return 1;
+
+    for(uint32_t cnt = 0; cnt < stream_count; cnt++) {
+        BENCH_STREAM* stream = &streams[cnt];
+        snprintf(stream->prefix, sizeof(stream->prefix), "cam%03u", cnt);
+        stream->scale = 1 + cnt % 4;
+
+        S3_HLS_SDK_CONFIG config = { NULL == gateway ? RING_SIZE : 0, "us-east-1", "bench", stream->prefix, endpoint, 0, 0 };
+        stream->sdk = S3_HLS_SDK_Create(&config);
+        if(NULL == stream->sdk)
+            return 1;
+
+        S3_HLS_SDK_Instance_Set_Segment_Duration(stream->sdk, GOP_SIZE * FRAME_GAP_US / 1000, 0);
+        if(NULL != gateway)
+            S3_HLS_SDK_Instance_Set_Gateway(stream->sdk, gateway);
+
+        if(S3_HLS_OK != S3_HLS_SDK_Instance_Initialize(stream->sdk)) {
+            fprintf(stderr, "initialize stream %u failed\n", cnt);
+            return 1;
+        }
+
+        if(NULL == gateway) {
+            S3_HLS_SDK_Instance_Set_Credential(stream->sdk, "ak", "sk", NULL);
+            S3_HLS_SDK_Instance_Start_Upload(stream->sdk);
+        }
+    }
+
+    if(NULL != gateway)
+        S3_HLS_SDK_Gateway_Start_Upload(gateway);
+
+    size_t init_heap = heap_read(NULL);
+
+    double start_cpu = cpu_seconds();
+    start_timestamp = (uint64_t)time(NULL) * 1000000;
+    for(uint32_t cnt = 0; cnt < stream_count; cnt++)
+        pthread_create(&threads[cnt], NULL, produce, &streams[cnt]);
+
+    sleep(seconds - 1);
+    uint32_t sdk_threads = count_threads() - base_threads - stream_count;
+    uint32_t connections = count_connections(strtoul(port + 1, NULL, 10));
+    size_t peak_heap;
+    size_t run_heap = heap_read(&peak_heap);
+
+    // bytes muxed but not uploaded yet, stays around a segment per stream when uploads keep up
+    uint64_t backlog = 0;
+    for(uint32_t cnt = 0; cnt < stream_count; cnt++) {
+        S3_HLS_BUFFER_INFO buffer_info;
+        if(S3_HLS_OK == S3_HLS_SDK_Instance_Get_Buffer_Info(streams[cnt].sdk, &buffer_info))
+            backlog += buffer_info.used_size;
+    }
+
+    for(uint32_t cnt = 0; cnt < stream_count; cnt++)
+        pthread_join(threads[cnt], NULL);
+
+    for(uint32_t cnt = 0; cnt < stream_count; cnt++)
+        S3_HLS_SDK_Instance_Finalize(streams[cnt].sdk);
+
+    double cpu = cpu_seconds() - start_cpu;
+
+    fprintf(stderr, "%u streams, %s: %u SDK threads, %u connections (%.3f per stream)\n",
+        stream_count, NULL == gateway ? "independent instances" : "gateway", sdk_threads, connections, (double)connections / stream_count);
+    fprintf(stderr, "SDK heap per stream beyond %u KB ring: %lld KB after initialize, %lld KB while uploading, %lld KB at peak\n", RING_SIZE / 1024,
+        heap_per_stream(init_heap, base_heap, stream_count), heap_per_stream(run_heap, base_heap, stream_count), heap_per_stream(peak_heap, base_heap, stream_count));
+    fprintf(stderr, "not uploaded %llu KB per stream\n", (unsigned long long)(backlog / stream_count / 1024));
+    fprintf(stderr, "CPU %.2f s in %u s, %.3f%% of a core per stream\n", cpu, seconds, cpu / seconds * 100 / stream_count);
+
+    for(uint32_t cnt = 0; cnt < stream_count; cnt++)
+        S3_HLS_SDK_Destroy(streams[cnt].sdk);
+
+    if(NULL != gateway)
+        S3_HLS_SDK_Gateway_Destroy(gateway);
+
+    free(threads);
+    free(streams);
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "S3_HLS_Buffer_Mgr.h"
+#include "S3_HLS_Pes.h"
+#include "S3_HLS_Return_Code.h"
+
+#define TOTAL_BYTES     (2048ULL * 1024 * 1024)
+#define GOP_SIZE        30
+
+static S3_HLS_BUFFER_CTX* buffer_ctx;
+
+// muxer cost only, parts are released as soon as they are flushed
+static void on_part(S3_HLS_BUFFER_PART_CTX* part, void* user_data) {
+    S3_HLS_Clear_Buffer(buffer_ctx, part);
+}
+
+static void on_release(void* user_data) {
+}
+
+static double cpu_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Usage: bench_mux_cpu [copy|ref] [frame bytes] [ring MB]
+ * Process CPU time spent by muxer per MB of video put, default 60000 bytes frames into 8 MB ring
+ * SDK debug output goes to stdout, results to stderr
+ */
+int main(int argc, char* argv[]) {
+    uint8_t by_reference = 1 < argc && 0 == strcmp(argv[1], "ref");
+    uint32_t frame_size = 2 < argc ? atoi(argv[2]) : 60000;
+    uint32_t ring_size = (3 < argc ? atoi(argv[3]) : 8) << 20;
+
+    S3_HLS_PES_CTX pes_ctx;
+    memset(&pes_ctx, 0, sizeof(pes_ctx));
+    S3_HLS_Pes_Initialize(&pes_ctx);
+    if(S3_HLS_OK != S3_HLS_Pes_Allocate_Programs(&pes_ctx))
+        return 1;
+
+    buffer_ctx = S3_HLS_Initialize_Buffer(ring_size, on_part, NULL);
+    uint8_t* frame = malloc(frame_size);
+    if(NULL == buffer_ctx || NULL == frame || 5 > frame_size)
+        return 1;
+
+    for(uint32_t cnt = 0; cnt < frame_size; cnt++)
+        frame[cnt] = (uint8_t)rand();
+
+    uint64_t total = 0;
+    double start = cpu_seconds();
+    for(uint32_t cnt = 0; total < TOTAL_BYTES; cnt++) {
+        frame[0] = 0x00;
+        frame[1] = 0x00;
+        frame[2] = 0x00;
+        frame[3] = 0x01;
+        frame[4] = 0 == cnt % GOP_SIZE ? 0x67 : 0x41; // SPS starts a segment
+
+        S3_HLS_FRAME_PACK pack;
+        memset(&pack, 0, sizeof(pack));
+        pack.item_count = 1;
+        pack.items[0].first_part_start = frame;
+        pack.items[0].first_part_length = frame_size;
+        pack.items[0].timestamp = (uint64_t)cnt * 33333;
+
+        if(by_reference)
+            S3_HLS_Pes_Write_Video_Frame_Ref(&pes_ctx, buffer_ctx, 0, &pack, on_release, NULL);
+        else
+            S3_HLS_Pes_Write_Video_Frame(&pes_ctx, buffer_ctx, 0, &pack);
+
+        total += frame_size;
+    }
+    double seconds = cpu_seconds() - start;
+
+    fprintf(stderr, "%s frame %u ring %u MB: %.1f us/MB\n", by_reference ? "ref " : "copy", frame_size, ring_size >> 20, seconds * 1e6 / (total / 1048576.0));
+
+    S3_HLS_Finalize_Buffer(buffer_ctx);
+    S3_HLS_Pes_Free_Programs(&pes_ctx);
+    free(frame);
+    return 0;
+}
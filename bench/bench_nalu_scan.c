@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "S3_HLS_Nalu_Scanner.h"
+
+#define SCAN_BYTES      (4ULL * 1024 * 1024 * 1024)
+#define FRAME_SIZE      (60 * 1024)             // IDR frame, stays in cache between scans
+#define LARGE_SIZE      (64 * 1024 * 1024)      // much larger than cache, scan is bound by memory bandwidth
+
+static double now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Random bytes as in entropy coded slice data, with emulation prevention applied so no start code is inside
+ */
+static void fill_slice_data(uint8_t* data, uint32_t length) {
+    srand(1);
+    for(uint32_t cnt = 0; cnt < length; cnt++)
+        data[cnt] = (uint8_t)rand();
+
+    for(uint32_t cnt = 2; cnt < length; cnt++) {
+        if(0x00 == data[cnt - 2] && 0x00 == data[cnt - 1] && data[cnt] <= 0x03)
+            data[cnt] = 0x03;
+    }
+}
+
+static void bench_scan(const char* name, uint8_t* data, uint32_t length) {
+    uint32_t rounds = (uint32_t)(SCAN_BYTES / length);
+    volatile uint32_t found = 0;
+
+    double start = now_s();
+    for(uint32_t cnt = 0; cnt < rounds; cnt++)
+        found += S3_HLS_Nalu_Find_Start_Code(data, length);
+
+    double elapsed = now_s() - start;
+
+    fprintf(stderr, "%-5s %8u bytes: %.2f GB/s\n", name, length, (double)length * rounds / elapsed / 1e9);
+}
+
+/*
+ * Usage: bench_nalu_scan
+ * Start code search over slice data without start code, built once for each scanner: default (SSE2 / NEON), AVX2 and scalar
+ */
+int main(int argc, char* argv[]) {
+    uint8_t* data = malloc(LARGE_SIZE);
+    if(NULL == data)
+        return 1;
+
+    fill_slice_data(data, LARGE_SIZE);
+
+    if(LARGE_SIZE != S3_HLS_Nalu_Find_Start_Code(data, LARGE_SIZE)) {
+        fprintf(stderr, "unexpected start code in slice data\n");
+        return 1;
+    }
+
+    bench_scan("frame", data, FRAME_SIZE);
+    bench_scan("large", data, LARGE_SIZE);
+
+    free(data);
+    return 0;
+}
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+
+#include "S3_Crypto.h"
+#include "S3_HLS_Buffer_Mgr.h"
+#include "S3_HLS_Pes.h"
+#include "S3_HLS_Queue.h"
+#include "S3_HLS_Return_Code.h"
+
+#define RING_SIZE       (8 * 1024 * 1024)
+#define FRAME_COUNT     60000
+#define GOP_SIZE        30
+#define IDR_SIZE        (200 * 1024)
+#define P_SIZE          (20 * 1024)
+#define FRAME_GAP_US    100     // producer pace, well below what uploader can hash
+
+static S3_HLS_BUFFER_CTX* buffer_ctx;
+static S3_HLS_QUEUE_CTX* queue_ctx;
+static S3_HLS_PES_CTX pes_ctx;
+static sem_t send_sem;
+static volatile int producer_done = 0;
+static int locked = 0;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// called by writer under buffer lock, same hand off as SDK
+static void on_part(S3_HLS_BUFFER_PART_CTX* part, void* user_data) {
+    S3_HLS_Add_To_Queue(queue_ctx, part, 0, S3_HLS_UPLOAD_LIVE);
+    sem_post(&send_sem);
+}
+
+static void hash_part(S3_HLS_BUFFER_PART_CTX* part) {
+    S3_SHA256_CTX sha256_ctx;
+    S3_SHA256_HASH hash;
+    S3_SHA256_Init(&sha256_ctx);
+
+    S3_HLS_BUFFER_READER reader;
+    S3_HLS_Initialize_Reader(&reader, buffer_ctx, part);
+
+    uint32_t length = S3_HLS_Get_Part_Length(part);
+    for(uint32_t pos = 0; pos < length;) {
+        uint8_t* span;
+        uint32_t span_length = S3_HLS_Read_Part(&reader, pos, &span);
+        if(0 == span_length)
+            break;
+
+        S3_SHA256_Update(&sha256_ctx, span, span_length);
+        pos += span_length;
+    }
+
+    S3_SHA256_Final(&sha256_ctx, hash);
+}
+
+/*
+ * Uploader takes parts from queue, hashes them as upload would and clears them
+ * In locked mode it holds buffer lock around queue access and clear, as upload thread did before the ring became lock free
+ */
+static void* uploader(void* arg) {
+    while(1) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += 10000000;
+        if(deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        if(0 != sem_timedwait(&send_sem, &deadline)) {
+            if(producer_done)
+                break;
+
+            continue;
+        }
+
+        S3_HLS_QUEUE_ITEM* item;
+        if(locked)
+            S3_HLS_Lock_Buffer(buffer_ctx);
+
+        int32_t ret = S3_HLS_Get_Item_From_Queue(queue_ctx, &item);
+
+        if(locked)
+            S3_HLS_Unlock_Buffer(buffer_ctx);
+
+        if(S3_HLS_OK != ret)
+            continue;
+
+        hash_part(&item->part);
+
+        if(locked)
+            S3_HLS_Lock_Buffer(buffer_ctx);
+
+        S3_HLS_Release_Queue(queue_ctx, item, buffer_ctx);
+
+        if(locked)
+            S3_HLS_Unlock_Buffer(buffer_ctx);
+    }
+
+    return NULL;
+}
+
+static int compare_latency(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_latency(const char* name, uint64_t* latency, uint32_t count) {
+    qsort(latency, count, sizeof(uint64_t), compare_latency);
+    fprintf(stderr, "%-8s %-9s %5d frames: p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+        locked ? "locked" : "lockfree", name, count,
+        latency[count / 2] / 1e3, latency[count * 99 / 100] / 1e3, latency[count * 999 / 1000] / 1e3, latency[count - 1] / 1e3);
+}
+
+/*
+ * Usage: bench_producer_latency [lockfree|locked]
+ * SDK debug output goes to stdout, results to stderr
+ */
+int main(int argc, char* argv[]) {
+    locked = 1 < argc && 0 == strcmp(argv[1], "locked");
+
+    S3_HLS_Pes_Initialize(&pes_ctx);
+    if(S3_HLS_OK != S3_HLS_Pes_Allocate_Programs(&pes_ctx))
+        return 1;
+
+    buffer_ctx = S3_HLS_Initialize_Buffer(RING_SIZE, on_part, NULL);
+    queue_ctx = S3_HLS_Initialize_Queue();
+    if(NULL == buffer_ctx || NULL == queue_ctx)
+        return 1;
+
+    sem_init(&send_sem, 0, 0);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, uploader, NULL);
+
+    uint8_t* frame = malloc(IDR_SIZE);
+    uint64_t* latency = malloc(FRAME_COUNT * sizeof(uint64_t));
+    uint64_t* p_latency = malloc(FRAME_COUNT * sizeof(uint64_t));    // IDR frames alone make up p99 of all frames
+    uint32_t p_count = 0;
+    if(NULL == frame || NULL == latency || NULL == p_latency)
+        return 1;
+
+    for(uint32_t cnt = 0; cnt < IDR_SIZE; cnt++)
+        frame[cnt] = (uint8_t)(cnt * 13 + 5) | 0x04; // no start code emulation
+
+    for(uint32_t cnt = 0; cnt < FRAME_COUNT; cnt++) {
+        uint8_t idr = (0 == cnt % GOP_SIZE);
+
+        frame[0] = 0x00;
+        frame[1] = 0x00;
+        frame[2] = 0x00;
+        frame[3] = 0x01;
+        frame[4] = idr ? 0x65 : 0x41;
+
+        S3_HLS_FRAME_PACK pack;
+        memset(&pack, 0, sizeof(pack));
+        pack.item_count = 1;
+        pack.items[0].first_part_start = frame;
+        pack.items[0].first_part_length = idr ? IDR_SIZE : P_SIZE;
+        pack.items[0].timestamp = (uint64_t)cnt * 1000000 / 30;
+
+        uint64_t start = now_ns();
+        S3_HLS_Pes_Write_Video_Frame(&pes_ctx, buffer_ctx, 0, &pack);
+        latency[cnt] = now_ns() - start;
+        if(!idr)
+            p_latency[p_count++] = latency[cnt];
+
+        usleep(FRAME_GAP_US);
+    }
+
+    producer_done = 1;
+    pthread_join(thread, NULL);
+
+    print_latency("all", latency, FRAME_COUNT);
+    print_latency("non-IDR", p_latency, p_count);
+
+    free(p_latency);
+    free(latency);
+    free(frame);
+    return 0;
+}
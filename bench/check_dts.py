@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+#
+# Checks timestamps of video segments written by mux_es, e.g. from h264_bframe_sample.h264 with its order file:
+#   PES header with PTS and DTS has flags 0xC0, header data length 10, PTS prefix 0011 and DTS prefix 0001
+#   PES header with PTS only has flags 0x80 and PTS prefix 0010, it is written when DTS is the same as PTS
+#   marker bits of every timestamp are set, DTS is never after PTS
+#   DTS goes up frame by frame across segments, PTS sorted goes up by the same frame duration, so no frame is lost or repeated
+#   PCR goes up, is never after DTS of the frame it is carried with and gaps are at most 100 ms
+#   at least one frame has DTS, so B frame path is covered
+#
+# Usage: check_dts.py segment.ts ...
+#
+
+import sys
+
+TS_PACKET_SIZE = 188
+PCR_CLOCK = 300                 # 27 MHz PCR per 90 kHz tick
+MAX_PCR_GAP = 9000              # 100 ms
+
+
+def read_packets(path):
+    with open(path, "rb") as segment:
+        data = segment.read()
+
+    if 0 == len(data) or 0 != len(data) % TS_PACKET_SIZE:
+        raise ValueError("size %d is not a multiple of %d" % (len(data), TS_PACKET_SIZE))
+
+    for pos in range(0, len(data), TS_PACKET_SIZE):
+        packet = data[pos:pos + TS_PACKET_SIZE]
+        if 0x47 != packet[0]:
+            raise ValueError("no sync byte at %d" % pos)
+
+        pid = ((packet[1] & 0x1f) << 8) | packet[2]
+        start = 0 != (packet[1] & 0x40)
+        pcr = None
+        payload = 4
+        if packet[3] & 0x20: # adaptation field
+            if 0 < packet[4] and packet[5] & 0x10:
+                pcr = (packet[6] << 25) | (packet[7] << 17) | (packet[8] << 9) | (packet[9] << 1) | (packet[10] >> 7)
+            payload += 1 + packet[4]
+        if not packet[3] & 0x10:
+            payload = TS_PACKET_SIZE
+
+        yield pid, start, pcr, packet[payload:]
+
+
+def section(payload):
+    # pointer field in front of a section starting in this packet
+    return payload[1 + payload[0]:]
+
+
+def timestamp(field, prefix):
+    # 4 bits prefix, 33 bits timestamp in 3 parts each followed by a marker bit
+    if prefix != field[0] >> 4 or not field[0] & 1 or not field[2] & 1 or not field[4] & 1:
+        return None
+
+    return ((field[0] >> 1) & 0x07) << 30 | field[1] << 22 | (field[2] >> 1) << 15 | field[3] << 7 | field[4] >> 1
+
+
+def read_frames(path):
+    # PTS, DTS and PCR of each video PES, PCR is the one in packet starting the PES
+    pmt_pid = None
+    video_pid = None
+    frames = []
+
+    for pid, start, pcr, payload in read_packets(path):
+        if 0 == pid and start and pmt_pid is None:
+            pat = section(payload)
+            pmt_pid = ((pat[10] & 0x1f) << 8) | pat[11] # first program after 8 bytes header
+        elif pid == pmt_pid and start and video_pid is None:
+            pmt = section(payload)
+            section_end = 3 + (((pmt[1] & 0x0f) << 8) | pmt[2]) - 4
+            pos = 12 + (((pmt[10] & 0x0f) << 8) | pmt[11])
+            while pos < section_end:
+                if pmt[pos] in (0x1b, 0x24) and video_pid is None:
+                    video_pid = ((pmt[pos + 1] & 0x1f) << 8) | pmt[pos + 2]
+                pos += 5 + (((pmt[pos + 3] & 0x0f) << 8) | pmt[pos + 4])
+        elif pid == video_pid and start:
+            frames.append((bytes(payload[:19]), pcr))
+
+    if video_pid is None:
+        raise ValueError("no video stream in PMT")
+
+    return frames
+
+
+def check_header(header):
+    # returns PTS, DTS and error of PES header
+    if b"\x00\x00\x01" != header[:3]:
+        return None, None, "no PES start code"
+
+    flags = header[7]
+    length = header[8]
+    if 0xC0 == flags:
+        pts = timestamp(header[9:14], 0x3)
+        dts = timestamp(header[14:19], 0x1)
+        if 10 != length or pts is None or dts is None:
+            return None, None, "bad PTS / DTS header %s" % header[7:19].hex()
+        if dts == pts:
+            return pts, dts, "DTS written although it is the same as PTS"
+        return pts, dts, None
+
+    if 0x80 == flags:
+        pts = timestamp(header[9:14], 0x2)
+        if 5 > length or pts is None:
+            return None, None, "bad PTS header %s" % header[7:14].hex()
+        return pts, pts, None
+
+    return None, None, "PTS DTS flags 0x%02x" % flags
+
+
+def main():
+    if 2 > len(sys.argv):
+        print("usage: %s segment.ts ..." % sys.argv[0], file=sys.stderr)
+        return 2
+
+    failed = False
+    all_pts = []
+    last_dts = None
+    last_pcr = None
+    frame_duration = None
+    with_dts = 0
+
+    for path in sys.argv[1:]:
+        errors = []
+        try:
+            frames = read_frames(path)
+        except (IndexError, ValueError) as error:
+            frames = []
+            errors.append(str(error))
+
+        for idx, (header, pcr) in enumerate(frames):
+            pts, dts, error = check_header(header)
+            if error is not None:
+                errors.append("frame %d: %s" % (idx, error))
+            if pts is None:
+                continue
+
+            with_dts += pts != dts
+            all_pts.append(pts)
+            if dts > pts:
+                errors.append("frame %d: DTS %d after PTS %d" % (idx, dts, pts))
+
+            if last_dts is not None:
+                if frame_duration is None:
+                    frame_duration = dts - last_dts
+                if dts - last_dts != frame_duration or 0 >= frame_duration:
+                    errors.append("frame %d: DTS %d does not follow %d" % (idx, dts, last_dts))
+            last_dts = dts
+
+            if pcr is not None:
+                if pcr > dts:
+                    errors.append("frame %d: PCR %d after DTS %d" % (idx, pcr, dts))
+                if last_pcr is not None and (pcr <= last_pcr or pcr - last_pcr > MAX_PCR_GAP):
+                    errors.append("frame %d: PCR %d after %d" % (idx, pcr, last_pcr))
+                last_pcr = pcr
+
+        print("%s: %d frames, %s" % (path, len(frames), "; ".join(errors) if errors else "ok"))
+        failed |= 0 != len(errors)
+
+    all_pts.sort()
+    gaps = set(all_pts[idx + 1] - all_pts[idx] for idx in range(len(all_pts) - 1))
+    if frame_duration is not None and gaps != {frame_duration}:
+        print("PTS in presentation order have gaps %s, frame duration is %d" % (sorted(gaps), frame_duration))
+        failed = True
+
+    print("%d frames, %d with DTS" % (len(all_pts), with_dts))
+    if 0 == with_dts:
+        print("no frame with DTS, B frame path not covered")
+        failed = True
+
+    print("FAIL" if failed else "PASS")
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+#
+# Checks HEVC segments written by mux_es, e.g. from hevc_sample.h265:
+#   PMT carries stream type 0x24 for the video PID
+#   every video PES starts with an HEVC AUD (NALU type 35)
+#   every segment starts at a VPS or IRAP picture (IDR / CRA / BLA), so segments are cut there
+#
+# Usage: check_hevc.py segment.ts ...
+#
+
+import sys
+
+TS_PACKET_SIZE = 188
+STREAM_TYPE_HEVC = 0x24
+NAL_AUD = 35
+NAL_VPS = 32
+AUD_PREFIX = bytes([0x00, 0x00, 0x00, 0x01, NAL_AUD << 1, 0x01])
+
+
+def nal_type(header):
+    return (header >> 1) & 0x3f
+
+
+def is_irap(nal):
+    return 16 <= nal <= 23
+
+
+def read_packets(path):
+    with open(path, "rb") as segment:
+        data = segment.read()
+
+    if 0 == len(data) or 0 != len(data) % TS_PACKET_SIZE:
+        raise ValueError("size %d is not a multiple of %d" % (len(data), TS_PACKET_SIZE))
+
+    for pos in range(0, len(data), TS_PACKET_SIZE):
+        packet = data[pos:pos + TS_PACKET_SIZE]
+        if 0x47 != packet[0]:
+            raise ValueError("no sync byte at %d" % pos)
+
+        pid = ((packet[1] & 0x1f) << 8) | packet[2]
+        start = 0 != (packet[1] & 0x40)
+        payload = 4
+        if packet[3] & 0x20: # adaptation field
+            payload += 1 + packet[4]
+        if not packet[3] & 0x10:
+            continue
+
+        yield pid, start, packet[payload:]
+
+
+def section(payload):
+    # pointer field in front of a section starting in this packet
+    return payload[1 + payload[0]:]
+
+
+def nalus(es):
+    pos = es.find(b"\x00\x00\x01")
+    while 0 <= pos:
+        next_pos = es.find(b"\x00\x00\x01", pos + 3)
+        yield nal_type(es[pos + 3])
+        pos = next_pos
+
+
+def check_segment(path):
+    pmt_pid = None
+    video_pid = None
+    stream_types = []
+    pes_list = []
+
+    for pid, start, payload in read_packets(path):
+        if 0 == pid and start and pmt_pid is None:
+            pat = section(payload)
+            pmt_pid = ((pat[10] & 0x1f) << 8) | pat[11] # first program after 8 bytes header
+        elif pid == pmt_pid and start and video_pid is None:
+            pmt = section(payload)
+            section_end = 3 + (((pmt[1] & 0x0f) << 8) | pmt[2]) - 4
+            pos = 12 + (((pmt[10] & 0x0f) << 8) | pmt[11])
+            while pos < section_end:
+                stream_type = pmt[pos]
+                elementary_pid = ((pmt[pos + 1] & 0x1f) << 8) | pmt[pos + 2]
+                stream_types.append(stream_type)
+                if stream_type in (STREAM_TYPE_HEVC, 0x1b) and video_pid is None:
+                    video_pid = elementary_pid
+                pos += 5 + (((pmt[pos + 3] & 0x0f) << 8) | pmt[pos + 4])
+        elif pid == video_pid:
+            if start:
+                pes_list.append(bytearray())
+            if pes_list:
+                pes_list[-1] += payload
+
+    errors = []
+    if video_pid is None:
+        return ["no video stream in PMT"], 0, None
+
+    if STREAM_TYPE_HEVC not in stream_types:
+        errors.append("PMT stream types %s, no 0x24" % ", ".join("0x%02x" % st for st in stream_types))
+
+    first_nalus = None
+    for idx, pes in enumerate(pes_list):
+        es = bytes(pes[9 + pes[8]:])
+        if not es.startswith(AUD_PREFIX):
+            errors.append("PES %d does not start with HEVC AUD: %s" % (idx, es[:7].hex()))
+            continue
+
+        if first_nalus is None:
+            first_nalus = list(nalus(es))[1:]
+
+    if first_nalus:
+        first_picture = next((nal for nal in first_nalus if 32 > nal), None)
+        if NAL_VPS != first_nalus[0] and not is_irap(first_nalus[0]):
+            errors.append("segment starts with NALU type %d, not VPS or IRAP" % first_nalus[0])
+        if first_picture is None or not is_irap(first_picture):
+            errors.append("first picture of segment is NALU type %s, not IRAP" % first_picture)
+    else:
+        errors.append("no video frame")
+
+    return errors, len(pes_list), first_nalus
+
+
+def main():
+    if 2 > len(sys.argv):
+        print("usage: %s segment.ts ..." % sys.argv[0], file=sys.stderr)
+        return 2
+
+    failed = False
+    for path in sys.argv[1:]:
+        try:
+            errors, frames, first_nalus = check_segment(path)
+        except (IndexError, ValueError) as error:
+            errors, frames, first_nalus = [str(error)], 0, None
+
+        starts = " ".join(str(nal) for nal in first_nalus[:4]) if first_nalus else "-"
+        print("%s: %d frames, NALU types after first AUD %s, %s" % (path, frames, starts, "; ".join(errors) if errors else "ok"))
+        failed |= 0 != len(errors)
+
+    if 2 > len(sys.argv) - 1:
+        print("only one segment, no cut to check")
+        failed = True
+
+    print("FAIL" if failed else "PASS")
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
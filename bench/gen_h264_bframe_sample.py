@@ -0,0 +1,195 @@
+#!/usr/bin/env python3
+#
+# Writes h264_bframe_sample.h264, 4 s of 320x240 25 fps H.264 Main Annex B elementary stream with B frames, used by check_dts.py
+# SPS / PPS and slice headers follow H.264 syntax, slice data after them is filler and does not decode
+# GOPs are 1 s, IDR then P B B in decode order (I0 P3 B1 B2 P6 B4 B5 ...), B frames are not reference frames
+# Also writes h264_bframe_sample.order, presentation index of each frame in decode order, one per line, for mux_es
+#
+# Usage: gen_h264_bframe_sample.py [output]
+#
+
+import random
+import sys
+
+FRAME_RATE = 25
+GOP_SIZE = 25
+GOP_COUNT = 4
+B_FRAMES = 2                    # between two reference frames
+
+NAL_SLICE = 1
+NAL_IDR = 5
+NAL_SPS = 7
+NAL_PPS = 8
+
+SLICE_P = 5                     # slice_type + 5, every slice of picture has same type
+SLICE_B = 6
+SLICE_I = 7
+
+LOG2_MAX_FRAME_NUM = 4
+LOG2_MAX_POC_LSB = 6
+
+
+class BitWriter:
+    def __init__(self):
+        self.bits = []
+
+    def u(self, count, value):
+        for cnt in range(count - 1, -1, -1):
+            self.bits.append((value >> cnt) & 1)
+
+    def ue(self, value):
+        value += 1
+        self.u(value.bit_length() * 2 - 1, value)
+
+    def se(self, value):
+        self.ue(2 * value - 1 if 0 < value else -2 * value)
+
+    def align(self):
+        # rbsp_trailing_bits() is a 1 followed by 0 up to byte boundary
+        self.bits.append(1)
+        while len(self.bits) % 8:
+            self.bits.append(0)
+
+    def bytes(self):
+        return bytes(int("".join(map(str, self.bits[pos:pos + 8])), 2) for pos in range(0, len(self.bits), 8))
+
+
+def nalu(ref_idc, nal_type, rbsp):
+    # emulation prevention, 00 00 followed by 00 - 03 gets 03 in between
+    data = bytearray()
+    zeros = 0
+    for byte in rbsp:
+        if 2 <= zeros and byte <= 3:
+            data.append(3)
+            zeros = 0
+
+        data.append(byte)
+        zeros = zeros + 1 if 0 == byte else 0
+
+    return b"\x00\x00\x00\x01" + bytes([(ref_idc << 5) | nal_type]) + bytes(data)
+
+
+def sps():
+    bits = BitWriter()
+    bits.u(8, 77)               # profile_idc, Main
+    bits.u(8, 0x40)             # constraint_set1_flag
+    bits.u(8, 21)               # level_idc, 2.1
+    bits.ue(0)                  # seq_parameter_set_id
+    bits.ue(LOG2_MAX_FRAME_NUM - 4)
+    bits.ue(0)                  # pic_order_cnt_type
+    bits.ue(LOG2_MAX_POC_LSB - 4)
+    bits.ue(2)                  # max_num_ref_frames
+    bits.u(1, 0)                # gaps_in_frame_num_value_allowed_flag
+    bits.ue(320 // 16 - 1)      # pic_width_in_mbs_minus1
+    bits.ue(240 // 16 - 1)      # pic_height_in_map_units_minus1
+    bits.u(1, 1)                # frame_mbs_only_flag
+    bits.u(1, 1)                # direct_8x8_inference_flag
+    bits.u(1, 0)                # frame_cropping_flag
+    bits.u(1, 1)                # vui_parameters_present_flag
+    bits.u(4, 0)                # aspect ratio, overscan, video signal type, chroma location info present flags
+    bits.u(1, 1)                # timing_info_present_flag
+    bits.u(32, 1)               # num_units_in_tick
+    bits.u(32, FRAME_RATE * 2)  # time_scale, a frame is two ticks
+    bits.u(1, 1)                # fixed_frame_rate_flag
+    bits.u(2, 0)                # nal_hrd_parameters_present_flag, vcl_hrd_parameters_present_flag
+    bits.u(1, 0)                # pic_struct_present_flag
+    bits.u(1, 1)                # bitstream_restriction_flag
+    bits.u(1, 1)                # motion_vectors_over_pic_boundaries_flag
+    bits.ue(0)                  # max_bytes_per_pic_denom
+    bits.ue(0)                  # max_bits_per_mb_denom
+    bits.ue(16)                 # log2_max_mv_length_horizontal
+    bits.ue(16)                 # log2_max_mv_length_vertical
+    bits.ue(B_FRAMES)           # max_num_reorder_frames
+    bits.ue(2)                  # max_dec_frame_buffering
+    bits.align()
+    return nalu(3, NAL_SPS, bits.bytes())
+
+
+def pps():
+    bits = BitWriter()
+    bits.ue(0)                  # pic_parameter_set_id
+    bits.ue(0)                  # seq_parameter_set_id
+    bits.u(2, 0)                # entropy_coding_mode_flag (CAVLC), bottom_field_pic_order_in_frame_present_flag
+    bits.ue(0)                  # num_slice_groups_minus1
+    bits.ue(0)                  # num_ref_idx_l0_default_active_minus1
+    bits.ue(0)                  # num_ref_idx_l1_default_active_minus1
+    bits.u(3, 0)                # weighted_pred_flag, weighted_bipred_idc
+    bits.se(0)                  # pic_init_qp_minus26
+    bits.se(0)                  # pic_init_qs_minus26
+    bits.se(0)                  # chroma_qp_index_offset
+    bits.u(1, 1)                # deblocking_filter_control_present_flag
+    bits.u(2, 0)                # constrained_intra_pred_flag, redundant_pic_cnt_present_flag
+    bits.align()
+    return nalu(3, NAL_PPS, bits.bytes())
+
+
+def slice_layer(slice_type, frame_num, poc, filler):
+    idr = SLICE_I == slice_type
+    reference = SLICE_B != slice_type
+    bits = BitWriter()
+    bits.ue(0)                  # first_mb_in_slice
+    bits.ue(slice_type)
+    bits.ue(0)                  # pic_parameter_set_id
+    bits.u(LOG2_MAX_FRAME_NUM, frame_num % (1 << LOG2_MAX_FRAME_NUM))
+    if idr:
+        bits.ue(0)              # idr_pic_id
+    bits.u(LOG2_MAX_POC_LSB, poc % (1 << LOG2_MAX_POC_LSB))
+    if SLICE_B == slice_type:
+        bits.u(1, 1)            # direct_spatial_mv_pred_flag
+    if not idr:
+        bits.u(1, 0)            # num_ref_idx_active_override_flag
+        bits.u(1, 0)            # ref_pic_list_modification_flag_l0
+    if SLICE_B == slice_type:
+        bits.u(1, 0)            # ref_pic_list_modification_flag_l1
+    if idr:
+        bits.u(2, 0)            # no_output_of_prior_pics_flag, long_term_reference_flag
+    elif reference:
+        bits.u(1, 0)            # adaptive_ref_pic_marking_mode_flag
+    bits.se(0)                  # slice_qp_delta
+    bits.ue(0)                  # disable_deblocking_filter_idc
+    bits.se(0)                  # slice_alpha_c0_offset_div2
+    bits.se(0)                  # slice_beta_offset_div2
+    bits.align()
+    return nalu(3 if idr else (2 if reference else 0), NAL_IDR if idr else NAL_SLICE, bits.bytes() + filler)
+
+
+def decode_order():
+    # presentation index in GOP of each frame in decode order, reference frame goes in front of B frames shown before it
+    order = [0]
+    for ref in range(B_FRAMES + 1, GOP_SIZE, B_FRAMES + 1):
+        order.append(ref)
+        order += range(ref - B_FRAMES, ref)
+
+    return order
+
+
+def main():
+    output = sys.argv[1] if 1 < len(sys.argv) else "h264_bframe_sample.h264"
+    rand = random.Random(264)
+
+    stream = bytearray()
+    presentation = []
+    for gop in range(GOP_COUNT):
+        frame_num = 0
+        for index in decode_order():
+            slice_type = SLICE_I if 0 == index else (SLICE_P if 0 == index % (B_FRAMES + 1) else SLICE_B)
+            if SLICE_I == slice_type:
+                stream += sps() + pps()
+
+            size = rand.randrange(1500, 2000) if SLICE_I == slice_type else rand.randrange(150, 300)
+            filler = bytes(rand.randrange(256) for _ in range(size))
+            stream += slice_layer(slice_type, frame_num, index * 2, filler)
+            presentation.append(gop * GOP_SIZE + index)
+
+            if SLICE_B != slice_type: # frame_num counts reference frames before picture
+                frame_num += 1
+
+    with open(output, "wb") as sample:
+        sample.write(stream)
+
+    with open(output.rsplit(".", 1)[0] + ".order", "w") as order:
+        order.write("".join("%d\n" % index for index in presentation))
+
+
+if __name__ == "__main__":
+    main()
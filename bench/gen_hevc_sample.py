@@ -0,0 +1,211 @@
+#!/usr/bin/env python3
+#
+# Writes hevc_sample.h265, 4 s of 320x240 25 fps HEVC Main Annex B elementary stream used by check_hevc.py
+# VPS / SPS / PPS and slice segment headers follow H.265 syntax, slice data after them is filler and does not decode
+# GOPs are 1 s and start with IDR_W_RADL with parameter sets, CRA without, IDR_N_LP with and CRA with parameter sets
+#
+# Usage: gen_hevc_sample.py [output]
+#
+
+import random
+import sys
+
+FRAME_RATE = 25
+GOP_SIZE = 25
+
+NAL_TRAIL_R = 1
+NAL_IDR_W_RADL = 19
+NAL_IDR_N_LP = 20
+NAL_CRA = 21
+NAL_VPS = 32
+NAL_SPS = 33
+NAL_PPS = 34
+
+# first frame type of each GOP and whether parameter sets are in front of it
+GOPS = [(NAL_IDR_W_RADL, True), (NAL_CRA, False), (NAL_IDR_N_LP, True), (NAL_CRA, True)]
+
+
+class BitWriter:
+    def __init__(self):
+        self.bits = []
+
+    def u(self, count, value):
+        for cnt in range(count - 1, -1, -1):
+            self.bits.append((value >> cnt) & 1)
+
+    def ue(self, value):
+        value += 1
+        self.u(value.bit_length() * 2 - 1, value)
+
+    def se(self, value):
+        self.ue(2 * value - 1 if 0 < value else -2 * value)
+
+    def align(self):
+        # rbsp_trailing_bits() and byte_alignment() are a 1 followed by 0 up to byte boundary
+        self.bits.append(1)
+        while len(self.bits) % 8:
+            self.bits.append(0)
+
+    def bytes(self):
+        return bytes(int("".join(map(str, self.bits[pos:pos + 8])), 2) for pos in range(0, len(self.bits), 8))
+
+
+def nalu(nal_type, rbsp):
+    # emulation prevention, 00 00 followed by 00 - 03 gets 03 in between
+    data = bytearray()
+    zeros = 0
+    for byte in rbsp:
+        if 2 <= zeros and byte <= 3:
+            data.append(3)
+            zeros = 0
+
+        data.append(byte)
+        zeros = zeros + 1 if 0 == byte else 0
+
+    return b"\x00\x00\x00\x01" + bytes([nal_type << 1, 1]) + bytes(data)
+
+
+def profile_tier_level(bits):
+    bits.u(2, 0)                # general_profile_space
+    bits.u(1, 0)                # general_tier_flag
+    bits.u(5, 1)                # general_profile_idc, Main
+    bits.u(32, 0x60000000)      # general_profile_compatibility_flag, Main and Main 10
+    bits.u(4, 0x9)              # progressive_source, interlaced_source, non_packed_constraint, frame_only_constraint
+    bits.u(44, 0)
+    bits.u(8, 60)               # general_level_idc, level 2
+
+
+def vps():
+    bits = BitWriter()
+    bits.u(4, 0)                # vps_video_parameter_set_id
+    bits.u(2, 3)                # vps_base_layer_internal_flag, vps_base_layer_available_flag
+    bits.u(6, 0)                # vps_max_layers_minus1
+    bits.u(3, 0)                # vps_max_sub_layers_minus1
+    bits.u(1, 1)                # vps_temporal_id_nesting_flag
+    bits.u(16, 0xffff)
+    profile_tier_level(bits)
+    bits.u(1, 1)                # vps_sub_layer_ordering_info_present_flag
+    bits.ue(1)                  # vps_max_dec_pic_buffering_minus1
+    bits.ue(0)                  # vps_max_num_reorder_pics
+    bits.ue(0)                  # vps_max_latency_increase_plus1
+    bits.u(6, 0)                # vps_max_layer_id
+    bits.ue(0)                  # vps_num_layer_sets_minus1
+    bits.u(1, 0)                # vps_timing_info_present_flag
+    bits.u(1, 0)                # vps_extension_flag
+    bits.align()
+    return nalu(NAL_VPS, bits.bytes())
+
+
+def sps():
+    bits = BitWriter()
+    bits.u(4, 0)                # sps_video_parameter_set_id
+    bits.u(3, 0)                # sps_max_sub_layers_minus1
+    bits.u(1, 1)                # sps_temporal_id_nesting_flag
+    profile_tier_level(bits)
+    bits.ue(0)                  # sps_seq_parameter_set_id
+    bits.ue(1)                  # chroma_format_idc, 4:2:0
+    bits.ue(320)                # pic_width_in_luma_samples
+    bits.ue(240)                # pic_height_in_luma_samples
+    bits.u(1, 0)                # conformance_window_flag
+    bits.ue(0)                  # bit_depth_luma_minus8
+    bits.ue(0)                  # bit_depth_chroma_minus8
+    bits.ue(4)                  # log2_max_pic_order_cnt_lsb_minus4
+    bits.u(1, 1)                # sps_sub_layer_ordering_info_present_flag
+    bits.ue(1)                  # sps_max_dec_pic_buffering_minus1
+    bits.ue(0)                  # sps_max_num_reorder_pics
+    bits.ue(0)                  # sps_max_latency_increase_plus1
+    bits.ue(0)                  # log2_min_luma_coding_block_size_minus3
+    bits.ue(1)                  # log2_diff_max_min_luma_coding_block_size
+    bits.ue(0)                  # log2_min_luma_transform_block_size_minus2
+    bits.ue(2)                  # log2_diff_max_min_luma_transform_block_size
+    bits.ue(1)                  # max_transform_hierarchy_depth_inter
+    bits.ue(1)                  # max_transform_hierarchy_depth_intra
+    bits.u(1, 0)                # scaling_list_enabled_flag
+    bits.u(2, 3)                # amp_enabled_flag, sample_adaptive_offset_enabled_flag
+    bits.u(1, 0)                # pcm_enabled_flag
+    bits.ue(1)                  # num_short_term_ref_pic_sets
+    bits.ue(1)                  # num_negative_pics, previous picture
+    bits.ue(0)                  # num_positive_pics
+    bits.ue(0)                  # delta_poc_s0_minus1
+    bits.u(1, 1)                # used_by_curr_pic_s0_flag
+    bits.u(1, 0)                # long_term_ref_pics_present_flag
+    bits.u(2, 3)                # sps_temporal_mvp_enabled_flag, strong_intra_smoothing_enabled_flag
+    bits.u(1, 1)                # vui_parameters_present_flag
+    bits.u(4, 0)                # aspect ratio, overscan, video signal type, chroma location info present flags
+    bits.u(3, 0)                # neutral_chroma_indication_flag, field_seq_flag, frame_field_info_present_flag
+    bits.u(1, 0)                # default_display_window_flag
+    bits.u(1, 1)                # vui_timing_info_present_flag
+    bits.u(32, 1)               # vui_num_units_in_tick
+    bits.u(32, FRAME_RATE)      # vui_time_scale
+    bits.u(1, 0)                # vui_poc_proportional_to_timing_flag
+    bits.u(1, 0)                # vui_hrd_parameters_present_flag
+    bits.u(1, 0)                # bitstream_restriction_flag
+    bits.u(1, 0)                # sps_extension_present_flag
+    bits.align()
+    return nalu(NAL_SPS, bits.bytes())
+
+
+def pps():
+    bits = BitWriter()
+    bits.ue(0)                  # pps_pic_parameter_set_id
+    bits.ue(0)                  # pps_seq_parameter_set_id
+    bits.u(2, 0)                # dependent_slice_segments_enabled_flag, output_flag_present_flag
+    bits.u(3, 0)                # num_extra_slice_header_bits
+    bits.u(2, 0)                # sign_data_hiding_enabled_flag, cabac_init_present_flag
+    bits.ue(0)                  # num_ref_idx_l0_default_active_minus1
+    bits.ue(0)                  # num_ref_idx_l1_default_active_minus1
+    bits.se(0)                  # init_qp_minus26
+    bits.u(3, 0)                # constrained_intra_pred_flag, transform_skip_enabled_flag, cu_qp_delta_enabled_flag
+    bits.se(0)                  # pps_cb_qp_offset
+    bits.se(0)                  # pps_cr_qp_offset
+    bits.u(6, 0)                # slice chroma qp offsets, weighted pred, weighted bipred, transquant bypass, tiles, entropy sync
+    bits.u(1, 1)                # pps_loop_filter_across_slices_enabled_flag
+    bits.u(3, 0)                # deblocking_filter_control_present_flag, pps_scaling_list_data_present_flag, lists_modification_present_flag
+    bits.ue(0)                  # log2_parallel_merge_level_minus2
+    bits.u(2, 0)                # slice_segment_header_extension_present_flag, pps_extension_present_flag
+    bits.align()
+    return nalu(NAL_PPS, bits.bytes())
+
+
+def slice_segment(nal_type, poc, filler):
+    irap = NAL_IDR_W_RADL <= nal_type <= NAL_CRA
+    bits = BitWriter()
+    bits.u(1, 1)                # first_slice_segment_in_pic_flag
+    if irap:
+        bits.u(1, 0)            # no_output_of_prior_pics_flag
+    bits.ue(0)                  # slice_pic_parameter_set_id
+    bits.ue(2 if irap else 1)   # slice_type, I or P
+    if nal_type not in (NAL_IDR_W_RADL, NAL_IDR_N_LP):
+        bits.u(8, poc & 0xff)   # slice_pic_order_cnt_lsb
+        bits.u(1, 1)            # short_term_ref_pic_set_sps_flag
+        bits.u(1, 1)            # slice_temporal_mvp_enabled_flag
+    bits.u(2, 3)                # slice_sao_luma_flag, slice_sao_chroma_flag
+    if not irap:
+        bits.u(1, 0)            # num_ref_idx_active_override_flag
+        bits.ue(0)              # five_minus_max_num_merge_cand
+    bits.se(0)                  # slice_qp_delta
+    bits.u(1, 1)                # slice_loop_filter_across_slices_enabled_flag
+    bits.align()
+    return nalu(nal_type, bits.bytes() + filler)
+
+
+def main():
+    output = sys.argv[1] if 1 < len(sys.argv) else "hevc_sample.h265"
+    rand = random.Random(265)
+
+    stream = bytearray()
+    for gop, (key_type, parameter_sets) in enumerate(GOPS):
+        for frame in range(GOP_SIZE):
+            if 0 == frame and parameter_sets:
+                stream += vps() + sps() + pps()
+
+            nal_type = key_type if 0 == frame else NAL_TRAIL_R
+            filler = bytes(rand.randrange(256) for _ in range(rand.randrange(1500, 2000) if 0 == frame else rand.randrange(150, 300)))
+            stream += slice_segment(nal_type, gop * GOP_SIZE + frame, filler)
+
+    with open(output, "wb") as sample:
+        sample.write(stream)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,60 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+
+/*
+ * LD_PRELOAD shim counting heap allocations of the whole process
+ * Calls are passed to glibc, so dlsym is not needed and nothing is allocated while counting
+ */
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void* ptr);
+
+static uint64_t allocation_count = 0;
+
+// looked up by test with dlsym, test fails when shim is not preloaded
+uint64_t malloc_count_read() {
+    return __atomic_load_n(&allocation_count, __ATOMIC_RELAXED);
+}
+
+static void malloc_count_add() {
+    __atomic_add_fetch(&allocation_count, 1, __ATOMIC_RELAXED);
+}
+
+void* malloc(size_t size) {
+    malloc_count_add();
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    malloc_count_add();
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    malloc_count_add();
+    return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t alignment, size_t size) {
+    malloc_count_add();
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    malloc_count_add();
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size) {
+    malloc_count_add();
+    *ptr = __libc_memalign(alignment, size);
+    return NULL == *ptr ? ENOMEM : 0;
+}
+
+void free(void* ptr) {
+    __libc_free(ptr);
+}
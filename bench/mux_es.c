@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "S3_HLS_Buffer_Mgr.h"
+#include "S3_HLS_Nalu_Scanner.h"
+#include "S3_HLS_Pes.h"
+#include "S3_HLS_Return_Code.h"
+
+#define RING_SIZE       (8 * 1024 * 1024)
+#define PATH_SIZE       256
+#define MAX_FRAMES      65536
+
+static S3_HLS_BUFFER_CTX* buffer_ctx;
+static const char* output_prefix;
+static uint32_t segment_count = 0;
+
+// each part handed over by muxer is written to its own file
+static void on_part(S3_HLS_BUFFER_PART_CTX* part, void* user_data) {
+    char path[PATH_SIZE];
+    snprintf(path, sizeof(path), "%s_%03u.ts", output_prefix, segment_count++);
+
+    FILE* file = fopen(path, "wb");
+    if(NULL != file) {
+        S3_HLS_BUFFER_READER reader;
+        S3_HLS_Initialize_Reader(&reader, buffer_ctx, part);
+
+        uint32_t length = S3_HLS_Get_Part_Length(part);
+        for(uint32_t pos = 0; pos < length;) {
+            uint8_t* span;
+            uint32_t span_length = S3_HLS_Read_Part(&reader, pos, &span);
+            if(0 == span_length)
+                break;
+
+            fwrite(span, 1, span_length, file);
+            pos += span_length;
+        }
+
+        fclose(file);
+    }
+
+    S3_HLS_Clear_Buffer(buffer_ctx, part);
+}
+
+/*
+ * NALU at data (after start code) begins a new access unit when previous access unit already has a picture
+ * Parameter sets, AUD and prefix SEI come before the picture they belong to, a picture begins with its first slice
+ */
+static uint8_t starts_access_unit(S3_HLS_VIDEO_CODEC codec, const uint8_t* data, uint32_t length) {
+    if(S3_HLS_VIDEO_CODEC_H265 == codec) {
+        uint8_t type = (data[0] >> 1) & 0x3f;
+        if(32 > type)
+            return 2 < length && (data[2] & 0x80); // first_slice_segment_in_pic_flag
+
+        return (32 <= type && type <= 35) || 39 == type; // VPS, SPS, PPS, AUD, prefix SEI
+    }
+
+    uint8_t type = data[0] & 0x1f;
+    if(1 <= type && type <= 5)
+        return 1 < length && (data[1] & 0x80); // first_mb_in_slice is 0
+
+    return 6 <= type && type <= 9; // SEI, SPS, PPS, AUD
+}
+
+static uint8_t is_picture(S3_HLS_VIDEO_CODEC codec, const uint8_t* data) {
+    if(S3_HLS_VIDEO_CODEC_H265 == codec)
+        return 32 > ((data[0] >> 1) & 0x3f);
+
+    return 1 <= (data[0] & 0x1f) && (data[0] & 0x1f) <= 5;
+}
+
+/*
+ * Read presentation index of each frame in decode order, returns number of frames or 0
+ * delay is set to frames PTS has to be moved back so no frame is presented before it is decoded
+ */
+static uint32_t read_order(const char* path, uint32_t* order, uint32_t* delay) {
+    FILE* file = fopen(path, "r");
+    if(NULL == file)
+        return 0;
+
+    uint32_t count = 0;
+    *delay = 0;
+    while(MAX_FRAMES > count && 1 == fscanf(file, "%u", &order[count])) {
+        if(count > order[count] && count - order[count] > *delay)
+            *delay = count - order[count];
+
+        count++;
+    }
+
+    fclose(file);
+    return count;
+}
+
+static void put_access_unit(S3_HLS_PES_CTX* pes_ctx, uint8_t* data, uint32_t length, uint64_t timestamp, uint64_t decode_timestamp) {
+    S3_HLS_FRAME_PACK pack;
+    memset(&pack, 0, sizeof(pack));
+    pack.item_count = 1;
+    pack.items[0].first_part_start = data;
+    pack.items[0].first_part_length = length;
+    pack.items[0].timestamp = timestamp;
+    pack.items[0].decode_timestamp = decode_timestamp;
+
+    S3_HLS_Pes_Write_Video_Frame(pes_ctx, buffer_ctx, 0, &pack);
+}
+
+/*
+ * Frame put in decode order, presented delay frames after its presentation index when order is given
+ */
+static void put_frame(S3_HLS_PES_CTX* pes_ctx, uint8_t* data, uint32_t length, uint32_t frame, uint32_t frame_rate, const uint32_t* order, uint32_t order_count, uint32_t delay) {
+    uint64_t decode_timestamp = (uint64_t)frame * 1000000 / frame_rate;
+    uint64_t timestamp = frame < order_count ? (uint64_t)(order[frame] + delay) * 1000000 / frame_rate : decode_timestamp;
+
+    put_access_unit(pes_ctx, data, length, timestamp, decode_timestamp);
+}
+
+/*
+ * Usage: mux_es h264|h265 input output_prefix [frame rate] [segment ms] [order file]
+ * Mux an Annex B elementary stream at fixed frame rate, default 25 fps and 1000 ms segments, into output_prefix_NNN.ts
+ * Order file gives presentation index of each frame in decode order, e.g. from gen_h264_bframe_sample.py,
+ * DTS follows decode order and PTS presentation order, otherwise both are the same
+ * SDK debug output goes to stdout, stream info to stderr
+ */
+int main(int argc, char* argv[]) {
+    if(4 > argc) {
+        fprintf(stderr, "usage: %s h264|h265 input output_prefix [frame rate] [segment ms] [order file]\n", argv[0]);
+        return 1;
+    }
+
+    S3_HLS_VIDEO_CODEC codec = 0 == strcmp(argv[1], "h265") ? S3_HLS_VIDEO_CODEC_H265 : S3_HLS_VIDEO_CODEC_H264;
+    output_prefix = argv[3];
+    uint32_t frame_rate = 4 < argc ? atoi(argv[4]) : 25;
+    uint32_t segment_ms = 5 < argc ? atoi(argv[5]) : 1000;
+
+    static uint32_t order[MAX_FRAMES];
+    uint32_t order_count = 0;
+    uint32_t delay = 0;
+    if(6 < argc && 0 == (order_count = read_order(argv[6], order, &delay)))
+        return 1;
+
+    FILE* file = fopen(argv[2], "rb");
+    if(NULL == file || 0 == frame_rate)
+        return 1;
+
+    fseek(file, 0, SEEK_END);
+    uint32_t length = (uint32_t)ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t* data = malloc(length);
+    if(NULL == data || length != fread(data, 1, length, file))
+        return 1;
+
+    fclose(file);
+
+    S3_HLS_PES_CTX pes_ctx;
+    memset(&pes_ctx, 0, sizeof(pes_ctx));
+    S3_HLS_Pes_Initialize(&pes_ctx);
+    if(S3_HLS_OK != S3_HLS_Pes_Allocate_Programs(&pes_ctx) || S3_HLS_OK != S3_HLS_Pes_Set_Video_Codec(&pes_ctx, codec))
+        return 1;
+
+    S3_HLS_Pes_Set_Segment_Duration(&pes_ctx, segment_ms, 0);
+    S3_HLS_Pes_Set_Decode_Timestamp(&pes_ctx, 0 < order_count);
+
+    buffer_ctx = S3_HLS_Initialize_Buffer(RING_SIZE, on_part, NULL);
+    if(NULL == buffer_ctx)
+        return 1;
+
+    // access unit runs from its first start code to start code of next access unit, leading zero byte included
+    uint32_t frames = 0;
+    uint32_t unit_start = length;
+    uint8_t unit_has_picture = 0;
+    for(uint32_t pos = S3_HLS_Nalu_Find_Start_Code(data, length); pos < length; pos = S3_HLS_Nalu_Find_Start_Code(data + pos + 3, length - pos - 3) + pos + 3) {
+        uint32_t start = 0 < pos && 0x00 == data[pos - 1] ? pos - 1 : pos;
+        const uint8_t* nalu = data + pos + 3;
+        uint32_t nalu_length = length - pos - 3;
+        if(0 == nalu_length)
+            break;
+
+        if(length == unit_start) {
+            unit_start = start;
+        } else if(unit_has_picture && starts_access_unit(codec, nalu, nalu_length)) {
+            put_frame(&pes_ctx, data + unit_start, start - unit_start, frames++, frame_rate, order, order_count, delay);
+            unit_start = start;
+            unit_has_picture = 0;
+        }
+
+        unit_has_picture |= is_picture(codec, nalu);
+    }
+
+    if(length != unit_start)
+        put_frame(&pes_ctx, data + unit_start, length - unit_start, frames++, frame_rate, order, order_count, delay);
+
+    S3_HLS_VIDEO_INFO info;
+    if(S3_HLS_OK == S3_HLS_Pes_Get_Video_Info(&pes_ctx, buffer_ctx, 0, &info))
+        fprintf(stderr, "%ux%u %u/%u fps codecs %s\n", info.width, info.height, info.frame_rate_num, info.frame_rate_den, info.codecs);
+    else
+        fprintf(stderr, "SPS not parsed\n");
+
+    S3_HLS_Pes_Flush(&pes_ctx, buffer_ctx);
+    fprintf(stderr, "%u frames, %u segments\n", frames, segment_count);
+
+    S3_HLS_Finalize_Buffer(buffer_ctx);
+    S3_HLS_Pes_Free_Programs(&pes_ctx);
+    free(data);
+    return 0;
+}
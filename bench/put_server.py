@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+#
+# Local HTTPS server answering PUT with 200, stands in for S3 in benchmarks
+# SDK does not verify peer, a self signed certificate is made on first start
+#
+# Usage: put_server.py port [log]
+# With log, each PUT is printed as: path length client_port content_type
+#
+
+import http.server
+import os
+import socketserver
+import ssl
+import subprocess
+import sys
+
+CERT = os.path.join(os.path.dirname(os.path.abspath(__file__)), "put_server.pem")
+
+class PutHandler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"   # keep alive, as S3
+
+    def do_PUT(self):
+        length = int(self.headers.get("Content-Length", 0))
+        self.rfile.read(length)
+
+        if self.server.log:
+            print("PUT", self.path, length, self.client_address[1], self.headers.get("Content-Type"), flush=True)
+
+        self.send_response(200)
+        self.send_header("Content-Length", "0")
+        self.end_headers()
+
+    def log_message(self, format, *args):
+        pass
+
+class PutServer(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads = True
+
+if __name__ == "__main__":
+    if not os.path.exists(CERT):
+        subprocess.check_call(["openssl", "req", "-x509", "-newkey", "rsa:2048", "-nodes", "-days", "3650",
+            "-subj", "/CN=localhost", "-keyout", CERT, "-out", CERT], stderr=subprocess.DEVNULL)
+
+    server = PutServer(("127.0.0.1", int(sys.argv[1])), PutHandler)
+    server.log = len(sys.argv) > 2 and sys.argv[2] == "log"
+
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.load_cert_chain(CERT)
+    server.socket = context.wrap_socket(server.socket, server_side=True)
+
+    server.serve_forever()
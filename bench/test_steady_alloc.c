@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlfcn.h>
+
+#include "S3_HLS_SDK.h"
+#include "S3_HLS_Return_Code.h"
+
+#define ARENA_SIZE      (32 * 1024 * 1024)
+#define RING_SIZE       (4 * 1024 * 1024)
+#define FRAME_GAP_US    2000    // 25 fps timestamps put 20 times faster than real time
+#define WARM_UP_MS      3000    // connection, TLS session and lazily created state are set up here
+#define STEADY_MS       5000
+#define IDR_SIZE        (60 * 1024)
+#define P_SIZE          (6 * 1024)
+#define AAC_SIZE        200
+
+typedef uint64_t (*MALLOC_COUNT_READ)();
+
+static uint8_t sps[] = { 0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x1f, 0xac, 0xd9, 0x40, 0x50, 0x05, 0xbb, 0x01, 0x10, 0x00, 0x00, 0x03, 0x00, 0x10, 0x00, 0x00, 0x03, 0x03, 0xc0, 0xf1, 0x83, 0x19, 0x60 };
+static uint8_t pps[] = { 0x00, 0x00, 0x00, 0x01, 0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc0 };
+
+static uint64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void put_frames(uint8_t* video, uint8_t* audio, uint32_t* frame, uint64_t until_ms) {
+    while(now_ms() < until_ms) {
+        uint64_t timestamp = (uint64_t)*frame * 40000;
+        uint8_t idr = (0 == *frame % 25);
+
+        video[4] = idr ? 0x65 : 0x41;
+
+        S3_HLS_FRAME_PACK pack;
+        memset(&pack, 0, sizeof(pack));
+        if(idr) {
+            pack.items[0].first_part_start = sps;
+            pack.items[0].first_part_length = sizeof(sps);
+            pack.items[1].first_part_start = pps;
+            pack.items[1].first_part_length = sizeof(pps);
+            pack.item_count = 2;
+        }
+
+        pack.items[pack.item_count].first_part_start = video;
+        pack.items[pack.item_count].first_part_length = idr ? IDR_SIZE : P_SIZE;
+        pack.item_count++;
+
+        for(uint32_t cnt = 0; cnt < pack.item_count; cnt++)
+            pack.items[cnt].timestamp = timestamp;
+
+        S3_HLS_SDK_Put_Video_Frame(&pack);
+
+        // about two AAC frames of 48 kHz per video frame
+        for(uint32_t cnt = 0; cnt < 2; cnt++) {
+            memset(&pack, 0, sizeof(pack));
+            pack.item_count = 1;
+            pack.items[0].first_part_start = audio;
+            pack.items[0].first_part_length = AAC_SIZE;
+            pack.items[0].timestamp = timestamp + cnt * 21333;
+
+            S3_HLS_SDK_Put_Audio_Frame(&pack);
+        }
+
+        (*frame)++;
+        usleep(FRAME_GAP_US);
+    }
+}
+
+/*
+ * Usage: LD_PRELOAD=./linux-x86_64/malloc_count.so test_steady_alloc endpoint [heap]
+ * endpoint is host:port of put_server.py or S3, SDK debug output goes to stdout, curl log and result to stderr
+ * Fails if anything in the process allocates from heap once uploads are in steady state
+ * With heap, SDK uses default allocator instead of arena and the test is expected to fail
+ */
+int main(int argc, char* argv[]) {
+    if(2 > argc) {
+        fprintf(stderr, "usage: %s endpoint\n", argv[0]);
+        return 2;
+    }
+
+    uint8_t use_arena = !(2 < argc && 0 == strcmp(argv[2], "heap"));
+
+    MALLOC_COUNT_READ malloc_count_read = (MALLOC_COUNT_READ)dlsym(RTLD_DEFAULT, "malloc_count_read");
+    if(NULL == malloc_count_read) {
+        fprintf(stderr, "malloc_count.so is not preloaded\n");
+        return 2;
+    }
+
+    uint8_t* video = malloc(IDR_SIZE);
+    uint8_t* audio = malloc(AAC_SIZE);
+    if(NULL == video || NULL == audio)
+        return 2;
+
+    for(uint32_t cnt = 0; cnt < IDR_SIZE; cnt++)
+        video[cnt] = (uint8_t)(cnt * 13 + 5) | 0x04; // no start code emulation
+
+    video[0] = video[1] = video[2] = 0x00;
+    video[3] = 0x01;
+
+    // ADTS header, AAC LC 48 kHz mono
+    memset(audio, 0x5a, AAC_SIZE);
+    audio[0] = 0xff;
+    audio[1] = 0xf1;
+    audio[2] = 0x4c;
+    audio[3] = 0x40;
+    audio[4] = (AAC_SIZE >> 3) & 0xff;
+    audio[5] = ((AAC_SIZE & 0x07) << 5) | 0x1f;
+    audio[6] = 0xfc;
+
+    uint64_t init_count = malloc_count_read();
+
+    if(use_arena && S3_HLS_OK != S3_HLS_SDK_Set_Memory_Arena(ARENA_SIZE, 0)) {
+        fprintf(stderr, "set arena failed\n");
+        return 2;
+    }
+
+    if(S3_HLS_OK != S3_HLS_SDK_Initialize(RING_SIZE, "us-east-1", "bench", "steady", argv[1], 0, 1)) {
+        fprintf(stderr, "initialize failed\n");
+        return 2;
+    }
+
+    S3_HLS_SDK_Set_Credential("ak", "sk", NULL);
+    S3_HLS_SDK_Start_Upload();
+
+    uint32_t frame = 0;
+    put_frames(video, audio, &frame, now_ms() + WARM_UP_MS);
+
+    S3_HLS_MUX_INFO mux_info;
+    S3_HLS_SDK_Get_Mux_Info(&mux_info);
+    uint32_t warm_up_segments = mux_info.segments;
+    uint32_t warm_up_frames = frame;
+
+    uint64_t start_count = malloc_count_read();
+    put_frames(video, audio, &frame, now_ms() + STEADY_MS);
+    uint64_t allocations = malloc_count_read() - start_count;
+
+    S3_HLS_SDK_Get_Mux_Info(&mux_info);
+
+    // segments must have been uploaded while counting, otherwise ring would fill up
+    S3_HLS_BUFFER_INFO buffer_info;
+    S3_HLS_SDK_Get_Buffer_Info(&buffer_info);
+
+    S3_HLS_SDK_Finalize();
+
+    uint8_t uploaded = buffer_info.used_size < RING_SIZE / 4;
+    fprintf(stderr, "%s: %llu heap allocations in warm up, %u segments and %u frames in steady state, %u bytes not uploaded: %llu heap allocations\n",
+        use_arena ? "arena" : "heap", (unsigned long long)(start_count - init_count), mux_info.segments - warm_up_segments, frame - warm_up_frames, buffer_info.used_size, (unsigned long long)allocations);
+
+    if(!uploaded || mux_info.segments == warm_up_segments) {
+        fprintf(stderr, "FAIL: segments were not uploaded in steady state\n");
+        return 1;
+    }
+
+    if(0 != allocations) {
+        fprintf(stderr, "FAIL: heap allocations in steady state\n");
+        return 1;
+    }
+
+    fprintf(stderr, "PASS\n");
+
+    free(audio);
+    free(video);
+    return 0;
+}